@@ -0,0 +1,122 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/allocations.cpp
+// Author:   Johnny Shaw
+// Abstract: Heap Allocation Counter
+//
+#include "pch.hpp"
+#include <crtdbg.h>
+#include "allocations.hpp"
+
+namespace Bench
+{
+    static std::atomic<uint64_t> g_Allocations{ 0 };
+
+#ifdef _DEBUG
+    //
+    // The debug heap reports every CRT allocation, malloc and _aligned_malloc
+    // as well as the operator new below, which is not counted twice.
+    //
+    static int __cdecl CountCrtAllocation(
+        _In_ int AllocationType,
+        _In_opt_ void* UserData,
+        _In_ size_t Size,
+        _In_ int BlockType,
+        _In_ long RequestNumber,
+        _In_opt_ const unsigned char* FileName,
+        _In_ int LineNumber)
+    {
+        UNREFERENCED_PARAMETER(UserData);
+        UNREFERENCED_PARAMETER(Size);
+        UNREFERENCED_PARAMETER(RequestNumber);
+        UNREFERENCED_PARAMETER(FileName);
+        UNREFERENCED_PARAMETER(LineNumber);
+
+        if (((AllocationType == _HOOK_ALLOC) || 
+             (AllocationType == _HOOK_REALLOC)) &&
+            (BlockType != _CRT_BLOCK))
+        {
+            g_Allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        return TRUE;
+    }
+
+    static const bool g_CrtHookInstalled = []() -> bool
+    {
+        _CrtSetAllocHook(CountCrtAllocation);
+        return true;
+    }();
+#endif
+
+    static void CountOperatorNew()
+    {
+#ifndef _DEBUG
+        g_Allocations.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+}
+
+uint64_t Bench::AllocationCount()
+{
+    return Bench::g_Allocations.load(std::memory_order_relaxed);
+}
+
+//
+// Replacements of the global allocation functions. The array, nothrow and 
+// sized forms of the library call these, only the aligned forms need their 
+// own.
+//
+void* operator new(size_t Size)
+{
+    Bench::CountOperatorNew();
+
+    Size = std::max<size_t>(Size, 1);
+    for (;;)
+    {
+        auto memory = malloc(Size);
+        if (memory != nullptr)
+        {
+            return memory;
+        }
+
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void* operator new(size_t Size, std::align_val_t Alignment)
+{
+    Bench::CountOperatorNew();
+
+    Size = std::max<size_t>(Size, 1);
+    for (;;)
+    {
+        auto memory = _aligned_malloc(Size, SCAST(size_t)(Alignment));
+        if (memory != nullptr)
+        {
+            return memory;
+        }
+
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* Memory) noexcept
+{
+    free(Memory);
+}
+
+void operator delete(void* Memory, std::align_val_t) noexcept
+{
+    _aligned_free(Memory);
+}
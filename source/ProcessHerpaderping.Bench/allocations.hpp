@@ -0,0 +1,23 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/allocations.hpp
+// Author:   Johnny Shaw
+// Abstract: Heap Allocation Counter
+//
+#pragma once
+
+namespace Bench
+{
+    /// <summary>
+    /// Gets the number of heap allocations the process made so far, on every
+    /// thread. The benchmark replaces the global operator new to count its
+    /// calls. Debug builds also hook the CRT heap and count malloc and
+    /// _aligned_malloc. Allocations made by the system on its own heaps,
+    /// such as HeapAlloc from within Win32 or BCrypt, are never counted.
+    /// </summary>
+    /// <returns>
+    /// Number of heap allocations counted so far.
+    /// </returns>
+    uint64_t AllocationCount();
+}
@@ -0,0 +1,506 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/bench.cpp
+// Author:   Johnny Shaw
+// Abstract: Herpaderping Benchmark Scenarios
+//
+#include "pch.hpp"
+#include "../ProcessHerpaderping/res/version.h"
+#include "herpaderp.hpp"
+#include "jobcontainer.hpp"
+#include "procparams.hpp"
+#include "arena.hpp"
+#include "utils.hpp"
+#include "bench.hpp"
+#include "jsonwriter.hpp"
+#include "allocations.hpp"
+
+namespace Bench
+{
+    constexpr static std::array<uint8_t, 4> Pattern{ '\x72', '\x6f', '\x66', '\x6c' };
+
+    constexpr static std::array<uint32_t, 4> MatrixFlags
+    {
+        Herpaderp::FlagFlushFile,
+        Herpaderp::FlagHoldHandleExclusive,
+        Herpaderp::FlagCloseFileEarly,
+        Herpaderp::FlagKillSpawnedProcess,
+    };
+
+    static std::atomic<uint64_t> g_TargetId{ 0 };
+}
+
+_Use_decl_annotations_
+const wchar_t* Bench::ReplaceModeName(ReplaceMode Mode)
+{
+    switch (Mode)
+    {
+        case ReplaceMode::None:
+        {
+            return L"none";
+        }
+        case ReplaceMode::Smaller:
+        {
+            return L"smaller";
+        }
+        case ReplaceMode::Larger:
+        {
+            return L"larger";
+        }
+        default:
+        {
+            return L"unknown";
+        }
+    }
+}
+
+static std::wstring FormatFlags(_In_ uint32_t Flags)
+{
+    std::wstring names;
+    auto append = [&names](const wchar_t* Name) -> void
+    {
+        if (!names.empty())
+        {
+            names += L'|';
+        }
+        names += Name;
+    };
+
+    if (FlagOn(Flags, Herpaderp::FlagWaitForProcess))
+    {
+        append(L"wait");
+    }
+    if (FlagOn(Flags, Herpaderp::FlagHoldHandleExclusive))
+    {
+        append(L"exclusive");
+    }
+    if (FlagOn(Flags, Herpaderp::FlagFlushFile))
+    {
+        append(L"flush");
+    }
+    if (FlagOn(Flags, Herpaderp::FlagCloseFileEarly))
+    {
+        append(L"close-early");
+    }
+    if (FlagOn(Flags, Herpaderp::FlagKillSpawnedProcess))
+    {
+        append(L"kill");
+    }
+
+    return names;
+}
+
+_Use_decl_annotations_
+Bench::Percentiles Bench::ComputePercentiles(std::vector<double>& Samples)
+{
+    Percentiles result;
+    if (Samples.empty())
+    {
+        return result;
+    }
+
+    std::sort(Samples.begin(), Samples.end());
+
+    auto rank = [&Samples](double Percentile) -> double
+    {
+        auto index = SCAST(size_t)(std::ceil((Percentile / 100.0) *
+                                             SCAST(double)(Samples.size())));
+        index = std::clamp<size_t>(index, 1, Samples.size());
+        return Samples[index - 1];
+    };
+
+    result.P50 = rank(50.0);
+    result.P95 = rank(95.0);
+    result.P99 = rank(99.0);
+    return result;
+}
+
+_Use_decl_annotations_
+std::vector<Bench::Scenario> Bench::BuildMatrix(
+    std::span<const uint64_t> SourceSizes,
+    std::span<const Herpaderp::WriteBackend> Backends)
+{
+    std::vector<Scenario> scenarios;
+
+    for (auto size : SourceSizes)
+    {
+        for (uint32_t replace = 0; 
+             replace < SCAST(uint32_t)(ReplaceMode::Count); 
+             replace++)
+        {
+            for (uint32_t mask = 0; mask < (1ul << MatrixFlags.size()); mask++)
+            {
+                uint32_t flags = 0;
+                for (size_t i = 0; i < MatrixFlags.size(); i++)
+                {
+                    if (FlagOn(mask, (1ul << i)))
+                    {
+                        SetFlag(flags, MatrixFlags[i]);
+                    }
+                }
+
+                if (FlagOn(flags, Herpaderp::FlagHoldHandleExclusive) &&
+                    FlagOn(flags, Herpaderp::FlagCloseFileEarly))
+                {
+                    //
+                    // Incompatible flags.
+                    //
+                    continue;
+                }
+
+                if (!FlagOn(flags, Herpaderp::FlagKillSpawnedProcess))
+                {
+                    //
+                    // Don't leave processes behind, wait for them instead.
+                    //
+                    SetFlag(flags, Herpaderp::FlagWaitForProcess);
+                }
+
+                for (auto backend : Backends)
+                {
+                    Scenario scenario;
+                    scenario.SourceSize = size;
+                    scenario.Replace = SCAST(ReplaceMode)(replace);
+                    scenario.Flags = flags;
+                    scenario.Backend = backend;
+                    scenarios.emplace_back(scenario);
+                }
+            }
+        }
+    }
+
+    return scenarios;
+}
+
+/// <summary>
+/// Creates a file of a given size in the working directory, optionally 
+/// starting with the content of another file and padded with a pattern. 
+/// An existing file of the right size is reused.
+/// </summary>
+static HRESULT PrepareFile(
+    _In_ const std::wstring& FileName,
+    _In_opt_ const std::optional<std::wstring>& Template,
+    _In_ uint64_t Size)
+{
+    wil::unique_handle fileHandle;
+    fileHandle.reset(CreateFileW(FileName.c_str(),
+                                 GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ,
+                                 nullptr,
+                                 OPEN_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL,
+                                 nullptr));
+    RETURN_LAST_ERROR_IF(!fileHandle.is_valid());
+
+    uint64_t fileSize;
+    RETURN_IF_FAILED(Utils::GetFileSize(fileHandle.get(), fileSize));
+    if (fileSize == Size)
+    {
+        return S_OK;
+    }
+
+    uint64_t offset = 0;
+    if (Template.has_value())
+    {
+        wil::unique_handle templateHandle;
+        templateHandle.reset(CreateFileW(Template->c_str(),
+                                         GENERIC_READ,
+                                         FILE_SHARE_READ,
+                                         nullptr,
+                                         OPEN_EXISTING,
+                                         FILE_ATTRIBUTE_NORMAL,
+                                         nullptr));
+        RETURN_LAST_ERROR_IF(!templateHandle.is_valid());
+
+        RETURN_IF_FAILED(Utils::CopyFileByHandle(templateHandle.get(),
+                                                 fileHandle.get(),
+                                                 offset));
+        if (offset > Size)
+        {
+            RETURN_LAST_ERROR_SET(ERROR_FILE_TOO_LARGE);
+        }
+    }
+
+    //
+    // Anything past the image is overlay data, the padded source still 
+    // executes.
+    //
+    uint64_t bytesWritten;
+    RETURN_IF_FAILED(Utils::WritePatternToFile(fileHandle.get(),
+                                               offset,
+                                               (Size - offset),
+                                               Bench::Pattern,
+                                               bytesWritten));
+    RETURN_IF_FAILED(Utils::SetFilePointer(fileHandle.get(), 
+                                           SCAST(int64_t)(Size), 
+                                           FILE_BEGIN));
+    RETURN_IF_WIN32_BOOL_FALSE(SetEndOfFile(fileHandle.get()));
+    return S_OK;
+}
+
+static std::wstring WorkingFileName(
+    _In_ const Bench::Settings& Config,
+    _In_ const wchar_t* Prefix,
+    _In_ uint64_t Number,
+    _In_ const wchar_t* Extension)
+{
+    std::wstring fileName;
+    wil::str_printf_nothrow(fileName,
+                            L"%ls\\%ls_%llu%ls",
+                            Config.WorkingDirectory.c_str(),
+                            Prefix,
+                            Number,
+                            Extension);
+    return fileName;
+}
+
+_Use_decl_annotations_
+HRESULT Bench::RunScenario(
+    const Settings& Config,
+    const Scenario& Cell,
+    ScenarioResult& Result)
+{
+    Result = {};
+    Result.Config = Cell;
+
+    auto sourceFileName = WorkingFileName(Config, 
+                                          L"source", 
+                                          Cell.SourceSize, 
+                                          L".exe");
+    RETURN_IF_FAILED(PrepareFile(sourceFileName, 
+                                 Config.SourceFileName, 
+                                 Cell.SourceSize));
+
+    std::optional<std::wstring> replaceWithFileName;
+    if (Cell.Replace != ReplaceMode::None)
+    {
+        auto size = (Cell.Replace == ReplaceMode::Smaller ? 
+                     (Cell.SourceSize / 2) 
+                     : 
+                     (Cell.SourceSize * 2));
+        replaceWithFileName = WorkingFileName(Config, L"replace", size, L".bin");
+        RETURN_IF_FAILED(PrepareFile(*replaceWithFileName, std::nullopt, size));
+    }
+
+    //
+    // Anything a scenario leaves running is torn down with its job before 
+    // the next scenario starts.
+    //
+    Herpaderp::JobContainer container;
+    RETURN_IF_FAILED(container.Initialize({}));
+    auto teardown = wil::scope_exit([&container]() -> void
+    {
+        LOG_IF_FAILED(container.TerminateAll(0));
+    });
+
+    //
+    // Like the batch runner, executions share one parameters template.
+    //
+    Herpaderp::ProcessParametersTemplate parametersTemplate;
+    RETURN_IF_FAILED(parametersTemplate.InitializeFromCurrentProcess());
+
+    Herpaderp::ExecuteOptions options;
+    options.Container = &container;
+    options.Backend = Cell.Backend;
+    options.ParametersTemplate = &parametersTemplate;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    std::vector<double> totals;
+    std::array<std::vector<double>, Herpaderp::PhaseCount> phases;
+    std::array<std::vector<double>, (Herpaderp::MilestoneCount - 1)> gaps;
+
+    //
+    // The result is reused the way a batch worker would reuse it, with room
+    // for any target name.
+    //
+    Herpaderp::ExecuteResult execution;
+    execution.TargetFileName.reserve(MAX_PATH);
+    auto& arena = Utils::Arena::Current();
+
+    for (uint32_t i = 0; i < (Config.Warmup + Config.Iterations); i++)
+    {
+        //
+        // Every execution gets its own target, the last one may still be 
+        // mapped for a moment after its process is gone.
+        //
+        auto targetFileName = WorkingFileName(Config, 
+                                              L"target", 
+                                              g_TargetId.fetch_add(1),
+                                              L".exe");
+
+        auto allocations = (AllocationCount() + arena.Growths());
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        HRESULT hr = Herpaderp::ExecuteProcess(sourceFileName,
+                                               targetFileName,
+                                               replaceWithFileName,
+                                               Pattern,
+                                               Cell.Flags,
+                                               &options,
+                                               &execution);
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+        allocations = ((AllocationCount() + arena.Growths()) - allocations);
+
+        DeleteFileW(targetFileName.c_str());
+
+        if (i < Config.Warmup)
+        {
+            continue;
+        }
+
+        Result.Allocations += allocations;
+
+        if (FAILED(hr))
+        {
+            Result.Failed++;
+            Result.LastError = hr;
+            continue;
+        }
+
+        Result.Succeeded++;
+        Result.Remote = execution.Remote;
+        totals.push_back((SCAST(double)(end.QuadPart - start.QuadPart) * 1000.0) / 
+                         SCAST(double)(frequency.QuadPart));
+
+        for (size_t p = 0; p < Herpaderp::PhaseCount; p++)
+        {
+            phases[p].push_back(
+                    execution.PhaseMilliseconds(SCAST(Herpaderp::Phase)(p)));
+        }
+
+        for (size_t m = 0; m < gaps.size(); m++)
+        {
+            auto gap = execution.MilestoneGapMilliseconds(
+                                            SCAST(Herpaderp::Milestone)(m),
+                                            SCAST(Herpaderp::Milestone)(m + 1));
+            if (gap.has_value())
+            {
+                gaps[m].push_back(*gap);
+            }
+        }
+    }
+
+    Result.Total = ComputePercentiles(totals);
+    for (size_t p = 0; p < phases.size(); p++)
+    {
+        Result.Phases[p] = ComputePercentiles(phases[p]);
+    }
+    for (size_t m = 0; m < gaps.size(); m++)
+    {
+        Result.Gaps[m] = ComputePercentiles(gaps[m]);
+    }
+
+    return S_OK;
+}
+
+static void WritePercentiles(
+    _Inout_ JsonWriter& Json,
+    _In_ std::wstring_view Name,
+    _In_ const Bench::Percentiles& Value)
+{
+    Json.Key(Name);
+    Json.BeginObject();
+    Json.Key(L"p50");
+    Json.Value(Value.P50);
+    Json.Key(L"p95");
+    Json.Value(Value.P95);
+    Json.Key(L"p99");
+    Json.Value(Value.P99);
+    Json.EndObject();
+}
+
+_Use_decl_annotations_
+HRESULT Bench::WriteJsonReport(
+    const std::wstring& FileName,
+    const Settings& Config,
+    std::span<const ScenarioResult> Results)
+{
+    JsonWriter json;
+    json.BeginObject();
+    json.Key(L"version");
+    json.Value(WSTR_VERSION);
+    json.Key(L"source");
+    json.Value(Config.SourceFileName);
+    json.Key(L"iterations");
+    json.Value(SCAST(uint64_t)(Config.Iterations));
+    json.Key(L"warmup");
+    json.Value(SCAST(uint64_t)(Config.Warmup));
+    json.Key(L"scenarios");
+    json.BeginArray();
+
+    for (const auto& result : Results)
+    {
+        std::wstring flags;
+        wil::str_printf_nothrow(flags, L"0x%08x", result.Config.Flags);
+        std::wstring lastError;
+        wil::str_printf_nothrow(lastError, L"0x%08x", result.LastError);
+
+        json.BeginObject();
+        json.Key(L"source_bytes");
+        json.Value(result.Config.SourceSize);
+        json.Key(L"replace");
+        json.Value(ReplaceModeName(result.Config.Replace));
+        json.Key(L"flags");
+        json.Value(flags);
+        json.Key(L"flag_names");
+        json.Value(FormatFlags(result.Config.Flags));
+        json.Key(L"write_backend");
+        json.Value(Herpaderp::WriteBackendName(result.Config.Backend));
+        json.Key(L"succeeded");
+        json.Value(SCAST(uint64_t)(result.Succeeded));
+        json.Key(L"failed");
+        json.Value(SCAST(uint64_t)(result.Failed));
+        json.Key(L"last_error");
+        json.Value(lastError);
+        WritePercentiles(json, L"total_ms", result.Total);
+
+        json.Key(L"phases_ms");
+        json.BeginObject();
+        for (size_t p = 0; p < result.Phases.size(); p++)
+        {
+            WritePercentiles(json,
+                             Herpaderp::PhaseName(SCAST(Herpaderp::Phase)(p)),
+                             result.Phases[p]);
+        }
+        json.EndObject();
+
+        json.Key(L"gaps_ms");
+        json.BeginObject();
+        for (size_t m = 0; m < result.Gaps.size(); m++)
+        {
+            std::wstring name;
+            wil::str_printf_nothrow(
+                    name,
+                    L"%ls -> %ls",
+                    Herpaderp::MilestoneName(SCAST(Herpaderp::Milestone)(m)),
+                    Herpaderp::MilestoneName(SCAST(Herpaderp::Milestone)(m + 1)));
+            WritePercentiles(json, name, result.Gaps[m]);
+        }
+        json.EndObject();
+
+        json.Key(L"remote");
+        json.BeginObject();
+        json.Key(L"syscalls");
+        json.Value(SCAST(uint64_t)(result.Remote.Syscalls));
+        json.Key(L"bytes_read");
+        json.Value(result.Remote.BytesRead);
+        json.Key(L"bytes_written");
+        json.Value(result.Remote.BytesWritten);
+        json.EndObject();
+
+        json.Key(L"allocations");
+        json.Value(result.Allocations);
+
+        json.EndObject();
+    }
+
+    json.EndArray();
+    json.EndObject();
+
+    RETURN_IF_FAILED(json.Save(FileName));
+    return S_OK;
+}
@@ -0,0 +1,206 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/bench.hpp
+// Author:   Johnny Shaw
+// Abstract: Herpaderping Benchmark Scenarios
+//
+#pragma once
+
+namespace Bench
+{
+    /// <summary>
+    /// How the target file is modified after the process is created.
+    /// </summary>
+    enum class ReplaceMode : uint32_t
+    {
+        /// <summary>
+        /// No replacement, the target is overwritten with a pattern.
+        /// </summary>
+        None = 0,
+
+        /// <summary>
+        /// Replaced with a file half the size of the source.
+        /// </summary>
+        Smaller,
+
+        /// <summary>
+        /// Replaced with a file twice the size of the source.
+        /// </summary>
+        Larger,
+
+        Count
+    };
+
+    /// <summary>
+    /// Gets the display name of a replace mode.
+    /// </summary>
+    /// <param name="Mode">
+    /// Replace mode to get the name of.
+    /// </param>
+    /// <returns>
+    /// Display name of the replace mode.
+    /// </returns>
+    const wchar_t* ReplaceModeName(_In_ ReplaceMode Mode);
+
+    /// <summary>
+    /// One cell of the benchmark matrix.
+    /// </summary>
+    struct Scenario
+    {
+        /// <summary>
+        /// Size of the source binary, the source is padded to this size.
+        /// </summary>
+        uint64_t SourceSize{ 0 };
+
+        /// <summary>
+        /// How the target is modified.
+        /// </summary>
+        ReplaceMode Replace{ ReplaceMode::None };
+
+        /// <summary>
+        /// Herpaderp::FlagXxx flags of the execution.
+        /// </summary>
+        uint32_t Flags{ 0 };
+
+        /// <summary>
+        /// How the target is written.
+        /// </summary>
+        Herpaderp::WriteBackend Backend{ Herpaderp::WriteBackend::Buffered };
+    };
+
+    /// <summary>
+    /// Settings shared by every scenario.
+    /// </summary>
+    struct Settings
+    {
+        /// <summary>
+        /// Source binary to execute, it should exit quickly on its own.
+        /// </summary>
+        std::wstring SourceFileName;
+
+        /// <summary>
+        /// Directory for generated sources, replacements and targets.
+        /// </summary>
+        std::wstring WorkingDirectory;
+
+        /// <summary>
+        /// Number of measured executions of each scenario.
+        /// </summary>
+        uint32_t Iterations{ 10 };
+
+        /// <summary>
+        /// Number of unmeasured executions before measuring each scenario.
+        /// </summary>
+        uint32_t Warmup{ 1 };
+    };
+
+    /// <summary>
+    /// 50th, 95th and 99th percentile of a set of samples, in milliseconds.
+    /// </summary>
+    struct Percentiles
+    {
+        double P50{ 0.0 };
+        double P95{ 0.0 };
+        double P99{ 0.0 };
+    };
+
+    /// <summary>
+    /// Computes nearest rank percentiles of a set of samples.
+    /// </summary>
+    /// <param name="Samples">
+    /// Samples to compute the percentiles of, reordered by the call.
+    /// </param>
+    /// <returns>
+    /// Percentiles of the samples, zero if there are none.
+    /// </returns>
+    Percentiles ComputePercentiles(_Inout_ std::vector<double>& Samples);
+
+    /// <summary>
+    /// Measured results of a scenario.
+    /// </summary>
+    struct ScenarioResult
+    {
+        Scenario Config;
+        uint32_t Succeeded{ 0 };
+        uint32_t Failed{ 0 };
+        HRESULT LastError{ S_OK };
+        Percentiles Total;
+        std::array<Percentiles, Herpaderp::PhaseCount> Phases{};
+        std::array<Percentiles, (Herpaderp::MilestoneCount - 1)> Gaps{};
+
+        /// <summary>
+        /// Calls made against the spawned process by the last successful 
+        /// execution, they do not vary between executions of a scenario.
+        /// </summary>
+        Herpaderp::RemoteCounters Remote;
+
+        /// <summary>
+        /// Heap allocations counted over the measured executions, operator
+        /// new calls and growth of the execution arena, plus malloc in debug
+        /// builds. Allocations the system makes on its own heaps are not
+        /// counted.
+        /// </summary>
+        uint64_t Allocations{ 0 };
+    };
+
+    /// <summary>
+    /// Builds the benchmark matrix, every source size with every replace 
+    /// mode, every valid combination of the benchmarked flags and every 
+    /// write backend.
+    /// </summary>
+    /// <param name="SourceSizes">
+    /// Source sizes to benchmark.
+    /// </param>
+    /// <param name="Backends">
+    /// Write backends to benchmark.
+    /// </param>
+    /// <returns>
+    /// Scenarios of the matrix.
+    /// </returns>
+    std::vector<Scenario> BuildMatrix(
+        _In_ std::span<const uint64_t> SourceSizes,
+        _In_ std::span<const Herpaderp::WriteBackend> Backends);
+
+    /// <summary>
+    /// Executes a scenario and measures it.
+    /// </summary>
+    /// <param name="Config">
+    /// Settings shared by every scenario.
+    /// </param>
+    /// <param name="Cell">
+    /// Scenario to execute.
+    /// </param>
+    /// <param name="Result">
+    /// Set to the measured results of the scenario.
+    /// </param>
+    /// <returns>
+    /// Success if the scenario files were prepared. Failed executions are
+    /// counted in the result rather than failing the scenario.
+    /// </returns>
+    _Must_inspect_result_ HRESULT RunScenario(
+        _In_ const Settings& Config,
+        _In_ const Scenario& Cell,
+        _Out_ ScenarioResult& Result);
+
+    /// <summary>
+    /// Writes the results as JSON. Keys and ordering are stable so the files
+    /// of two builds can be diffed.
+    /// </summary>
+    /// <param name="FileName">
+    /// File to write the report to.
+    /// </param>
+    /// <param name="Config">
+    /// Settings the scenarios ran with.
+    /// </param>
+    /// <param name="Results">
+    /// Results to write.
+    /// </param>
+    /// <returns>
+    /// Success if the report was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WriteJsonReport(
+        _In_ const std::wstring& FileName,
+        _In_ const Settings& Config,
+        _In_ std::span<const ScenarioResult> Results);
+}
@@ -0,0 +1,190 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/jsonwriter.hpp
+// Author:   Johnny Shaw
+// Abstract: Minimal JSON Writer for Benchmark Reports
+//
+#pragma once
+
+/// <summary>
+/// Minimal JSON writer producing one value per line so reports diff well.
+/// </summary>
+class JsonWriter
+{
+public:
+
+    void BeginObject()
+    {
+        Prefix();
+        m_Text += '{';
+        m_First.push_back(true);
+    }
+
+    void EndObject()
+    {
+        Close('}');
+    }
+
+    void BeginArray()
+    {
+        Prefix();
+        m_Text += '[';
+        m_First.push_back(true);
+    }
+
+    void EndArray()
+    {
+        Close(']');
+    }
+
+    void Key(_In_ std::wstring_view Name)
+    {
+        Prefix();
+        AppendString(Name);
+        m_Text += ": ";
+        m_AfterKey = true;
+    }
+
+    void Value(_In_ std::wstring_view Text)
+    {
+        Prefix();
+        AppendString(Text);
+    }
+
+    void Value(_In_ uint64_t Number)
+    {
+        Prefix();
+        m_Text += std::to_string(Number);
+    }
+
+    void Value(_In_ double Number)
+    {
+        Prefix();
+        char buffer[64];
+        sprintf_s(buffer, "%.3f", Number);
+        m_Text += buffer;
+    }
+
+    const std::string& Text() const
+    {
+        return m_Text;
+    }
+
+    /// <summary>
+    /// Writes the text to a file, replacing it.
+    /// </summary>
+    /// <param name="FileName">
+    /// File to write the text to.
+    /// </param>
+    /// <returns>
+    /// Success if the file was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT Save(_In_ const std::wstring& FileName) const
+    {
+        auto text = (m_Text + '\n');
+
+        wil::unique_handle fileHandle;
+        fileHandle.reset(CreateFileW(FileName.c_str(),
+                                     GENERIC_WRITE,
+                                     0,
+                                     nullptr,
+                                     CREATE_ALWAYS,
+                                     FILE_ATTRIBUTE_NORMAL,
+                                     nullptr));
+        RETURN_LAST_ERROR_IF(!fileHandle.is_valid());
+
+        RETURN_IF_FAILED(Utils::WriteFileAt(
+                            fileHandle.get(),
+                            0,
+                            { RCAST(const uint8_t*)(text.data()), text.size() }));
+        return S_OK;
+    }
+
+private:
+
+    void Prefix()
+    {
+        if (m_AfterKey)
+        {
+            m_AfterKey = false;
+            return;
+        }
+
+        if (!m_First.empty())
+        {
+            if (!m_First.back())
+            {
+                m_Text += ',';
+            }
+            m_First.back() = false;
+            m_Text += '\n';
+            m_Text.append((m_First.size() * 2), ' ');
+        }
+    }
+
+    void Close(_In_ char Bracket)
+    {
+        auto empty = m_First.back();
+        m_First.pop_back();
+        if (!empty)
+        {
+            m_Text += '\n';
+            m_Text.append((m_First.size() * 2), ' ');
+        }
+        m_Text += Bracket;
+    }
+
+    void AppendString(_In_ std::wstring_view Text)
+    {
+        std::string utf8;
+        if (!Text.empty())
+        {
+            auto length = WideCharToMultiByte(CP_UTF8,
+                                              0,
+                                              Text.data(),
+                                              SCAST(int)(Text.size()),
+                                              nullptr,
+                                              0,
+                                              nullptr,
+                                              nullptr);
+            if (length > 0)
+            {
+                utf8.resize(SCAST(size_t)(length));
+                WideCharToMultiByte(CP_UTF8,
+                                    0,
+                                    Text.data(),
+                                    SCAST(int)(Text.size()),
+                                    utf8.data(),
+                                    length,
+                                    nullptr,
+                                    nullptr);
+            }
+        }
+
+        m_Text += '"';
+        for (auto c : utf8)
+        {
+            if ((c == '"') || (c == '\\'))
+            {
+                m_Text += '\\';
+                m_Text += c;
+            }
+            else if (SCAST(unsigned char)(c) < 0x20)
+            {
+                char escaped[8];
+                sprintf_s(escaped, "\\u%04x", SCAST(unsigned int)(c));
+                m_Text += escaped;
+            }
+            else
+            {
+                m_Text += c;
+            }
+        }
+        m_Text += '"';
+    }
+
+    std::string m_Text;
+    std::vector<bool> m_First;
+    bool m_AfterKey{ false };
+};
@@ -0,0 +1,691 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+// 
+// File:     source/ProcessHerpaderping.Bench/main.cpp
+// Author:   Johnny Shaw
+// Abstract: Process Herpaderping Benchmark
+//
+#include "pch.hpp"
+#include "../ProcessHerpaderping/res/version.h"
+#include "memoryfile.hpp"
+#include "utils.hpp"
+#include "herpaderp.hpp"
+#include "trace.hpp"
+#include "bench.hpp"
+#include "micro.hpp"
+
+namespace Constants 
+{
+    constexpr static std::wstring_view BenchHeader
+    {
+        L"Process Herpaderping Benchmark - " WSTR_COPYRIGHT
+    };
+
+    constexpr static std::array<uint64_t, 4> DefaultSizesMegabytes
+    {
+        1, 16, 256, 1024
+    };
+
+    constexpr static std::array<uint64_t, 4> DefaultMicroSizesKilobytes
+    {
+        4, 64, 1024, 16384
+    };
+}
+
+/// <summary>
+/// Class for parsing and storing benchmark arguments. 
+/// </summary>
+class Parameters : public Utils::IArgumentParser
+{
+public:
+    constexpr static std::wstring_view Usage
+    {
+L"ProcessHerpaderping.Bench.exe SourceFile WorkingDirectory [Options...]\n"
+L"ProcessHerpaderping.Bench.exe --micro [Micro Options...]\n"
+L"Usage:\n"
+L"  SourceFile               Source file to execute, it should exit quickly\n"
+L"                           on its own. It is padded to each source size.\n"
+L"  WorkingDirectory         Directory for generated sources, replacements\n"
+L"                           and targets. Generated files of the right size\n"
+L"                           are reused between runs.\n"
+L"  -i,--iterations number   Measured executions of each scenario, defaults\n"
+L"                           to 10.\n"
+L"  -w,--warmup number       Unmeasured executions before each scenario,\n"
+L"                           defaults to 1.\n"
+L"  -s,--sizes list          Comma separated source sizes in megabytes,\n"
+L"                           defaults to 1,16,256,1024.\n"
+L"  -o,--output file         JSON report file, defaults to bench.json in the\n"
+L"                           working directory.\n"
+L"  -b,--backends list       Comma separated write backends to compare,\n"
+L"                           buffered, unbuffered or mapped, defaults to\n"
+L"                           buffered. With more than one the fastest for\n"
+L"                           the working directory is reported.\n"
+L"  -a,--no-allocations      Fails the run if a measured execution calls\n"
+L"                           operator new or grows its arena, debug builds\n"
+L"                           also count malloc. Allocations the system makes\n"
+L"                           on its own heaps are not seen. Warmup executions\n"
+L"                           may allocate.\n"
+L"  -h,--help                Prints usage.\n"
+L"Micro Options:\n"
+L"  --micro                  Measures the file helpers against in-memory\n"
+L"                           files instead, nothing touches the disk.\n"
+L"  -s,--sizes list          Comma separated sizes in kilobytes, defaults\n"
+L"                           to 4,64,1024,16384.\n"
+L"  -t,--time milliseconds   Time each helper is repeated for at each size,\n"
+L"                           defaults to 200.\n"
+L"  -o,--output file         JSON report file, defaults to micro.json.\n"
+L"  --block-size bytes       Longest block a copy reads at once, defaults to\n"
+L"                           1048576.\n"
+L"  --latency-op nanoseconds Fixed cost charged to each read, write and\n"
+L"                           flush of the in-memory files.\n"
+L"  --latency-rate megabytes Rate in megabytes per second the in-memory\n"
+L"                           files move bytes at, defaults to no limit."
+    };
+
+    Parameters() = default;
+
+    /// <summary>
+    /// Parses command line arguments and stores the data in the class.
+    /// </summary>
+    /// <param name="Argc">
+    /// Number of command line arguments.
+    /// </param>
+    /// <param name="Argv">
+    /// Command line arguments.
+    /// </param>
+    /// <returns>
+    /// Success if arguments were parsed successfully. Failure otherwise.
+    /// </returns>
+    _Must_inspect_result_ virtual HRESULT ParseArguments(
+        _In_ int Argc,
+        _In_reads_(Argc) const wchar_t* Argv[]) override
+    {
+        if ((Argc >= 2) &&
+            SUCCEEDED(Utils::MatchParameter(Argv[1], std::nullopt, L"micro")))
+        {
+            m_Micro = true;
+            return ParseMicroArguments(Argc, Argv);
+        }
+
+        if (Argc < 3)
+        {
+            return E_INVALIDARG;
+        }
+
+        m_Settings.SourceFileName = Argv[1];
+        m_Settings.WorkingDirectory = Argv[2];
+        m_Output = (m_Settings.WorkingDirectory + L"\\bench.json");
+        m_SourceSizes.clear();
+        for (auto megabytes : Constants::DefaultSizesMegabytes)
+        {
+            m_SourceSizes.push_back(megabytes * 0x100000);
+        }
+        m_Backends = { Herpaderp::WriteBackend::Buffered };
+
+        for (int i = 3; i < Argc; i++)
+        {
+            std::wstring arg = Argv[i];
+
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"i", L"iterations")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_Settings.Iterations = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"w", L"warmup")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_Settings.Warmup = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"s", L"sizes")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_SourceSizes.clear();
+                std::wstringstream list(Argv[i]);
+                std::wstring size;
+                while (std::getline(list, size, L','))
+                {
+                    try
+                    {
+                        m_SourceSizes.push_back(
+                                    std::stoull(size, 0, 0) * 0x100000);
+                    }
+                    catch (...)
+                    {
+                        //
+                        // Invalid number...
+                        //
+                        return E_INVALIDARG;
+                    }
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"o", L"output")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_Output = Argv[i];
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"a", L"no-allocations")))
+            {
+                m_NoAllocations = true;
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"b", L"backends")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_Backends.clear();
+                std::wstringstream list(Argv[i]);
+                std::wstring backend;
+                while (std::getline(list, backend, L','))
+                {
+                    if (backend == L"buffered")
+                    {
+                        m_Backends.push_back(Herpaderp::WriteBackend::Buffered);
+                    }
+                    else if (backend == L"unbuffered")
+                    {
+                        m_Backends.push_back(Herpaderp::WriteBackend::Unbuffered);
+                    }
+                    else if (backend == L"mapped")
+                    {
+                        m_Backends.push_back(Herpaderp::WriteBackend::Mapped);
+                    }
+                    else
+                    {
+                        return E_INVALIDARG;
+                    }
+                }
+                continue;
+            }
+
+            return E_INVALIDARG;
+        }
+
+        return S_OK;
+    }
+
+    _Must_inspect_result_ virtual HRESULT ValidateArguments() const override
+    {
+        if (m_Micro)
+        {
+            if ((m_MicroSettings.Milliseconds == 0) ||
+                (m_MicroSettings.BlockSize == 0) ||
+                (m_MicroSettings.BlockSize > UINT32_MAX) ||
+                m_MicroSettings.Sizes.empty())
+            {
+                return E_FAIL;
+            }
+            for (auto size : m_MicroSettings.Sizes)
+            {
+                if (size == 0)
+                {
+                    return E_FAIL;
+                }
+            }
+            return S_OK;
+        }
+
+        if ((m_Settings.Iterations == 0) || 
+            m_SourceSizes.empty() || 
+            m_Backends.empty())
+        {
+            return E_FAIL;
+        }
+        for (auto size : m_SourceSizes)
+        {
+            if (size == 0)
+            {
+                return E_FAIL;
+            }
+        }
+        return S_OK;
+    }
+
+    /// <summary>Gets the usage string.</summary>
+    /// <returns>Usage string.</returns>
+    virtual std::wstring_view GetUsage() const override
+    {
+        return Usage;
+    }
+
+    /// <summary>Gets the benchmark settings.</summary>
+    /// <returns>Benchmark settings.</returns>
+    const Bench::Settings& Settings() const
+    {
+        return m_Settings;
+    }
+
+    /// <summary>Gets the source sizes in bytes.</summary>
+    /// <returns>Source sizes in bytes.</returns>
+    const std::vector<uint64_t>& SourceSizes() const
+    {
+        return m_SourceSizes;
+    }
+
+    /// <summary>Gets the write backends to compare.</summary>
+    /// <returns>Write backends to compare.</returns>
+    const std::vector<Herpaderp::WriteBackend>& Backends() const
+    {
+        return m_Backends;
+    }
+
+    /// <summary>Gets if measured executions must not allocate.</summary>
+    /// <returns>True if measured executions must not allocate.</returns>
+    bool NoAllocations() const
+    {
+        return m_NoAllocations;
+    }
+
+    /// <summary>Gets if the microbenchmarks run instead.</summary>
+    /// <returns>True if the microbenchmarks run instead.</returns>
+    bool Micro() const
+    {
+        return m_Micro;
+    }
+
+    /// <summary>Gets the microbenchmark settings.</summary>
+    /// <returns>Microbenchmark settings.</returns>
+    const Bench::MicroSettings& MicroSettings() const
+    {
+        return m_MicroSettings;
+    }
+
+    /// <summary>Gets the report file name.</summary>
+    /// <returns>Report file name.</returns>
+    const std::wstring& Output() const
+    {
+        return m_Output;
+    }
+
+private:
+
+    /// <summary>
+    /// Parses the arguments of the microbenchmarks, which take no positional
+    /// arguments after the mode.
+    /// </summary>
+    /// <param name="Argc">
+    /// Number of command line arguments.
+    /// </param>
+    /// <param name="Argv">
+    /// Command line arguments.
+    /// </param>
+    /// <returns>
+    /// Success if arguments were parsed successfully. Failure otherwise.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ParseMicroArguments(
+        _In_ int Argc,
+        _In_reads_(Argc) const wchar_t* Argv[])
+    {
+        m_Output = L"micro.json";
+        m_MicroSettings.Sizes.clear();
+        for (auto kilobytes : Constants::DefaultMicroSizesKilobytes)
+        {
+            m_MicroSettings.Sizes.push_back(kilobytes * 0x400);
+        }
+
+        for (int i = 2; i < Argc; i++)
+        {
+            std::wstring arg = Argv[i];
+
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"s", L"sizes")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_MicroSettings.Sizes.clear();
+                std::wstringstream list(Argv[i]);
+                std::wstring size;
+                while (std::getline(list, size, L','))
+                {
+                    try
+                    {
+                        m_MicroSettings.Sizes.push_back(
+                                    std::stoull(size, 0, 0) * 0x400);
+                    }
+                    catch (...)
+                    {
+                        //
+                        // Invalid number...
+                        //
+                        return E_INVALIDARG;
+                    }
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"o", L"output")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_Output = Argv[i];
+                continue;
+            }
+
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"t", L"time")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_MicroSettings.Milliseconds = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+
+            //
+            // The remaining options each take one number.
+            //
+            uint64_t* number = nullptr;
+            uint64_t scale = 1;
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"block-size")))
+            {
+                number = &m_MicroSettings.BlockSize;
+            }
+            else if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"latency-op")))
+            {
+                number = &m_MicroSettings.Latency.OperationNanoseconds;
+            }
+            else if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"latency-rate")))
+            {
+                number = &m_MicroSettings.Latency.BytesPerSecond;
+                scale = 0x100000;
+            }
+            else
+            {
+                return E_INVALIDARG;
+            }
+
+            i++;
+            if (i >= Argc)
+            {
+                return E_INVALIDARG;
+            }
+            try
+            {
+                *number = (std::stoull(Argv[i], 0, 0) * scale);
+            }
+            catch (...)
+            {
+                //
+                // Invalid number...
+                //
+                return E_INVALIDARG;
+            }
+        }
+
+        return S_OK;
+    }
+
+    Bench::Settings m_Settings;
+    std::vector<uint64_t> m_SourceSizes;
+    std::vector<Herpaderp::WriteBackend> m_Backends;
+    std::wstring m_Output;
+    bool m_NoAllocations{ false };
+    bool m_Micro{ false };
+    Bench::MicroSettings m_MicroSettings;
+};
+
+/// <summary>
+/// Reports the write backend with the lowest sum of medians over the matrix.
+/// Only cells where every backend succeeded are compared, so a backend is
+/// not favored for skipping the cells it failed.
+/// </summary>
+/// <param name="Params">
+/// Parameters the matrix was built with.
+/// </param>
+/// <param name="Results">
+/// Results of the matrix.
+/// </param>
+static void ReportFastestBackend(
+    _In_ const Parameters& Params,
+    _In_ std::span<const Bench::ScenarioResult> Results)
+{
+    //
+    // The matrix varies the backend fastest, each run of Backends().size()
+    // results is one cell.
+    //
+    const auto& backends = Params.Backends();
+    std::vector<double> medians(backends.size(), 0.0);
+    for (size_t cell = 0; 
+         (cell + backends.size()) <= Results.size(); 
+         cell += backends.size())
+    {
+        auto results = Results.subspan(cell, backends.size());
+        if (std::any_of(results.begin(), 
+                        results.end(), 
+                        [](const Bench::ScenarioResult& Result) -> bool
+                        {
+                            return ((Result.Succeeded == 0) || (Result.Failed > 0));
+                        }))
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < backends.size(); i++)
+        {
+            medians[i] += results[i].Total.P50;
+        }
+    }
+
+    auto fastest = SCAST(size_t)(std::distance(medians.begin(),
+                                               std::min_element(medians.begin(),
+                                                                medians.end())));
+    for (size_t i = 0; i < backends.size(); i++)
+    {
+        std::wcout << std::fixed << std::setprecision(3)
+                   << Herpaderp::WriteBackendName(backends[i]) 
+                   << L" summed p50 " << medians[i] << L" ms\n";
+    }
+    std::wcout << L"Fastest write backend for \"" 
+               << Params.Settings().WorkingDirectory << L"\" is " 
+               << Herpaderp::WriteBackendName(backends[fastest]) << L'\n';
+}
+
+/// <summary>
+/// Runs the microbenchmarks, printing each result and writing the report.
+/// </summary>
+/// <param name="Params">
+/// Parameters of the microbenchmarks.
+/// </param>
+/// <returns>
+/// EXIT_SUCCESS if every primitive ran and the report was written,
+/// EXIT_FAILURE otherwise.
+/// </returns>
+static int RunMicro(_In_ const Parameters& Params)
+{
+    int exitCode = EXIT_SUCCESS;
+
+    auto results = Bench::RunMicrobenchmarks(Params.MicroSettings());
+    for (const auto& result : results)
+    {
+        std::wcout << std::left << std::setw(14) << result.Primitive
+                   << std::right << std::setw(10) << result.Size << L" bytes, ";
+        if (FAILED(result.Status))
+        {
+            std::wcout << L"failed, "
+                       << Utils::FormatError(SCAST(uint32_t)(result.Status)) << L'\n';
+            exitCode = EXIT_FAILURE;
+            continue;
+        }
+        std::wcout << std::fixed << std::setprecision(1)
+                   << result.NanosecondsPerOperation << L" ns/op, "
+                   << (result.BytesPerSecond / 0x100000) << L" MB/s\n";
+    }
+
+    HRESULT hr = Bench::WriteMicroJsonReport(Params.Output(),
+                                             Params.MicroSettings(),
+                                             results);
+    if (FAILED(hr))
+    {
+        std::wcout << L"Failed to write report \"" << Params.Output()
+                   << L"\", " << Utils::FormatError(SCAST(uint32_t)(hr)) << L'\n';
+        return EXIT_FAILURE;
+    }
+
+    std::wcout << L"Report written to \"" << Params.Output() << L"\"\n";
+    return exitCode;
+}
+
+/// <summary>
+/// Main entry point for the Process Herpaderping Benchmark.
+/// </summary>
+/// <param name="Argc">
+/// Number of command line arguments.
+/// </param>
+/// <param name="Argv">
+/// Command line arguments.
+/// </param>
+/// <returns>
+/// EXIT_SUCCESS if every scenario ran and the report was written, 
+/// EXIT_FAILURE otherwise.
+/// </returns>
+int wmain(
+    _In_ int Argc, 
+    _In_reads_(Argc) const wchar_t* Argv[])
+{
+    Trace::Register();
+    auto unregisterTrace = wil::scope_exit([]() -> void
+    {
+        Trace::Unregister();
+    });
+
+    Parameters params;
+    if (FAILED(Utils::HandleCommandLineArgs(Argc,
+                                            Argv,
+                                            Constants::BenchHeader,
+                                            params)))
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::wcout << Constants::BenchHeader << L'\n';
+
+    //
+    // Tool logging would be measured along with everything else, silence it. 
+    // Execution phases are still available through tracing.
+    //
+    Utils::SetLoggingMask(0);
+
+    if (params.Micro())
+    {
+        return RunMicro(params);
+    }
+
+    auto scenarios = Bench::BuildMatrix(params.SourceSizes(), params.Backends());
+    std::vector<Bench::ScenarioResult> results(scenarios.size());
+
+    int exitCode = EXIT_SUCCESS;
+    for (size_t i = 0; i < scenarios.size(); i++)
+    {
+        const auto& scenario = scenarios[i];
+        std::wcout << L"[" << (i + 1) << L"/" << scenarios.size() << L"] "
+                   << (scenario.SourceSize / 0x100000) << L" MB, replace "
+                   << Bench::ReplaceModeName(scenario.Replace) << L", flags 0x"
+                   << std::hex << scenario.Flags << std::dec << L", "
+                   << Herpaderp::WriteBackendName(scenario.Backend) << L"... ";
+
+        HRESULT hr = Bench::RunScenario(params.Settings(), 
+                                        scenario, 
+                                        results[i]);
+        if (FAILED(hr))
+        {
+            std::wcout << L"failed to prepare, " 
+                       << Utils::FormatError(SCAST(uint32_t)(hr)) << L'\n';
+            exitCode = EXIT_FAILURE;
+            continue;
+        }
+
+        std::wcout << std::fixed << std::setprecision(3)
+                   << L"p50 " << results[i].Total.P50 
+                   << L" ms, p99 " << results[i].Total.P99 << L" ms";
+        if (results[i].Failed > 0)
+        {
+            std::wcout << L", " << results[i].Failed << L" failed, last " 
+                       << Utils::FormatError(SCAST(uint32_t)(results[i].LastError));
+            exitCode = EXIT_FAILURE;
+        }
+        if (results[i].Allocations > 0)
+        {
+            std::wcout << L", " << results[i].Allocations << L" allocations";
+            if (params.NoAllocations())
+            {
+                exitCode = EXIT_FAILURE;
+            }
+        }
+        std::wcout << L'\n';
+    }
+
+    if (params.Backends().size() > 1)
+    {
+        ReportFastestBackend(params, results);
+    }
+
+    HRESULT hr = Bench::WriteJsonReport(params.Output(), 
+                                        params.Settings(), 
+                                        results);
+    if (FAILED(hr))
+    {
+        std::wcout << L"Failed to write report \"" << params.Output() 
+                   << L"\", " << Utils::FormatError(SCAST(uint32_t)(hr)) << L'\n';
+        return EXIT_FAILURE;
+    }
+
+    std::wcout << L"Report written to \"" << params.Output() << L"\"\n";
+    return exitCode;
+}
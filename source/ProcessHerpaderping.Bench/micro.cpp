@@ -0,0 +1,233 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/micro.cpp
+// Author:   Johnny Shaw
+// Abstract: Microbenchmarks of the I/O Primitives
+//
+#include "pch.hpp"
+#include "../ProcessHerpaderping/res/version.h"
+#include "memoryfile.hpp"
+#include "random.hpp"
+#include "peview.hpp"
+#include "arena.hpp"
+#include "utils.hpp"
+#include "micro.hpp"
+#include "jsonwriter.hpp"
+
+namespace Bench
+{
+    constexpr static std::array<uint8_t, 4> MicroPattern{ '\x72', '\x6f', '\x66', '\x6c' };
+
+    constexpr static uint64_t MicroSeed{ 0x68657270 };
+
+    //
+    // The headers of a loaded image are always within its first page.
+    //
+    constexpr static size_t ImageHeaderSize{ 0x1000 }; // page
+
+    /// <summary>
+    /// Repeats an operation until the time budget is spent. One unmeasured
+    /// operation runs first so lazy allocations are not measured.
+    /// </summary>
+    template <typename OperationT>
+    static void Measure(
+        _In_ const MicroSettings& Config,
+        _In_ uint64_t Bytes,
+        _Inout_ MicroResult& Result,
+        _In_ OperationT&& Operation)
+    {
+        Result.Size = Bytes;
+
+        Result.Status = Operation();
+        if (FAILED(Result.Status))
+        {
+            return;
+        }
+
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        auto budget = ((SCAST(uint64_t)(frequency.QuadPart) * Config.Milliseconds) / 1000);
+
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        LARGE_INTEGER now = start;
+        while (SCAST(uint64_t)(now.QuadPart - start.QuadPart) < budget)
+        {
+            Result.Status = Operation();
+            if (FAILED(Result.Status))
+            {
+                return;
+            }
+            Result.Operations++;
+            QueryPerformanceCounter(&now);
+        }
+
+        auto seconds = (SCAST(double)(now.QuadPart - start.QuadPart) /
+                        SCAST(double)(frequency.QuadPart));
+        if ((Result.Operations == 0) || (seconds <= 0.0))
+        {
+            return;
+        }
+
+        Result.NanosecondsPerOperation = ((seconds * 1e9) /
+                                          SCAST(double)(Result.Operations));
+        Result.BytesPerSecond = ((SCAST(double)(Bytes) *
+                                  SCAST(double)(Result.Operations)) / seconds);
+    }
+}
+
+_Use_decl_annotations_
+std::vector<Bench::MicroResult> Bench::RunMicrobenchmarks(
+    const MicroSettings& Config)
+{
+    std::vector<MicroResult> results;
+
+    for (auto size : Config.Sizes)
+    {
+        if (size > SIZE_MAX)
+        {
+            continue;
+        }
+
+        std::vector<uint8_t> buffer(SCAST(size_t)(size));
+        Utils::RandomStream(MicroSeed).Fill(buffer);
+        Utils::MemoryFileSink sink(SCAST(size_t)(size), Config.Latency);
+
+        {
+            auto& result = results.emplace_back();
+            result.Primitive = L"fill_pattern";
+            Measure(Config, size, result, [&]() -> HRESULT
+            {
+                return Utils::FillBufferWithPattern(buffer, MicroPattern);
+            });
+        }
+
+        {
+            auto& result = results.emplace_back();
+            result.Primitive = L"fill_random";
+            Utils::RandomStream random(MicroSeed);
+            Measure(Config, size, result, [&]() -> HRESULT
+            {
+                random.Fill(buffer);
+                return S_OK;
+            });
+        }
+
+        {
+            auto& result = results.emplace_back();
+            result.Primitive = L"copy";
+            Measure(Config, size, result, [&]() -> HRESULT
+            {
+                Utils::MemoryFileSource source(buffer,
+                                               SCAST(size_t)(Config.BlockSize),
+                                               Config.Latency);
+                sink.Clear();
+                uint64_t bytesCopied;
+                RETURN_IF_FAILED(Utils::CopyFileContents(source, sink, bytesCopied));
+                return S_OK;
+            });
+        }
+
+        {
+            auto& result = results.emplace_back();
+            result.Primitive = L"write_pattern";
+            Measure(Config, size, result, [&]() -> HRESULT
+            {
+                Utils::ArenaScope scratch;
+                sink.Clear();
+                uint64_t bytesWritten;
+                RETURN_IF_FAILED(Utils::WritePatternToSink(sink,
+                                                           0,
+                                                           size,
+                                                           MicroPattern,
+                                                           bytesWritten));
+                return S_OK;
+            });
+        }
+
+        {
+            auto& result = results.emplace_back();
+            result.Primitive = L"write_random";
+            Measure(Config, size, result, [&]() -> HRESULT
+            {
+                Utils::ArenaScope scratch;
+                sink.Clear();
+                uint64_t bytesWritten;
+                RETURN_IF_FAILED(Utils::WriteRandomToSink(sink,
+                                                          0,
+                                                          size,
+                                                          MicroSeed,
+                                                          bytesWritten));
+                return S_OK;
+            });
+        }
+    }
+
+    //
+    // Header parsing does not scale with the file, it is measured once over
+    // the headers of this image as the loader mapped them.
+    //
+    {
+        auto& result = results.emplace_back();
+        result.Primitive = L"pe_headers";
+        std::span<const uint8_t> headers{ RCAST(const uint8_t*)(GetModuleHandleW(nullptr)),
+                                          ImageHeaderSize };
+        Utils::PeView view;
+        Measure(Config, headers.size(), result, [&]() -> HRESULT
+        {
+            return view.Parse(headers);
+        });
+    }
+
+    return results;
+}
+
+_Use_decl_annotations_
+HRESULT Bench::WriteMicroJsonReport(
+    const std::wstring& FileName,
+    const MicroSettings& Config,
+    std::span<const MicroResult> Results)
+{
+    JsonWriter json;
+    json.BeginObject();
+    json.Key(L"version");
+    json.Value(WSTR_VERSION);
+    json.Key(L"milliseconds");
+    json.Value(SCAST(uint64_t)(Config.Milliseconds));
+    json.Key(L"block_size");
+    json.Value(Config.BlockSize);
+    json.Key(L"latency_operation_ns");
+    json.Value(Config.Latency.OperationNanoseconds);
+    json.Key(L"latency_bytes_per_second");
+    json.Value(Config.Latency.BytesPerSecond);
+    json.Key(L"primitives");
+    json.BeginArray();
+
+    for (const auto& result : Results)
+    {
+        std::wstring status;
+        wil::str_printf_nothrow(status, L"0x%08x", result.Status);
+
+        json.BeginObject();
+        json.Key(L"primitive");
+        json.Value(result.Primitive);
+        json.Key(L"bytes");
+        json.Value(result.Size);
+        json.Key(L"operations");
+        json.Value(result.Operations);
+        json.Key(L"ns_per_op");
+        json.Value(result.NanosecondsPerOperation);
+        json.Key(L"bytes_per_second");
+        json.Value(result.BytesPerSecond);
+        json.Key(L"status");
+        json.Value(status);
+        json.EndObject();
+    }
+
+    json.EndArray();
+    json.EndObject();
+
+    RETURN_IF_FAILED(json.Save(FileName));
+    return S_OK;
+}
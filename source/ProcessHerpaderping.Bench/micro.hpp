@@ -0,0 +1,84 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Bench/micro.hpp
+// Author:   Johnny Shaw
+// Abstract: Microbenchmarks of the I/O Primitives
+//
+#pragma once
+
+namespace Bench
+{
+    /// <summary>
+    /// Settings of the microbenchmarks.
+    /// </summary>
+    struct MicroSettings
+    {
+        /// <summary>
+        /// Bytes each operation handles, every primitive is measured at each.
+        /// </summary>
+        std::vector<uint64_t> Sizes;
+
+        /// <summary>
+        /// Longest block a copy reads at once.
+        /// </summary>
+        uint64_t BlockSize{ Utils::HandleFileSource::BlockSize };
+
+        /// <summary>
+        /// How long each primitive is repeated for at each size.
+        /// </summary>
+        uint32_t Milliseconds{ 200 };
+
+        /// <summary>
+        /// Cost charged to the in-memory files, zero for none.
+        /// </summary>
+        Utils::LatencyModel Latency;
+    };
+
+    /// <summary>
+    /// Measured throughput of one primitive at one size.
+    /// </summary>
+    struct MicroResult
+    {
+        const wchar_t* Primitive{ L"" };
+        uint64_t Size{ 0 };
+        uint64_t Operations{ 0 };
+        double NanosecondsPerOperation{ 0.0 };
+        double BytesPerSecond{ 0.0 };
+        HRESULT Status{ S_OK };
+    };
+
+    /// <summary>
+    /// Measures each I/O primitive at each size against in-memory files,
+    /// nothing touches the disk.
+    /// </summary>
+    /// <param name="Config">
+    /// Settings of the microbenchmarks.
+    /// </param>
+    /// <returns>
+    /// Measured throughput of every primitive at every size. A primitive
+    /// that failed has its status set.
+    /// </returns>
+    std::vector<MicroResult> RunMicrobenchmarks(_In_ const MicroSettings& Config);
+
+    /// <summary>
+    /// Writes the microbenchmark results as JSON. Keys and ordering are
+    /// stable so the files of two builds can be diffed.
+    /// </summary>
+    /// <param name="FileName">
+    /// File to write the report to.
+    /// </param>
+    /// <param name="Config">
+    /// Settings the microbenchmarks ran with.
+    /// </param>
+    /// <param name="Results">
+    /// Results to write.
+    /// </param>
+    /// <returns>
+    /// Success if the report was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WriteMicroJsonReport(
+        _In_ const std::wstring& FileName,
+        _In_ const MicroSettings& Config,
+        _In_ std::span<const MicroResult> Results);
+}
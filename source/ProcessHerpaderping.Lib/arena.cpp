@@ -0,0 +1,166 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/arena.cpp
+// Author:   Johnny Shaw
+// Abstract: Per-Thread Scratch Arena for Executions
+//
+#include "pch.hpp"
+#include "arena.hpp"
+
+namespace Utils
+{
+    constexpr static size_t AlignUp(
+        _In_ size_t Value,
+        _In_ size_t Alignment)
+    {
+        return (((Value + Alignment - 1) / Alignment) * Alignment);
+    }
+}
+
+Utils::Arena& Utils::Arena::Current()
+{
+    //
+    // Executions on a thread run one after another, each borrows the arena
+    // for its duration and hands it back at the start.
+    //
+    thread_local Arena t_Arena;
+    return t_Arena;
+}
+
+_Use_decl_annotations_
+void* Utils::Arena::Allocate(
+    size_t Size,
+    size_t Alignment)
+{
+    Size = std::max<size_t>(Size, 1);
+
+    //
+    // After rewinding into an earlier chunk the chunks past it are still
+    // held, move on through them before growing.
+    //
+    while (m_Chunk < m_Chunks.size())
+    {
+        auto memory = AllocateFrom(m_Chunk, Size, Alignment);
+        if (memory != nullptr)
+        {
+            return memory;
+        }
+
+        if ((m_Chunk + 1) == m_Chunks.size())
+        {
+            break;
+        }
+        m_Chunk++;
+        m_Offset = 0;
+    }
+
+    if (FAILED(Grow(Size + ((Alignment > ChunkAlignment) ? Alignment : 0))))
+    {
+        return nullptr;
+    }
+
+    m_Chunk = (m_Chunks.size() - 1);
+    m_Offset = 0;
+    return AllocateFrom(m_Chunk, Size, Alignment);
+}
+
+_Use_decl_annotations_
+void Utils::Arena::Rewind(Mark Position)
+{
+    m_Chunk = Position.Chunk;
+    m_Offset = Position.Offset;
+
+    if ((Position.Chunk != 0) ||
+        (Position.Offset != 0) ||
+        (m_Chunks.size() <= 1))
+    {
+        return;
+    }
+
+    //
+    // Nothing is live at the start, replace the chunks with one that holds
+    // all of them so the next execution does not have to grow.
+    //
+    auto capacity = Capacity();
+    m_Chunks.clear();
+    LOG_IF_FAILED(Grow(capacity));
+}
+
+size_t Utils::Arena::Capacity() const
+{
+    size_t capacity = 0;
+    for (const auto& chunk : m_Chunks)
+    {
+        capacity += chunk.Size;
+    }
+    return capacity;
+}
+
+_Use_decl_annotations_
+void* Utils::Arena::do_allocate(
+    size_t Bytes,
+    size_t Alignment)
+{
+    auto memory = Allocate(Bytes, Alignment);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+_Use_decl_annotations_
+void Utils::Arena::do_deallocate(
+    void* Pointer,
+    size_t Bytes,
+    size_t Alignment)
+{
+    //
+    // Released when the scope ends.
+    //
+    UNREFERENCED_PARAMETER(Pointer);
+    UNREFERENCED_PARAMETER(Bytes);
+    UNREFERENCED_PARAMETER(Alignment);
+}
+
+_Use_decl_annotations_
+bool Utils::Arena::do_is_equal(
+    const std::pmr::memory_resource& Other) const noexcept
+{
+    return (this == &Other);
+}
+
+_Use_decl_annotations_
+void* Utils::Arena::AllocateFrom(
+    size_t Chunk,
+    size_t Size,
+    size_t Alignment)
+{
+    const auto& chunk = m_Chunks[Chunk];
+    auto base = RCAST(uintptr_t)(chunk.Buffer.get());
+    auto start = (AlignUp((base + m_Offset), Alignment) - base);
+    if ((start > chunk.Size) || (Size > (chunk.Size - start)))
+    {
+        return nullptr;
+    }
+
+    m_Offset = (start + Size);
+    return RCAST(void*)(base + start);
+}
+
+_Use_decl_annotations_
+HRESULT Utils::Arena::Grow(size_t Size)
+{
+    auto size = AlignUp(std::max<size_t>(Size, MinChunkSize), ChunkAlignment);
+
+    wil::unique_aligned_buffer buffer(_aligned_malloc(size, ChunkAlignment));
+    RETURN_IF_NULL_ALLOC(buffer.get());
+
+    Chunk chunk;
+    chunk.Buffer = std::move(buffer);
+    chunk.Size = size;
+    m_Chunks.emplace_back(std::move(chunk));
+    m_Growths++;
+    return S_OK;
+}
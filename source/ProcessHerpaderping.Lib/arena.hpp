@@ -0,0 +1,215 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/arena.hpp
+// Author:   Johnny Shaw
+// Abstract: Per-Thread Scratch Arena for Executions
+//
+#pragma once
+
+namespace Utils
+{
+    /// <summary>
+    /// Destroys an object placed in an arena, the memory stays with the
+    /// arena.
+    /// </summary>
+    struct ArenaDelete
+    {
+        template <typename T>
+        void operator()(_In_ T* Object) const
+        {
+            std::destroy_at(Object);
+        }
+    };
+
+    /// <summary>
+    /// Owns an object placed in an arena. It must be released before the
+    /// arena scope it was created in ends.
+    /// </summary>
+    template <typename T>
+    using ArenaPtr = std::unique_ptr<T, ArenaDelete>;
+
+    /// <summary>
+    /// Scratch memory of the execution running on a thread. Allocations are
+    /// bumped out of large chunks and released together when the scope
+    /// that made them ends, nothing is freed on its own. When an execution
+    /// needed more than one chunk they are merged once it ends, so the next
+    /// execution of the same shape is served from memory the arena already
+    /// holds. Not safe for concurrent use, each thread has its own.
+    /// </summary>
+    class Arena final : public std::pmr::memory_resource
+    {
+    public:
+        /// <summary>
+        /// Alignment of each chunk, page aligned I/O buffers are carved out
+        /// without padding.
+        /// </summary>
+        constexpr static size_t ChunkAlignment = 0x1000; // page
+
+        /// <summary>
+        /// Smallest chunk allocated.
+        /// </summary>
+        constexpr static size_t MinChunkSize = 0x10000; // 64kib
+
+        /// <summary>
+        /// Position in the arena, everything allocated after it is released
+        /// by rewinding to it.
+        /// </summary>
+        struct Mark
+        {
+            size_t Chunk{ 0 };
+            size_t Offset{ 0 };
+        };
+
+        /// <summary>
+        /// Gets the arena of the calling thread.
+        /// </summary>
+        /// <returns>
+        /// Arena of the calling thread.
+        /// </returns>
+        static Arena& Current();
+
+        Arena() = default;
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        /// <summary>
+        /// Allocates from the arena.
+        /// </summary>
+        /// <param name="Size">
+        /// Number of bytes to allocate.
+        /// </param>
+        /// <param name="Alignment">
+        /// Alignment of the allocation, must be a power of two.
+        /// </param>
+        /// <returns>
+        /// Allocated memory, null if the arena could not grow.
+        /// </returns>
+        _Ret_maybenull_ void* Allocate(
+            _In_ size_t Size,
+            _In_ size_t Alignment = alignof(std::max_align_t));
+
+        /// <summary>
+        /// Constructs an object in the arena.
+        /// </summary>
+        /// <param name="Arguments">
+        /// Arguments of the object constructor.
+        /// </param>
+        /// <returns>
+        /// Owner of the object, null if the arena could not grow.
+        /// </returns>
+        template <typename T, typename... Args>
+        ArenaPtr<T> New(Args&&... Arguments)
+        {
+            auto memory = Allocate(sizeof(T), alignof(T));
+            if (memory == nullptr)
+            {
+                return nullptr;
+            }
+            return ArenaPtr<T>(new (memory) T(std::forward<Args>(Arguments)...));
+        }
+
+        /// <summary>Gets the current position.</summary>
+        /// <returns>Current position.</returns>
+        Mark Position() const
+        {
+            return { m_Chunk, m_Offset };
+        }
+
+        /// <summary>
+        /// Releases everything allocated after a position. Rewinding to the
+        /// start merges the chunks.
+        /// </summary>
+        /// <param name="Position">
+        /// Position to rewind to, taken from this arena.
+        /// </param>
+        void Rewind(_In_ Mark Position);
+
+        /// <summary>
+        /// Gets the number of chunks allocated from the heap so far, it
+        /// stays put once executions are served from the chunks held.
+        /// </summary>
+        /// <returns>Number of chunks allocated.</returns>
+        uint64_t Growths() const
+        {
+            return m_Growths;
+        }
+
+        /// <summary>Gets the bytes held by the arena.</summary>
+        /// <returns>Bytes held by the arena.</returns>
+        size_t Capacity() const;
+
+    private:
+
+        void* do_allocate(
+            _In_ size_t Bytes,
+            _In_ size_t Alignment) override;
+
+        void do_deallocate(
+            _In_ void* Pointer,
+            _In_ size_t Bytes,
+            _In_ size_t Alignment) override;
+
+        bool do_is_equal(
+            _In_ const std::pmr::memory_resource& Other) const noexcept override;
+
+        _Ret_maybenull_ void* AllocateFrom(
+            _In_ size_t Chunk,
+            _In_ size_t Size,
+            _In_ size_t Alignment);
+
+        _Must_inspect_result_ HRESULT Grow(_In_ size_t Size);
+
+        struct Chunk
+        {
+            wil::unique_aligned_buffer Buffer;
+            size_t Size{ 0 };
+        };
+
+        std::vector<Chunk> m_Chunks;
+        size_t m_Chunk{ 0 };
+        size_t m_Offset{ 0 };
+        uint64_t m_Growths{ 0 };
+    };
+
+    /// <summary>
+    /// Releases what is allocated from an arena while the scope is alive.
+    /// Scopes nest, the outermost one of an execution returns the arena to
+    /// its start.
+    /// </summary>
+    class ArenaScope
+    {
+    public:
+        ArenaScope() :
+            ArenaScope(Arena::Current())
+        {
+        }
+
+        explicit ArenaScope(_Inout_ Arena& Scratch) :
+            m_Arena(Scratch),
+            m_Mark(Scratch.Position())
+        {
+        }
+
+        ~ArenaScope()
+        {
+            m_Arena.Rewind(m_Mark);
+        }
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+
+        /// <summary>Gets the arena of the scope.</summary>
+        /// <returns>Arena of the scope.</returns>
+        Arena& Get() const
+        {
+            return m_Arena;
+        }
+
+    private:
+
+        Arena& m_Arena;
+        const Arena::Mark m_Mark;
+    };
+}
@@ -0,0 +1,398 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/batch.cpp
+// Author:   Johnny Shaw
+// Abstract: Batch Execution of Herpaderping Jobs
+//
+#include "pch.hpp"
+#include "herpaderp.hpp"
+#include "batch.hpp"
+#include "procparams.hpp"
+#include "processwatcher.hpp"
+#include "imagecache.hpp"
+#include "utils.hpp"
+#include "random.hpp"
+
+Batch::Executor::~Executor()
+{
+    WaitForAll();
+
+    //
+    // The cleanup group must go before the pool it is bound to.
+    //
+    m_CleanupGroup.reset();
+    m_Pool.reset();
+
+    if (m_EnvironmentInitialized)
+    {
+        DestroyThreadpoolEnvironment(&m_Environment);
+    }
+}
+
+_Use_decl_annotations_
+HRESULT Batch::Executor::Initialize(
+    uint32_t Concurrency,
+    const WorkerScheduling& Scheduling)
+{
+    if ((Concurrency == 0) || m_Pool.is_valid())
+    {
+        return E_INVALIDARG;
+    }
+
+    m_Pool.reset(CreateThreadpool(nullptr));
+    RETURN_LAST_ERROR_IF(!m_Pool.is_valid());
+
+    SetThreadpoolThreadMaximum(m_Pool.get(), Concurrency);
+    RETURN_IF_WIN32_BOOL_FALSE(SetThreadpoolThreadMinimum(m_Pool.get(), 1));
+
+    m_CleanupGroup.reset(CreateThreadpoolCleanupGroup());
+    RETURN_LAST_ERROR_IF(!m_CleanupGroup.is_valid());
+
+    InitializeThreadpoolEnvironment(&m_Environment);
+    m_EnvironmentInitialized = true;
+    SetThreadpoolCallbackPool(&m_Environment, m_Pool.get());
+    SetThreadpoolCallbackCleanupGroup(&m_Environment, 
+                                      m_CleanupGroup.get(), 
+                                      nullptr);
+
+    m_Scheduling = Scheduling;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Batch::Executor::Submit(std::function<void()> Work)
+{
+    if (!m_Pool.is_valid())
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    if (m_Scheduling.Affinity.has_value() || m_Scheduling.Priority.has_value())
+    {
+        //
+        // The pool is private, its threads only ever run our work. Applying
+        // the scheduling per work item keeps up with threads the pool adds.
+        //
+        Work = [Scheduling = m_Scheduling, Work = std::move(Work)]() -> void
+        {
+            LOG_IF_FAILED(ApplyWorkerScheduling(Scheduling));
+            Work();
+        };
+    }
+
+    auto work = std::make_unique<std::function<void()>>(std::move(Work));
+    RETURN_IF_WIN32_BOOL_FALSE(TrySubmitThreadpoolCallback(WorkCallback,
+                                                           work.get(),
+                                                           &m_Environment));
+    //
+    // The callback owns the work now.
+    //
+    work.release();
+    return S_OK;
+}
+
+void Batch::Executor::WaitForAll()
+{
+    if (m_CleanupGroup.is_valid())
+    {
+        CloseThreadpoolCleanupGroupMembers(m_CleanupGroup.get(), 
+                                           FALSE, 
+                                           nullptr);
+    }
+}
+
+_Use_decl_annotations_
+void NTAPI Batch::Executor::WorkCallback(
+    PTP_CALLBACK_INSTANCE Instance,
+    void* Context)
+{
+    UNREFERENCED_PARAMETER(Instance);
+
+    std::unique_ptr<std::function<void()>> work(
+                                RCAST(std::function<void()>*)(Context));
+    (*work)();
+}
+
+_Use_decl_annotations_
+HRESULT Batch::ApplyWorkerScheduling(const WorkerScheduling& Scheduling)
+{
+    if (Scheduling.Affinity.has_value())
+    {
+        auto affinity = *Scheduling.Affinity;
+        RETURN_IF_WIN32_BOOL_FALSE(SetThreadGroupAffinity(GetCurrentThread(),
+                                                          &affinity,
+                                                          nullptr));
+    }
+    if (Scheduling.Priority.has_value())
+    {
+        RETURN_IF_WIN32_BOOL_FALSE(SetThreadPriority(GetCurrentThread(),
+                                                     *Scheduling.Priority));
+    }
+    return S_OK;
+}
+
+_Use_decl_annotations_
+void Batch::FoldProcessExit(JobResult& Result)
+{
+    auto& execution = Result.Execution;
+    if (!execution.Exit.has_value())
+    {
+        return;
+    }
+
+    execution.PhaseTicks[SCAST(size_t)(Herpaderp::Phase::Wait)] = 
+                                                execution.Exit->WaitTicks;
+    if (SUCCEEDED(Result.Status) && FAILED(execution.Exit->Status))
+    {
+        Result.Status = execution.Exit->Status;
+    }
+}
+
+_Use_decl_annotations_
+HRESULT Batch::ExecuteJobs(
+    std::span<const Job> Jobs,
+    std::span<const uint8_t> DefaultPattern,
+    uint32_t Concurrency,
+    const WorkerScheduling& Scheduling,
+    const Herpaderp::ExecuteOptions& Options,
+    std::vector<JobResult>& Results)
+{
+    Results.assign(Jobs.size(), JobResult{});
+
+    HRESULT hr;
+
+    //
+    // Process parameters only differ by the target name between jobs, 
+    // build them once for the whole batch unless the caller provided them.
+    //
+    auto options = Options;
+    Herpaderp::ProcessParametersTemplate parametersTemplate;
+    if (options.ParametersTemplate == nullptr)
+    {
+        hr = parametersTemplate.InitializeFromCurrentProcess();
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to build process parameters");
+            RETURN_HR(hr);
+        }
+        options.ParametersTemplate = &parametersTemplate;
+    }
+
+    //
+    // Spawned processes are watched rather than waited for on an executor 
+    // thread, declared before the executor so it outlives every job.
+    //
+    Herpaderp::ProcessWatcher watcher;
+    if (options.Watcher == nullptr)
+    {
+        options.Watcher = &watcher;
+    }
+
+    Executor executor;
+    hr = executor.Initialize(Concurrency, Scheduling);
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, hr, L"Failed to initialize job executor");
+        RETURN_HR(hr);
+    }
+
+    Utils::Log(Log::Information,
+               L"Executing %zu jobs, at most %lu at once",
+               Jobs.size(),
+               Concurrency);
+
+    for (size_t i = 0; i < Jobs.size(); i++)
+    {
+        //
+        // Each job only touches its own result slot, the vector is not
+        // resized until every job has completed.
+        //
+        hr = executor.Submit([&Jobs, &Results, &options, DefaultPattern, i]() -> void
+        {
+            const auto& job = Jobs[i];
+
+            Utils::Log(Log::Success,
+                       L"Executing job %lu (%zu of %zu)",
+                       job.Id,
+                       (i + 1),
+                       Jobs.size());
+
+            std::span<const uint8_t> pattern = DefaultPattern;
+            if (!job.Pattern.empty())
+            {
+                pattern = std::span<const uint8_t>(job.Pattern);
+            }
+
+            auto& result = Results[i];
+
+            //
+            // The exit is recorded apart from the execution status, the 
+            // process may exit before ExecuteProcess returns.
+            //
+            auto jobOptions = options;
+            jobOptions.WaitTimeoutMilliseconds = job.WaitTimeoutMilliseconds;
+            jobOptions.Flush = job.Flush;
+            jobOptions.Backend = job.Backend;
+            if (job.RandomSeed.has_value())
+            {
+                jobOptions.RandomSeed = Utils::DeriveSeed(*job.RandomSeed, 
+                                                          job.Id);
+            }
+            jobOptions.OnExit = [&result](const Herpaderp::ProcessExit& Exit) -> void
+            {
+                result.Execution.Exit = Exit;
+            };
+
+            result.Status = Herpaderp::ExecuteProcess(job.SourceFileName,
+                                                      job.TargetFileName,
+                                                      job.ReplaceWithFileName,
+                                                      pattern,
+                                                      job.Flags,
+                                                      &jobOptions,
+                                                      &result.Execution);
+        });
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to submit job %lu", Jobs[i].Id);
+            Results[i].Status = hr;
+        }
+    }
+
+    executor.WaitForAll();
+    options.Watcher->WaitForAll();
+
+    //
+    // Summarize the results.
+    //
+    size_t failed = 0;
+    for (size_t i = 0; i < Jobs.size(); i++)
+    {
+        FoldProcessExit(Results[i]);
+
+        const auto& execution = Results[i].Execution;
+        if (execution.Exit.has_value())
+        {
+            Utils::Log(Log::Information,
+                       L"Job %lu process %lu exited with code 0x%08x",
+                       Jobs[i].Id,
+                       execution.Exit->ProcessId,
+                       execution.Exit->ExitCode);
+        }
+
+        if (FAILED(Results[i].Status))
+        {
+            failed++;
+            Utils::Log(Log::Error,
+                       Results[i].Status,
+                       L"Job %lu failed, \"%ls\" -> \"%ls\"",
+                       Jobs[i].Id,
+                       Jobs[i].SourceFileName.c_str(),
+                       Jobs[i].TargetFileName.c_str());
+        }
+    }
+
+    Utils::Log((failed == 0 ? Log::Success : Log::Warning),
+               L"Batch complete, %zu succeeded, %zu failed",
+               (Jobs.size() - failed),
+               failed);
+
+    if (failed != 0)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Batch::ExecuteFanOut(
+    std::span<const Job> Jobs,
+    std::span<const uint8_t> DefaultPattern,
+    uint32_t Concurrency,
+    const WorkerScheduling& Scheduling,
+    const Herpaderp::ExecuteOptions& Options,
+    std::vector<JobResult>& Results)
+{
+    Results.assign(Jobs.size(), JobResult{});
+
+    if (Jobs.empty() || (Concurrency == 0))
+    {
+        return E_INVALIDARG;
+    }
+
+    const auto& sourceFileName = Jobs.front().SourceFileName;
+    for (const auto& job : Jobs)
+    {
+        if (_wcsicmp(job.SourceFileName.c_str(), sourceFileName.c_str()) != 0)
+        {
+            for (auto& result : Results)
+            {
+                result.Status = E_INVALIDARG;
+            }
+            return E_INVALIDARG;
+        }
+    }
+
+    //
+    // Read the source into the cache before fanning out, otherwise every
+    // job races to miss it. The image is held so it is not evicted while
+    // the targets are written from it. If it can't be read here each job
+    // fails on its own.
+    //
+    auto options = Options;
+    std::unique_ptr<Herpaderp::ImageCache> sourceCache;
+    std::shared_ptr<const Herpaderp::CachedImage> sourceImage;
+
+    HRESULT hr = S_OK;
+    wil::unique_handle sourceHandle(CreateFileW(sourceFileName.c_str(),
+                                                GENERIC_READ,
+                                                FILE_SHARE_READ |
+                                                    FILE_SHARE_WRITE |
+                                                    FILE_SHARE_DELETE,
+                                                nullptr,
+                                                OPEN_EXISTING,
+                                                FILE_ATTRIBUTE_NORMAL,
+                                                nullptr));
+    if (!sourceHandle.is_valid())
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    uint64_t sourceSize = 0;
+    if (SUCCEEDED(hr))
+    {
+        hr = Utils::GetFileSize(sourceHandle.get(), sourceSize);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        if (options.SourceCache == nullptr)
+        {
+            sourceCache = std::make_unique<Herpaderp::ImageCache>(sourceSize);
+            options.SourceCache = sourceCache.get();
+        }
+        hr = options.SourceCache->Acquire(sourceHandle.get(), sourceImage);
+    }
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Information,
+                   hr,
+                   L"Source image not cached, each target copies from file");
+    }
+    sourceHandle.reset();
+
+    Utils::Log(Log::Information,
+               L"Fanning \"%ls\" out to %zu targets, %lu at once",
+               sourceFileName.c_str(),
+               Jobs.size(),
+               Concurrency);
+
+    RETURN_IF_FAILED_EXPECTED(ExecuteJobs(Jobs,
+                                          DefaultPattern,
+                                          Concurrency,
+                                          Scheduling,
+                                          options,
+                                          Results));
+    return S_OK;
+}
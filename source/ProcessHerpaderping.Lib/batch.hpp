@@ -0,0 +1,261 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/batch.hpp
+// Author:   Johnny Shaw
+// Abstract: Batch Execution of Herpaderping Jobs
+//
+#pragma once
+
+namespace Batch
+{
+    /// <summary>
+    /// Describes a single herpaderping job.
+    /// </summary>
+    struct Job
+    {
+        /// <summary>
+        /// Source binary to execute.
+        /// </summary>
+        std::wstring SourceFileName;
+
+        /// <summary>
+        /// File name to copy source to and obfuscate.
+        /// </summary>
+        std::wstring TargetFileName;
+
+        /// <summary>
+        /// Optional, file to replace the target with.
+        /// </summary>
+        std::optional<std::wstring> ReplaceWithFileName{ std::nullopt };
+
+        /// <summary>
+        /// Optional, pattern used for obfuscation. If empty the default
+        /// pattern supplied to the executor is used.
+        /// </summary>
+        std::vector<uint8_t> Pattern;
+
+        /// <summary>
+        /// Flags controlling behavior of herpaderping (Herpaderp::FlagXxx).
+        /// </summary>
+        uint32_t Flags{ 0 };
+
+        /// <summary>
+        /// With Herpaderp::FlagWaitForProcess, time to let the spawned 
+        /// process run before terminating it. Defaults to no timeout.
+        /// </summary>
+        uint32_t WaitTimeoutMilliseconds{ INFINITE };
+
+        /// <summary>
+        /// With Herpaderp::FlagFlushFile, how the target file is flushed.
+        /// </summary>
+        Herpaderp::FlushPolicy Flush{ Herpaderp::FlushPolicy::PerStep };
+
+        /// <summary>
+        /// How the target file is written.
+        /// </summary>
+        Herpaderp::WriteBackend Backend{ Herpaderp::WriteBackend::Buffered };
+
+        /// <summary>
+        /// Optional, obfuscates the target with a random stream rather than
+        /// with the pattern. The stream of the job is derived from this 
+        /// seed and the job identifier, so every job of a run differs and a
+        /// run is reproduced by the same seed.
+        /// </summary>
+        std::optional<uint64_t> RandomSeed{ std::nullopt };
+
+        /// <summary>
+        /// Identifies the job in log output (e.g. manifest line number).
+        /// </summary>
+        uint32_t Id{ 0 };
+    };
+
+    /// <summary>
+    /// Outcome of a single herpaderping job.
+    /// </summary>
+    struct JobResult
+    {
+        /// <summary>
+        /// Result of the job execution.
+        /// </summary>
+        HRESULT Status{ E_PENDING };
+
+        /// <summary>
+        /// Timings and details of the job execution.
+        /// </summary>
+        Herpaderp::ExecuteResult Execution;
+    };
+
+    /// <summary>
+    /// Folds the exit of the spawned process, once reported, into a job 
+    /// result. The wait phase is taken from the exit and a failed exit fails
+    /// a job that otherwise succeeded.
+    /// </summary>
+    /// <param name="Result">
+    /// Result of the job to fold the exit into.
+    /// </param>
+    void FoldProcessExit(_Inout_ JobResult& Result);
+
+    /// <summary>
+    /// Scheduling of the threads that execute jobs. Pinning the workers and
+    /// lowering their priority keeps them from starving other work on the
+    /// machine, at the cost of throughput.
+    /// </summary>
+    struct WorkerScheduling
+    {
+        /// <summary>
+        /// Optional, workers only run on these processors of a processor 
+        /// group.
+        /// </summary>
+        std::optional<GROUP_AFFINITY> Affinity{ std::nullopt };
+
+        /// <summary>
+        /// Optional, priority of the workers (THREAD_PRIORITY_Xxx).
+        /// </summary>
+        std::optional<int32_t> Priority{ std::nullopt };
+    };
+
+    /// <summary>
+    /// Applies worker scheduling to the calling thread.
+    /// </summary>
+    /// <param name="Scheduling">
+    /// Scheduling to apply.
+    /// </param>
+    /// <returns>
+    /// Success if the scheduling was applied.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ApplyWorkerScheduling(
+        _In_ const WorkerScheduling& Scheduling);
+
+    /// <summary>
+    /// Executes work items concurrently on a private thread pool with a 
+    /// bounded number of threads.
+    /// </summary>
+    class Executor
+    {
+    public:
+        Executor() = default;
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        /// <summary>
+        /// Initializes the executor.
+        /// </summary>
+        /// <param name="Concurrency">
+        /// Maximum number of work items executing at once, must not be zero.
+        /// </param>
+        /// <param name="Scheduling">
+        /// Optional, scheduling of the threads executing work.
+        /// </param>
+        /// <returns>
+        /// Success if the executor is ready to accept work.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize(
+            _In_ uint32_t Concurrency,
+            _In_ const WorkerScheduling& Scheduling = {});
+
+        /// <summary>
+        /// Submits a work item to the executor.
+        /// </summary>
+        /// <param name="Work">
+        /// Work to execute on a thread pool thread.
+        /// </param>
+        /// <returns>
+        /// Success if the work was submitted.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Submit(_In_ std::function<void()> Work);
+
+        /// <summary>
+        /// Waits for all submitted work to complete. More work may be 
+        /// submitted afterwards.
+        /// </summary>
+        void WaitForAll();
+
+    private:
+
+        static void NTAPI WorkCallback(
+            _Inout_ PTP_CALLBACK_INSTANCE Instance,
+            _Inout_opt_ void* Context);
+
+        wil::unique_threadpool_pool m_Pool;
+        wil::unique_threadpool_cleanup_group m_CleanupGroup;
+        TP_CALLBACK_ENVIRON m_Environment{};
+        bool m_EnvironmentInitialized{ false };
+        WorkerScheduling m_Scheduling;
+    };
+
+    /// <summary>
+    /// Executes a set of herpaderping jobs in this process. Every job is
+    /// executed regardless of the failure of another, a summary is logged
+    /// once all jobs have completed.
+    /// </summary>
+    /// <param name="Jobs">
+    /// Jobs to execute.
+    /// </param>
+    /// <param name="DefaultPattern">
+    /// Pattern used for obfuscation by jobs which do not supply their own.
+    /// </param>
+    /// <param name="Concurrency">
+    /// Maximum number of jobs executing at once, must not be zero. Spawned 
+    /// processes are waited for asynchronously and do not count against it.
+    /// </param>
+    /// <param name="Scheduling">
+    /// Scheduling of the threads executing jobs.
+    /// </param>
+    /// <param name="Options">
+    /// Settings shared by every job execution.
+    /// </param>
+    /// <param name="Results">
+    /// Set to the result of each job, in the same order as Jobs.
+    /// </param>
+    /// <returns>
+    /// Success if every job succeeded. Failure otherwise.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ExecuteJobs(
+        _In_ std::span<const Job> Jobs,
+        _In_ std::span<const uint8_t> DefaultPattern,
+        _In_ uint32_t Concurrency,
+        _In_ const WorkerScheduling& Scheduling,
+        _In_ const Herpaderp::ExecuteOptions& Options,
+        _Out_ std::vector<JobResult>& Results);
+
+    /// <summary>
+    /// Executes jobs that share one source against their targets. The source
+    /// is read a single time and every target is written from the same 
+    /// in-memory image, then each target has its section, process and 
+    /// overwrite done in parallel with the others, up to the concurrency.
+    /// </summary>
+    /// <param name="Jobs">
+    /// Jobs to execute, one per target, all with the same source.
+    /// </param>
+    /// <param name="DefaultPattern">
+    /// Pattern used for obfuscation by jobs which do not supply their own.
+    /// </param>
+    /// <param name="Concurrency">
+    /// Maximum number of targets executed at once, must not be zero. The
+    /// number of jobs executes every target at once.
+    /// </param>
+    /// <param name="Scheduling">
+    /// Scheduling of the threads executing jobs.
+    /// </param>
+    /// <param name="Options">
+    /// Settings shared by every job execution. The source is held in the
+    /// source cache if one is set, otherwise in a private one.
+    /// </param>
+    /// <param name="Results">
+    /// Set to the result of each job, in the same order as Jobs.
+    /// </param>
+    /// <returns>
+    /// Success if every job succeeded. E_INVALIDARG if the jobs do not share
+    /// a source. Failure otherwise.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ExecuteFanOut(
+        _In_ std::span<const Job> Jobs,
+        _In_ std::span<const uint8_t> DefaultPattern,
+        _In_ uint32_t Concurrency,
+        _In_ const WorkerScheduling& Scheduling,
+        _In_ const Herpaderp::ExecuteOptions& Options,
+        _Out_ std::vector<JobResult>& Results);
+}
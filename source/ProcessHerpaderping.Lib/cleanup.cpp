@@ -0,0 +1,242 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/cleanup.cpp
+// Author:   Johnny Shaw
+// Abstract: Background Deletion of Target Files
+//
+#include "pch.hpp"
+#include "cleanup.hpp"
+#include "utils.hpp"
+
+static HRESULT DeleteWithPosixSemantics(_In_ const std::wstring& FileName)
+{
+    wil::unique_handle fileHandle(CreateFileW(FileName.c_str(),
+                                              DELETE,
+                                              FILE_SHARE_READ |
+                                                  FILE_SHARE_WRITE |
+                                                  FILE_SHARE_DELETE,
+                                              nullptr,
+                                              OPEN_EXISTING,
+                                              FILE_FLAG_OPEN_REPARSE_POINT,
+                                              nullptr));
+    RETURN_LAST_ERROR_IF_EXPECTED(!fileHandle.is_valid());
+
+    FILE_DISPOSITION_INFO_EX dispositionEx{};
+    dispositionEx.Flags = (FILE_DISPOSITION_FLAG_DELETE |
+                           FILE_DISPOSITION_FLAG_POSIX_SEMANTICS |
+                           FILE_DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE);
+    if (SetFileInformationByHandle(fileHandle.get(),
+                                   FileDispositionInfoEx,
+                                   &dispositionEx,
+                                   sizeof(dispositionEx)))
+    {
+        return S_OK;
+    }
+
+    auto error = GetLastError();
+    if ((error != ERROR_INVALID_PARAMETER) && (error != ERROR_NOT_SUPPORTED))
+    {
+        return HRESULT_FROM_WIN32(error);
+    }
+
+    //
+    // Older systems and file systems without POSIX semantics only delete
+    // the file when the last handle to it closes.
+    //
+    FILE_DISPOSITION_INFO disposition{};
+    disposition.DeleteFile = TRUE;
+    RETURN_IF_WIN32_BOOL_FALSE_EXPECTED(SetFileInformationByHandle(
+                                                        fileHandle.get(),
+                                                        FileDispositionInfo,
+                                                        &disposition,
+                                                        sizeof(disposition)));
+    return S_OK;
+}
+
+static bool IsFileInUse(_In_ HRESULT Status)
+{
+    //
+    // An image section backing a running process fails the delete with
+    // access denied.
+    //
+    return ((Status == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED)) ||
+            (Status == HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION)) ||
+            (Status == HRESULT_FROM_WIN32(ERROR_LOCK_VIOLATION)) ||
+            (Status == HRESULT_FROM_WIN32(ERROR_USER_MAPPED_FILE)));
+}
+
+Herpaderp::TargetCleaner::~TargetCleaner()
+{
+    Stop();
+}
+
+HRESULT Herpaderp::TargetCleaner::Start()
+{
+    auto lock = m_Lock.lock_exclusive();
+    if (m_Running)
+    {
+        return S_OK;
+    }
+
+    m_Stopping = false;
+
+    m_Thread.reset(CreateThread(nullptr, 0, CleanThread, this, 0, nullptr));
+    RETURN_LAST_ERROR_IF(!m_Thread.is_valid());
+
+    m_Running = true;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+void Herpaderp::TargetCleaner::Stop(uint32_t TimeoutMilliseconds)
+{
+    {
+        auto lock = m_Lock.lock_exclusive();
+        if (!m_Running)
+        {
+            return;
+        }
+        m_Stopping = true;
+        m_StopDeadline = ((TimeoutMilliseconds == INFINITE) ?
+                              UINT64_MAX :
+                              (GetTickCount64() + TimeoutMilliseconds));
+    }
+    m_StateChanged.notify_all();
+
+    WaitForSingleObject(m_Thread.get(), INFINITE);
+    m_Thread.reset();
+}
+
+_Use_decl_annotations_
+void Herpaderp::TargetCleaner::Queue(std::wstring FileName)
+{
+    {
+        auto lock = m_Lock.lock_exclusive();
+        if (m_Running)
+        {
+            m_Queued.push_back(std::move(FileName));
+            lock.reset();
+            m_StateChanged.notify_all();
+            return;
+        }
+    }
+
+    //
+    // Nothing is cleaning, delete it here.
+    //
+    Delete(FileName, nullptr);
+}
+
+_Use_decl_annotations_
+DWORD WINAPI Herpaderp::TargetCleaner::CleanThread(void* Context)
+{
+    RCAST(TargetCleaner*)(Context)->Clean();
+    return 0;
+}
+
+void Herpaderp::TargetCleaner::Clean()
+{
+    std::vector<std::wstring> work;
+    std::vector<std::wstring> retry;
+    for (;;)
+    {
+        {
+            auto lock = m_Lock.lock_exclusive();
+            if (m_Queued.empty())
+            {
+                if (!retry.empty())
+                {
+                    //
+                    // Give the processes still using them time to exit,
+                    // newly queued files are taken as they arrive.
+                    //
+                    m_StateChanged.wait_for(lock, RetryIntervalMilliseconds);
+                }
+                else
+                {
+                    while (m_Queued.empty() && !m_Stopping)
+                    {
+                        m_StateChanged.wait(lock);
+                    }
+                }
+            }
+
+            if (m_Stopping &&
+                m_Queued.empty() &&
+                (retry.empty() || (GetTickCount64() >= m_StopDeadline)))
+            {
+                //
+                // Queuers delete synchronously from here on.
+                //
+                m_Running = false;
+                break;
+            }
+
+            work.swap(m_Queued);
+        }
+
+        //
+        // Take the whole queue in one go so deletes run in parallel with
+        // the executions queuing more.
+        //
+        auto retrying = std::move(retry);
+        retry.clear();
+        for (const auto& fileName : retrying)
+        {
+            Delete(fileName, &retry);
+        }
+        for (const auto& fileName : work)
+        {
+            Delete(fileName, &retry);
+        }
+        work.clear();
+    }
+
+    for (const auto& fileName : retry)
+    {
+        m_Failed++;
+        Utils::Log(Log::Warning,
+                   L"Target file \"%ls\" still in use, not deleted",
+                   fileName.c_str());
+    }
+
+    Utils::Log(Log::Information,
+               L"Target cleanup, %llu deleted, %llu not deleted",
+               Deleted(),
+               Failed());
+}
+
+_Use_decl_annotations_
+void Herpaderp::TargetCleaner::Delete(
+    const std::wstring& FileName,
+    std::vector<std::wstring>* Retry)
+{
+    auto hr = DeleteWithPosixSemantics(FileName);
+    if (SUCCEEDED(hr))
+    {
+        m_Deleted++;
+        return;
+    }
+
+    if ((hr == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)) ||
+        (hr == HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND)))
+    {
+        //
+        // Already gone.
+        //
+        return;
+    }
+
+    if ((Retry != nullptr) && IsFileInUse(hr))
+    {
+        Retry->push_back(FileName);
+        return;
+    }
+
+    m_Failed++;
+    Utils::Log(Log::Warning,
+               hr,
+               L"Failed to delete target file \"%ls\"",
+               FileName.c_str());
+}
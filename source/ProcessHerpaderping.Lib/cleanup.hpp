@@ -0,0 +1,113 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/cleanup.hpp
+// Author:   Johnny Shaw
+// Abstract: Background Deletion of Target Files
+//
+#pragma once
+
+//
+// Public header of the library, a cleaner can be shared by every execution
+// in the process through ExecuteOptions.
+//
+#include "herpaderp.hpp"
+#include <wil/resource.h>
+#include <atomic>
+#include <vector>
+
+namespace Herpaderp
+{
+    /// <summary>
+    /// Deletes target files on a background thread with POSIX semantics,
+    /// the name goes away at once and the data when the last handle to it
+    /// closes. Files that can't be deleted yet, because an image section of
+    /// a running process still backs them, are retried until they can. Safe
+    /// for concurrent use.
+    /// </summary>
+    class TargetCleaner
+    {
+    public:
+        /// <summary>
+        /// Time between retries of files that could not be deleted yet.
+        /// </summary>
+        constexpr static uint32_t RetryIntervalMilliseconds = 100;
+
+        /// <summary>
+        /// Time the destructor lets files still in use be retried.
+        /// </summary>
+        constexpr static uint32_t DefaultStopTimeoutMilliseconds = 5000;
+
+        TargetCleaner() = default;
+
+        /// <summary>
+        /// Stops the cleaner, see Stop.
+        /// </summary>
+        ~TargetCleaner();
+
+        TargetCleaner(const TargetCleaner&) = delete;
+        TargetCleaner& operator=(const TargetCleaner&) = delete;
+
+        /// <summary>
+        /// Starts the background thread.
+        /// </summary>
+        /// <returns>
+        /// Success if the background thread is running.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Start();
+
+        /// <summary>
+        /// Deletes every queued file and stops the background thread. Files
+        /// still in use when the timeout expires are left behind.
+        /// </summary>
+        /// <param name="TimeoutMilliseconds">
+        /// Time to keep retrying files still in use, optional.
+        /// </param>
+        void Stop(
+            _In_ uint32_t TimeoutMilliseconds = DefaultStopTimeoutMilliseconds);
+
+        /// <summary>
+        /// Queues a file to be deleted. Before the cleaner is started, or
+        /// after it is stopped, the file is deleted synchronously and only
+        /// once.
+        /// </summary>
+        /// <param name="FileName">
+        /// File to delete.
+        /// </param>
+        void Queue(_In_ std::wstring FileName);
+
+        /// <summary>Gets the number of files deleted.</summary>
+        /// <returns>Number of files deleted.</returns>
+        uint64_t Deleted() const
+        {
+            return m_Deleted.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>Gets the number of files that could not be deleted.</summary>
+        /// <returns>Number of files that could not be deleted.</returns>
+        uint64_t Failed() const
+        {
+            return m_Failed.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        static DWORD WINAPI CleanThread(_In_ void* Context);
+
+        void Clean();
+
+        void Delete(
+            _In_ const std::wstring& FileName,
+            _Inout_opt_ std::vector<std::wstring>* Retry);
+
+        wil::srwlock m_Lock;
+        wil::condition_variable m_StateChanged;
+        wil::unique_handle m_Thread;
+        std::vector<std::wstring> m_Queued;
+        uint64_t m_StopDeadline{ 0 };
+        bool m_Running{ false };
+        bool m_Stopping{ false };
+        std::atomic<uint64_t> m_Deleted{ 0 };
+        std::atomic<uint64_t> m_Failed{ 0 };
+    };
+}
@@ -0,0 +1,551 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/filesink.cpp
+// Author:   Johnny Shaw
+// Abstract: Write Backends for Target Files
+//
+#include "pch.hpp"
+#include "filesink.hpp"
+#include "utils.hpp"
+
+namespace Utils
+{
+    constexpr static uint32_t SinkSlotSize{ 0x100000 }; // 1mib
+    constexpr static uint32_t SinkSlotCount{ 3 };
+    constexpr static uint32_t SinkPageSize{ 0x1000 }; // page
+    constexpr static uint64_t MappedViewSize{ 0x4000000 }; // 64mib
+
+    constexpr static uint64_t AlignUp(
+        _In_ uint64_t Value,
+        _In_ uint64_t Alignment)
+    {
+        return (((Value + Alignment - 1) / Alignment) * Alignment);
+    }
+
+    constexpr static uint64_t AlignDown(
+        _In_ uint64_t Value,
+        _In_ uint64_t Alignment)
+    {
+        return ((Value / Alignment) * Alignment);
+    }
+
+    static HRESULT CopyToView(
+        _Out_writes_bytes_(Length) void* View,
+        _In_reads_bytes_(Length) const void* Buffer,
+        _In_ size_t Length)
+    {
+        //
+        // Storage errors surface as an in page error on the touched page,
+        // not as the result of a call.
+        //
+        __try
+        {
+            std::memcpy(View, Buffer, Length);
+        }
+        __except ((GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ?
+                      EXCEPTION_EXECUTE_HANDLER :
+                      EXCEPTION_CONTINUE_SEARCH)
+        {
+            return HRESULT_FROM_NT(STATUS_IN_PAGE_ERROR);
+        }
+        return S_OK;
+    }
+
+    /// <summary>
+    /// Cached writes through the file handle.
+    /// </summary>
+    class BufferedFileSink final : public IFileSink
+    {
+    public:
+        explicit BufferedFileSink(_In_ handle_t FileHandle) :
+            m_FileHandle(FileHandle)
+        {
+        }
+
+        HRESULT Write(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer) override
+        {
+            RETURN_IF_FAILED(WriteFileAt(m_FileHandle, Offset, Buffer));
+            return S_OK;
+        }
+
+        HRESULT Flush() override
+        {
+            RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_FileHandle));
+            return S_OK;
+        }
+
+        HRESULT Close() override
+        {
+            return S_OK;
+        }
+
+    private:
+
+        const handle_t m_FileHandle;
+    };
+
+    /// <summary>
+    /// Overlapped writes through a second, unbuffered, handle to the file.
+    /// Each write is copied to one of a few aligned slots so the caller can
+    /// reuse its buffer while the write is in flight.
+    /// </summary>
+    class UnbufferedFileSink final : public IFileSink
+    {
+    public:
+        explicit UnbufferedFileSink(_In_ handle_t FileHandle) :
+            m_FileHandle(FileHandle)
+        {
+        }
+
+        ~UnbufferedFileSink() override
+        {
+            //
+            // Never free the slots with writes in flight.
+            //
+            LOG_IF_FAILED(WaitForWrites());
+        }
+
+        HRESULT Initialize()
+        {
+            FILE_STORAGE_INFO storageInfo{};
+            RETURN_IF_WIN32_BOOL_FALSE_EXPECTED(GetFileInformationByHandleEx(
+                                                        m_FileHandle,
+                                                        FileStorageInfo,
+                                                        &storageInfo,
+                                                        sizeof(storageInfo)));
+
+            //
+            // Unbuffered ranges are page aligned, not only sector aligned, so
+            // the buffered head and tail of a write never share a cached page
+            // with it.
+            //
+            auto sectorSize = storageInfo.LogicalBytesPerSector;
+            RETURN_HR_IF_EXPECTED(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED),
+                                  ((sectorSize == 0) ||
+                                   ((sectorSize & (sectorSize - 1)) != 0) ||
+                                   (sectorSize > SinkSlotSize)));
+            m_Alignment = std::max<uint32_t>(sectorSize, SinkPageSize);
+
+            m_Unbuffered.reset(ReOpenFile(m_FileHandle,
+                                          GENERIC_WRITE,
+                                          FILE_SHARE_READ |
+                                              FILE_SHARE_WRITE |
+                                              FILE_SHARE_DELETE,
+                                          FILE_FLAG_NO_BUFFERING |
+                                              FILE_FLAG_OVERLAPPED));
+            RETURN_LAST_ERROR_IF_EXPECTED(!m_Unbuffered.is_valid());
+
+            RETURN_IF_FAILED(GetFileSize(m_FileHandle, m_EndOfFile));
+
+            m_Buffers = RCAST(uint8_t*)(Arena::Current().Allocate(
+                                    (SCAST(size_t)(SinkSlotSize) * SinkSlotCount),
+                                    m_Alignment));
+            RETURN_IF_NULL_ALLOC(m_Buffers);
+
+            for (auto& event : m_Events)
+            {
+                event.reset(CreateEventW(nullptr, TRUE, FALSE, nullptr));
+                RETURN_LAST_ERROR_IF(!event.is_valid());
+            }
+
+            return S_OK;
+        }
+
+        HRESULT Write(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer) override
+        {
+            RETURN_IF_FAILED(m_Status);
+
+            if (Buffer.empty())
+            {
+                return S_OK;
+            }
+
+            //
+            // Only whole aligned blocks inside the end of file are written
+            // unbuffered, an unbuffered write past it would round the file
+            // size up to the sector.
+            //
+            auto end = (Offset + Buffer.size());
+            auto bodyStart = AlignUp(Offset, m_Alignment);
+            auto bodyEnd = AlignDown(std::min<uint64_t>(end, m_EndOfFile),
+                                     m_Alignment);
+            if (bodyStart >= bodyEnd)
+            {
+                RETURN_IF_FAILED(WriteBuffered(Offset, Buffer));
+                return S_OK;
+            }
+
+            if (Offset < bodyStart)
+            {
+                RETURN_IF_FAILED(WriteBuffered(
+                                    Offset,
+                                    Buffer.first(SCAST(size_t)(bodyStart - Offset))));
+            }
+
+            for (auto position = bodyStart; position < bodyEnd; )
+            {
+                auto length = SCAST(size_t)(std::min<uint64_t>(
+                                                    SinkSlotSize,
+                                                    (bodyEnd - position)));
+                RETURN_IF_FAILED(WriteSlot(
+                                    position,
+                                    Buffer.subspan(SCAST(size_t)(position - Offset),
+                                                   length)));
+                position += length;
+            }
+
+            if (bodyEnd < end)
+            {
+                RETURN_IF_FAILED(WriteBuffered(
+                                    bodyEnd,
+                                    Buffer.subspan(SCAST(size_t)(bodyEnd - Offset))));
+            }
+
+            return S_OK;
+        }
+
+        HRESULT Flush() override
+        {
+            RETURN_IF_FAILED(WaitForWrites());
+            RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_FileHandle));
+            return S_OK;
+        }
+
+        HRESULT Close() override
+        {
+            RETURN_IF_FAILED(WaitForWrites());
+            m_Unbuffered.reset();
+            return S_OK;
+        }
+
+    private:
+
+        uint8_t* SlotBuffer(_In_ uint32_t Slot)
+        {
+            return (m_Buffers + (SCAST(size_t)(SinkSlotSize) * Slot));
+        }
+
+        HRESULT WriteBuffered(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer)
+        {
+            //
+            // A cached write reads in the rest of its pages, unbuffered writes
+            // still in flight to those pages must land first.
+            //
+            auto pageStart = AlignDown(Offset, m_Alignment);
+            auto pageEnd = AlignUp((Offset + Buffer.size()), m_Alignment);
+            for (uint32_t i = 0; i < SinkSlotCount; i++)
+            {
+                if (m_Pending[i] &&
+                    (m_SlotOffset[i] < pageEnd) &&
+                    ((m_SlotOffset[i] + m_Expected[i]) > pageStart))
+                {
+                    RETURN_IF_FAILED(WaitForSlot(i));
+                }
+            }
+
+            RETURN_IF_FAILED(WriteFileAt(m_FileHandle, Offset, Buffer));
+            m_EndOfFile = std::max<uint64_t>(m_EndOfFile,
+                                             (Offset + Buffer.size()));
+            return S_OK;
+        }
+
+        HRESULT WriteSlot(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer)
+        {
+            auto slot = m_NextSlot;
+            RETURN_IF_FAILED(WaitForSlot(slot));
+
+            std::memcpy(SlotBuffer(slot), Buffer.data(), Buffer.size());
+
+            ULARGE_INTEGER offset;
+            offset.QuadPart = Offset;
+            m_Overlapped[slot] = {};
+            m_Overlapped[slot].Offset = offset.LowPart;
+            m_Overlapped[slot].OffsetHigh = offset.HighPart;
+            m_Overlapped[slot].hEvent = m_Events[slot].get();
+
+            if (!WriteFile(m_Unbuffered.get(),
+                           SlotBuffer(slot),
+                           SCAST(DWORD)(Buffer.size()),
+                           nullptr,
+                           &m_Overlapped[slot]))
+            {
+                RETURN_LAST_ERROR_IF(GetLastError() != ERROR_IO_PENDING);
+            }
+
+            m_Pending[slot] = true;
+            m_SlotOffset[slot] = Offset;
+            m_Expected[slot] = SCAST(DWORD)(Buffer.size());
+            m_NextSlot = ((slot + 1) % SinkSlotCount);
+            return S_OK;
+        }
+
+        HRESULT WaitForSlot(_In_ uint32_t Slot)
+        {
+            if (!m_Pending[Slot])
+            {
+                return S_OK;
+            }
+            m_Pending[Slot] = false;
+
+            DWORD bytesWritten = 0;
+            if (!GetOverlappedResult(m_Unbuffered.get(),
+                                     &m_Overlapped[Slot],
+                                     &bytesWritten,
+                                     TRUE))
+            {
+                m_Status = HRESULT_FROM_WIN32(GetLastError());
+            }
+            else if (bytesWritten != m_Expected[Slot])
+            {
+                m_Status = HRESULT_FROM_WIN32(ERROR_WRITE_FAULT);
+            }
+
+            RETURN_IF_FAILED(m_Status);
+            return S_OK;
+        }
+
+        HRESULT WaitForWrites()
+        {
+            //
+            // Wait for every slot even after a failure, the first failure is
+            // the one returned.
+            //
+            for (uint32_t i = 0; i < SinkSlotCount; i++)
+            {
+                (void)WaitForSlot(i);
+            }
+            return m_Status;
+        }
+
+        const handle_t m_FileHandle;
+        wil::unique_handle m_Unbuffered;
+        uint8_t* m_Buffers{ nullptr };
+        std::array<OVERLAPPED, SinkSlotCount> m_Overlapped{};
+        std::array<wil::unique_handle, SinkSlotCount> m_Events;
+        std::array<uint64_t, SinkSlotCount> m_SlotOffset{};
+        std::array<DWORD, SinkSlotCount> m_Expected{};
+        std::array<bool, SinkSlotCount> m_Pending{};
+        uint32_t m_NextSlot{ 0 };
+        uint32_t m_Alignment{ SinkPageSize };
+        uint64_t m_EndOfFile{ 0 };
+        HRESULT m_Status{ S_OK };
+    };
+
+    /// <summary>
+    /// Copies into a window of the file mapped into memory. The window
+    /// slides over the file as it is written.
+    /// </summary>
+    class MappedFileSink final : public IFileSink
+    {
+    public:
+        MappedFileSink(
+            _In_ handle_t FileHandle,
+            _In_ uint64_t ExpectedSize) :
+            m_FileHandle(FileHandle),
+            m_ExpectedSize(ExpectedSize)
+        {
+        }
+
+        HRESULT Initialize()
+        {
+            SYSTEM_INFO systemInfo;
+            GetSystemInfo(&systemInfo);
+            m_Granularity = systemInfo.dwAllocationGranularity;
+
+            RETURN_IF_FAILED(GetFileSize(m_FileHandle, m_FileSize));
+            return S_OK;
+        }
+
+        HRESULT Write(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer) override
+        {
+            if (Buffer.empty())
+            {
+                return S_OK;
+            }
+
+            RETURN_IF_FAILED(MapFile(Offset + Buffer.size()));
+
+            size_t written = 0;
+            while (written < Buffer.size())
+            {
+                auto position = (Offset + written);
+                if ((m_View == nullptr) ||
+                    (position < m_ViewOffset) ||
+                    (position >= (m_ViewOffset + m_ViewSize)))
+                {
+                    RETURN_IF_FAILED(MapView(position));
+                }
+
+                auto length = SCAST(size_t)(std::min<uint64_t>(
+                                    (Buffer.size() - written),
+                                    ((m_ViewOffset + m_ViewSize) - position)));
+                RETURN_IF_FAILED(CopyToView(
+                                    Add2Ptr(m_View.get(), (position - m_ViewOffset)),
+                                    &Buffer[written],
+                                    length));
+                written += length;
+            }
+
+            return S_OK;
+        }
+
+        HRESULT Flush() override
+        {
+            //
+            // Views unmapped earlier left their dirty pages with the file,
+            // flushing the file writes those too.
+            //
+            if (m_View != nullptr)
+            {
+                RETURN_IF_WIN32_BOOL_FALSE(FlushViewOfFile(m_View.get(), 0));
+            }
+            RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_FileHandle));
+            return S_OK;
+        }
+
+        HRESULT Close() override
+        {
+            //
+            // A mapped file can't be truncated, release it for the caller.
+            //
+            m_View.reset();
+            m_Mapping.reset();
+            m_MappingSize = 0;
+            return S_OK;
+        }
+
+    private:
+
+        HRESULT MapFile(_In_ uint64_t EndOfWrite)
+        {
+            if (EndOfWrite <= m_MappingSize)
+            {
+                return S_OK;
+            }
+
+            //
+            // Mapping past the end of the file extends it. Map the expected
+            // size at once so sequential writes don't remap as they go.
+            //
+            m_View.reset();
+            m_Mapping.reset();
+            m_MappingSize = 0;
+
+            ULARGE_INTEGER mappingSize;
+            mappingSize.QuadPart = std::max<uint64_t>({ EndOfWrite,
+                                                        m_ExpectedSize,
+                                                        m_FileSize });
+            m_Mapping.reset(CreateFileMappingW(m_FileHandle,
+                                               nullptr,
+                                               PAGE_READWRITE,
+                                               mappingSize.HighPart,
+                                               mappingSize.LowPart,
+                                               nullptr));
+            RETURN_LAST_ERROR_IF_NULL(m_Mapping.get());
+
+            m_MappingSize = mappingSize.QuadPart;
+            m_FileSize = mappingSize.QuadPart;
+            return S_OK;
+        }
+
+        HRESULT MapView(_In_ uint64_t Position)
+        {
+            m_View.reset();
+
+            ULARGE_INTEGER viewOffset;
+            viewOffset.QuadPart = AlignDown(Position, m_Granularity);
+            auto viewSize = std::min<uint64_t>(MappedViewSize,
+                                               (m_MappingSize - viewOffset.QuadPart));
+
+            m_View.reset(MapViewOfFile(m_Mapping.get(),
+                                       FILE_MAP_WRITE,
+                                       viewOffset.HighPart,
+                                       viewOffset.LowPart,
+                                       SCAST(SIZE_T)(viewSize)));
+            RETURN_LAST_ERROR_IF_NULL(m_View.get());
+
+            m_ViewOffset = viewOffset.QuadPart;
+            m_ViewSize = viewSize;
+            return S_OK;
+        }
+
+        const handle_t m_FileHandle;
+        const uint64_t m_ExpectedSize;
+        uint32_t m_Granularity{ 0 };
+        uint64_t m_FileSize{ 0 };
+        uint64_t m_MappingSize{ 0 };
+        wil::unique_handle m_Mapping;
+        wil::unique_mapview_ptr<void> m_View;
+        uint64_t m_ViewOffset{ 0 };
+        uint64_t m_ViewSize{ 0 };
+    };
+}
+
+_Use_decl_annotations_
+HRESULT Utils::CreateFileSink(
+    Herpaderp::WriteBackend Backend,
+    handle_t FileHandle,
+    uint64_t ExpectedSize,
+    ArenaPtr<IFileSink>& Sink)
+{
+    Sink.reset();
+
+    auto& arena = Arena::Current();
+
+    HRESULT hr = S_OK;
+    switch (Backend)
+    {
+        case Herpaderp::WriteBackend::Unbuffered:
+        {
+            auto sink = arena.New<UnbufferedFileSink>(FileHandle);
+            RETURN_IF_NULL_ALLOC(sink);
+            hr = sink->Initialize();
+            if (SUCCEEDED(hr))
+            {
+                Sink = std::move(sink);
+            }
+            break;
+        }
+        case Herpaderp::WriteBackend::Mapped:
+        {
+            auto sink = arena.New<MappedFileSink>(FileHandle, ExpectedSize);
+            RETURN_IF_NULL_ALLOC(sink);
+            hr = sink->Initialize();
+            if (SUCCEEDED(hr))
+            {
+                Sink = std::move(sink);
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    if (Sink == nullptr)
+    {
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Debug,
+                       hr,
+                       L"%ls writes not possible, writing buffered",
+                       Herpaderp::WriteBackendName(Backend));
+        }
+        Sink = arena.New<BufferedFileSink>(FileHandle);
+        RETURN_IF_NULL_ALLOC(Sink);
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,90 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/filesink.hpp
+// Author:   Johnny Shaw
+// Abstract: Write Backends for Target Files
+//
+#pragma once
+
+#include "herpaderp.hpp"
+#include "arena.hpp"
+
+namespace Utils
+{
+    /// <summary>
+    /// Destination of positioned writes to a file, implemented by each
+    /// write backend. The file handle stays owned by the caller and must
+    /// outlive the sink.
+    /// </summary>
+    class IFileSink
+    {
+    public:
+        virtual ~IFileSink() = default;
+
+        /// <summary>
+        /// Writes a buffer to the file at an offset. The write may still be
+        /// in flight when this returns, the buffer may be reused at once.
+        /// </summary>
+        /// <param name="Offset">
+        /// File offset to write at. The file is extended if the write ends
+        /// beyond the end of the file.
+        /// </param>
+        /// <param name="Buffer">
+        /// Buffer to write.
+        /// </param>
+        /// <returns>
+        /// Success if the write was issued. A failure of an earlier write
+        /// still in flight may be returned instead.
+        /// </returns>
+        _Must_inspect_result_ virtual HRESULT Write(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer) = 0;
+
+        /// <summary>
+        /// Completes every write and flushes the file to storage.
+        /// </summary>
+        /// <returns>
+        /// Success if every write completed and the file is flushed.
+        /// </returns>
+        _Must_inspect_result_ virtual HRESULT Flush() = 0;
+
+        /// <summary>
+        /// Completes every write and releases what the backend holds on the
+        /// file, after this the file may be truncated through its handle.
+        /// </summary>
+        /// <returns>
+        /// Success if every write completed.
+        /// </returns>
+        _Must_inspect_result_ virtual HRESULT Close() = 0;
+    };
+
+    /// <summary>
+    /// Creates the sink of a write backend for a file. If the backend can't
+    /// be used for the file, for example it was opened without sharing or is
+    /// on a device without a sector size, a buffered sink is created instead.
+    /// The sink and its buffers are placed in the arena of the calling
+    /// thread, the caller holds an arena scope for as long as the sink.
+    /// </summary>
+    /// <param name="Backend">
+    /// Write backend to create.
+    /// </param>
+    /// <param name="FileHandle">
+    /// File to write, must be opened for synchronous read and write access.
+    /// </param>
+    /// <param name="ExpectedSize">
+    /// Size the file is expected to have once written, mapped sinks map
+    /// this much up front.
+    /// </param>
+    /// <param name="Sink">
+    /// Set to the created sink.
+    /// </param>
+    /// <returns>
+    /// Success if a sink was created.
+    /// </returns>
+    _Must_inspect_result_ HRESULT CreateFileSink(
+        _In_ Herpaderp::WriteBackend Backend,
+        _In_ handle_t FileHandle,
+        _In_ uint64_t ExpectedSize,
+        _Out_ ArenaPtr<IFileSink>& Sink);
+}
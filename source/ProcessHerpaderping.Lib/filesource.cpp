@@ -0,0 +1,216 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/filesource.cpp
+// Author:   Johnny Shaw
+// Abstract: Read Sources for File Copies
+//
+#include "pch.hpp"
+#include "filesource.hpp"
+#include "arena.hpp"
+#include "utils.hpp"
+
+namespace Utils
+{
+    constexpr static uint32_t SourcePageSize{ 0x1000 }; // page
+
+    constexpr static uint64_t AlignUp(
+        _In_ uint64_t Value,
+        _In_ uint64_t Alignment)
+    {
+        return (((Value + Alignment - 1) / Alignment) * Alignment);
+    }
+}
+
+_Use_decl_annotations_
+Utils::HandleFileSource::HandleFileSource(handle_t FileHandle) :
+    m_FileHandle(FileHandle)
+{
+}
+
+Utils::HandleFileSource::~HandleFileSource()
+{
+    //
+    // Never leave the buffers with reads in flight.
+    //
+    CancelReads();
+}
+
+HRESULT Utils::HandleFileSource::Initialize()
+{
+    RETURN_IF_FAILED(GetFileSize(m_FileHandle, m_Size));
+    if (m_Size == 0)
+    {
+        return S_OK;
+    }
+
+    //
+    // Size the pipeline to the file, small files should not pay for buffers
+    // they will never fill.
+    //
+    m_BufferSize = SCAST(uint32_t)(std::min<uint64_t>(
+                                        BlockSize,
+                                        AlignUp(m_Size, SourcePageSize)));
+    m_BufferCount = SCAST(uint32_t)(std::min<uint64_t>(
+                                        BlockCount,
+                                        AlignUp(m_Size, m_BufferSize) / m_BufferSize));
+
+    m_Buffers = RCAST(uint8_t*)(Arena::Current().Allocate(
+                                    (SCAST(size_t)(m_BufferSize) * m_BufferCount),
+                                    SourcePageSize));
+    RETURN_IF_NULL_ALLOC(m_Buffers);
+
+    m_Overlapped.reset(ReOpenFile(m_FileHandle,
+                                  GENERIC_READ,
+                                  FILE_SHARE_READ |
+                                      FILE_SHARE_WRITE |
+                                      FILE_SHARE_DELETE,
+                                  FILE_FLAG_OVERLAPPED |
+                                      FILE_FLAG_SEQUENTIAL_SCAN));
+    if (!m_Overlapped.is_valid())
+    {
+        RETURN_IF_FAILED(SetFilePointer(m_FileHandle, 0, FILE_BEGIN));
+        return S_OK;
+    }
+
+    for (uint32_t i = 0; i < m_BufferCount; i++)
+    {
+        m_Events[i].reset(CreateEventW(nullptr, TRUE, FALSE, nullptr));
+        RETURN_LAST_ERROR_IF(!m_Events[i].is_valid());
+    }
+
+    //
+    // Prime the pipeline.
+    //
+    for (uint32_t i = 0; (i < m_BufferCount) && (m_Issued < m_Size); i++)
+    {
+        RETURN_IF_FAILED(IssueRead(i));
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::HandleFileSource::Read(std::span<const uint8_t>& Block)
+{
+    Block = {};
+
+    if (!m_Overlapped.is_valid())
+    {
+        if (m_Delivered >= m_Size)
+        {
+            return S_OK;
+        }
+
+        auto length = SCAST(DWORD)(std::min<uint64_t>(m_BufferSize,
+                                                      (m_Size - m_Delivered)));
+        DWORD bytesRead = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(ReadFile(m_FileHandle,
+                                            SlotBuffer(0),
+                                            length,
+                                            &bytesRead,
+                                            nullptr));
+        if (bytesRead == 0)
+        {
+            //
+            // The file was truncated under us.
+            //
+            RETURN_LAST_ERROR_SET(ERROR_HANDLE_EOF);
+        }
+
+        Block = { SlotBuffer(0), bytesRead };
+        m_Delivered += bytesRead;
+        return S_OK;
+    }
+
+    //
+    // The block lent last is done with, read the next one into its buffer.
+    //
+    if (m_Lent.has_value())
+    {
+        auto slot = *m_Lent;
+        m_Lent.reset();
+        if (m_Issued < m_Size)
+        {
+            RETURN_IF_FAILED(IssueRead(slot));
+        }
+    }
+
+    if (m_Delivered >= m_Size)
+    {
+        return S_OK;
+    }
+
+    auto slot = m_NextSlot;
+    DWORD bytesRead = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(GetOverlappedResult(m_Overlapped.get(),
+                                                   &m_Requests[slot],
+                                                   &bytesRead,
+                                                   TRUE));
+    m_Pending[slot] = false;
+
+    if (bytesRead != m_Expected[slot])
+    {
+        //
+        // The file was truncated under us.
+        //
+        RETURN_LAST_ERROR_SET(ERROR_HANDLE_EOF);
+    }
+
+    Block = { SlotBuffer(slot), bytesRead };
+    m_Delivered += bytesRead;
+    m_Lent = slot;
+    m_NextSlot = ((slot + 1) % m_BufferCount);
+    return S_OK;
+}
+
+_Use_decl_annotations_
+uint8_t* Utils::HandleFileSource::SlotBuffer(uint32_t Slot) const
+{
+    return (m_Buffers + (SCAST(size_t)(m_BufferSize) * Slot));
+}
+
+_Use_decl_annotations_
+HRESULT Utils::HandleFileSource::IssueRead(uint32_t Slot)
+{
+    auto length = SCAST(DWORD)(std::min<uint64_t>(m_BufferSize,
+                                                  (m_Size - m_Issued)));
+
+    ULARGE_INTEGER offset;
+    offset.QuadPart = m_Issued;
+    m_Requests[Slot] = {};
+    m_Requests[Slot].Offset = offset.LowPart;
+    m_Requests[Slot].OffsetHigh = offset.HighPart;
+    m_Requests[Slot].hEvent = m_Events[Slot].get();
+
+    if (!ReadFile(m_Overlapped.get(),
+                  SlotBuffer(Slot),
+                  length,
+                  nullptr,
+                  &m_Requests[Slot]))
+    {
+        RETURN_LAST_ERROR_IF(GetLastError() != ERROR_IO_PENDING);
+    }
+
+    m_Pending[Slot] = true;
+    m_Expected[Slot] = length;
+    m_Issued += length;
+    return S_OK;
+}
+
+void Utils::HandleFileSource::CancelReads()
+{
+    for (uint32_t i = 0; i < m_BufferCount; i++)
+    {
+        if (m_Pending[i])
+        {
+            DWORD transferred;
+            CancelIoEx(m_Overlapped.get(), &m_Requests[i]);
+            GetOverlappedResult(m_Overlapped.get(),
+                                &m_Requests[i],
+                                &transferred,
+                                TRUE);
+            m_Pending[i] = false;
+        }
+    }
+}
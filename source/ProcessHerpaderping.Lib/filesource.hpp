@@ -0,0 +1,120 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/filesource.hpp
+// Author:   Johnny Shaw
+// Abstract: Read Sources for File Copies
+//
+#pragma once
+
+namespace Utils
+{
+    /// <summary>
+    /// Origin of the bytes of a copy, read in order from the start. Blocks
+    /// are lent by the source rather than read into a caller buffer, so a
+    /// source that already holds the bytes hands them out without copying.
+    /// </summary>
+    class IFileSource
+    {
+    public:
+        virtual ~IFileSource() = default;
+
+        /// <summary>
+        /// Gets the number of bytes the source holds.
+        /// </summary>
+        /// <returns>
+        /// Number of bytes the source holds.
+        /// </returns>
+        virtual uint64_t Size() const = 0;
+
+        /// <summary>
+        /// Reads the next block of the source.
+        /// </summary>
+        /// <param name="Block">
+        /// Set to the next block, empty once every byte was read. The block
+        /// stays valid until the next read.
+        /// </param>
+        /// <returns>
+        /// Success if the block was read. ERROR_HANDLE_EOF if the source
+        /// ended before its size.
+        /// </returns>
+        _Must_inspect_result_ virtual HRESULT Read(
+            _Out_ std::span<const uint8_t>& Block) = 0;
+    };
+
+    /// <summary>
+    /// Reads a file through its handle. The next blocks are read in through
+    /// a second, overlapped, handle while the current one is used. If one
+    /// can't be opened the file is read synchronously. The buffers are
+    /// placed in the arena of the calling thread, the caller holds an arena
+    /// scope for as long as the source.
+    /// </summary>
+    class HandleFileSource final : public IFileSource
+    {
+    public:
+        /// <summary>
+        /// Longest block read at once.
+        /// </summary>
+        constexpr static uint32_t BlockSize = 0x100000; // 1mib
+
+        /// <summary>
+        /// Number of blocks kept in flight.
+        /// </summary>
+        constexpr static uint32_t BlockCount = 3;
+
+        /// <summary>
+        /// Creates a source over a file, nothing is read until initialized.
+        /// </summary>
+        /// <param name="FileHandle">
+        /// File to read, must be opened for synchronous read access. The
+        /// handle stays owned by the caller and must outlive the source.
+        /// </param>
+        explicit HandleFileSource(_In_ handle_t FileHandle);
+
+        /// <summary>
+        /// Cancels reads still in flight.
+        /// </summary>
+        ~HandleFileSource() override;
+
+        HandleFileSource(const HandleFileSource&) = delete;
+        HandleFileSource& operator=(const HandleFileSource&) = delete;
+
+        /// <summary>
+        /// Sizes the buffers to the file and starts reading it.
+        /// </summary>
+        /// <returns>
+        /// Success if the source is ready to read.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize();
+
+        uint64_t Size() const override
+        {
+            return m_Size;
+        }
+
+        HRESULT Read(_Out_ std::span<const uint8_t>& Block) override;
+
+    private:
+
+        uint8_t* SlotBuffer(_In_ uint32_t Slot) const;
+
+        _Must_inspect_result_ HRESULT IssueRead(_In_ uint32_t Slot);
+
+        void CancelReads();
+
+        const handle_t m_FileHandle;
+        wil::unique_handle m_Overlapped;
+        uint8_t* m_Buffers{ nullptr };
+        uint32_t m_BufferSize{ 0 };
+        uint32_t m_BufferCount{ 0 };
+        std::array<OVERLAPPED, BlockCount> m_Requests{};
+        std::array<wil::unique_handle, BlockCount> m_Events;
+        std::array<DWORD, BlockCount> m_Expected{};
+        std::array<bool, BlockCount> m_Pending{};
+        std::optional<uint32_t> m_Lent;
+        uint32_t m_NextSlot{ 0 };
+        uint64_t m_Size{ 0 };
+        uint64_t m_Issued{ 0 };
+        uint64_t m_Delivered{ 0 };
+    };
+}
@@ -0,0 +1,224 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/hashing.cpp
+// Author:   Johnny Shaw
+// Abstract: Content Hashing of Files Being Written
+//
+#include "pch.hpp"
+#include "hashing.hpp"
+#include "utils.hpp"
+
+namespace Utils
+{
+    constexpr static uint32_t HashReadSize{ 0x100000 }; // 1mib
+}
+
+HRESULT Utils::Sha256::Initialize()
+{
+    m_Hash.reset();
+
+    //
+    // The size of the hash object doesn't change, query it once. If it
+    // can't be queried or doesn't fit BCrypt allocates the object instead.
+    //
+    static const ULONG objectLength = []() -> ULONG
+    {
+        ULONG length = 0;
+        ULONG resultLength;
+        if (!NT_SUCCESS(BCryptGetProperty(BCRYPT_SHA256_ALG_HANDLE,
+                                          BCRYPT_OBJECT_LENGTH,
+                                          RCAST(PUCHAR)(&length),
+                                          sizeof(length),
+                                          &resultLength,
+                                          0)))
+        {
+            return 0;
+        }
+        return length;
+    }();
+    auto inPlace = ((objectLength != 0) && (objectLength <= m_Object.size()));
+
+    //
+    // The algorithm pseudo handle needs no provider to be opened.
+    //
+    RETURN_IF_NTSTATUS_FAILED(BCryptCreateHash(BCRYPT_SHA256_ALG_HANDLE,
+                                               &m_Hash,
+                                               (inPlace ? m_Object.data() : nullptr),
+                                               (inPlace ? objectLength : 0),
+                                               nullptr,
+                                               0,
+                                               0));
+    return S_OK;
+}
+
+_Use_decl_annotations_
+void Utils::Sha256::Update(std::span<const uint8_t> Buffer)
+{
+    while (m_Hash && !Buffer.empty())
+    {
+        auto length = SCAST(ULONG)(std::min<size_t>(Buffer.size(), MAXULONG));
+        auto status = BCryptHashData(m_Hash.get(),
+                                     const_cast<PUCHAR>(Buffer.data()),
+                                     length,
+                                     0);
+        if (!NT_SUCCESS(status))
+        {
+            Utils::Log(Log::Debug, HRESULT_FROM_NT(status), L"Hash discarded");
+            Discard();
+            break;
+        }
+        Buffer = Buffer.subspan(length);
+    }
+}
+
+void Utils::Sha256::Discard()
+{
+    m_Hash.reset();
+}
+
+_Use_decl_annotations_
+void Utils::Sha256::Finish(std::optional<Herpaderp::Sha256Digest>& Digest)
+{
+    Digest = std::nullopt;
+    if (!m_Hash)
+    {
+        return;
+    }
+
+    Herpaderp::Sha256Digest digest;
+    auto status = BCryptFinishHash(m_Hash.get(),
+                                   digest.data(),
+                                   SCAST(ULONG)(digest.size()),
+                                   0);
+    m_Hash.reset();
+    if (NT_SUCCESS(status))
+    {
+        Digest = digest;
+    }
+}
+
+_Use_decl_annotations_
+Utils::HashingFileSink::HashingFileSink(
+    ArenaPtr<IFileSink> Inner,
+    Sha256& Hash) :
+    m_Inner(std::move(Inner)),
+    m_Hash(Hash)
+{
+}
+
+_Use_decl_annotations_
+void Utils::HashingFileSink::Overlay(
+    uint64_t Offset,
+    std::span<const uint8_t> Bytes)
+{
+    m_OverlayOffset = Offset;
+    m_Overlay.assign(Bytes.begin(), Bytes.end());
+}
+
+_Use_decl_annotations_
+HRESULT Utils::HashingFileSink::Write(
+    uint64_t Offset,
+    std::span<const uint8_t> Buffer)
+{
+    //
+    // Hash before handing the buffer on, it is still in the cache.
+    //
+    Hash(Offset, Buffer);
+    RETURN_IF_FAILED(m_Inner->Write(Offset, Buffer));
+    return S_OK;
+}
+
+HRESULT Utils::HashingFileSink::Flush()
+{
+    RETURN_IF_FAILED(m_Inner->Flush());
+    return S_OK;
+}
+
+HRESULT Utils::HashingFileSink::Close()
+{
+    RETURN_IF_FAILED(m_Inner->Close());
+    return S_OK;
+}
+
+_Use_decl_annotations_
+void Utils::HashingFileSink::Hash(
+    uint64_t Offset,
+    std::span<const uint8_t> Buffer)
+{
+    if (m_Hashed == MAXUINT64)
+    {
+        return;
+    }
+
+    auto overlayEnd = (m_OverlayOffset + m_Overlay.size());
+    if (!m_Overlay.empty() &&
+        (Offset == m_OverlayOffset) &&
+        (Buffer.size() == m_Overlay.size()) &&
+        (overlayEnd <= m_Hashed))
+    {
+        //
+        // The announced overlay, already hashed in its place.
+        //
+        return;
+    }
+
+    if (Offset != m_Hashed)
+    {
+        Utils::Log(Log::Debug,
+                   L"Write at %llu is out of order, hash discarded",
+                   Offset);
+        m_Hash.Discard();
+        m_Hashed = MAXUINT64;
+        return;
+    }
+    m_Hashed += Buffer.size();
+
+    if (m_Overlay.empty() ||
+        (overlayEnd <= Offset) ||
+        (m_OverlayOffset >= m_Hashed))
+    {
+        m_Hash.Update(Buffer);
+        return;
+    }
+
+    //
+    // The buffer covers some of the overlay, hash the overlay bytes for
+    // that part rather than the bytes written.
+    //
+    auto begin = std::max<uint64_t>(m_OverlayOffset, Offset);
+    auto end = std::min<uint64_t>(overlayEnd, m_Hashed);
+
+    auto overlay = std::span<const uint8_t>(m_Overlay);
+    m_Hash.Update(Buffer.first(SCAST(size_t)(begin - Offset)));
+    m_Hash.Update(overlay.subspan(SCAST(size_t)(begin - m_OverlayOffset),
+                                  SCAST(size_t)(end - begin)));
+    m_Hash.Update(Buffer.subspan(SCAST(size_t)(end - Offset)));
+}
+
+_Use_decl_annotations_
+HRESULT Utils::HashFileContents(
+    handle_t FileHandle,
+    Sha256& Hash)
+{
+    ArenaScope scratch;
+    auto memory = RCAST(uint8_t*)(scratch.Get().Allocate(HashReadSize));
+    RETURN_IF_NULL_ALLOC(memory);
+    auto buffer = std::span<uint8_t>(memory, HashReadSize);
+
+    uint64_t offset = 0;
+    for (;;)
+    {
+        size_t bytesRead;
+        RETURN_IF_FAILED(ReadFileAt(FileHandle, offset, buffer, bytesRead));
+        if (bytesRead == 0)
+        {
+            break;
+        }
+
+        Hash.Update(buffer.first(bytesRead));
+        offset += bytesRead;
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,134 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/hashing.hpp
+// Author:   Johnny Shaw
+// Abstract: Content Hashing of Files Being Written
+//
+#pragma once
+
+#include "filesink.hpp"
+
+namespace Utils
+{
+    /// <summary>
+    /// Incremental SHA-256 of a byte stream. A hash that can no longer
+    /// describe the stream, because an update failed or bytes were missed,
+    /// is discarded and finishes without a digest.
+    /// </summary>
+    class Sha256
+    {
+    public:
+        Sha256() = default;
+
+        Sha256(const Sha256&) = delete;
+        Sha256& operator=(const Sha256&) = delete;
+
+        /// <summary>
+        /// Starts the hash.
+        /// </summary>
+        /// <returns>
+        /// Success if the hash is ready for updates.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize();
+
+        /// <summary>
+        /// Hashes the next bytes of the stream. A failure discards the hash.
+        /// </summary>
+        /// <param name="Buffer">
+        /// Bytes to hash.
+        /// </param>
+        void Update(_In_ std::span<const uint8_t> Buffer);
+
+        /// <summary>
+        /// Discards the hash, it finishes without a digest.
+        /// </summary>
+        void Discard();
+
+        /// <summary>
+        /// Finishes the hash, no more updates may be made.
+        /// </summary>
+        /// <param name="Digest">
+        /// Set to the digest of the stream, or to nothing if the hash was
+        /// discarded.
+        /// </param>
+        void Finish(_Out_ std::optional<Herpaderp::Sha256Digest>& Digest);
+
+    private:
+
+        //
+        // Room for the SHA-256 hash object, so BCrypt doesn't allocate one
+        // from the heap for every hash.
+        //
+        constexpr static uint32_t HashObjectSize = 0x400;
+
+        alignas(16) std::array<uint8_t, HashObjectSize> m_Object{};
+        wil::unique_bcrypt_hash m_Hash;
+    };
+
+    /// <summary>
+    /// Hashes writes on their way to another sink. Writes must arrive in file
+    /// order starting at offset zero, anything else discards the hash unless
+    /// it was announced as an overlay. Placed in an arena like the sink it
+    /// wraps.
+    /// </summary>
+    class HashingFileSink final : public IFileSink
+    {
+    public:
+        HashingFileSink(
+            _In_ ArenaPtr<IFileSink> Inner,
+            _Inout_ Sha256& Hash);
+
+        /// <summary>
+        /// Announces bytes that will be written over a range after it has
+        /// been written, they are hashed in place of what is written first.
+        /// The later write of exactly these bytes is not hashed again.
+        /// </summary>
+        /// <param name="Offset">
+        /// File offset of the overlay.
+        /// </param>
+        /// <param name="Bytes">
+        /// Overlay bytes, copied.
+        /// </param>
+        void Overlay(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Bytes);
+
+        HRESULT Write(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer) override;
+
+        HRESULT Flush() override;
+
+        HRESULT Close() override;
+
+    private:
+
+        void Hash(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer);
+
+        ArenaPtr<IFileSink> m_Inner;
+        Sha256& m_Hash;
+        uint64_t m_Hashed{ 0 };
+        uint64_t m_OverlayOffset{ 0 };
+        std::pmr::vector<uint8_t> m_Overlay{ &Arena::Current() };
+    };
+
+    /// <summary>
+    /// Hashes the contents of a file by reading it, for when the contents
+    /// were never in a buffer.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// File to hash, must be opened for synchronous read access.
+    /// </param>
+    /// <param name="Hash">
+    /// Hash to update with the contents.
+    /// </param>
+    /// <returns>
+    /// Success if the whole file was hashed.
+    /// </returns>
+    _Must_inspect_result_ HRESULT HashFileContents(
+        _In_ handle_t FileHandle,
+        _Inout_ Sha256& Hash);
+}
@@ -0,0 +1,1463 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+// 
+// File:     source/ProcessHerpaderping.Lib/herpaderp.cpp
+// Author:   Johnny Shaw
+// Abstract: Herpaderping Functionality
+//
+#include "pch.hpp"
+#include "herpaderp.hpp"
+#include "utils.hpp"
+#include "imagecache.hpp"
+#include "procparams.hpp"
+#include "processwatcher.hpp"
+#include "jobcontainer.hpp"
+#include "scratch.hpp"
+#include "cleanup.hpp"
+#include "trace.hpp"
+#include "hashing.hpp"
+#include "arena.hpp"
+
+_Use_decl_annotations_
+const wchar_t* Herpaderp::CopyStrategyName(CopyStrategy Strategy)
+{
+    switch (Strategy)
+    {
+        case CopyStrategy::BlockClone:
+        {
+            return L"block clone";
+        }
+        case CopyStrategy::Offload:
+        {
+            return L"offloaded transfer";
+        }
+        case CopyStrategy::Buffered:
+        {
+            return L"buffered copy";
+        }
+        case CopyStrategy::CachedImage:
+        {
+            return L"cached image";
+        }
+        default:
+        {
+            return L"none";
+        }
+    }
+}
+
+_Use_decl_annotations_
+const wchar_t* Herpaderp::FlushPolicyName(FlushPolicy Policy)
+{
+    switch (Policy)
+    {
+        case FlushPolicy::PerStep:
+        {
+            return L"per step";
+        }
+        case FlushPolicy::Coalesced:
+        {
+            return L"coalesced";
+        }
+        case FlushPolicy::WriteThrough:
+        {
+            return L"write through";
+        }
+        default:
+        {
+            return L"none";
+        }
+    }
+}
+
+_Use_decl_annotations_
+const wchar_t* Herpaderp::WriteBackendName(WriteBackend Backend)
+{
+    switch (Backend)
+    {
+        case WriteBackend::Unbuffered:
+        {
+            return L"unbuffered";
+        }
+        case WriteBackend::Mapped:
+        {
+            return L"mapped";
+        }
+        default:
+        {
+            return L"buffered";
+        }
+    }
+}
+
+_Use_decl_annotations_
+void Herpaderp::FormatDigest(
+    const Sha256Digest& Digest,
+    std::wstring& Text)
+{
+    constexpr static std::wstring_view digits{ L"0123456789abcdef" };
+
+    Text.clear();
+    Text.reserve(Digest.size() * 2);
+    for (auto b : Digest)
+    {
+        Text += digits[b >> 4];
+        Text += digits[b & 0xf];
+    }
+}
+
+_Use_decl_annotations_
+const wchar_t* Herpaderp::PhaseName(Phase Value)
+{
+    switch (Value)
+    {
+        case Phase::Open:
+        {
+            return L"open";
+        }
+        case Phase::Copy:
+        {
+            return L"copy";
+        }
+        case Phase::CreateSection:
+        {
+            return L"create section";
+        }
+        case Phase::CreateProcess:
+        {
+            return L"create process";
+        }
+        case Phase::EntryPoint:
+        {
+            return L"entry point";
+        }
+        case Phase::Modify:
+        {
+            return L"modify";
+        }
+        case Phase::Flush:
+        {
+            return L"flush";
+        }
+        case Phase::WriteParameters:
+        {
+            return L"write parameters";
+        }
+        case Phase::CreateThread:
+        {
+            return L"create thread";
+        }
+        case Phase::Wait:
+        {
+            return L"wait";
+        }
+        default:
+        {
+            return L"unknown";
+        }
+    }
+}
+
+_Use_decl_annotations_
+const wchar_t* Herpaderp::MilestoneName(Milestone Value)
+{
+    switch (Value)
+    {
+        case Milestone::TargetOpened:
+        {
+            return L"target opened";
+        }
+        case Milestone::ImageMapped:
+        {
+            return L"image mapped";
+        }
+        case Milestone::TargetModified:
+        {
+            return L"target modified";
+        }
+        case Milestone::ThreadInserted:
+        {
+            return L"thread inserted";
+        }
+        default:
+        {
+            return L"unknown";
+        }
+    }
+}
+
+_Use_decl_annotations_
+double Herpaderp::ExecuteResult::PhaseMilliseconds(Phase Value) const
+{
+    if (Frequency == 0)
+    {
+        return 0.0;
+    }
+
+    return ((SCAST(double)(PhaseTicks[SCAST(size_t)(Value)]) * 1000.0) /
+            SCAST(double)(Frequency));
+}
+
+_Use_decl_annotations_
+std::optional<double> Herpaderp::ExecuteResult::MilestoneGapMilliseconds(
+    Milestone From,
+    Milestone To) const
+{
+    auto from = MilestoneTicks[SCAST(size_t)(From)];
+    auto to = MilestoneTicks[SCAST(size_t)(To)];
+    if ((Frequency == 0) || (from == 0) || (to == 0))
+    {
+        return std::nullopt;
+    }
+
+    return ((SCAST(double)(to - from) * 1000.0) / SCAST(double)(Frequency));
+}
+
+static uint64_t FileTimeValue(_In_ const FILETIME& Time)
+{
+    ULARGE_INTEGER value;
+    value.LowPart = Time.dwLowDateTime;
+    value.HighPart = Time.dwHighDateTime;
+    return value.QuadPart;
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::QueryProcessUsage(
+    handle_t ProcessHandle,
+    ResourceUsage& Usage)
+{
+    Usage = {};
+
+    ULONG64 cycleTime;
+    RETURN_IF_WIN32_BOOL_FALSE(QueryProcessCycleTime(ProcessHandle, &cycleTime));
+    Usage.CycleTime = cycleTime;
+
+    FILETIME creationTime;
+    FILETIME exitTime;
+    FILETIME kernelTime;
+    FILETIME userTime;
+    RETURN_IF_WIN32_BOOL_FALSE(GetProcessTimes(ProcessHandle,
+                                               &creationTime,
+                                               &exitTime,
+                                               &kernelTime,
+                                               &userTime));
+    Usage.KernelTime = FileTimeValue(kernelTime);
+    Usage.UserTime = FileTimeValue(userTime);
+
+    IO_COUNTERS ioCounters;
+    RETURN_IF_WIN32_BOOL_FALSE(GetProcessIoCounters(ProcessHandle, &ioCounters));
+    Usage.ReadOperations = ioCounters.ReadOperationCount;
+    Usage.WriteOperations = ioCounters.WriteOperationCount;
+    Usage.OtherOperations = ioCounters.OtherOperationCount;
+    Usage.ReadBytes = ioCounters.ReadTransferCount;
+    Usage.WriteBytes = ioCounters.WriteTransferCount;
+    Usage.OtherBytes = ioCounters.OtherTransferCount;
+
+    PROCESS_MEMORY_COUNTERS memoryCounters;
+    RETURN_IF_WIN32_BOOL_FALSE(GetProcessMemoryInfo(ProcessHandle,
+                                                    &memoryCounters,
+                                                    sizeof(memoryCounters)));
+    Usage.PeakWorkingSet = memoryCounters.PeakWorkingSetSize;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Queries the processor time used so far by the calling thread.
+/// </summary>
+/// <param name="Usage">
+/// Receives the processor cycles and times, the bytes are left as is.
+/// </param>
+/// <returns>
+/// Success if the usage was queried.
+/// </returns>
+static HRESULT QueryThreadUsage(_Inout_ Herpaderp::ExecutionUsage& Usage)
+{
+    ULONG64 cycleTime;
+    RETURN_IF_WIN32_BOOL_FALSE(QueryThreadCycleTime(GetCurrentThread(), &cycleTime));
+
+    FILETIME creationTime;
+    FILETIME exitTime;
+    FILETIME kernelTime;
+    FILETIME userTime;
+    RETURN_IF_WIN32_BOOL_FALSE(GetThreadTimes(GetCurrentThread(),
+                                              &creationTime,
+                                              &exitTime,
+                                              &kernelTime,
+                                              &userTime));
+
+    Usage.CycleTime = cycleTime;
+    Usage.KernelTime = FileTimeValue(kernelTime);
+    Usage.UserTime = FileTimeValue(userTime);
+    return S_OK;
+}
+
+static int64_t QueryTicks()
+{
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+/// <summary>
+/// Accumulates the time spent in a phase into an execution result. The 
+/// timer starts on construction and stops on destruction, it may be stopped
+/// and started again to exclude nested work.
+/// </summary>
+class PhaseTimer
+{
+public:
+    PhaseTimer(
+        _Inout_ Herpaderp::ExecuteResult& Result,
+        _In_ Herpaderp::Phase Phase) :
+        m_Result(Result),
+        m_Phase(Phase)
+    {
+        Start();
+    }
+
+    ~PhaseTimer()
+    {
+        Stop();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+    void Start()
+    {
+        if (m_Start == 0)
+        {
+            Trace::PhaseStart(Herpaderp::PhaseName(m_Phase), 
+                              m_Result.ProcessId);
+            m_Start = QueryTicks();
+        }
+    }
+
+    void Stop()
+    {
+        if (m_Start != 0)
+        {
+            auto elapsed = (QueryTicks() - m_Start);
+            m_Result.PhaseTicks[SCAST(size_t)(m_Phase)] += elapsed;
+            m_Start = 0;
+
+            Trace::PhaseStop(Herpaderp::PhaseName(m_Phase),
+                             m_Result.ProcessId,
+                             SCAST(uint64_t)((elapsed * 1000000) /
+                                             m_Result.Frequency));
+        }
+    }
+
+private:
+    Herpaderp::ExecuteResult& m_Result;
+    Herpaderp::Phase m_Phase;
+    int64_t m_Start{ 0 };
+};
+
+static void MarkMilestone(
+    _Inout_ Herpaderp::ExecuteResult& Result,
+    _In_ Herpaderp::Milestone Milestone)
+{
+    Result.MilestoneTicks[SCAST(size_t)(Milestone)] = QueryTicks();
+    Trace::Milestone(Herpaderp::MilestoneName(Milestone), Result.ProcessId);
+}
+
+/// <summary>
+/// What later bootstrap steps need to know about the spawned process, 
+/// gathered with as few calls against it as possible. Every call made 
+/// against the process during bootstrap is counted in the execution result.
+/// </summary>
+class BootstrapContext
+{
+public:
+    BootstrapContext(
+        _In_ handle_t ProcessHandle,
+        _Inout_ Herpaderp::RemoteCounters& Counters) :
+        m_ProcessHandle(ProcessHandle),
+        m_Counters(Counters)
+    {
+    }
+
+    BootstrapContext(const BootstrapContext&) = delete;
+    BootstrapContext& operator=(const BootstrapContext&) = delete;
+
+    /// <summary>
+    /// Queries the basic information of the process once and reads only the
+    /// image base address from its PEB.
+    /// </summary>
+    /// <returns>
+    /// Success if the process information is gathered.
+    /// </returns>
+    _Must_inspect_result_ HRESULT Query()
+    {
+        PROCESS_BASIC_INFORMATION pbi{};
+        m_Counters.Syscalls++;
+        auto status = NtQueryInformationProcess(m_ProcessHandle,
+                                                ProcessBasicInformation,
+                                                &pbi,
+                                                sizeof(pbi),
+                                                nullptr);
+        if (!NT_SUCCESS(status))
+        {
+            RETURN_NTSTATUS(Utils::Log(Log::Error, 
+                                       status, 
+                                       L"Failed to query new process info"));
+        }
+
+        m_PebBaseAddress = pbi.PebBaseAddress;
+        m_ProcessId = SCAST(uint32_t)(RCAST(uintptr_t)(pbi.UniqueProcessId));
+
+        m_Counters.Syscalls++;
+        if (!ReadProcessMemory(m_ProcessHandle,
+                               Add2Ptr(m_PebBaseAddress, 
+                                       FIELD_OFFSET(PEB, ImageBaseAddress)),
+                               &m_ImageBaseAddress,
+                               sizeof(m_ImageBaseAddress),
+                               nullptr))
+        {
+            RETURN_LAST_ERROR_SET(Utils::Log(
+                                    Log::Error, 
+                                    GetLastError(), 
+                                    L"Failed to read remote process image base"));
+        }
+        m_Counters.BytesRead += sizeof(m_ImageBaseAddress);
+
+        return S_OK;
+    }
+
+    handle_t ProcessHandle() const
+    {
+        return m_ProcessHandle;
+    }
+
+    uint32_t ProcessId() const
+    {
+        return m_ProcessId;
+    }
+
+    void* PebBaseAddress() const
+    {
+        return m_PebBaseAddress;
+    }
+
+    void* ImageBaseAddress() const
+    {
+        return m_ImageBaseAddress;
+    }
+
+    Herpaderp::RemoteCounters& Counters() const
+    {
+        return m_Counters;
+    }
+
+private:
+    handle_t m_ProcessHandle;
+    Herpaderp::RemoteCounters& m_Counters;
+    uint32_t m_ProcessId{ 0 };
+    void* m_PebBaseAddress{ nullptr };
+    void* m_ImageBaseAddress{ nullptr };
+};
+
+/// <summary>
+/// Reserves the final size of the target up front, so writes don't extend
+/// it a block at a time. Failure is logged and otherwise ignored.
+/// </summary>
+/// <param name="TargetHandle">
+/// Target file to preallocate.
+/// </param>
+/// <param name="FileSize">
+/// Size the target will be written to.
+/// </param>
+static void PreallocateTarget(
+    _In_ handle_t TargetHandle,
+    _In_ uint64_t FileSize)
+{
+    //
+    // Only an optimization, the writes extend the target if it fails.
+    //
+    HRESULT hr = Utils::PreallocateFile(TargetHandle, FileSize);
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Debug, hr, L"Target file not preallocated");
+    }
+}
+
+/// <summary>
+/// Copies the source binary to the target file using the fastest strategy
+/// the files support. Block cloning and offloaded transfer are attempted 
+/// first, falling back to a buffered copy.
+/// </summary>
+static HRESULT CopySourceToTarget(
+    _In_ handle_t SourceHandle,
+    _In_ handle_t TargetHandle,
+    _In_ bool FlushFile,
+    _In_ Herpaderp::WriteBackend Backend,
+    _Inout_opt_ Utils::Sha256* Hash,
+    _Out_ uint64_t& BytesCopied,
+    _Out_ Herpaderp::CopyStrategy& Strategy)
+{
+    Strategy = Herpaderp::CopyStrategy::None;
+
+    HRESULT hr = Utils::CloneFileByHandle(SourceHandle, 
+                                          TargetHandle, 
+                                          BytesCopied);
+    if (SUCCEEDED(hr))
+    {
+        Strategy = Herpaderp::CopyStrategy::BlockClone;
+    }
+    else
+    {
+        Utils::Log(Log::Debug, hr, L"Block clone not used");
+
+        hr = Utils::OffloadCopyFileByHandle(SourceHandle,
+                                            TargetHandle,
+                                            BytesCopied);
+        if (SUCCEEDED(hr))
+        {
+            Strategy = Herpaderp::CopyStrategy::Offload;
+        }
+        else
+        {
+            Utils::Log(Log::Debug, hr, L"Offloaded transfer not used");
+        }
+    }
+
+    if (Strategy != Herpaderp::CopyStrategy::None)
+    {
+        if (Hash != nullptr)
+        {
+            //
+            // The fast paths move no bytes through us, reading the source 
+            // once is still cheaper than a buffered copy.
+            //
+            hr = Utils::HashFileContents(SourceHandle, *Hash);
+            if (FAILED(hr))
+            {
+                Utils::Log(Log::Debug, hr, L"Source not hashed");
+                Hash->Discard();
+            }
+        }
+
+        if (FlushFile)
+        {
+            RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(TargetHandle));
+        }
+        return S_OK;
+    }
+
+    //
+    // A failed fast path may have left partial content, the buffered copy 
+    // rewrites the whole target. Size it up front so it is not extended a
+    // block at a time.
+    //
+    uint64_t sourceSize;
+    RETURN_IF_FAILED(Utils::GetFileSize(SourceHandle, sourceSize));
+    PreallocateTarget(TargetHandle, sourceSize);
+
+    RETURN_IF_FAILED(Utils::CopyFileByHandle(SourceHandle,
+                                             TargetHandle,
+                                             BytesCopied,
+                                             FlushFile,
+                                             Backend,
+                                             Hash));
+    Strategy = Herpaderp::CopyStrategy::Buffered;
+    return S_OK;
+}
+
+namespace Herpaderp
+{
+    static HRESULT ExecuteProcessInternal(
+        _In_ const std::wstring& SourceFileName,
+        _In_ const std::wstring& TargetFileName,
+        _In_opt_ const std::optional<std::wstring>& ReplaceWithFileName,
+        _In_ std::span<const uint8_t> Pattern,
+        _In_ uint32_t Flags,
+        _In_ const ExecuteOptions& Options,
+        _Inout_ ExecuteResult& Result);
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ExecuteProcess(
+    const std::wstring& SourceFileName,
+    const std::wstring& TargetFileName,
+    const std::optional<std::wstring>& ReplaceWithFileName,
+    std::span<const uint8_t> Pattern, 
+    uint32_t Flags,
+    const ExecuteOptions* Options,
+    ExecuteResult* Result)
+{
+    const ExecuteOptions defaultOptions{};
+    const auto& options = (Options != nullptr ? *Options : defaultOptions);
+
+    //
+    // Scratch memory of the execution comes from the arena of this thread
+    // and is handed back when it ends, for the next execution to reuse.
+    //
+    Utils::ArenaScope scratch;
+
+    //
+    // A result reused for the next execution keeps the capacity of its 
+    // target name, setting the new name does not allocate.
+    //
+    ExecuteResult localResult;
+    auto& result = (Result != nullptr ? *Result : localResult);
+    auto resultTargetFileName = std::move(result.TargetFileName);
+    result = {};
+    result.TargetFileName = std::move(resultTargetFileName);
+
+    //
+    // The processor time the execution cost the tool is measured over the
+    // whole of it. Job threads run one execution at a time, so the thread's
+    // times are not shared with concurrent executions as the process's are.
+    //
+    ExecutionUsage toolStart;
+    auto toolMeasured = SUCCEEDED(QueryThreadUsage(toolStart));
+
+    //
+    // Under a scratch root the target is placed with a generated name, the
+    // execution only sees the placed name.
+    //
+    HRESULT hr = S_OK;
+    if (options.Scratch != nullptr)
+    {
+        hr = options.Scratch->PlaceTarget(TargetFileName, result.TargetFileName);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr, 
+                       L"Failed to place target file under scratch root");
+        }
+    }
+    else
+    {
+        result.TargetFileName.assign(TargetFileName);
+    }
+    const auto& targetFileName = result.TargetFileName;
+
+    Trace::ExecuteStart(SourceFileName, targetFileName, Flags);
+
+    //
+    // A watched process still runs from the target when we return, have 
+    // the watcher queue it for cleanup when the process exits.
+    //
+    auto cleanOnExit = ((options.Cleaner != nullptr) &&
+                        (options.Watcher != nullptr) &&
+                        FlagOn(Flags, FlagWaitForProcess));
+    ExecuteOptions watchedOptions;
+    const ExecuteOptions* executeOptions = &options;
+    if (cleanOnExit)
+    {
+        watchedOptions = options;
+        watchedOptions.OnExit = [Cleaner = options.Cleaner,
+                                 FileName = targetFileName,
+                                 OnExit = options.OnExit](
+                                    const ProcessExit& Exit) -> void
+        {
+            if (OnExit)
+            {
+                OnExit(Exit);
+            }
+            Cleaner->Queue(FileName);
+        };
+        executeOptions = &watchedOptions;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = ExecuteProcessInternal(SourceFileName,
+                                    targetFileName,
+                                    ReplaceWithFileName,
+                                    Pattern,
+                                    Flags,
+                                    *executeOptions,
+                                    result);
+    }
+
+    if ((options.Cleaner != nullptr) &&
+        (result.MilestoneTicks[SCAST(size_t)(Milestone::TargetOpened)] != 0) &&
+        (!cleanOnExit || FAILED(hr)))
+    {
+        options.Cleaner->Queue(targetFileName);
+    }
+
+    ExecutionUsage toolEnd;
+    if (toolMeasured && SUCCEEDED(QueryThreadUsage(toolEnd)))
+    {
+        result.ToolUsage.CycleTime = (toolEnd.CycleTime - toolStart.CycleTime);
+        result.ToolUsage.KernelTime = (toolEnd.KernelTime - toolStart.KernelTime);
+        result.ToolUsage.UserTime = (toolEnd.UserTime - toolStart.UserTime);
+    }
+
+    Trace::ExecuteStop(hr, result);
+
+    return hr;
+}
+
+_Use_decl_annotations_
+void Herpaderp::SetLoggingMask(uint32_t Mask)
+{
+    Utils::SetLoggingMask(Mask);
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ExecuteProcessInternal(
+    const std::wstring& SourceFileName,
+    const std::wstring& TargetFileName,
+    const std::optional<std::wstring>& ReplaceWithFileName,
+    std::span<const uint8_t> Pattern, 
+    uint32_t Flags,
+    const ExecuteOptions& Options,
+    ExecuteResult& Result)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    Result.Frequency = frequency.QuadPart;
+
+    if (FlagOn(Flags, FlagHoldHandleExclusive) && 
+        FlagOn(Flags, FlagCloseFileEarly))
+    {
+        //
+        // Incompatible flags.
+        //
+        return E_INVALIDARG;
+    }
+
+    if (FlagOn(Flags, FlagWaitForProcess) &&
+        FlagOn(Flags, FlagKillSpawnedProcess))
+    {
+        //
+        // Incompatible flags.
+        //
+        return E_INVALIDARG;
+    }
+
+    wil::unique_handle processHandle;
+    //
+    // If something goes wrong, we'll terminate the process.
+    //
+    auto terminateProcess = wil::scope_exit([&processHandle]() -> void
+    {
+        if (processHandle.is_valid())
+        {
+            TerminateProcess(processHandle.get(), 0);
+        }
+    });
+
+    Utils::Log(Log::Success, L"Source File: \"%ls\"", SourceFileName.c_str());
+    Utils::Log(Log::Success, L"Target File: \"%ls\"", TargetFileName.c_str());
+
+    //
+    // Open the source binary and the target file we will execute it from.
+    //
+    PhaseTimer openTimer(Result, Phase::Open);
+    wil::unique_handle sourceHandle;
+    sourceHandle.reset(CreateFileW(SourceFileName.c_str(),
+                                   GENERIC_READ,
+                                   FILE_SHARE_READ | 
+                                       FILE_SHARE_WRITE | 
+                                       FILE_SHARE_DELETE,
+                                   nullptr,
+                                   OPEN_EXISTING,
+                                   FILE_ATTRIBUTE_NORMAL,
+                                   nullptr));
+    if (!sourceHandle.is_valid())
+    {
+        RETURN_LAST_ERROR_SET(Utils::Log(Log::Error, 
+                                         GetLastError(), 
+                                         L"Failed to open source file"));
+    }
+
+    auto flushPolicy = (FlagOn(Flags, FlagFlushFile) ? 
+                            Options.Flush : 
+                            FlushPolicy::None);
+    Result.Flush = flushPolicy;
+    Result.Backend = Options.Backend;
+    Result.RandomSeed = Options.RandomSeed;
+
+    //
+    // Digests are computed on the buffers in flight, a hash that fails to
+    // start only costs the digest.
+    //
+    Utils::Sha256 imageHash;
+    Utils::Sha256 targetHash;
+    Utils::Sha256* imageHashing = nullptr;
+    Utils::Sha256* targetHashing = nullptr;
+    if (FlagOn(Flags, FlagHashContents))
+    {
+        HRESULT hr = imageHash.Initialize();
+        if (SUCCEEDED(hr))
+        {
+            hr = targetHash.Initialize();
+        }
+        if (SUCCEEDED(hr))
+        {
+            imageHashing = &imageHash;
+            targetHashing = &targetHash;
+        }
+        else
+        {
+            Utils::Log(Log::Warning, hr, L"Contents will not be hashed");
+        }
+    }
+
+    DWORD flagsAndAttributes = FILE_ATTRIBUTE_NORMAL;
+    if (flushPolicy == FlushPolicy::WriteThrough)
+    {
+        SetFlag(flagsAndAttributes, FILE_FLAG_WRITE_THROUGH);
+    }
+
+    DWORD shareMode = (FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE);
+    if (FlagOn(Flags, FlagHoldHandleExclusive))
+    {
+        Utils::Log(Log::Information, 
+                   L"Creating target file with exclusive access");
+        shareMode = 0;
+    }
+
+    wil::unique_handle targetHandle;
+    targetHandle.reset(CreateFileW(TargetFileName.c_str(),
+                                   GENERIC_READ | GENERIC_WRITE,
+                                   shareMode,
+                                   nullptr,
+                                   CREATE_ALWAYS,
+                                   flagsAndAttributes,
+                                   nullptr));
+    if(!targetHandle.is_valid())
+    {
+        RETURN_LAST_ERROR_SET(Utils::Log(Log::Error, 
+                                         GetLastError(), 
+                                         L"Failed to create target file"));
+    }
+
+    if (Options.TargetIoPriority != IoPriority::Default)
+    {
+        //
+        // Only a hint, the target is written either way.
+        //
+        FILE_IO_PRIORITY_HINT_INFO priorityHint{};
+        priorityHint.PriorityHint = 
+                        ((Options.TargetIoPriority == IoPriority::Low) ? 
+                            IoPriorityHintLow : 
+                            IoPriorityHintNormal);
+        if (!SetFileInformationByHandle(targetHandle.get(),
+                                        FileIoPriorityHintInfo,
+                                        &priorityHint,
+                                        sizeof(priorityHint)))
+        {
+            Utils::Log(Log::Debug, 
+                       GetLastError(), 
+                       L"Target I/O priority not set");
+        }
+    }
+
+    openTimer.Stop();
+    MarkMilestone(Result, Milestone::TargetOpened);
+
+    //
+    // Copy the content of the source process to the target.
+    //
+    PhaseTimer copyTimer(Result, Phase::Copy);
+    HRESULT hr;
+    std::shared_ptr<const CachedImage> sourceImage;
+    if (Options.SourceCache != nullptr)
+    {
+        hr = Options.SourceCache->Acquire(sourceHandle.get(), sourceImage);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Information, 
+                       hr, 
+                       L"Source image not cached, copying from file");
+        }
+    }
+
+    uint64_t bytesCopied;
+    CopyStrategy copyStrategy;
+    if (sourceImage != nullptr)
+    {
+        PreallocateTarget(targetHandle.get(), sourceImage->Bytes.size());
+        hr = Utils::WriteFileFromBuffer(targetHandle.get(),
+                                        sourceImage->Bytes,
+                                        bytesCopied,
+                                        (flushPolicy == FlushPolicy::PerStep),
+                                        Options.Backend,
+                                        imageHashing);
+        copyStrategy = CopyStrategy::CachedImage;
+    }
+    else
+    {
+        hr = CopySourceToTarget(sourceHandle.get(),
+                                targetHandle.get(),
+                                (flushPolicy == FlushPolicy::PerStep),
+                                Options.Backend,
+                                imageHashing,
+                                bytesCopied,
+                                copyStrategy);
+    }
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error,
+                   hr,
+                   L"Failed to copy source binary to target file");
+        RETURN_HR(hr);
+    }
+
+    copyTimer.Stop();
+    Result.Strategy = copyStrategy;
+    Result.BytesCopied = bytesCopied;
+
+    //
+    // The fast paths copy in the file system, only hashing the source reads
+    // it through us. A cached image is written from memory.
+    //
+    switch (copyStrategy)
+    {
+        case CopyStrategy::Buffered:
+        {
+            Result.ToolUsage.ReadBytes += bytesCopied;
+            Result.ToolUsage.WriteBytes += bytesCopied;
+            break;
+        }
+        case CopyStrategy::CachedImage:
+        {
+            Result.ToolUsage.WriteBytes += bytesCopied;
+            break;
+        }
+        default:
+        {
+            if (imageHashing != nullptr)
+            {
+                Result.ToolUsage.ReadBytes += bytesCopied;
+            }
+            break;
+        }
+    }
+    if (imageHashing != nullptr)
+    {
+        imageHashing->Finish(Result.ImageDigest);
+    }
+
+    Utils::Log(Log::Information, 
+               L"Copied source binary to target file using %ls, %llu bytes",
+               CopyStrategyName(copyStrategy),
+               bytesCopied);
+
+    //
+    // We're done with the source binary.
+    //
+    sourceHandle.reset();
+
+    //
+    // Map and create the target process. We'll make it all derpy in a moment...
+    //
+    PhaseTimer sectionTimer(Result, Phase::CreateSection);
+    wil::unique_handle sectionHandle;
+    auto status = NtCreateSection(&sectionHandle,
+                                  SECTION_ALL_ACCESS,
+                                  nullptr,
+                                  nullptr,
+                                  PAGE_READONLY,
+                                  SEC_IMAGE,
+                                  targetHandle.get());
+    if (!NT_SUCCESS(status))
+    {
+        sectionHandle.release();
+        RETURN_NTSTATUS(Utils::Log(
+                              Log::Error, 
+                              status, 
+                              L"Failed to create target file image section"));
+    }
+
+    sectionTimer.Stop();
+
+    Utils::Log(Log::Information, L"Created image section for target");
+
+    PhaseTimer processTimer(Result, Phase::CreateProcess);
+    status = NtCreateProcessEx(&processHandle,
+                               PROCESS_ALL_ACCESS,
+                               nullptr,
+                               NtCurrentProcess(),
+                               PROCESS_CREATE_FLAGS_INHERIT_HANDLES,
+                               sectionHandle.get(),
+                               nullptr,
+                               nullptr,
+                               0);
+    if (!NT_SUCCESS(status))
+    {
+        processHandle.release();
+        RETURN_NTSTATUS(Utils::Log(Log::Error, 
+                                   status, 
+                                   L"Failed to create process"));
+    }
+
+    BootstrapContext bootstrap(processHandle.get(), Result.Remote);
+    RETURN_IF_FAILED(bootstrap.Query());
+
+    processTimer.Stop();
+    Result.ProcessId = bootstrap.ProcessId();
+    MarkMilestone(Result, Milestone::ImageMapped);
+
+    Utils::Log(Log::Information,
+               L"Created process object, PID %lu",
+               Result.ProcessId);
+
+    if (Options.Container != nullptr)
+    {
+        //
+        // Contain the process before it has a thread that could run.
+        //
+        bootstrap.Counters().Syscalls++;
+        hr = Options.Container->Assign(bootstrap.ProcessHandle());
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to assign process to job");
+            RETURN_HR(hr);
+        }
+    }
+
+    if (Options.ChildPriorityClass != 0)
+    {
+        bootstrap.Counters().Syscalls++;
+        if (!SetPriorityClass(bootstrap.ProcessHandle(), 
+                              Options.ChildPriorityClass))
+        {
+            RETURN_LAST_ERROR_SET(Utils::Log(Log::Error, 
+                                             GetLastError(), 
+                                             L"Failed to set process priority"));
+        }
+    }
+
+    //
+    // Alright we have the process set up, we don't need the section.
+    //
+    sectionHandle.reset();
+
+    //
+    // Go get the remote entry RVA to create a thread later on.
+    //
+    PhaseTimer entryPointTimer(Result, Phase::EntryPoint);
+    uint32_t imageEntryPointRva;
+    if (sourceImage != nullptr)
+    {
+        //
+        // The target is a copy of the cached image, it was parsed already.
+        //
+        imageEntryPointRva = sourceImage->EntryPointRva;
+    }
+    else
+    {
+        hr = Utils::GetImageEntryPointRva(targetHandle.get(),
+                                          imageEntryPointRva);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr, 
+                       L"Failed to get target file image entry RVA");
+            RETURN_HR(hr);
+        }
+    }
+
+    entryPointTimer.Stop();
+    Result.EntryPointRva = imageEntryPointRva;
+
+    Utils::Log(Log::Information,
+               L"Located target image entry RVA 0x%08x",
+               imageEntryPointRva);
+
+    //
+    // Flushes are timed on their own, pause the modify timer around them.
+    // Each flush point only flushes under the policy it belongs to.
+    //
+    PhaseTimer modifyTimer(Result, Phase::Modify);
+    auto flushTarget = [&](FlushPolicy When) -> HRESULT
+    {
+        if (flushPolicy != When)
+        {
+            return S_OK;
+        }
+
+        modifyTimer.Stop();
+        PhaseTimer flushTimer(Result, Phase::Flush);
+        auto flushed = FlushFileBuffers(targetHandle.get());
+        flushTimer.Stop();
+        modifyTimer.Start();
+
+        RETURN_IF_WIN32_BOOL_FALSE(flushed);
+        return S_OK;
+    };
+
+    //
+    // Alright, depending on the parameter passed in. We will either:
+    //   A. Overwrite the target binary with another.
+    //   B. Overwrite the target binary with a pattern.
+    //
+    if (ReplaceWithFileName.has_value())
+    {
+        //
+        // (A) We are overwriting the binary with another file.
+        //
+        Utils::Log(Log::Success,
+                   L"Replacing target with \"%ls\"",
+                   ReplaceWithFileName->c_str());
+
+        wil::unique_handle replaceWithHandle;
+        replaceWithHandle.reset(CreateFileW(ReplaceWithFileName->c_str(),
+                                            GENERIC_READ,
+                                            FILE_SHARE_READ |
+                                                FILE_SHARE_WRITE |
+                                                FILE_SHARE_DELETE,
+                                            nullptr,
+                                            OPEN_EXISTING,
+                                            FILE_ATTRIBUTE_NORMAL,
+                                            nullptr));
+
+        if (!replaceWithHandle.is_valid())
+        {
+            RETURN_LAST_ERROR_SET(Utils::Log(
+                                        Log::Error, 
+                                        GetLastError(), 
+                                        L"Failed to open replace with file"));
+        }
+
+        //
+        // Compare the sizes up front. A smaller replacement can't truncate 
+        // the target while the image section maps it, so its write also 
+        // hides the original bytes past it and retains any signature.
+        //
+        uint64_t replaceWithSize;
+        hr = Utils::GetFileSize(replaceWithHandle.get(), replaceWithSize);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr,
+                       L"Failed to get replace with file size");
+            RETURN_HR(hr);
+        }
+
+        uint64_t bytesReplaced;
+        if (replaceWithSize < Result.BytesCopied)
+        {
+            Utils::Log(Log::Information,
+                       L"Replacement is smaller than the target, hiding "
+                       L"original bytes and retaining any signature");
+
+            uint64_t bytesHidden;
+            hr = Utils::ReplaceFileContents(replaceWithHandle.get(),
+                                            targetHandle.get(),
+                                            Result.BytesCopied,
+                                            Pattern,
+                                            bytesReplaced,
+                                            bytesHidden,
+                                            Options.Backend,
+                                            Options.RandomSeed,
+                                            targetHashing);
+            Result.BytesOverwritten = (bytesReplaced + bytesHidden);
+            Result.ToolUsage.ReadBytes += bytesReplaced;
+            Result.ToolUsage.WriteBytes += Result.BytesOverwritten;
+        }
+        else
+        {
+            hr = Utils::CopyFileByHandle(replaceWithHandle.get(),
+                                         targetHandle.get(),
+                                         bytesReplaced,
+                                         false,
+                                         Options.Backend,
+                                         targetHashing);
+            Result.BytesOverwritten = std::min<uint64_t>(bytesReplaced, 
+                                                         Result.BytesCopied);
+            Result.BytesAppended = (bytesReplaced - Result.BytesOverwritten);
+            Result.ToolUsage.ReadBytes += bytesReplaced;
+            Result.ToolUsage.WriteBytes += bytesReplaced;
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = flushTarget(FlushPolicy::PerStep);
+        }
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr,
+                       L"Failed to replace target file");
+            RETURN_HR(hr);
+        }
+    }
+    else
+    {
+        //
+        // (B) Just overwrite the target binary with a pattern.
+        //
+        Utils::Log(Log::Success, L"Overwriting target with pattern");
+
+        hr = Utils::OverwriteFileContentsWithPattern(targetHandle.get(),
+                                                     Pattern,
+                                                     false,
+                                                     Options.Backend,
+                                                     Options.RandomSeed,
+                                                     targetHashing);
+        if (SUCCEEDED(hr))
+        {
+            Result.BytesOverwritten = Result.BytesCopied;
+            Result.ToolUsage.WriteBytes += Result.BytesOverwritten;
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = flushTarget(FlushPolicy::PerStep);
+        }
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr, 
+                       L"Failed to write pattern over file");
+            RETURN_HR(hr);
+        }
+    }
+
+    if (targetHashing != nullptr)
+    {
+        targetHashing->Finish(Result.TargetDigest);
+    }
+
+    hr = flushTarget(FlushPolicy::Coalesced);
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, 
+                   hr,
+                   L"Failed to flush target file");
+        RETURN_HR(hr);
+    }
+
+    modifyTimer.Stop();
+    MarkMilestone(Result, Milestone::TargetModified);
+
+    //
+    // Alright, at this point the process is going to be derpy enough.
+    // Do the work necessary to make it execute.
+    //
+    Utils::Log(Log::Success, L"Preparing target for execution");
+
+    PhaseTimer parametersTimer(Result, Phase::WriteParameters);
+
+    Utils::Log(Log::Information,
+               L"Writing process parameters, remote PEB ProcessParameters 0x%p",
+               Add2Ptr(bootstrap.PebBaseAddress(), 
+                       FIELD_OFFSET(PEB, ProcessParameters)));
+
+    //
+    // Without a shared template build one for this execution only.
+    //
+    ProcessParametersTemplate localTemplate;
+    auto parametersTemplate = Options.ParametersTemplate;
+    if (parametersTemplate == nullptr)
+    {
+        hr = localTemplate.InitializeFromCurrentProcess();
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr, 
+                       L"Failed to build process parameters");
+            RETURN_HR(hr);
+        }
+        parametersTemplate = &localTemplate;
+    }
+
+    hr = parametersTemplate->Write(bootstrap.ProcessHandle(),
+                                   bootstrap.PebBaseAddress(),
+                                   TargetFileName,
+                                   &bootstrap.Counters());
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, 
+                   hr, 
+                   L"Failed to write remote process parameters");
+        RETURN_HR(hr);
+    }
+
+    parametersTimer.Stop();
+
+    if (FlagOn(Flags, FlagCloseFileEarly))
+    {
+        //
+        // Caller wants to close the file early, before the notification
+        // callback in the kernel would fire, do so.
+        //
+        targetHandle.reset();
+    }
+
+    //
+    // Create the initial thread, when this first thread is inserted the
+    // process create callback will fire in the kernel.
+    //
+    void* remoteEntryPoint = Add2Ptr(bootstrap.ImageBaseAddress(), 
+                                     imageEntryPointRva);
+
+    Utils::Log(Log::Information,
+               L"Creating thread in process at entry point 0x%p",
+               remoteEntryPoint);
+
+    //
+    // Have the thread client ID returned with the thread rather than 
+    // querying it afterwards.
+    //
+    CLIENT_ID clientId{};
+    PS_ATTRIBUTE_LIST attributeList{};
+    attributeList.TotalLength = sizeof(attributeList);
+    attributeList.Attributes[0].Attribute = PS_ATTRIBUTE_CLIENT_ID;
+    attributeList.Attributes[0].Size = sizeof(clientId);
+    attributeList.Attributes[0].ValuePtr = &clientId;
+    attributeList.Attributes[0].ReturnLength = nullptr;
+
+    PhaseTimer threadTimer(Result, Phase::CreateThread);
+    wil::unique_handle threadHandle;
+    bootstrap.Counters().Syscalls++;
+    status = NtCreateThreadEx(&threadHandle,
+                              THREAD_ALL_ACCESS,
+                              nullptr,
+                              bootstrap.ProcessHandle(),
+                              remoteEntryPoint,
+                              nullptr,
+                              0,
+                              0,
+                              0,
+                              0,
+                              &attributeList);
+    if (!NT_SUCCESS(status))
+    {
+        threadHandle.release();
+        RETURN_NTSTATUS(Utils::Log(Log::Error, 
+                                   status, 
+                                   L"Failed to create remote thread"));
+    }
+
+    threadTimer.Stop();
+    Result.ThreadId = SCAST(uint32_t)(RCAST(uintptr_t)(clientId.UniqueThread));
+    MarkMilestone(Result, Milestone::ThreadInserted);
+
+    Utils::Log(Log::Information,
+               L"Created thread, TID %lu",
+               Result.ThreadId);
+
+    if (!FlagOn(Flags, FlagKillSpawnedProcess))
+    {
+        //
+        // Process was executed successfully. Do not terminate.
+        //
+        terminateProcess.release();
+    }
+
+    if (!FlagOn(Flags, FlagHoldHandleExclusive))
+    {
+        //
+        // We're done with the target file handle. At this point the process 
+        // create callback will have fired in the kernel.
+        //
+        targetHandle.reset();
+    }
+
+    if (!FlagOn(Flags, FlagWaitForProcess))
+    {
+        Utils::Log(Log::Success, L"Successfully spawned herpaderped process");
+        return S_OK;
+    }
+
+    if (Options.Watcher != nullptr)
+    {
+        //
+        // Hand the process to the watcher rather than blocking this thread,
+        // a held target handle stays open until the process exits.
+        //
+        hr = Options.Watcher->Watch(std::move(processHandle),
+                                    std::move(targetHandle),
+                                    Options.WaitTimeoutMilliseconds,
+                                    Options.OnExit);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to watch herpaderped process");
+            RETURN_HR(hr);
+        }
+
+        Utils::Log(Log::Success, L"Watching herpaderped process for exit");
+        return S_OK;
+    }
+
+    //
+    // Wait for the process to exit.
+    //
+    Utils::Log(Log::Success, L"Waiting for herpaderped process to exit");
+
+    ProcessExit exit;
+    exit.ProcessId = Result.ProcessId;
+
+    PhaseTimer waitTimer(Result, Phase::Wait);
+    auto waitResult = WaitForSingleObject(processHandle.get(), 
+                                          Options.WaitTimeoutMilliseconds);
+    auto terminated = false;
+    if (waitResult == WAIT_FAILED)
+    {
+        exit.Status = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (waitResult == WAIT_TIMEOUT)
+    {
+        //
+        // Out of time, terminate it and wait for it to be gone. If it can't
+        // be terminated don't wait on it again, that is what the timeout is
+        // there to prevent.
+        //
+        exit.Status = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+        terminated = !!TerminateProcess(processHandle.get(), 
+                                        SCAST(UINT)(exit.Status));
+        if (terminated)
+        {
+            WaitForSingleObject(processHandle.get(), INFINITE);
+        }
+        else
+        {
+            Utils::Log(Log::Warning,
+                       GetLastError(),
+                       L"Failed to terminate herpaderped process");
+        }
+    }
+    waitTimer.Stop();
+    exit.WaitTicks = Result.PhaseTicks[SCAST(size_t)(Phase::Wait)];
+
+    DWORD targetExitCode = 0;
+    GetExitCodeProcess(processHandle.get(), &targetExitCode);
+    exit.ExitCode = targetExitCode;
+
+    ResourceUsage usage;
+    if (SUCCEEDED(QueryProcessUsage(processHandle.get(), usage)))
+    {
+        exit.Usage = usage;
+    }
+    Result.Exit = exit;
+
+    if (Options.OnExit)
+    {
+        Options.OnExit(exit);
+    }
+
+    if (waitResult == WAIT_FAILED)
+    {
+        Utils::Log(Log::Error,
+                   exit.Status,
+                   L"Failed to wait for herpaderped process");
+        RETURN_HR(exit.Status);
+    }
+    if (FAILED(exit.Status))
+    {
+        Utils::Log(Log::Error,
+                   exit.Status,
+                   (terminated ? 
+                       L"Herpaderped process ran past its timeout of %lu ms "
+                       L"and was terminated" :
+                       L"Herpaderped process ran past its timeout of %lu ms "
+                       L"and is still running"),
+                   Options.WaitTimeoutMilliseconds);
+        RETURN_HR(exit.Status);
+    }
+
+    Utils::Log(Log::Success,
+               L"Herpaderped process exited with code 0x%08x",
+               targetExitCode);
+
+    return S_OK;
+}
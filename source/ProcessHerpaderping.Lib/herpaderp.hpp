@@ -0,0 +1,772 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+// 
+// File:     source/ProcessHerpaderping.Lib/herpaderp.hpp
+// Author:   Johnny Shaw
+// Abstract: Herpaderping Functionality
+//
+#pragma once
+
+//
+// Public header of the library, it only depends on the Windows headers and 
+// the STL so it can be included without the library precompiled header.
+//
+#include <Windows.h>
+#include <cstdint>
+#include <array>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace Herpaderp
+{
+    class ImageCache;
+    class ProcessParametersTemplate;
+    class ProcessWatcher;
+    class JobContainer;
+    class ScratchDirectory;
+    class TargetCleaner;
+
+#pragma warning(push)
+#pragma warning(disable : 4634)  // xmldoc: discarding XML document comment for invalid target 
+    /// <summary>
+    /// Waits for process to exit before returning.
+    /// </summary>
+    constexpr static uint32_t FlagWaitForProcess = 0x00000001ul;
+
+    /// <summary>
+    /// Opens and hold the target file handle exclusive for as long as 
+    /// reasonable. This flag is incompatible with FlagCloseFileEarly.
+    /// </summary>
+    constexpr static uint32_t FlagHoldHandleExclusive = 0x00000002ul;
+
+    /// <summary>
+    /// Flushes file buffers of target file, as set by 
+    /// ExecuteOptions::Flush.
+    /// </summary>
+    constexpr static uint32_t FlagFlushFile = 0x00000004ul;
+
+    /// <summary>
+    /// Closes the file handle early, before creating the initial thread 
+    /// (before process notification would fire in the kernel). This flag is 
+    /// not compatible with FlagHoldHandleExclusive.
+    /// </summary>
+    constexpr static uint32_t FlagCloseFileEarly = 0x00000008ul;
+
+    /// <summary>
+    /// Terminates the spawned process on success, this can be useful in some 
+    /// automation environments. Not compatible with FlagWaitForProcess.
+    /// </summary>
+    constexpr static uint32_t FlagKillSpawnedProcess = 0x00000010ul;
+
+    /// <summary>
+    /// Computes the SHA-256 of the executed image and of the final target
+    /// contents from the buffers the copy and overwrite write, see 
+    /// ExecuteResult::ImageDigest and ExecuteResult::TargetDigest.
+    /// </summary>
+    constexpr static uint32_t FlagHashContents = 0x00000020ul;
+#pragma warning(pop)
+
+    /// <summary>
+    /// Strategy used to copy the source binary to the target file.
+    /// </summary>
+    enum class CopyStrategy : uint32_t
+    {
+        /// <summary>
+        /// No copy has been made.
+        /// </summary>
+        None = 0,
+
+        /// <summary>
+        /// Block cloned by the file system (FSCTL_DUPLICATE_EXTENTS_TO_FILE).
+        /// </summary>
+        BlockClone,
+
+        /// <summary>
+        /// Offloaded data transfer by the storage (FSCTL_OFFLOAD_READ/WRITE).
+        /// </summary>
+        Offload,
+
+        /// <summary>
+        /// Read and written through buffers in this process.
+        /// </summary>
+        Buffered,
+
+        /// <summary>
+        /// Written from an image already held in memory.
+        /// </summary>
+        CachedImage,
+    };
+
+    /// <summary>
+    /// Gets the display name of a copy strategy.
+    /// </summary>
+    /// <param name="Strategy">
+    /// Copy strategy to get the name of.
+    /// </param>
+    /// <returns>
+    /// Display name of the copy strategy.
+    /// </returns>
+    const wchar_t* CopyStrategyName(_In_ CopyStrategy Strategy);
+
+    /// <summary>
+    /// How the target file is flushed with FlagFlushFile.
+    /// </summary>
+    enum class FlushPolicy : uint32_t
+    {
+        /// <summary>
+        /// Flushed after the copy and after each step of the modification.
+        /// </summary>
+        PerStep = 0,
+
+        /// <summary>
+        /// Never flushed, the same as not passing FlagFlushFile.
+        /// </summary>
+        None,
+
+        /// <summary>
+        /// Flushed once, at the end of the modification.
+        /// </summary>
+        Coalesced,
+
+        /// <summary>
+        /// Never flushed, the target is opened write through 
+        /// (FILE_FLAG_WRITE_THROUGH) instead.
+        /// </summary>
+        WriteThrough,
+    };
+
+    /// <summary>
+    /// Gets the display name of a flush policy.
+    /// </summary>
+    /// <param name="Policy">
+    /// Flush policy to get the name of.
+    /// </param>
+    /// <returns>
+    /// Display name of the flush policy.
+    /// </returns>
+    const wchar_t* FlushPolicyName(_In_ FlushPolicy Policy);
+
+    /// <summary>
+    /// How the bytes of the target file are written.
+    /// </summary>
+    enum class WriteBackend : uint32_t
+    {
+        /// <summary>
+        /// Cached writes through the target handle.
+        /// </summary>
+        Buffered = 0,
+
+        /// <summary>
+        /// Overlapped writes that bypass the cache (FILE_FLAG_NO_BUFFERING) 
+        /// through a second handle to the target, several kept in flight. 
+        /// Ranges that are not sector aligned are written buffered.
+        /// </summary>
+        Unbuffered,
+
+        /// <summary>
+        /// Copies into mapped views of the target, the views are flushed
+        /// with the target.
+        /// </summary>
+        Mapped,
+    };
+
+    /// <summary>
+    /// Gets the display name of a write backend.
+    /// </summary>
+    /// <param name="Backend">
+    /// Write backend to get the name of.
+    /// </param>
+    /// <returns>
+    /// Display name of the write backend.
+    /// </returns>
+    const wchar_t* WriteBackendName(_In_ WriteBackend Backend);
+
+    /// <summary>
+    /// I/O priority hint set on the target file handle.
+    /// </summary>
+    enum class IoPriority : uint32_t
+    {
+        /// <summary>
+        /// The handle keeps the priority of the issuing thread.
+        /// </summary>
+        Default = 0,
+
+        /// <summary>
+        /// Low priority I/O (IoPriorityHintLow), yields to other I/O.
+        /// </summary>
+        Low,
+
+        /// <summary>
+        /// Normal priority I/O (IoPriorityHintNormal), even from threads 
+        /// running in background mode.
+        /// </summary>
+        Normal,
+    };
+
+    /// <summary>
+    /// SHA-256 digest.
+    /// </summary>
+    using Sha256Digest = std::array<uint8_t, 32>;
+
+    /// <summary>
+    /// Formats a digest as lower case hexadecimal.
+    /// </summary>
+    /// <param name="Digest">
+    /// Digest to format.
+    /// </param>
+    /// <param name="Text">
+    /// Set to the formatted digest.
+    /// </param>
+    void FormatDigest(
+        _In_ const Sha256Digest& Digest,
+        _Out_ std::wstring& Text);
+
+    /// <summary>
+    /// Resources a process used. Times are in 100 nanosecond units.
+    /// </summary>
+    struct ResourceUsage
+    {
+        /// <summary>
+        /// Processor cycles used, as counted by the scheduler.
+        /// </summary>
+        uint64_t CycleTime{ 0 };
+
+        /// <summary>
+        /// Time spent in kernel mode.
+        /// </summary>
+        uint64_t KernelTime{ 0 };
+
+        /// <summary>
+        /// Time spent in user mode.
+        /// </summary>
+        uint64_t UserTime{ 0 };
+
+        /// <summary>
+        /// Number of read, write and other I/O operations.
+        /// </summary>
+        uint64_t ReadOperations{ 0 };
+        uint64_t WriteOperations{ 0 };
+        uint64_t OtherOperations{ 0 };
+
+        /// <summary>
+        /// Number of bytes moved by read, write and other I/O operations.
+        /// </summary>
+        uint64_t ReadBytes{ 0 };
+        uint64_t WriteBytes{ 0 };
+        uint64_t OtherBytes{ 0 };
+
+        /// <summary>
+        /// Largest working set reached, in bytes.
+        /// </summary>
+        uint64_t PeakWorkingSet{ 0 };
+    };
+
+    /// <summary>
+    /// Queries the resources a process used over its life.
+    /// </summary>
+    /// <param name="ProcessHandle">
+    /// Process to query, requires PROCESS_QUERY_LIMITED_INFORMATION and for
+    /// the working set PROCESS_VM_READ.
+    /// </param>
+    /// <param name="Usage">
+    /// Set to the resources the process used.
+    /// </param>
+    /// <returns>
+    /// Success if the usage was queried.
+    /// </returns>
+    _Must_inspect_result_ HRESULT QueryProcessUsage(
+        _In_ handle_t ProcessHandle,
+        _Out_ ResourceUsage& Usage);
+
+    /// <summary>
+    /// Resources the tool used for one execution. Only what can be told 
+    /// apart from concurrent executions is kept. Times are in 100 
+    /// nanosecond units.
+    /// </summary>
+    struct ExecutionUsage
+    {
+        /// <summary>
+        /// Processor cycles used by the executing thread.
+        /// </summary>
+        uint64_t CycleTime{ 0 };
+
+        /// <summary>
+        /// Time the executing thread spent in kernel mode.
+        /// </summary>
+        uint64_t KernelTime{ 0 };
+
+        /// <summary>
+        /// Time the executing thread spent in user mode.
+        /// </summary>
+        uint64_t UserTime{ 0 };
+
+        /// <summary>
+        /// Bytes the execution read from the source and replacement files 
+        /// itself. Block cloned and offloaded copies move none, loads into 
+        /// a shared source cache are not counted.
+        /// </summary>
+        uint64_t ReadBytes{ 0 };
+
+        /// <summary>
+        /// Bytes the execution wrote to the target file itself, by copy, 
+        /// replacement or obfuscation. Block cloned and offloaded copies 
+        /// move none.
+        /// </summary>
+        uint64_t WriteBytes{ 0 };
+    };
+
+    /// <summary>
+    /// How a spawned process exited.
+    /// </summary>
+    struct ProcessExit
+    {
+        /// <summary>
+        /// Process identifier of the spawned process.
+        /// </summary>
+        uint32_t ProcessId{ 0 };
+
+        /// <summary>
+        /// Success if the process exited on its own. ERROR_TIMEOUT if it was
+        /// terminated because it ran past its timeout.
+        /// </summary>
+        HRESULT Status{ S_OK };
+
+        /// <summary>
+        /// Exit code of the process.
+        /// </summary>
+        uint32_t ExitCode{ 0 };
+
+        /// <summary>
+        /// Performance counter ticks spent waiting for the process.
+        /// </summary>
+        int64_t WaitTicks{ 0 };
+
+        /// <summary>
+        /// Resources the process used over its life, collected once it 
+        /// exited. Not set if they could not be queried.
+        /// </summary>
+        std::optional<ResourceUsage> Usage{ std::nullopt };
+    };
+
+    /// <summary>
+    /// Called when a waited for process exits.
+    /// </summary>
+    using ExitCallback = std::function<void(const ProcessExit& Exit)>;
+
+    /// <summary>
+    /// Optional settings for executing process herpaderping.
+    /// </summary>
+    struct ExecuteOptions
+    {
+        /// <summary>
+        /// Optional, source images are acquired from this cache rather than 
+        /// being read and parsed for each execution.
+        /// </summary>
+        ImageCache* SourceCache{ nullptr };
+
+        /// <summary>
+        /// Optional, process parameters are written from this template 
+        /// rather than being generated for each execution.
+        /// </summary>
+        const ProcessParametersTemplate* ParametersTemplate{ nullptr };
+
+        /// <summary>
+        /// Optional, with FlagWaitForProcess the spawned process is handed
+        /// to this watcher and the execution returns without waiting. The 
+        /// exit is reported through OnExit.
+        /// </summary>
+        ProcessWatcher* Watcher{ nullptr };
+
+        /// <summary>
+        /// With FlagWaitForProcess, time to let the spawned process run 
+        /// before terminating it. Defaults to no timeout.
+        /// </summary>
+        uint32_t WaitTimeoutMilliseconds{ INFINITE };
+
+        /// <summary>
+        /// With FlagFlushFile, how the target file is flushed. Defaults to
+        /// flushing after each step.
+        /// </summary>
+        FlushPolicy Flush{ FlushPolicy::PerStep };
+
+        /// <summary>
+        /// How the target file is written, when it is written from user 
+        /// mode. Defaults to buffered writes. Backends that can't be used
+        /// for the target fall back to buffered writes.
+        /// </summary>
+        WriteBackend Backend{ WriteBackend::Buffered };
+
+        /// <summary>
+        /// Optional, the target is obfuscated with the pseudo random stream
+        /// of this seed, for its whole length, rather than with the pattern.
+        /// The same seed reproduces the same bytes.
+        /// </summary>
+        std::optional<uint64_t> RandomSeed{ std::nullopt };
+
+        /// <summary>
+        /// I/O priority hint of the target file handle. Defaults to leaving
+        /// the handle at the priority of the thread.
+        /// </summary>
+        IoPriority TargetIoPriority{ IoPriority::Default };
+
+        /// <summary>
+        /// Optional, priority class of the spawned process 
+        /// (IDLE_PRIORITY_CLASS, ...), set before its initial thread is
+        /// created. Zero leaves the inherited priority class.
+        /// </summary>
+        uint32_t ChildPriorityClass{ 0 };
+
+        /// <summary>
+        /// Optional, with FlagWaitForProcess called when the spawned 
+        /// process exits. When waiting synchronously it is called before 
+        /// the execution returns.
+        /// </summary>
+        ExitCallback OnExit;
+
+        /// <summary>
+        /// Optional, the spawned process is assigned to this job before its
+        /// initial thread is created.
+        /// </summary>
+        const JobContainer* Container{ nullptr };
+
+        /// <summary>
+        /// Optional, the target file is placed under this scratch root with
+        /// a generated unique name rather than at the requested path.
+        /// </summary>
+        const ScratchDirectory* Scratch{ nullptr };
+
+        /// <summary>
+        /// Optional, the target file is queued to this cleaner once the 
+        /// execution is done with it. A waited for process has its target
+        /// queued when it exits.
+        /// </summary>
+        TargetCleaner* Cleaner{ nullptr };
+    };
+
+    /// <summary>
+    /// Timed phases of a herpaderping execution.
+    /// </summary>
+    enum class Phase : uint32_t
+    {
+        /// <summary>
+        /// Opening the source file and creating the target file.
+        /// </summary>
+        Open = 0,
+
+        /// <summary>
+        /// Copying the source binary to the target file.
+        /// </summary>
+        Copy,
+
+        /// <summary>
+        /// Creating the image section (NtCreateSection).
+        /// </summary>
+        CreateSection,
+
+        /// <summary>
+        /// Creating the process object (NtCreateProcessEx).
+        /// </summary>
+        CreateProcess,
+
+        /// <summary>
+        /// Locating the image entry point.
+        /// </summary>
+        EntryPoint,
+
+        /// <summary>
+        /// Replacing or overwriting the target file, excluding flushes.
+        /// </summary>
+        Modify,
+
+        /// <summary>
+        /// Flushing the target file after it is modified.
+        /// </summary>
+        Flush,
+
+        /// <summary>
+        /// Writing the remote process parameters.
+        /// </summary>
+        WriteParameters,
+
+        /// <summary>
+        /// Creating the initial thread (NtCreateThreadEx).
+        /// </summary>
+        CreateThread,
+
+        /// <summary>
+        /// Waiting for the process to exit.
+        /// </summary>
+        Wait,
+
+        Count
+    };
+
+    constexpr static size_t PhaseCount = static_cast<size_t>(Phase::Count);
+
+    /// <summary>
+    /// Points in a herpaderping execution, these follow the states in
+    /// res/StateDiagram.svg. The gap between TargetModified and 
+    /// ThreadInserted is the window in which the file on disk no longer
+    /// matches the image that is about to execute.
+    /// </summary>
+    enum class Milestone : uint32_t
+    {
+        /// <summary>
+        /// Target file is created and the handle is open.
+        /// </summary>
+        TargetOpened = 0,
+
+        /// <summary>
+        /// Image section is mapped into the process object.
+        /// </summary>
+        ImageMapped,
+
+        /// <summary>
+        /// Target file is obscured on disk.
+        /// </summary>
+        TargetModified,
+
+        /// <summary>
+        /// Initial thread is inserted, process notify routines have fired.
+        /// </summary>
+        ThreadInserted,
+
+        Count
+    };
+
+    constexpr static size_t MilestoneCount = static_cast<size_t>(Milestone::Count);
+
+    /// <summary>
+    /// Gets the display name of a phase.
+    /// </summary>
+    /// <param name="Value">
+    /// Phase to get the name of.
+    /// </param>
+    /// <returns>
+    /// Display name of the phase.
+    /// </returns>
+    const wchar_t* PhaseName(_In_ Phase Value);
+
+    /// <summary>
+    /// Gets the display name of a milestone.
+    /// </summary>
+    /// <param name="Value">
+    /// Milestone to get the name of.
+    /// </param>
+    /// <returns>
+    /// Display name of the milestone.
+    /// </returns>
+    const wchar_t* MilestoneName(_In_ Milestone Value);
+
+    /// <summary>
+    /// Calls made against the spawned process while bootstrapping it.
+    /// </summary>
+    struct RemoteCounters
+    {
+        /// <summary>
+        /// Number of system calls made against the spawned process.
+        /// </summary>
+        uint32_t Syscalls{ 0 };
+
+        /// <summary>
+        /// Number of bytes read from the spawned process.
+        /// </summary>
+        uint64_t BytesRead{ 0 };
+
+        /// <summary>
+        /// Number of bytes written to the spawned process.
+        /// </summary>
+        uint64_t BytesWritten{ 0 };
+    };
+
+    /// <summary>
+    /// Describes a herpaderping execution. Timings are recorded with the 
+    /// performance counter and are filled in as far as the execution got, 
+    /// including on failure.
+    /// </summary>
+    struct ExecuteResult
+    {
+        /// <summary>
+        /// Performance counter ticks spent in each phase.
+        /// </summary>
+        std::array<int64_t, PhaseCount> PhaseTicks{};
+
+        /// <summary>
+        /// Performance counter value when each milestone was reached, zero 
+        /// if it was not reached.
+        /// </summary>
+        std::array<int64_t, MilestoneCount> MilestoneTicks{};
+
+        /// <summary>
+        /// Performance counter frequency, ticks per second.
+        /// </summary>
+        int64_t Frequency{ 0 };
+
+        /// <summary>
+        /// Strategy used to copy the source binary to the target file.
+        /// </summary>
+        CopyStrategy Strategy{ CopyStrategy::None };
+
+        /// <summary>
+        /// Number of bytes copied to the target file.
+        /// </summary>
+        uint64_t BytesCopied{ 0 };
+
+        /// <summary>
+        /// Number of bytes of the target file overwritten, by the replace 
+        /// with file or the pattern.
+        /// </summary>
+        uint64_t BytesOverwritten{ 0 };
+
+        /// <summary>
+        /// Number of bytes appended to the target file by a replace with 
+        /// file larger than the source.
+        /// </summary>
+        uint64_t BytesAppended{ 0 };
+
+        /// <summary>
+        /// Flush policy in effect for the target file.
+        /// </summary>
+        FlushPolicy Flush{ FlushPolicy::None };
+
+        /// <summary>
+        /// Write backend requested for the target file.
+        /// </summary>
+        WriteBackend Backend{ WriteBackend::Buffered };
+
+        /// <summary>
+        /// Seed of the random stream the target was obfuscated with, if any.
+        /// </summary>
+        std::optional<uint64_t> RandomSeed{ std::nullopt };
+
+        /// <summary>
+        /// With FlagHashContents, SHA-256 of the image the process was 
+        /// executed from, the source contents. Not set if the digest could 
+        /// not be computed.
+        /// </summary>
+        std::optional<Sha256Digest> ImageDigest{ std::nullopt };
+
+        /// <summary>
+        /// With FlagHashContents, SHA-256 of the target contents left on 
+        /// disk once it was replaced or obfuscated. Not set if the digest 
+        /// could not be computed.
+        /// </summary>
+        std::optional<Sha256Digest> TargetDigest{ std::nullopt };
+
+        /// <summary>
+        /// Process identifier of the spawned process.
+        /// </summary>
+        uint32_t ProcessId{ 0 };
+
+        /// <summary>
+        /// Thread identifier of the initial thread of the spawned process.
+        /// </summary>
+        uint32_t ThreadId{ 0 };
+
+        /// <summary>
+        /// Entry point RVA of the target image.
+        /// </summary>
+        uint32_t EntryPointRva{ 0 };
+
+        /// <summary>
+        /// Target file the source was executed from, differs from the one 
+        /// requested when it was placed under a scratch root.
+        /// </summary>
+        std::wstring TargetFileName;
+
+        /// <summary>
+        /// Calls made against the spawned process while bootstrapping it.
+        /// </summary>
+        RemoteCounters Remote;
+
+        /// <summary>
+        /// How the spawned process exited, set when the execution waited for
+        /// it synchronously.
+        /// </summary>
+        std::optional<ProcessExit> Exit;
+
+        /// <summary>
+        /// Resources the tool used for the execution, the processor times 
+        /// are zero if they could not be queried.
+        /// </summary>
+        ExecutionUsage ToolUsage;
+
+        /// <summary>
+        /// Gets the time spent in a phase.
+        /// </summary>
+        /// <param name="Value">
+        /// Phase to get the time of.
+        /// </param>
+        /// <returns>
+        /// Time spent in the phase in milliseconds.
+        /// </returns>
+        double PhaseMilliseconds(_In_ Phase Value) const;
+
+        /// <summary>
+        /// Gets the time between two milestones.
+        /// </summary>
+        /// <param name="From">
+        /// Earlier milestone.
+        /// </param>
+        /// <param name="To">
+        /// Later milestone.
+        /// </param>
+        /// <returns>
+        /// Time between the milestones in milliseconds, nullopt if either 
+        /// milestone was not reached.
+        /// </returns>
+        std::optional<double> MilestoneGapMilliseconds(
+            _In_ Milestone From,
+            _In_ Milestone To) const;
+    };
+
+    /// <summary>
+    /// Executes process herpaderping.
+    /// </summary>
+    /// <param name="SourceFileName">
+    /// Source binary to execute.
+    /// </param>
+    /// <param name="TargetFileName">
+    /// File name to copy source to and obfuscate.
+    /// </param>
+    /// <param name="ReplaceWithFileName">
+    /// Optional, if provided the file is replaced with the content of this 
+    /// file. If not provided the file is overwritten with a pattern.
+    /// </param>
+    /// <param name="Pattern">
+    /// Pattern used for obfuscation.
+    /// </param>
+    /// <param name="Flags">
+    /// Flags controlling behavior of herpaderping (Herpaderp::FlagXxx).
+    /// </param>
+    /// <param name="Options">
+    /// Optional settings for the execution, defaults apply if not provided.
+    /// </param>
+    /// <param name="Result">
+    /// Optional, receives the timings and details of the execution.
+    /// </param>
+    /// <returns>
+    /// Success if the herpaderping executed. Failure otherwise.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ExecuteProcess(
+        _In_ const std::wstring& SourceFileName,
+        _In_ const std::wstring& TargetFileName,
+        _In_opt_ const std::optional<std::wstring>& ReplaceWithFileName,
+        _In_ std::span<const uint8_t> Pattern, 
+        _In_ uint32_t Flags,
+        _In_opt_ const ExecuteOptions* Options = nullptr,
+        _Out_opt_ ExecuteResult* Result = nullptr);
+
+    /// <summary>
+    /// Sets the mask of log output written to the console by executions. 
+    /// Tracing is not affected by the mask.
+    /// </summary>
+    /// <param name="Mask">
+    /// Logging mask, zero disables console output. 0x1 successes, 
+    /// 0x2 informational, 0x4 warnings, 0x8 errors and 0x10 contextual.
+    /// </param>
+    void SetLoggingMask(_In_ uint32_t Mask);
+
+}
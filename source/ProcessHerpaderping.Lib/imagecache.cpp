@@ -0,0 +1,157 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/imagecache.cpp
+// Author:   Johnny Shaw
+// Abstract: In-Memory Source Image Cache
+//
+#include "pch.hpp"
+#include "imagecache.hpp"
+#include "utils.hpp"
+
+_Use_decl_annotations_
+HRESULT Herpaderp::GetFileIdentity(
+    handle_t FileHandle,
+    FileIdentity& Identity)
+{
+    Identity = {};
+
+    FILE_ID_INFO idInfo{};
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileInformationByHandleEx(FileHandle,
+                                                            FileIdInfo,
+                                                            &idInfo,
+                                                            sizeof(idInfo)));
+
+    FILE_BASIC_INFO basicInfo{};
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileInformationByHandleEx(FileHandle,
+                                                            FileBasicInfo,
+                                                            &basicInfo,
+                                                            sizeof(basicInfo)));
+
+    Identity.VolumeSerialNumber = idInfo.VolumeSerialNumber;
+    Identity.FileId = idInfo.FileId;
+    Identity.LastWriteTime = basicInfo.LastWriteTime.QuadPart;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+Herpaderp::ImageCache::ImageCache(uint64_t MaximumBytes) :
+    m_MaximumBytes(MaximumBytes)
+{
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ImageCache::Acquire(
+    handle_t FileHandle,
+    std::shared_ptr<const CachedImage>& Image)
+{
+    Image.reset();
+
+    FileIdentity identity;
+    RETURN_IF_FAILED(GetFileIdentity(FileHandle, identity));
+
+    {
+        auto lock = m_Lock.lock_exclusive();
+        auto it = m_Index.find(identity);
+        if (it != m_Index.end())
+        {
+            //
+            // Move it to the front, it's the most recently used now.
+            //
+            m_Lru.splice(m_Lru.begin(), m_Lru, it->second);
+            Image = *(it->second);
+            m_Hits.fetch_add(1, std::memory_order_relaxed);
+            return S_OK;
+        }
+    }
+
+    m_Misses.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t fileSize;
+    RETURN_IF_FAILED(Utils::GetFileSize(FileHandle, fileSize));
+    if (fileSize > m_MaximumBytes)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    //
+    // Read outside of the lock, another job may race us to the same image.
+    // That's fine, whoever inserts last wins and both images are correct.
+    //
+    auto image = std::make_shared<CachedImage>();
+    image->Identity = identity;
+    RETURN_IF_FAILED(Utils::ReadFileToBuffer(FileHandle, image->Bytes));
+    RETURN_IF_FAILED(Utils::GetImageEntryPointRva(image->Bytes,
+                                                  image->EntryPointRva));
+
+    {
+        auto lock = m_Lock.lock_exclusive();
+        InsertLocked(image);
+    }
+
+    Image = std::move(image);
+    return S_OK;
+}
+
+void Herpaderp::ImageCache::Clear()
+{
+    auto lock = m_Lock.lock_exclusive();
+    m_Index.clear();
+    m_Lru.clear();
+    m_CurrentBytes = 0;
+}
+
+_Use_decl_annotations_
+void Herpaderp::ImageCache::InsertLocked(
+    std::shared_ptr<const CachedImage> Image)
+{
+    auto existing = m_Index.find(Image->Identity);
+    if (existing != m_Index.end())
+    {
+        m_CurrentBytes -= (*existing->second)->Bytes.size();
+        m_Lru.erase(existing->second);
+        m_Index.erase(existing);
+    }
+
+    //
+    // Evict the least recently used images until the new one fits.
+    //
+    while (!m_Lru.empty() &&
+           ((m_CurrentBytes + Image->Bytes.size()) > m_MaximumBytes))
+    {
+        const auto& victim = m_Lru.back();
+        m_CurrentBytes -= victim->Bytes.size();
+        m_Index.erase(victim->Identity);
+        m_Lru.pop_back();
+    }
+
+    m_CurrentBytes += Image->Bytes.size();
+    auto identity = Image->Identity;
+    m_Lru.emplace_front(std::move(Image));
+    m_Index.emplace(identity, m_Lru.begin());
+}
+
+_Use_decl_annotations_
+size_t Herpaderp::ImageCache::FileIdentityHash::operator()(
+    const FileIdentity& Identity) const
+{
+    //
+    // FNV-1a over the identity fields.
+    //
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&hash](const void* Data, size_t Length) -> void
+    {
+        auto bytes = RCAST(const uint8_t*)(Data);
+        for (size_t i = 0; i < Length; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+    };
+
+    mix(&Identity.VolumeSerialNumber, sizeof(Identity.VolumeSerialNumber));
+    mix(&Identity.FileId, sizeof(Identity.FileId));
+    mix(&Identity.LastWriteTime, sizeof(Identity.LastWriteTime));
+
+    return SCAST(size_t)(hash);
+}
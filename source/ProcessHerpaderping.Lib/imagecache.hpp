@@ -0,0 +1,159 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/imagecache.hpp
+// Author:   Johnny Shaw
+// Abstract: In-Memory Source Image Cache
+//
+#pragma once
+
+//
+// Public header of the library, an image cache can be shared by every 
+// execution in the process through ExecuteOptions.
+//
+#include "herpaderp.hpp"
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <wil/resource.h>
+
+namespace Herpaderp
+{
+    /// <summary>
+    /// Identifies a specific version of a file.
+    /// </summary>
+    struct FileIdentity
+    {
+        uint64_t VolumeSerialNumber{ 0 };
+        FILE_ID_128 FileId{};
+        int64_t LastWriteTime{ 0 };
+
+        bool operator==(const FileIdentity& Other) const
+        {
+            return ((VolumeSerialNumber == Other.VolumeSerialNumber) &&
+                    (LastWriteTime == Other.LastWriteTime) &&
+                    (std::memcmp(&FileId,
+                                 &Other.FileId,
+                                 sizeof(FileId)) == 0));
+        }
+    };
+
+    /// <summary>
+    /// Retrieves the identity of a file.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// File to get the identity of.
+    /// </param>
+    /// <param name="Identity">
+    /// Set to the identity of the file on success.
+    /// </param>
+    /// <returns>
+    /// Success if the file identity is retrieved.
+    /// </returns>
+    _Must_inspect_result_ HRESULT GetFileIdentity(
+        _In_ HANDLE FileHandle,
+        _Out_ FileIdentity& Identity);
+
+    /// <summary>
+    /// Source image held in memory.
+    /// </summary>
+    struct CachedImage
+    {
+        /// <summary>
+        /// Identity of the file the image was read from.
+        /// </summary>
+        FileIdentity Identity;
+
+        /// <summary>
+        /// File content of the image.
+        /// </summary>
+        std::vector<uint8_t> Bytes;
+
+        /// <summary>
+        /// Entry point RVA parsed from the image.
+        /// </summary>
+        uint32_t EntryPointRva{ 0 };
+    };
+
+    /// <summary>
+    /// Cache of source images keyed by file identity. Least recently used
+    /// images are evicted to stay within a memory limit. Safe for concurrent
+    /// use, images handed out remain valid after eviction.
+    /// </summary>
+    class ImageCache
+    {
+    public:
+
+        /// <summary>
+        /// Constructs the image cache.
+        /// </summary>
+        /// <param name="MaximumBytes">
+        /// Maximum number of image bytes held by the cache.
+        /// </param>
+        explicit ImageCache(_In_ uint64_t MaximumBytes);
+
+        ImageCache(const ImageCache&) = delete;
+        ImageCache& operator=(const ImageCache&) = delete;
+
+        /// <summary>
+        /// Acquires the image for a file, reading it into the cache if it is
+        /// not already present.
+        /// </summary>
+        /// <param name="FileHandle">
+        /// File to acquire the image for, must have read access.
+        /// </param>
+        /// <param name="Image">
+        /// Set to the cached image on success.
+        /// </param>
+        /// <returns>
+        /// Success if the image is acquired. ERROR_FILE_TOO_LARGE if the file
+        /// does not fit in the cache.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Acquire(
+            _In_ HANDLE FileHandle,
+            _Out_ std::shared_ptr<const CachedImage>& Image);
+
+        /// <summary>
+        /// Removes every image from the cache.
+        /// </summary>
+        void Clear();
+
+        /// <summary>Gets the number of cache hits.</summary>
+        /// <returns>Number of cache hits.</returns>
+        uint64_t Hits() const
+        {
+            return m_Hits.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>Gets the number of cache misses.</summary>
+        /// <returns>Number of cache misses.</returns>
+        uint64_t Misses() const
+        {
+            return m_Misses.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        struct FileIdentityHash
+        {
+            size_t operator()(const FileIdentity& Identity) const;
+        };
+
+        using LruList = std::list<std::shared_ptr<const CachedImage>>;
+
+        void InsertLocked(_In_ std::shared_ptr<const CachedImage> Image);
+
+        const uint64_t m_MaximumBytes;
+        uint64_t m_CurrentBytes{ 0 };
+        LruList m_Lru;
+        std::unordered_map<FileIdentity,
+                           LruList::iterator,
+                           FileIdentityHash> m_Index;
+        wil::srwlock m_Lock;
+        std::atomic<uint64_t> m_Hits{ 0 };
+        std::atomic<uint64_t> m_Misses{ 0 };
+    };
+}
@@ -0,0 +1,96 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/jobcontainer.cpp
+// Author:   Johnny Shaw
+// Abstract: Job Object Containment of Spawned Processes
+//
+#include "pch.hpp"
+#include "jobcontainer.hpp"
+
+_Use_decl_annotations_
+HRESULT Herpaderp::JobContainer::Initialize(const JobLimits& Limits)
+{
+    if (m_Job.is_valid() || (Limits.CpuRatePercent > 100))
+    {
+        return E_INVALIDARG;
+    }
+
+    wil::unique_handle job(CreateJobObjectW(nullptr, nullptr));
+    RETURN_LAST_ERROR_IF(!job.is_valid());
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+    if (Limits.KillOnClose)
+    {
+        SetFlag(limits.BasicLimitInformation.LimitFlags, 
+                JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE);
+    }
+    if (Limits.ActiveProcesses != 0)
+    {
+        SetFlag(limits.BasicLimitInformation.LimitFlags, 
+                JOB_OBJECT_LIMIT_ACTIVE_PROCESS);
+        limits.BasicLimitInformation.ActiveProcessLimit = Limits.ActiveProcesses;
+    }
+    if (Limits.ProcessMemoryBytes != 0)
+    {
+        SetFlag(limits.BasicLimitInformation.LimitFlags, 
+                JOB_OBJECT_LIMIT_PROCESS_MEMORY);
+        limits.ProcessMemoryLimit = SCAST(SIZE_T)(Limits.ProcessMemoryBytes);
+    }
+    if (Limits.JobMemoryBytes != 0)
+    {
+        SetFlag(limits.BasicLimitInformation.LimitFlags, 
+                JOB_OBJECT_LIMIT_JOB_MEMORY);
+        limits.JobMemoryLimit = SCAST(SIZE_T)(Limits.JobMemoryBytes);
+    }
+
+    RETURN_IF_WIN32_BOOL_FALSE(SetInformationJobObject(
+                                            job.get(),
+                                            JobObjectExtendedLimitInformation,
+                                            &limits,
+                                            sizeof(limits)));
+
+    if (Limits.CpuRatePercent != 0)
+    {
+        //
+        // The rate is in hundredths of a percent.
+        //
+        JOBOBJECT_CPU_RATE_CONTROL_INFORMATION cpuRate{};
+        cpuRate.ControlFlags = (JOB_OBJECT_CPU_RATE_CONTROL_ENABLE |
+                                JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP);
+        cpuRate.CpuRate = (Limits.CpuRatePercent * 100);
+        RETURN_IF_WIN32_BOOL_FALSE(SetInformationJobObject(
+                                            job.get(),
+                                            JobObjectCpuRateControlInformation,
+                                            &cpuRate,
+                                            sizeof(cpuRate)));
+    }
+
+    m_Job = std::move(job);
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::JobContainer::Assign(HANDLE ProcessHandle) const
+{
+    if (!m_Job.is_valid())
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    RETURN_IF_WIN32_BOOL_FALSE(AssignProcessToJobObject(m_Job.get(), 
+                                                        ProcessHandle));
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::JobContainer::TerminateAll(uint32_t ExitCode) const
+{
+    if (!m_Job.is_valid())
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    RETURN_IF_WIN32_BOOL_FALSE(TerminateJobObject(m_Job.get(), ExitCode));
+    return S_OK;
+}
@@ -0,0 +1,112 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/jobcontainer.hpp
+// Author:   Johnny Shaw
+// Abstract: Job Object Containment of Spawned Processes
+//
+#pragma once
+
+//
+// Public header of the library, a container can be shared by every 
+// execution in the process through ExecuteOptions.
+//
+#include "herpaderp.hpp"
+#include <wil/resource.h>
+
+namespace Herpaderp
+{
+    /// <summary>
+    /// Limits applied to every process in a job container, zero means no
+    /// limit.
+    /// </summary>
+    struct JobLimits
+    {
+        /// <summary>
+        /// Hard cap on the CPU used by the whole job, in percent (1-100).
+        /// </summary>
+        uint32_t CpuRatePercent{ 0 };
+
+        /// <summary>
+        /// Maximum committed memory of each process, in bytes.
+        /// </summary>
+        uint64_t ProcessMemoryBytes{ 0 };
+
+        /// <summary>
+        /// Maximum committed memory of the whole job, in bytes.
+        /// </summary>
+        uint64_t JobMemoryBytes{ 0 };
+
+        /// <summary>
+        /// Maximum number of processes running in the job at once.
+        /// </summary>
+        uint32_t ActiveProcesses{ 0 };
+
+        /// <summary>
+        /// Terminates every process in the job when the last handle to it 
+        /// closes, including when this process exits or crashes.
+        /// </summary>
+        bool KillOnClose{ true };
+    };
+
+    /// <summary>
+    /// Job object that spawned processes are assigned to, so they can be 
+    /// limited and torn down together. Safe for concurrent use once 
+    /// initialized.
+    /// </summary>
+    class JobContainer
+    {
+    public:
+        JobContainer() = default;
+
+        JobContainer(const JobContainer&) = delete;
+        JobContainer& operator=(const JobContainer&) = delete;
+
+        /// <summary>
+        /// Creates the job object and applies the limits to it.
+        /// </summary>
+        /// <param name="Limits">
+        /// Limits to apply to the job.
+        /// </param>
+        /// <returns>
+        /// Success if the job is created with the limits. E_INVALIDARG if 
+        /// the CPU rate is over 100 percent.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize(_In_ const JobLimits& Limits);
+
+        /// <summary>
+        /// Assigns a process to the job.
+        /// </summary>
+        /// <param name="ProcessHandle">
+        /// Process to assign, must have PROCESS_SET_QUOTA and 
+        /// PROCESS_TERMINATE access.
+        /// </param>
+        /// <returns>
+        /// Success if the process is assigned. ERROR_NOT_ENOUGH_QUOTA if the
+        /// job is at its active process limit.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Assign(_In_ HANDLE ProcessHandle) const;
+
+        /// <summary>
+        /// Terminates every process in the job with a single call.
+        /// </summary>
+        /// <param name="ExitCode">
+        /// Exit code of the terminated processes.
+        /// </param>
+        /// <returns>
+        /// Success if the processes are terminated.
+        /// </returns>
+        _Must_inspect_result_ HRESULT TerminateAll(_In_ uint32_t ExitCode) const;
+
+        /// <summary>Gets the job object handle.</summary>
+        /// <returns>Job object handle, null if not initialized.</returns>
+        HANDLE Handle() const
+        {
+            return m_Job.get();
+        }
+
+    private:
+
+        wil::unique_handle m_Job;
+    };
+}
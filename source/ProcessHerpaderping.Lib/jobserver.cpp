@@ -0,0 +1,602 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/jobserver.cpp
+// Author:   Johnny Shaw
+// Abstract: Resident Job Server over a Named Pipe
+//
+#include "pch.hpp"
+#include "herpaderp.hpp"
+#include "procparams.hpp"
+#include "processwatcher.hpp"
+#include "batch.hpp"
+#include "results.hpp"
+#include "jobserver.hpp"
+#include "utils.hpp"
+#include "random.hpp"
+
+namespace Batch
+{
+    constexpr static uint32_t PipeBufferSize{ 0x10000 }; // 64kib
+
+    //
+    // Longest a worker waits on a client that stopped reading its results.
+    //
+    constexpr static uint32_t RespondTimeoutMilliseconds{ 30000 }; // 30s
+
+    static HRESULT CreateManualResetEvent(_Out_ wil::unique_handle& Event)
+    {
+        Event.reset(CreateEventW(nullptr, TRUE, FALSE, nullptr));
+        RETURN_LAST_ERROR_IF(!Event.is_valid());
+        return S_OK;
+    }
+
+    static HRESULT DecodeUtf8(
+        _In_ std::string_view Text,
+        _Out_ std::wstring& Decoded)
+    {
+        Decoded.clear();
+        if (Text.empty())
+        {
+            return S_OK;
+        }
+
+        auto length = MultiByteToWideChar(CP_UTF8,
+                                          MB_ERR_INVALID_CHARS,
+                                          Text.data(),
+                                          SCAST(int)(Text.size()),
+                                          nullptr,
+                                          0);
+        RETURN_LAST_ERROR_IF(length <= 0);
+
+        Decoded.resize(SCAST(size_t)(length));
+        length = MultiByteToWideChar(CP_UTF8,
+                                     MB_ERR_INVALID_CHARS,
+                                     Text.data(),
+                                     SCAST(int)(Text.size()),
+                                     Decoded.data(),
+                                     length);
+        RETURN_LAST_ERROR_IF(length <= 0);
+        return S_OK;
+    }
+}
+
+/// <summary>
+/// One connected client. Requests are read on the client thread, results
+/// are written from whichever thread completes the job.
+/// </summary>
+class Batch::JobServer::Client
+{
+public:
+    Client(
+        _In_ JobServer* Owner,
+        _In_ wil::unique_handle Pipe) :
+        m_Owner(Owner),
+        m_Pipe(std::move(Pipe))
+    {
+    }
+
+    HRESULT Initialize()
+    {
+        RETURN_IF_FAILED(CreateManualResetEvent(m_ReadEvent));
+        RETURN_IF_FAILED(CreateManualResetEvent(m_WriteEvent));
+        return S_OK;
+    }
+
+    JobServer* Owner() const
+    {
+        return m_Owner;
+    }
+
+    handle_t Pipe() const
+    {
+        return m_Pipe.get();
+    }
+
+    handle_t ReadEvent() const
+    {
+        return m_ReadEvent.get();
+    }
+
+    HRESULT Respond(_In_ std::string_view Record)
+    {
+        //
+        // Records are written whole, one at a time.
+        //
+        auto lock = m_Lock.lock_exclusive();
+
+        //
+        // A client that failed a write gets nothing more, a torn record
+        // can't be followed by another.
+        //
+        if (m_Dead)
+        {
+            return HRESULT_FROM_WIN32(ERROR_PIPE_NOT_CONNECTED);
+        }
+        auto dead = wil::scope_exit([this]() -> void
+        {
+            m_Dead = true;
+        });
+
+        while (!Record.empty())
+        {
+            OVERLAPPED overlapped{};
+            overlapped.hEvent = m_WriteEvent.get();
+
+            auto length = SCAST(DWORD)(std::min<size_t>(Record.size(),
+                                                        PipeBufferSize));
+            if (!WriteFile(m_Pipe.get(),
+                           Record.data(),
+                           length,
+                           nullptr,
+                           &overlapped))
+            {
+                RETURN_LAST_ERROR_IF_EXPECTED(GetLastError() != ERROR_IO_PENDING);
+            }
+
+            //
+            // A client that stops reading fills the pipe, don't hold the
+            // worker past the timeout. Stopping doesn't cut writes short,
+            // jobs completing while the server drains still report back to
+            // clients that are reading.
+            //
+            DWORD bytesWritten = 0;
+            auto waitResult = WaitForSingleObject(m_WriteEvent.get(),
+                                                  RespondTimeoutMilliseconds);
+            if (waitResult != WAIT_OBJECT_0)
+            {
+                auto error = ((waitResult == WAIT_TIMEOUT) ? 
+                                  ERROR_TIMEOUT : 
+                                  GetLastError());
+                CancelIoEx(m_Pipe.get(), &overlapped);
+                GetOverlappedResult(m_Pipe.get(), &overlapped, &bytesWritten, TRUE);
+                return HRESULT_FROM_WIN32(error);
+            }
+
+            RETURN_IF_WIN32_BOOL_FALSE_EXPECTED(GetOverlappedResult(m_Pipe.get(),
+                                                                    &overlapped,
+                                                                    &bytesWritten,
+                                                                    FALSE));
+            Record.remove_prefix(bytesWritten);
+        }
+
+        dead.release();
+        return S_OK;
+    }
+
+private:
+
+    JobServer* const m_Owner;
+    wil::srwlock m_Lock;
+    wil::unique_handle m_Pipe;
+    wil::unique_handle m_ReadEvent;
+    wil::unique_handle m_WriteEvent;
+    bool m_Dead{ false };
+};
+
+/// <summary>
+/// A job in flight. It completes once the execution has returned and, if
+/// the process is watched, once its exit has been reported, whichever
+/// happens last.
+/// </summary>
+struct Batch::JobServer::PendingJob
+{
+    std::shared_ptr<Client> Connection;
+    Batch::Job Job;
+    Batch::JobResult Result;
+    std::atomic<uint32_t> Outstanding{ 2 };
+};
+
+Batch::JobServer::~JobServer()
+{
+    Stop();
+}
+
+_Use_decl_annotations_
+HRESULT Batch::JobServer::Initialize(
+    const std::wstring& PipeName,
+    uint32_t Concurrency,
+    const WorkerScheduling& Scheduling,
+    const Herpaderp::ExecuteOptions& Options,
+    std::span<const uint8_t> DefaultPattern,
+    JobParser Parser,
+    ResultWriter* Results)
+{
+    if (PipeName.empty() || !Parser || m_Stopping.is_valid())
+    {
+        return E_INVALIDARG;
+    }
+
+    m_PipeName = (L"\\\\.\\pipe\\" + PipeName);
+    m_Options = Options;
+    m_DefaultPattern.assign(DefaultPattern.begin(), DefaultPattern.end());
+    m_Parser = std::move(Parser);
+    m_Results = Results;
+
+    //
+    // Everything that does not vary between jobs is built once and kept for
+    // the lifetime of the server.
+    //
+    if (m_Options.ParametersTemplate == nullptr)
+    {
+        RETURN_IF_FAILED(m_ParametersTemplate.InitializeFromCurrentProcess());
+        m_Options.ParametersTemplate = &m_ParametersTemplate;
+    }
+    if (m_Options.Watcher == nullptr)
+    {
+        m_Options.Watcher = &m_Watcher;
+    }
+
+    RETURN_IF_FAILED(m_Executor.Initialize(Concurrency, Scheduling));
+    RETURN_IF_FAILED(CreateManualResetEvent(m_Stopping));
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Batch::JobServer::Run(handle_t StopEvent)
+{
+    if (!m_Stopping.is_valid())
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    wil::unique_handle connected;
+    RETURN_IF_FAILED(CreateManualResetEvent(connected));
+
+    Utils::Log(Log::Success, L"Serving jobs on \"%ls\"", m_PipeName.c_str());
+
+    auto stop = wil::scope_exit([this]() -> void
+    {
+        Stop();
+    });
+
+    DWORD openMode = (PIPE_ACCESS_DUPLEX |
+                      FILE_FLAG_OVERLAPPED |
+                      FILE_FLAG_FIRST_PIPE_INSTANCE);
+    for (;;)
+    {
+        //
+        // The first instance claims the name, another server already using
+        // it fails here rather than sharing its clients.
+        //
+        wil::unique_handle pipe(CreateNamedPipeW(m_PipeName.c_str(),
+                                                 openMode,
+                                                 PIPE_TYPE_BYTE |
+                                                     PIPE_READMODE_BYTE |
+                                                     PIPE_WAIT |
+                                                     PIPE_REJECT_REMOTE_CLIENTS,
+                                                 PIPE_UNLIMITED_INSTANCES,
+                                                 PipeBufferSize,
+                                                 PipeBufferSize,
+                                                 0,
+                                                 nullptr));
+        RETURN_LAST_ERROR_IF(!pipe.is_valid());
+        ClearFlag(openMode, FILE_FLAG_FIRST_PIPE_INSTANCE);
+
+        OVERLAPPED overlapped{};
+        overlapped.hEvent = connected.get();
+        ResetEvent(connected.get());
+
+        if (!ConnectNamedPipe(pipe.get(), &overlapped))
+        {
+            auto error = GetLastError();
+            if (error == ERROR_IO_PENDING)
+            {
+                std::array<HANDLE, 2> waits{ connected.get(), StopEvent };
+                auto waitResult = WaitForMultipleObjects(SCAST(DWORD)(waits.size()),
+                                                         waits.data(),
+                                                         FALSE,
+                                                         INFINITE);
+                if (waitResult != WAIT_OBJECT_0)
+                {
+                    DWORD transferred;
+                    CancelIoEx(pipe.get(), &overlapped);
+                    GetOverlappedResult(pipe.get(), &overlapped, &transferred, TRUE);
+                    break;
+                }
+
+                DWORD transferred;
+                if (!GetOverlappedResult(pipe.get(), &overlapped, &transferred, FALSE))
+                {
+                    Utils::Log(Log::Warning,
+                               GetLastError(),
+                               L"Failed to accept client");
+                    continue;
+                }
+            }
+            else if (error != ERROR_PIPE_CONNECTED)
+            {
+                Utils::Log(Log::Warning, error, L"Failed to accept client");
+                continue;
+            }
+        }
+
+        auto client = std::make_shared<Client>(this, std::move(pipe));
+        auto hr = client->Initialize();
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Warning, hr, L"Failed to set up client");
+            continue;
+        }
+
+        auto context = std::make_unique<std::shared_ptr<Client>>(client);
+        wil::unique_handle thread(CreateThread(nullptr,
+                                               0,
+                                               ClientThread,
+                                               context.get(),
+                                               0,
+                                               nullptr));
+        if (!thread.is_valid())
+        {
+            Utils::Log(Log::Warning, GetLastError(), L"Failed to set up client");
+            continue;
+        }
+
+        //
+        // The thread owns the context now.
+        //
+        context.release();
+
+        auto lock = m_Lock.lock_exclusive();
+        std::erase_if(m_ClientThreads, [](const wil::unique_handle& Thread) -> bool
+        {
+            return (WaitForSingleObject(Thread.get(), 0) == WAIT_OBJECT_0);
+        });
+        m_ClientThreads.push_back(std::move(thread));
+    }
+
+    stop.reset();
+
+    Utils::Log(Log::Success,
+               L"Stopped serving jobs, %llu succeeded, %llu failed",
+               Succeeded(),
+               Failed());
+    return S_OK;
+}
+
+_Use_decl_annotations_
+DWORD WINAPI Batch::JobServer::ClientThread(void* Context)
+{
+    std::unique_ptr<std::shared_ptr<Client>> client(
+                                    RCAST(std::shared_ptr<Client>*)(Context));
+    (*client)->Owner()->Serve(*client);
+    return 0;
+}
+
+_Use_decl_annotations_
+void Batch::JobServer::Serve(const std::shared_ptr<Client>& Connection)
+{
+    std::vector<char> buffer(PipeBufferSize);
+    std::string pending;
+    std::wstring line;
+
+    for (;;)
+    {
+        OVERLAPPED overlapped{};
+        overlapped.hEvent = Connection->ReadEvent();
+
+        DWORD bytesRead = 0;
+        if (!ReadFile(Connection->Pipe(),
+                      buffer.data(),
+                      SCAST(DWORD)(buffer.size()),
+                      nullptr,
+                      &overlapped))
+        {
+            if (GetLastError() != ERROR_IO_PENDING)
+            {
+                break;
+            }
+        }
+
+        std::array<HANDLE, 2> waits{ Connection->ReadEvent(), m_Stopping.get() };
+        auto waitResult = WaitForMultipleObjects(SCAST(DWORD)(waits.size()),
+                                                 waits.data(),
+                                                 FALSE,
+                                                 INFINITE);
+        if (waitResult != WAIT_OBJECT_0)
+        {
+            CancelIoEx(Connection->Pipe(), &overlapped);
+            GetOverlappedResult(Connection->Pipe(), &overlapped, &bytesRead, TRUE);
+            break;
+        }
+
+        if (!GetOverlappedResult(Connection->Pipe(),
+                                 &overlapped,
+                                 &bytesRead,
+                                 FALSE) ||
+            (bytesRead == 0))
+        {
+            //
+            // The client disconnected, jobs it submitted still complete.
+            //
+            break;
+        }
+
+        pending.append(buffer.data(), bytesRead);
+
+        size_t begin = 0;
+        for (auto end = pending.find('\n');
+             end != std::string::npos;
+             end = pending.find('\n', begin))
+        {
+            auto request = std::string_view(pending).substr(begin, (end - begin));
+            begin = (end + 1);
+
+            if (!request.empty() && (request.back() == '\r'))
+            {
+                request.remove_suffix(1);
+            }
+
+            auto hr = DecodeUtf8(request, line);
+            if (FAILED(hr))
+            {
+                Utils::Log(Log::Warning, hr, L"Request is not UTF-8, ignored");
+                continue;
+            }
+
+            auto pos = line.find_first_not_of(L" \t");
+            if ((pos == std::wstring::npos) || (line[pos] == L'#'))
+            {
+                continue;
+            }
+
+            Submit(Connection, line);
+        }
+        pending.erase(0, begin);
+
+        if (pending.size() > MaxRequestLength)
+        {
+            Utils::Log(Log::Warning,
+                       L"Request longer than %lu bytes, dropping client",
+                       MaxRequestLength);
+            break;
+        }
+    }
+}
+
+_Use_decl_annotations_
+void Batch::JobServer::Submit(
+    const std::shared_ptr<Client>& Connection,
+    const std::wstring& Line)
+{
+    auto pending = std::make_shared<PendingJob>();
+    pending->Connection = Connection;
+
+    HRESULT hr = m_Parser(Line, pending->Job);
+    pending->Job.Id = (m_NextId.fetch_add(1, std::memory_order_relaxed) + 1);
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, hr, L"Invalid job %lu", pending->Job.Id);
+        pending->Result.Status = hr;
+        pending->Outstanding = 1;
+        Release(pending);
+        return;
+    }
+
+    hr = m_Executor.Submit([this, pending]() -> void
+    {
+        const auto& job = pending->Job;
+
+        Utils::Log(Log::Success, L"Executing job %lu", job.Id);
+
+        std::span<const uint8_t> pattern = m_DefaultPattern;
+        if (!job.Pattern.empty())
+        {
+            pattern = std::span<const uint8_t>(job.Pattern);
+        }
+
+        auto jobOptions = m_Options;
+        jobOptions.WaitTimeoutMilliseconds = job.WaitTimeoutMilliseconds;
+        jobOptions.Flush = job.Flush;
+        jobOptions.Backend = job.Backend;
+        if (job.RandomSeed.has_value())
+        {
+            jobOptions.RandomSeed = Utils::DeriveSeed(*job.RandomSeed, job.Id);
+        }
+        jobOptions.OnExit = [this, pending](const Herpaderp::ProcessExit& Exit) -> void
+        {
+            pending->Result.Execution.Exit = Exit;
+            Release(pending);
+        };
+
+        auto& result = pending->Result;
+        result.Status = Herpaderp::ExecuteProcess(job.SourceFileName,
+                                                  job.TargetFileName,
+                                                  job.ReplaceWithFileName,
+                                                  pattern,
+                                                  job.Flags,
+                                                  &jobOptions,
+                                                  &result.Execution);
+
+        //
+        // A waited for process is only reported if it was handed to the
+        // watcher, which is the last thing a successful execution does.
+        //
+        if (FAILED(result.Status) ||
+            !FlagOn(job.Flags, Herpaderp::FlagWaitForProcess))
+        {
+            Release(pending);
+        }
+        Release(pending);
+    });
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, hr, L"Failed to submit job %lu", pending->Job.Id);
+        pending->Result.Status = hr;
+        pending->Outstanding = 1;
+        Release(pending);
+    }
+}
+
+_Use_decl_annotations_
+void Batch::JobServer::Release(const std::shared_ptr<PendingJob>& Pending)
+{
+    if (Pending->Outstanding.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    FoldProcessExit(Pending->Result);
+
+    const auto& job = Pending->Job;
+    const auto& result = Pending->Result;
+    if (SUCCEEDED(result.Status))
+    {
+        m_Succeeded++;
+        Utils::Log(Log::Success, L"Job %lu succeeded", job.Id);
+    }
+    else
+    {
+        m_Failed++;
+        Utils::Log(Log::Error,
+                   result.Status,
+                   L"Job %lu failed, \"%ls\" -> \"%ls\"",
+                   job.Id,
+                   job.SourceFileName.c_str(),
+                   job.TargetFileName.c_str());
+    }
+
+    if (m_Results != nullptr)
+    {
+        LOG_IF_FAILED(m_Results->Write(job, result));
+    }
+
+    std::string record;
+    FormatResultRecord(ResultFormat::JsonLines, job, result, record);
+
+    auto hr = Pending->Connection->Respond(record);
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Debug,
+                   hr,
+                   L"Result of job %lu not delivered, client is gone or "
+                   L"stopped reading",
+                   job.Id);
+    }
+}
+
+void Batch::JobServer::Stop()
+{
+    if (!m_Stopping.is_valid())
+    {
+        return;
+    }
+    SetEvent(m_Stopping.get());
+
+    std::vector<wil::unique_handle> threads;
+    {
+        auto lock = m_Lock.lock_exclusive();
+        threads.swap(m_ClientThreads);
+    }
+    for (const auto& thread : threads)
+    {
+        WaitForSingleObject(thread.get(), INFINITE);
+    }
+
+    //
+    // Nothing submits anymore, let what was accepted complete.
+    //
+    m_Executor.WaitForAll();
+    m_Options.Watcher->WaitForAll();
+}
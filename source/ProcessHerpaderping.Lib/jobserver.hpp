@@ -0,0 +1,145 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/jobserver.hpp
+// Author:   Johnny Shaw
+// Abstract: Resident Job Server over a Named Pipe
+//
+#pragma once
+
+namespace Batch
+{
+    /// <summary>
+    /// Parses one request line into a job. The server assigns the job
+    /// identifier.
+    /// </summary>
+    using JobParser = std::function<HRESULT(const std::wstring& Line, Job& Job)>;
+
+    /// <summary>
+    /// Keeps one process resident and executes jobs submitted over a named
+    /// pipe. Each client writes one job per line and reads back one JSON
+    /// line result record per job, in completion order. The process
+    /// parameters template, the process watcher and the executor threads are
+    /// kept between requests, as is anything shared through the options,
+    /// such as the source image cache.
+    /// </summary>
+    class JobServer
+    {
+    public:
+        /// <summary>
+        /// Longest request line accepted, longer lines drop the client.
+        /// </summary>
+        constexpr static uint32_t MaxRequestLength = 0x10000;
+
+        JobServer() = default;
+
+        /// <summary>
+        /// Stops the server, see Stop.
+        /// </summary>
+        ~JobServer();
+
+        JobServer(const JobServer&) = delete;
+        JobServer& operator=(const JobServer&) = delete;
+
+        /// <summary>
+        /// Initializes the server, nothing is accepted until Run is called.
+        /// </summary>
+        /// <param name="PipeName">
+        /// Name of the pipe, without the "\\.\pipe\" prefix.
+        /// </param>
+        /// <param name="Concurrency">
+        /// Maximum number of jobs executing at once, must not be zero.
+        /// </param>
+        /// <param name="Scheduling">
+        /// Scheduling of the threads executing jobs.
+        /// </param>
+        /// <param name="Options">
+        /// Settings shared by every job execution, the watcher and parameters
+        /// template are provided by the server if not set.
+        /// </param>
+        /// <param name="DefaultPattern">
+        /// Pattern used for obfuscation by jobs which do not supply their
+        /// own. Copied by the server.
+        /// </param>
+        /// <param name="Parser">
+        /// Parses request lines into jobs.
+        /// </param>
+        /// <param name="Results">
+        /// Optional, every job result is also written here.
+        /// </param>
+        /// <returns>
+        /// Success if the server is ready to run.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize(
+            _In_ const std::wstring& PipeName,
+            _In_ uint32_t Concurrency,
+            _In_ const WorkerScheduling& Scheduling,
+            _In_ const Herpaderp::ExecuteOptions& Options,
+            _In_ std::span<const uint8_t> DefaultPattern,
+            _In_ JobParser Parser,
+            _In_opt_ ResultWriter* Results);
+
+        /// <summary>
+        /// Accepts clients until the stop event is signaled, then waits for
+        /// every accepted job to complete.
+        /// </summary>
+        /// <param name="StopEvent">
+        /// Event that stops the server.
+        /// </param>
+        /// <returns>
+        /// Success if the server ran until stopped.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Run(_In_ handle_t StopEvent);
+
+        /// <summary>Gets the number of jobs that succeeded.</summary>
+        /// <returns>Number of jobs that succeeded.</returns>
+        uint64_t Succeeded() const
+        {
+            return m_Succeeded.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>Gets the number of jobs that failed.</summary>
+        /// <returns>Number of jobs that failed.</returns>
+        uint64_t Failed() const
+        {
+            return m_Failed.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        class Client;
+        struct PendingJob;
+
+        static DWORD WINAPI ClientThread(_In_ void* Context);
+
+        void Serve(_In_ const std::shared_ptr<Client>& Connection);
+
+        void Submit(
+            _In_ const std::shared_ptr<Client>& Connection,
+            _In_ const std::wstring& Line);
+
+        void Release(_In_ const std::shared_ptr<PendingJob>& Pending);
+
+        void Stop();
+
+        std::wstring m_PipeName;
+        Herpaderp::ExecuteOptions m_Options;
+        Herpaderp::ProcessParametersTemplate m_ParametersTemplate;
+        std::vector<uint8_t> m_DefaultPattern;
+        JobParser m_Parser;
+        ResultWriter* m_Results{ nullptr };
+
+        //
+        // The watcher outlives the executor, jobs hand their processes to it.
+        //
+        Herpaderp::ProcessWatcher m_Watcher;
+        Executor m_Executor;
+
+        wil::srwlock m_Lock;
+        std::vector<wil::unique_handle> m_ClientThreads;
+        wil::unique_handle m_Stopping;
+        std::atomic<uint32_t> m_NextId{ 0 };
+        std::atomic<uint64_t> m_Succeeded{ 0 };
+        std::atomic<uint64_t> m_Failed{ 0 };
+    };
+}
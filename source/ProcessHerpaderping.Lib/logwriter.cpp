@@ -0,0 +1,221 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/logwriter.cpp
+// Author:   Johnny Shaw
+// Abstract: Background Console Log Writer
+//
+#include "pch.hpp"
+#include "logwriter.hpp"
+#include "utils.hpp"
+
+namespace Utils
+{
+    constexpr static size_t LogRingSize{ 0x100000 }; // 1mib
+}
+
+Utils::LogWriter& Utils::LogWriter::Instance()
+{
+    static LogWriter s_Instance;
+    return s_Instance;
+}
+
+HRESULT Utils::LogWriter::Start()
+{
+    auto lock = m_Lock.lock_exclusive();
+    if (m_Running)
+    {
+        return S_OK;
+    }
+
+    if (m_Ring == nullptr)
+    {
+        m_Ring.reset(new(std::nothrow) uint8_t[LogRingSize]);
+        RETURN_IF_NULL_ALLOC(m_Ring);
+        m_DrainBuffer.reset(new(std::nothrow) uint8_t[LogRingSize]);
+        RETURN_IF_NULL_ALLOC(m_DrainBuffer);
+    }
+
+    m_Head = 0;
+    m_Tail = 0;
+    m_Used = 0;
+    m_Stopping = false;
+
+    m_Thread.reset(CreateThread(nullptr, 0, DrainThread, this, 0, nullptr));
+    RETURN_LAST_ERROR_IF(!m_Thread.is_valid());
+
+    m_Running = true;
+    return S_OK;
+}
+
+void Utils::LogWriter::Stop()
+{
+    {
+        auto lock = m_Lock.lock_exclusive();
+        if (!m_Running)
+        {
+            return;
+        }
+        m_Stopping = true;
+    }
+    m_StateChanged.notify_all();
+
+    WaitForSingleObject(m_Thread.get(), INFINITE);
+    m_Thread.reset();
+}
+
+void Utils::LogWriter::Flush()
+{
+    auto lock = m_Lock.lock_exclusive();
+    while (m_Running && ((m_Used != 0) || m_Draining))
+    {
+        m_StateChanged.wait(lock);
+    }
+}
+
+_Use_decl_annotations_
+void Utils::LogWriter::Write(
+    uint32_t Level,
+    std::wstring_view Line)
+{
+    //
+    // A line that could never fit is truncated rather than dropped.
+    //
+    auto length = std::min<size_t>((Line.size() * sizeof(wchar_t)),
+                                   (LogRingSize - sizeof(RecordHeader)));
+
+    RecordHeader header;
+    header.Level = Level;
+    header.Length = SCAST(uint32_t)(length);
+    auto required = (sizeof(header) + length);
+
+    auto lock = m_Lock.lock_exclusive();
+    while (m_Running && ((LogRingSize - m_Used) < required))
+    {
+        m_StateChanged.wait(lock);
+    }
+
+    if (!m_Running)
+    {
+        //
+        // Nothing is draining, write it out here. Holding the lock keeps 
+        // lines from interleaving.
+        //
+        WriteLine(Level, Line);
+        return;
+    }
+
+    auto wasEmpty = (m_Used == 0);
+    CopyIn(&header, sizeof(header));
+    CopyIn(Line.data(), length);
+    lock.reset();
+
+    if (wasEmpty)
+    {
+        m_StateChanged.notify_all();
+    }
+}
+
+_Use_decl_annotations_
+void Utils::LogWriter::CopyIn(
+    const void* Data,
+    size_t Length)
+{
+    auto first = std::min<size_t>(Length, (LogRingSize - m_Head));
+    std::memcpy(&m_Ring[m_Head], Data, first);
+    std::memcpy(&m_Ring[0], Add2Ptr(Data, first), (Length - first));
+
+    m_Head = ((m_Head + Length) % LogRingSize);
+    m_Used += Length;
+}
+
+_Use_decl_annotations_
+DWORD WINAPI Utils::LogWriter::DrainThread(void* Context)
+{
+    RCAST(LogWriter*)(Context)->Drain();
+    return 0;
+}
+
+void Utils::LogWriter::Drain()
+{
+    for (;;)
+    {
+        size_t length;
+        {
+            auto lock = m_Lock.lock_exclusive();
+            while ((m_Used == 0) && !m_Stopping)
+            {
+                m_StateChanged.wait(lock);
+            }
+
+            if (m_Used == 0)
+            {
+                //
+                // Stopping and everything is written. Writers go back to 
+                // writing synchronously from here on.
+                //
+                m_Running = false;
+                break;
+            }
+
+            //
+            // Take everything pending in one go, the ring is free for 
+            // writers again while we write to the console.
+            //
+            length = m_Used;
+            auto first = std::min<size_t>(length, (LogRingSize - m_Tail));
+            std::memcpy(&m_DrainBuffer[0], &m_Ring[m_Tail], first);
+            std::memcpy(&m_DrainBuffer[first], &m_Ring[0], (length - first));
+
+            m_Tail = ((m_Tail + length) % LogRingSize);
+            m_Used = 0;
+            m_Draining = true;
+        }
+        m_StateChanged.notify_all();
+
+        WriteRecords({ m_DrainBuffer.get(), length });
+
+        {
+            auto lock = m_Lock.lock_exclusive();
+            m_Draining = false;
+        }
+        m_StateChanged.notify_all();
+    }
+
+    m_StateChanged.notify_all();
+}
+
+_Use_decl_annotations_
+void Utils::LogWriter::WriteRecords(std::span<const uint8_t> Records)
+{
+    size_t offset = 0;
+    while (offset < Records.size())
+    {
+        RecordHeader header;
+        std::memcpy(&header, &Records[offset], sizeof(header));
+        offset += sizeof(header);
+
+        WriteLine(header.Level,
+                  { RCAST(const wchar_t*)(&Records[offset]),
+                    (header.Length / sizeof(wchar_t)) });
+        offset += header.Length;
+    }
+
+    std::wcout.flush();
+    std::wcerr.flush();
+}
+
+_Use_decl_annotations_
+void Utils::LogWriter::WriteLine(
+    uint32_t Level,
+    std::wstring_view Line)
+{
+    if (Level & Log::Error)
+    {
+        std::wcerr.write(Line.data(), Line.size());
+    }
+    else
+    {
+        std::wcout.write(Line.data(), Line.size());
+    }
+}
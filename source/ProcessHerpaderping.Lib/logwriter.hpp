@@ -0,0 +1,100 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/logwriter.hpp
+// Author:   Johnny Shaw
+// Abstract: Background Console Log Writer
+//
+#pragma once
+
+namespace Utils
+{
+    /// <summary>
+    /// Writes log lines to the console. Once started, lines are copied into
+    /// a preallocated ring buffer and written by a background thread, a
+    /// caller only blocks if the ring is full. Before it is started, or
+    /// after it is stopped, lines are written synchronously.
+    /// </summary>
+    class LogWriter
+    {
+    public:
+
+        /// <summary>
+        /// Gets the process wide log writer.
+        /// </summary>
+        /// <returns>
+        /// Process wide log writer.
+        /// </returns>
+        static LogWriter& Instance();
+
+        LogWriter(const LogWriter&) = delete;
+        LogWriter& operator=(const LogWriter&) = delete;
+
+        /// <summary>
+        /// Starts the background thread.
+        /// </summary>
+        /// <returns>
+        /// Success if the background thread is running.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Start();
+
+        /// <summary>
+        /// Writes out every pending line and stops the background thread.
+        /// </summary>
+        void Stop();
+
+        /// <summary>
+        /// Waits for every pending line to be written.
+        /// </summary>
+        void Flush();
+
+        /// <summary>
+        /// Writes a log line.
+        /// </summary>
+        /// <param name="Level">
+        /// Logging level of the line (Log::Xxx).
+        /// </param>
+        /// <param name="Line">
+        /// Line to write, including the line ending.
+        /// </param>
+        void Write(
+            _In_ uint32_t Level,
+            _In_ std::wstring_view Line);
+
+    private:
+
+        struct RecordHeader
+        {
+            uint32_t Level;
+            uint32_t Length;
+        };
+
+        LogWriter() = default;
+
+        void CopyIn(
+            _In_reads_bytes_(Length) const void* Data,
+            _In_ size_t Length);
+
+        static DWORD WINAPI DrainThread(_In_ void* Context);
+
+        void Drain();
+
+        static void WriteRecords(_In_ std::span<const uint8_t> Records);
+
+        static void WriteLine(
+            _In_ uint32_t Level,
+            _In_ std::wstring_view Line);
+
+        wil::srwlock m_Lock;
+        wil::condition_variable m_StateChanged;
+        wil::unique_handle m_Thread;
+        std::unique_ptr<uint8_t[]> m_Ring;
+        std::unique_ptr<uint8_t[]> m_DrainBuffer;
+        size_t m_Head{ 0 };
+        size_t m_Tail{ 0 };
+        size_t m_Used{ 0 };
+        bool m_Running{ false };
+        bool m_Stopping{ false };
+        bool m_Draining{ false };
+    };
+}
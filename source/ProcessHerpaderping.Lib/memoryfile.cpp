@@ -0,0 +1,113 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/memoryfile.cpp
+// Author:   Johnny Shaw
+// Abstract: In-Memory File Sources and Sinks
+//
+#include "pch.hpp"
+#include "memoryfile.hpp"
+
+_Use_decl_annotations_
+void Utils::ChargeLatency(
+    const LatencyModel& Latency,
+    uint64_t Bytes)
+{
+    auto nanoseconds = SCAST(double)(Latency.OperationNanoseconds);
+    if (Latency.BytesPerSecond != 0)
+    {
+        nanoseconds += ((SCAST(double)(Bytes) * 1e9) /
+                        SCAST(double)(Latency.BytesPerSecond));
+    }
+    if (nanoseconds <= 0.0)
+    {
+        return;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    auto end = (now.QuadPart + SCAST(LONGLONG)(
+                    (nanoseconds * SCAST(double)(frequency.QuadPart)) / 1e9));
+    while (now.QuadPart < end)
+    {
+        YieldProcessor();
+        QueryPerformanceCounter(&now);
+    }
+}
+
+_Use_decl_annotations_
+Utils::MemoryFileSource::MemoryFileSource(
+    std::span<const uint8_t> Contents,
+    size_t BlockSize,
+    const LatencyModel& Latency) :
+    m_Contents(Contents),
+    m_BlockSize(std::max<size_t>(BlockSize, 1)),
+    m_Latency(Latency)
+{
+}
+
+_Use_decl_annotations_
+HRESULT Utils::MemoryFileSource::Read(std::span<const uint8_t>& Block)
+{
+    auto length = std::min<size_t>(m_BlockSize, (m_Contents.size() - m_Offset));
+    Block = m_Contents.subspan(m_Offset, length);
+    m_Offset += length;
+
+    if (length > 0)
+    {
+        ChargeLatency(m_Latency, length);
+    }
+    return S_OK;
+}
+
+_Use_decl_annotations_
+Utils::MemoryFileSink::MemoryFileSink(
+    size_t ExpectedSize,
+    const LatencyModel& Latency) :
+    m_Latency(Latency)
+{
+    m_Contents.reserve(ExpectedSize);
+}
+
+_Use_decl_annotations_
+HRESULT Utils::MemoryFileSink::Write(
+    uint64_t Offset,
+    std::span<const uint8_t> Buffer)
+{
+    if (Buffer.empty())
+    {
+        return S_OK;
+    }
+
+    auto end = (Offset + Buffer.size());
+    if (end > SIZE_MAX)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_FILE_TOO_LARGE);
+    }
+
+    //
+    // A write past the end leaves a zero filled gap, like a file.
+    //
+    if (end > m_Contents.size())
+    {
+        m_Contents.resize(SCAST(size_t)(end));
+    }
+    std::memcpy(&m_Contents[SCAST(size_t)(Offset)], Buffer.data(), Buffer.size());
+
+    ChargeLatency(m_Latency, Buffer.size());
+    return S_OK;
+}
+
+HRESULT Utils::MemoryFileSink::Flush()
+{
+    ChargeLatency(m_Latency, 0);
+    return S_OK;
+}
+
+HRESULT Utils::MemoryFileSink::Close()
+{
+    return S_OK;
+}
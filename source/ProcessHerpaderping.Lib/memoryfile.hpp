@@ -0,0 +1,134 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/memoryfile.hpp
+// Author:   Johnny Shaw
+// Abstract: In-Memory File Sources and Sinks
+//
+#pragma once
+
+#include "filesink.hpp"
+#include "filesource.hpp"
+
+namespace Utils
+{
+    /// <summary>
+    /// Cost charged to each operation on an in-memory file, so the helpers
+    /// can be measured against a device of a known speed without touching
+    /// one. Zero costs nothing.
+    /// </summary>
+    struct LatencyModel
+    {
+        /// <summary>
+        /// Fixed cost of each operation, in nanoseconds.
+        /// </summary>
+        uint64_t OperationNanoseconds{ 0 };
+
+        /// <summary>
+        /// Rate the bytes of an operation move at, zero for no limit.
+        /// </summary>
+        uint64_t BytesPerSecond{ 0 };
+    };
+
+    /// <summary>
+    /// Charges the cost of an operation by spinning, sleeping is far too
+    /// coarse for the latencies of storage.
+    /// </summary>
+    /// <param name="Latency">
+    /// Latency model to charge.
+    /// </param>
+    /// <param name="Bytes">
+    /// Number of bytes the operation moved.
+    /// </param>
+    void ChargeLatency(
+        _In_ const LatencyModel& Latency,
+        _In_ uint64_t Bytes);
+
+    /// <summary>
+    /// Source over bytes already in memory, blocks are lent straight out of
+    /// them.
+    /// </summary>
+    class MemoryFileSource final : public IFileSource
+    {
+    public:
+        /// <summary>
+        /// Creates a source over bytes in memory.
+        /// </summary>
+        /// <param name="Contents">
+        /// Bytes of the source, must outlive it.
+        /// </param>
+        /// <param name="BlockSize">
+        /// Longest block read at once, optional. Must not be zero.
+        /// </param>
+        /// <param name="Latency">
+        /// Cost charged to each read, optional.
+        /// </param>
+        explicit MemoryFileSource(
+            _In_ std::span<const uint8_t> Contents,
+            _In_ size_t BlockSize = HandleFileSource::BlockSize,
+            _In_ const LatencyModel& Latency = {});
+
+        uint64_t Size() const override
+        {
+            return m_Contents.size();
+        }
+
+        HRESULT Read(_Out_ std::span<const uint8_t>& Block) override;
+
+    private:
+
+        const std::span<const uint8_t> m_Contents;
+        const size_t m_BlockSize;
+        const LatencyModel m_Latency;
+        size_t m_Offset{ 0 };
+    };
+
+    /// <summary>
+    /// Sink that writes into a buffer, grown like a file when a write ends
+    /// past it.
+    /// </summary>
+    class MemoryFileSink final : public IFileSink
+    {
+    public:
+        /// <summary>
+        /// Creates an empty sink.
+        /// </summary>
+        /// <param name="ExpectedSize">
+        /// Size the contents are expected to reach, reserved up front.
+        /// </param>
+        /// <param name="Latency">
+        /// Cost charged to each write and flush, optional.
+        /// </param>
+        explicit MemoryFileSink(
+            _In_ size_t ExpectedSize = 0,
+            _In_ const LatencyModel& Latency = {});
+
+        HRESULT Write(
+            _In_ uint64_t Offset,
+            _In_ std::span<const uint8_t> Buffer) override;
+
+        HRESULT Flush() override;
+
+        HRESULT Close() override;
+
+        /// <summary>
+        /// Empties the sink, keeping what it reserved.
+        /// </summary>
+        void Clear()
+        {
+            m_Contents.clear();
+        }
+
+        /// <summary>Gets the contents written.</summary>
+        /// <returns>Contents written.</returns>
+        std::span<const uint8_t> Contents() const
+        {
+            return m_Contents;
+        }
+
+    private:
+
+        std::vector<uint8_t> m_Contents;
+        const LatencyModel m_Latency;
+    };
+}
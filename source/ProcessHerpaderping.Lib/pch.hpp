@@ -17,12 +17,17 @@
 #include <ntstatus.h>
 #include <strsafe.h>
 #include <winioctl.h>
+#include <psapi.h>
 #include <bcrypt.h>
+#include <shellapi.h>
+#include <winmeta.h>
+#include <TraceLoggingProvider.h>
 
 //
 // STL
 //
 #include <cstdint>
+#include <cmath>
 #include <iostream>
 #include <iomanip>
 #include <string>
@@ -33,6 +38,11 @@
 #include <functional>
 #include <optional>
 #include <span>
+#include <atomic>
+#include <memory>
+#include <memory_resource>
+#include <list>
+#include <unordered_map>
 
 //
 // Third Party
@@ -89,6 +99,21 @@ namespace wil
         PRTL_USER_PROCESS_PARAMETERS,
         decltype(&RtlDestroyProcessParameters),
         RtlDestroyProcessParameters>;
+
+    using unique_aligned_buffer = unique_any<
+        void*,
+        decltype(&_aligned_free),
+        _aligned_free>;
+
+    using unique_threadpool_pool = unique_any<
+        PTP_POOL,
+        decltype(&CloseThreadpool),
+        CloseThreadpool>;
+
+    using unique_threadpool_cleanup_group = unique_any<
+        PTP_CLEANUP_GROUP,
+        decltype(&CloseThreadpoolCleanupGroup),
+        CloseThreadpoolCleanupGroup>;
 }
 #define RETURN_LAST_ERROR_SET(win32err) SetLastError(win32err); RETURN_LAST_ERROR()
 
@@ -96,8 +121,3 @@ namespace wil
 // prefast suppression
 //
 #pragma warning(disable : 6319)  // prefast: use of the comma-operator in a tested expression
-
-//
-// Internal
-//
-#include "res/version.h"
@@ -0,0 +1,235 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/peview.cpp
+// Author:   Johnny Shaw
+// Abstract: Bounds Checked PE Header View
+//
+#include "pch.hpp"
+#include "peview.hpp"
+#include "utils.hpp"
+
+namespace Utils
+{
+    constexpr static size_t InitialHeaderRead{ 0x1000 }; // page
+    constexpr static size_t MaxHeaderSize{ 0x100000 }; // 1mib
+}
+
+static size_t GetHeadersExtent(_In_ std::span<const uint8_t> Headers)
+{
+    //
+    // Returns how many bytes are needed to parse the headers given what is
+    // known so far. If the headers are malformed the current size is
+    // returned and parsing fails later.
+    //
+    if (Headers.size() < sizeof(IMAGE_DOS_HEADER))
+    {
+        return sizeof(IMAGE_DOS_HEADER);
+    }
+
+    auto dosHeader = RCAST(const IMAGE_DOS_HEADER*)(Headers.data());
+    if ((dosHeader->e_magic != IMAGE_DOS_SIGNATURE) ||
+        (dosHeader->e_lfanew < 0))
+    {
+        return Headers.size();
+    }
+
+    auto fileHeaderOffset = (SCAST(size_t)(dosHeader->e_lfanew) +
+                             FIELD_OFFSET(IMAGE_NT_HEADERS32, FileHeader));
+    auto optionalHeaderOffset = (fileHeaderOffset + sizeof(IMAGE_FILE_HEADER));
+    if (Headers.size() < optionalHeaderOffset)
+    {
+        return optionalHeaderOffset;
+    }
+
+    auto fileHeader = RCAST(const IMAGE_FILE_HEADER*)(
+                            Add2Ptr(Headers.data(), fileHeaderOffset));
+    return (optionalHeaderOffset +
+            fileHeader->SizeOfOptionalHeader +
+            (SCAST(size_t)(fileHeader->NumberOfSections) *
+             sizeof(IMAGE_SECTION_HEADER)));
+}
+
+_Use_decl_annotations_
+HRESULT Utils::PeView::Parse(
+    handle_t FileHandle)
+{
+    m_Headers.clear();
+
+    auto required = InitialHeaderRead;
+    for (;;)
+    {
+        m_Headers.resize(required);
+
+        size_t bytesRead;
+        RETURN_IF_FAILED(ReadFileAt(FileHandle, 0, m_Headers, bytesRead));
+        if (bytesRead < required)
+        {
+            //
+            // The file is smaller than what we asked for, parse what is there
+            // and let the bounds checks decide.
+            //
+            m_Headers.resize(bytesRead);
+            break;
+        }
+
+        auto extent = GetHeadersExtent(m_Headers);
+        if (extent <= m_Headers.size())
+        {
+            break;
+        }
+
+        if (extent > MaxHeaderSize)
+        {
+            RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+        }
+
+        required = extent;
+    }
+
+    return ParseHeaders();
+}
+
+_Use_decl_annotations_
+HRESULT Utils::PeView::Parse(
+    std::span<const uint8_t> Image)
+{
+    auto extent = std::min<size_t>(Image.size(), GetHeadersExtent(Image));
+    m_Headers.assign(Image.begin(), Image.begin() + extent);
+    return ParseHeaders();
+}
+
+std::optional<IMAGE_DATA_DIRECTORY> Utils::PeView::SecurityDirectory() const
+{
+    if (m_NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_SECURITY)
+    {
+        return std::nullopt;
+    }
+
+    IMAGE_DATA_DIRECTORY secDir;
+    std::memcpy(&secDir,
+                &m_Headers[SCAST(size_t)(m_SecurityDirectoryOffset)],
+                sizeof(secDir));
+
+    if ((secDir.VirtualAddress == 0) || (secDir.Size == 0))
+    {
+        return std::nullopt;
+    }
+
+    return secDir;
+}
+
+std::span<const IMAGE_SECTION_HEADER> Utils::PeView::Sections() const
+{
+    if (m_NumberOfSections == 0)
+    {
+        return {};
+    }
+
+    auto sections = RCAST(const IMAGE_SECTION_HEADER*)(
+                        &m_Headers[SCAST(size_t)(m_SectionsOffset)]);
+    return { sections, m_NumberOfSections };
+}
+
+HRESULT Utils::PeView::ParseHeaders()
+{
+    m_Is64Bit = false;
+    m_EntryPointRva = 0;
+    m_NumberOfRvaAndSizes = 0;
+    m_DataDirectoryOffset = 0;
+    m_SecurityDirectoryOffset = 0;
+    m_SectionsOffset = 0;
+    m_NumberOfSections = 0;
+
+    if (m_Headers.size() < sizeof(IMAGE_DOS_HEADER))
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+
+    auto dosHeader = RCAST(const IMAGE_DOS_HEADER*)(m_Headers.data());
+    if ((dosHeader->e_magic != IMAGE_DOS_SIGNATURE) ||
+        (dosHeader->e_lfanew < 0))
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+
+    //
+    // Everything up to the optional header magic must be present before we
+    // can tell which optional header layout we have.
+    //
+    auto ntHeaderOffset = SCAST(size_t)(dosHeader->e_lfanew);
+    auto optionalHeaderOffset = (ntHeaderOffset +
+                                 FIELD_OFFSET(IMAGE_NT_HEADERS32, OptionalHeader));
+    if ((optionalHeaderOffset + sizeof(WORD)) > m_Headers.size())
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+
+    auto ntHeader = RCAST(const IMAGE_NT_HEADERS32*)(
+                        Add2Ptr(m_Headers.data(), ntHeaderOffset));
+    if (ntHeader->Signature != IMAGE_NT_SIGNATURE)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+
+    size_t sizeOfOptionalHeader = ntHeader->FileHeader.SizeOfOptionalHeader;
+    if ((optionalHeaderOffset + sizeOfOptionalHeader) > m_Headers.size())
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+
+    size_t dataDirectoryOffset;
+    if (ntHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
+    {
+        dataDirectoryOffset = FIELD_OFFSET(IMAGE_OPTIONAL_HEADER32, DataDirectory);
+        if (sizeOfOptionalHeader < dataDirectoryOffset)
+        {
+            RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+        }
+
+        m_EntryPointRva = ntHeader->OptionalHeader.AddressOfEntryPoint;
+        m_NumberOfRvaAndSizes = ntHeader->OptionalHeader.NumberOfRvaAndSizes;
+    }
+    else if (ntHeader->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+    {
+        dataDirectoryOffset = FIELD_OFFSET(IMAGE_OPTIONAL_HEADER64, DataDirectory);
+        if (sizeOfOptionalHeader < dataDirectoryOffset)
+        {
+            RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+        }
+
+        auto ntHeader64 = RCAST(const IMAGE_NT_HEADERS64*)(ntHeader);
+        m_Is64Bit = true;
+        m_EntryPointRva = ntHeader64->OptionalHeader.AddressOfEntryPoint;
+        m_NumberOfRvaAndSizes = ntHeader64->OptionalHeader.NumberOfRvaAndSizes;
+    }
+    else
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+
+    //
+    // Only trust the data directories that actually fit in the optional
+    // header.
+    //
+    auto maxDirectories = ((sizeOfOptionalHeader - dataDirectoryOffset) /
+                           sizeof(IMAGE_DATA_DIRECTORY));
+    m_NumberOfRvaAndSizes = SCAST(uint32_t)(
+        std::min<size_t>(m_NumberOfRvaAndSizes, maxDirectories));
+
+    m_DataDirectoryOffset = (optionalHeaderOffset + dataDirectoryOffset);
+    m_SecurityDirectoryOffset = (m_DataDirectoryOffset +
+                                 (IMAGE_DIRECTORY_ENTRY_SECURITY *
+                                  sizeof(IMAGE_DATA_DIRECTORY)));
+
+    m_SectionsOffset = (optionalHeaderOffset + sizeOfOptionalHeader);
+    if ((m_SectionsOffset +
+         (SCAST(uint64_t)(ntHeader->FileHeader.NumberOfSections) *
+          sizeof(IMAGE_SECTION_HEADER))) > m_Headers.size())
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_IMAGE_HASH);
+    }
+    m_NumberOfSections = ntHeader->FileHeader.NumberOfSections;
+
+    return S_OK;
+}
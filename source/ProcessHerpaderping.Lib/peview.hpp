@@ -0,0 +1,105 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/peview.hpp
+// Author:   Johnny Shaw
+// Abstract: Bounds Checked PE Header View
+//
+#pragma once
+
+namespace Utils
+{
+    /// <summary>
+    /// Bounds checked view of the headers of a PE file. Only the header
+    /// bytes are read, the view holds its own copy of them.
+    /// </summary>
+    class PeView
+    {
+    public:
+        PeView() = default;
+
+        /// <summary>
+        /// Creates a view that holds its copy of the headers in a memory
+        /// resource, such as the arena of an execution.
+        /// </summary>
+        /// <param name="Resource">
+        /// Memory resource for the header bytes, it must outlive the view.
+        /// </param>
+        explicit PeView(_In_ std::pmr::memory_resource* Resource) :
+            m_Headers(Resource)
+        {
+        }
+
+        /// <summary>
+        /// Reads and parses the headers of a PE file.
+        /// </summary>
+        /// <param name="FileHandle">
+        /// File to parse, must have read access.
+        /// </param>
+        /// <returns>
+        /// Success if the file has valid PE headers. ERROR_INVALID_IMAGE_HASH
+        /// if the file is not a PE file or its headers are truncated.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Parse(_In_ handle_t FileHandle);
+
+        /// <summary>
+        /// Parses the headers of a PE file in memory.
+        /// </summary>
+        /// <param name="Image">
+        /// File content to parse, only the leading header bytes are needed.
+        /// </param>
+        /// <returns>
+        /// Success if the buffer has valid PE headers.
+        /// ERROR_INVALID_IMAGE_HASH if the buffer is not a PE file or its
+        /// headers are truncated.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Parse(_In_ std::span<const uint8_t> Image);
+
+        /// <summary>Gets if the image is 64-bit (PE32+).</summary>
+        /// <returns>True if the image is 64-bit.</returns>
+        bool Is64Bit() const
+        {
+            return m_Is64Bit;
+        }
+
+        /// <summary>Gets the image entry point RVA.</summary>
+        /// <returns>Image entry point RVA.</returns>
+        uint32_t EntryPointRva() const
+        {
+            return m_EntryPointRva;
+        }
+
+        /// <summary>Gets the image security directory.</summary>
+        /// <returns>
+        /// Security directory, nullopt if the image does not have one.
+        /// </returns>
+        std::optional<IMAGE_DATA_DIRECTORY> SecurityDirectory() const;
+
+        /// <summary>
+        /// Gets the file offset of the security directory entry in the
+        /// optional header. Only valid if SecurityDirectory has a value.
+        /// </summary>
+        /// <returns>File offset of the security directory entry.</returns>
+        uint64_t SecurityDirectoryOffset() const
+        {
+            return m_SecurityDirectoryOffset;
+        }
+
+        /// <summary>Gets the image section table.</summary>
+        /// <returns>Image section table.</returns>
+        std::span<const IMAGE_SECTION_HEADER> Sections() const;
+
+    private:
+
+        _Must_inspect_result_ HRESULT ParseHeaders();
+
+        std::pmr::vector<uint8_t> m_Headers;
+        bool m_Is64Bit{ false };
+        uint32_t m_EntryPointRva{ 0 };
+        uint32_t m_NumberOfRvaAndSizes{ 0 };
+        uint64_t m_DataDirectoryOffset{ 0 };
+        uint64_t m_SecurityDirectoryOffset{ 0 };
+        uint64_t m_SectionsOffset{ 0 };
+        uint16_t m_NumberOfSections{ 0 };
+    };
+}
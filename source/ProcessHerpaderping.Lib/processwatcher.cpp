@@ -0,0 +1,171 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/processwatcher.cpp
+// Author:   Johnny Shaw
+// Abstract: Asynchronous Process Exit Watcher
+//
+#include "pch.hpp"
+#include "processwatcher.hpp"
+#include "utils.hpp"
+
+Herpaderp::ProcessWatcher::~ProcessWatcher()
+{
+    WaitForAll();
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ProcessWatcher::Watch(
+    wil::unique_handle ProcessHandle,
+    wil::unique_handle HeldHandle,
+    uint32_t TimeoutMilliseconds,
+    ExitCallback OnExit)
+{
+    auto entry = std::make_unique<Entry>();
+    entry->Owner = this;
+    entry->ProcessHandle = std::move(ProcessHandle);
+    entry->HeldHandle = std::move(HeldHandle);
+    entry->OnExit = std::move(OnExit);
+
+    entry->Wait = CreateThreadpoolWait(WaitCallback, entry.get(), nullptr);
+    RETURN_LAST_ERROR_IF_NULL(entry->Wait);
+
+    //
+    // Relative timeouts are negative, in 100 nanosecond units.
+    //
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = SCAST(ULONGLONG)(
+                            -(SCAST(int64_t)(TimeoutMilliseconds) * 10000));
+    FILETIME timeout;
+    timeout.dwLowDateTime = dueTime.LowPart;
+    timeout.dwHighDateTime = dueTime.HighPart;
+
+    {
+        auto lock = m_Lock.lock_exclusive();
+        m_Pending++;
+    }
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    entry->StartTicks = start.QuadPart;
+
+    //
+    // The callback owns the entry once the wait is set.
+    //
+    auto rawEntry = entry.release();
+    SetThreadpoolWait(rawEntry->Wait,
+                      rawEntry->ProcessHandle.get(),
+                      (TimeoutMilliseconds == INFINITE ? nullptr : &timeout));
+    return S_OK;
+}
+
+void Herpaderp::ProcessWatcher::WaitForAll()
+{
+    auto lock = m_Lock.lock_exclusive();
+    while (m_Pending != 0)
+    {
+        m_Drained.wait(lock);
+    }
+}
+
+size_t Herpaderp::ProcessWatcher::Pending() const
+{
+    auto lock = m_Lock.lock_shared();
+    return m_Pending;
+}
+
+_Use_decl_annotations_
+void NTAPI Herpaderp::ProcessWatcher::WaitCallback(
+    PTP_CALLBACK_INSTANCE Instance,
+    void* Context,
+    PTP_WAIT Wait,
+    TP_WAIT_RESULT WaitResult)
+{
+    UNREFERENCED_PARAMETER(Instance);
+
+    std::unique_ptr<Entry> entry(RCAST(Entry*)(Context));
+
+    ProcessExit exit;
+    exit.ProcessId = GetProcessId(entry->ProcessHandle.get());
+
+    if (WaitResult == WAIT_TIMEOUT)
+    {
+        //
+        // Out of time, terminate it and report the exit once it is gone. If
+        // it can't be terminated report it as is rather than blocking the 
+        // thread pool thread on it.
+        //
+        exit.Status = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+        if (TerminateProcess(entry->ProcessHandle.get(), SCAST(UINT)(exit.Status)))
+        {
+            WaitForSingleObject(entry->ProcessHandle.get(), INFINITE);
+        }
+        else
+        {
+            Utils::Log(Log::Warning,
+                       GetLastError(),
+                       L"Failed to terminate watched process %lu",
+                       exit.ProcessId);
+        }
+    }
+    else if (WaitResult != WAIT_OBJECT_0)
+    {
+        //
+        // Thread pool waits only report signaled or timed out, anything else
+        // is not an exit.
+        //
+        exit.Status = HRESULT_FROM_WIN32(ERROR_INVALID_STATE);
+    }
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    exit.WaitTicks = (end.QuadPart - entry->StartTicks);
+
+    DWORD exitCode = 0;
+    if (!GetExitCodeProcess(entry->ProcessHandle.get(), &exitCode) && 
+        SUCCEEDED(exit.Status))
+    {
+        exit.Status = HRESULT_FROM_WIN32(GetLastError());
+    }
+    exit.ExitCode = exitCode;
+
+    ResourceUsage usage;
+    if (SUCCEEDED(QueryProcessUsage(entry->ProcessHandle.get(), usage)))
+    {
+        exit.Usage = usage;
+    }
+
+    //
+    // Release the held handle before reporting, as a synchronous wait would.
+    //
+    entry->HeldHandle.reset();
+
+    if (entry->OnExit)
+    {
+        entry->OnExit(exit);
+    }
+
+    //
+    // Closing the wait from its own callback is allowed, it is freed once
+    // this callback returns.
+    //
+    CloseThreadpoolWait(Wait);
+
+    auto owner = entry->Owner;
+    entry.reset();
+    owner->Complete();
+}
+
+void Herpaderp::ProcessWatcher::Complete()
+{
+    //
+    // Notify under the lock, the watcher may be destroyed as soon as a 
+    // waiter sees nothing pending.
+    //
+    auto lock = m_Lock.lock_exclusive();
+    m_Pending--;
+    if (m_Pending == 0)
+    {
+        m_Drained.notify_all();
+    }
+}
@@ -0,0 +1,98 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/processwatcher.hpp
+// Author:   Johnny Shaw
+// Abstract: Asynchronous Process Exit Watcher
+//
+#pragma once
+
+//
+// Public header of the library, a watcher can be shared by every execution
+// in the process through ExecuteOptions.
+//
+#include "herpaderp.hpp"
+#include <wil/resource.h>
+
+namespace Herpaderp
+{
+    /// <summary>
+    /// Watches processes for exit with thread pool waits, no thread is 
+    /// blocked per process. Processes still running when their timeout 
+    /// expires are terminated. Safe for concurrent use.
+    /// </summary>
+    class ProcessWatcher
+    {
+    public:
+        ProcessWatcher() = default;
+
+        /// <summary>
+        /// Waits for every watched process to be reported.
+        /// </summary>
+        ~ProcessWatcher();
+
+        ProcessWatcher(const ProcessWatcher&) = delete;
+        ProcessWatcher& operator=(const ProcessWatcher&) = delete;
+
+        /// <summary>
+        /// Starts watching a process.
+        /// </summary>
+        /// <param name="ProcessHandle">
+        /// Process to watch, the watcher takes ownership of the handle.
+        /// </param>
+        /// <param name="HeldHandle">
+        /// Optional, handle to keep open until the process exits. The 
+        /// watcher takes ownership of the handle.
+        /// </param>
+        /// <param name="TimeoutMilliseconds">
+        /// Time to let the process run before terminating it, INFINITE for
+        /// no timeout.
+        /// </param>
+        /// <param name="OnExit">
+        /// Optional, called from a thread pool thread when the process 
+        /// exits or is terminated.
+        /// </param>
+        /// <returns>
+        /// Success if the process is being watched. On failure the handles 
+        /// are closed and the callback is not called.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Watch(
+            _In_ wil::unique_handle ProcessHandle,
+            _In_ wil::unique_handle HeldHandle,
+            _In_ uint32_t TimeoutMilliseconds,
+            _In_ ExitCallback OnExit);
+
+        /// <summary>
+        /// Waits until every watched process has been reported.
+        /// </summary>
+        void WaitForAll();
+
+        /// <summary>Gets the number of processes being watched.</summary>
+        /// <returns>Number of processes being watched.</returns>
+        size_t Pending() const;
+
+    private:
+
+        struct Entry
+        {
+            ProcessWatcher* Owner{ nullptr };
+            wil::unique_handle ProcessHandle;
+            wil::unique_handle HeldHandle;
+            ExitCallback OnExit;
+            PTP_WAIT Wait{ nullptr };
+            int64_t StartTicks{ 0 };
+        };
+
+        static void NTAPI WaitCallback(
+            _Inout_ PTP_CALLBACK_INSTANCE Instance,
+            _Inout_opt_ void* Context,
+            _Inout_ PTP_WAIT Wait,
+            _In_ TP_WAIT_RESULT WaitResult);
+
+        void Complete();
+
+        mutable wil::srwlock m_Lock;
+        wil::condition_variable m_Drained;
+        size_t m_Pending{ 0 };
+    };
+}
@@ -0,0 +1,195 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/procparams.cpp
+// Author:   Johnny Shaw
+// Abstract: Reusable Process Parameters Template
+//
+#include "pch.hpp"
+#include "procparams.hpp"
+
+namespace Herpaderp
+{
+    constexpr static std::wstring_view DefaultDesktopInfo{ L"WinSta0\\Default" };
+
+    static thread_local std::vector<uint8_t> t_Parameters;
+}
+
+static size_t AlignOffset(_In_ size_t Offset)
+{
+    return (((Offset + sizeof(ULONG_PTR) - 1) / sizeof(ULONG_PTR)) * 
+            sizeof(ULONG_PTR));
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ProcessParametersTemplate::Initialize(
+    void* EnvironmentBlock,
+    const std::wstring& DesktopInfo)
+{
+    m_Template.clear();
+    m_Environment.clear();
+
+    //
+    // The per-execution strings are left empty, they are placed after the 
+    // template when it is written. Like WriteRemoteProcessParameters the 
+    // parameters are left de-normalized so string buffers are offsets and 
+    // the loader fixes them up when the process starts.
+    //
+    UNICODE_STRING empty;
+    RtlInitUnicodeString(&empty, L"");
+    UNICODE_STRING desktopInfo;
+    RtlInitUnicodeString(&desktopInfo, DesktopInfo.c_str());
+    wil::unique_user_process_parameters params;
+
+    RETURN_IF_NTSTATUS_FAILED(RtlCreateProcessParametersEx(&params,
+                                                           &empty,
+                                                           nullptr,
+                                                           nullptr,
+                                                           &empty,
+                                                           EnvironmentBlock,
+                                                           &empty,
+                                                           &desktopInfo,
+                                                           nullptr,
+                                                           nullptr,
+                                                           0));
+
+    auto begin = RCAST(const uint8_t*)(params.get());
+    m_Template.assign(begin, (begin + params.get()->MaximumLength));
+
+    if (params.get()->Environment != nullptr)
+    {
+        auto environment = RCAST(const uint8_t*)(params.get()->Environment);
+        m_Environment.assign(environment, 
+                             (environment + params.get()->EnvironmentSize));
+    }
+
+    return S_OK;
+}
+
+HRESULT Herpaderp::ProcessParametersTemplate::InitializeFromCurrentProcess()
+{
+    return Initialize(NtCurrentPeb()->ProcessParameters->Environment,
+                      std::wstring(DefaultDesktopInfo));
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ProcessParametersTemplate::Write(
+    HANDLE ProcessHandle,
+    void* PebBaseAddress,
+    std::wstring_view ImageFileName,
+    RemoteCounters* Counters) const
+{
+    RemoteCounters localCounters;
+    auto& counters = (Counters != nullptr ? *Counters : localCounters);
+
+    if (!IsInitialized())
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    //
+    // The command line is the quoted image name, the longest of the strings.
+    //
+    auto imageBytes = (ImageFileName.size() * sizeof(wchar_t));
+    auto commandLineBytes = (imageBytes + (2 * sizeof(wchar_t)));
+    if ((commandLineBytes + sizeof(wchar_t)) > MAXUSHORT)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_FILENAME_EXCED_RANGE);
+    }
+
+    auto imageOffset = AlignOffset(m_Template.size());
+    auto commandLineOffset = AlignOffset(imageOffset + imageBytes + sizeof(wchar_t));
+    auto windowTitleOffset = AlignOffset(commandLineOffset + 
+                                         commandLineBytes + 
+                                         sizeof(wchar_t));
+    auto parametersLength = AlignOffset(windowTitleOffset + 
+                                        imageBytes + 
+                                        sizeof(wchar_t));
+    auto totalLength = (parametersLength + m_Environment.size());
+
+    //
+    // Build the whole block locally so it goes over in one write. The 
+    // per-thread buffer keeps its capacity between executions.
+    //
+    auto& block = t_Parameters;
+    block.assign(totalLength, 0);
+    std::memcpy(block.data(), m_Template.data(), m_Template.size());
+
+    auto writeString = [&block](
+        UNICODE_STRING& String,
+        size_t Offset,
+        std::wstring_view Prefix,
+        std::wstring_view Text,
+        std::wstring_view Suffix) -> void
+    {
+        auto dest = RCAST(wchar_t*)(Add2Ptr(block.data(), Offset));
+        std::memcpy(dest, Prefix.data(), (Prefix.size() * sizeof(wchar_t)));
+        dest += Prefix.size();
+        std::memcpy(dest, Text.data(), (Text.size() * sizeof(wchar_t)));
+        dest += Text.size();
+        std::memcpy(dest, Suffix.data(), (Suffix.size() * sizeof(wchar_t)));
+
+        auto length = ((Prefix.size() + Text.size() + Suffix.size()) * 
+                       sizeof(wchar_t));
+        String.Length = SCAST(USHORT)(length);
+        String.MaximumLength = SCAST(USHORT)(length + sizeof(wchar_t));
+        String.Buffer = RCAST(PWCH)(Offset);
+    };
+
+    auto params = RCAST(PRTL_USER_PROCESS_PARAMETERS)(block.data());
+    writeString(params->ImagePathName, imageOffset, {}, ImageFileName, {});
+    writeString(params->CommandLine, 
+                commandLineOffset, 
+                L"\"", 
+                ImageFileName, 
+                L"\"");
+    writeString(params->WindowTitle, windowTitleOffset, {}, ImageFileName, {});
+    params->MaximumLength = SCAST(ULONG)(parametersLength);
+    params->Length = SCAST(ULONG)(parametersLength);
+
+    counters.Syscalls++;
+    auto remoteMemory = VirtualAllocEx(ProcessHandle,
+                                       nullptr,
+                                       totalLength,
+                                       MEM_COMMIT | MEM_RESERVE,
+                                       PAGE_READWRITE);
+    RETURN_IF_NULL_ALLOC(remoteMemory);
+
+    //
+    // The environment pointer is not de-normalized, point it at the remote
+    // copy directly.
+    //
+    if (m_Environment.empty())
+    {
+        params->Environment = nullptr;
+        params->EnvironmentSize = 0;
+    }
+    else
+    {
+        params->Environment = Add2Ptr(remoteMemory, parametersLength);
+        params->EnvironmentSize = m_Environment.size();
+        std::memcpy(Add2Ptr(block.data(), parametersLength),
+                    m_Environment.data(),
+                    m_Environment.size());
+    }
+
+    counters.Syscalls++;
+    RETURN_IF_WIN32_BOOL_FALSE(WriteProcessMemory(ProcessHandle,
+                                                  remoteMemory,
+                                                  block.data(),
+                                                  totalLength,
+                                                  nullptr));
+    counters.BytesWritten += totalLength;
+
+    counters.Syscalls++;
+    RETURN_IF_WIN32_BOOL_FALSE(WriteProcessMemory(
+                                 ProcessHandle,
+                                 Add2Ptr(PebBaseAddress,
+                                         FIELD_OFFSET(PEB, ProcessParameters)),
+                                 &remoteMemory,
+                                 sizeof(remoteMemory),
+                                 nullptr));
+    counters.BytesWritten += sizeof(remoteMemory);
+
+    return S_OK;
+}
@@ -0,0 +1,94 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/procparams.hpp
+// Author:   Johnny Shaw
+// Abstract: Reusable Process Parameters Template
+//
+#pragma once
+
+//
+// Public header of the library, a template can be shared by every 
+// execution in the process through ExecuteOptions.
+//
+#include "herpaderp.hpp"
+#include <string_view>
+#include <vector>
+
+namespace Herpaderp
+{
+    /// <summary>
+    /// Prebuilt process parameters. Everything but the per-execution strings 
+    /// (image path, command line and window title) is generated once, each 
+    /// write only patches those strings into a copy of the template. Safe 
+    /// for concurrent writes once initialized.
+    /// </summary>
+    class ProcessParametersTemplate
+    {
+    public:
+        ProcessParametersTemplate() = default;
+
+        /// <summary>
+        /// Builds the template.
+        /// </summary>
+        /// <param name="EnvironmentBlock">
+        /// Environment block to serialize into the template, optional.
+        /// </param>
+        /// <param name="DesktopInfo">
+        /// Desktop info to serialize into the template.
+        /// </param>
+        /// <returns>
+        /// Success if the template is built.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize(
+            _In_opt_ void* EnvironmentBlock,
+            _In_ const std::wstring& DesktopInfo);
+
+        /// <summary>
+        /// Builds the template from the environment of this process and the 
+        /// default interactive desktop.
+        /// </summary>
+        /// <returns>
+        /// Success if the template is built.
+        /// </returns>
+        _Must_inspect_result_ HRESULT InitializeFromCurrentProcess();
+
+        /// <summary>Gets if the template is built.</summary>
+        /// <returns>True if the template is built.</returns>
+        bool IsInitialized() const
+        {
+            return !m_Template.empty();
+        }
+
+        /// <summary>
+        /// Writes the parameters into a process and points its PEB at them. 
+        /// The image path and window title are set to the image file name 
+        /// and the command line is the quoted image file name.
+        /// </summary>
+        /// <param name="ProcessHandle">
+        /// Process to write the parameters into.
+        /// </param>
+        /// <param name="PebBaseAddress">
+        /// Address of the PEB in the process.
+        /// </param>
+        /// <param name="ImageFileName">
+        /// Image file name of the process.
+        /// </param>
+        /// <param name="Counters">
+        /// Optional, the calls made against the process are added to this.
+        /// </param>
+        /// <returns>
+        /// Success if the parameters are written.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Write(
+            _In_ HANDLE ProcessHandle,
+            _In_ void* PebBaseAddress,
+            _In_ std::wstring_view ImageFileName,
+            _Inout_opt_ RemoteCounters* Counters = nullptr) const;
+
+    private:
+
+        std::vector<uint8_t> m_Template;
+        std::vector<uint8_t> m_Environment;
+    };
+}
@@ -0,0 +1,115 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/random.cpp
+// Author:   Johnny Shaw
+// Abstract: Seeded Pseudo Random Byte Stream
+//
+#include "pch.hpp"
+#include "random.hpp"
+
+namespace Utils
+{
+    constexpr static uint64_t SplitMix64(_Inout_ uint64_t& State)
+    {
+        uint64_t z = (State += 0x9e3779b97f4a7c15ull);
+        z = ((z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull);
+        z = ((z ^ (z >> 27)) * 0x94d049bb133111ebull);
+        return (z ^ (z >> 31));
+    }
+
+    constexpr static uint64_t RotateLeft(
+        _In_ uint64_t Value,
+        _In_ uint32_t Count)
+    {
+        return ((Value << Count) | (Value >> (64 - Count)));
+    }
+}
+
+_Use_decl_annotations_
+Utils::RandomStream::RandomStream(uint64_t Seed)
+{
+    //
+    // SplitMix64 expands the seed, as recommended for xoshiro. It never
+    // produces an all zero state.
+    //
+    for (size_t lane = 0; lane < Lanes; lane++)
+    {
+        for (auto& word : m_State)
+        {
+            word[lane] = SplitMix64(Seed);
+        }
+    }
+}
+
+void Utils::RandomStream::Step()
+{
+    auto& [s0, s1, s2, s3] = m_State;
+    for (size_t lane = 0; lane < Lanes; lane++)
+    {
+        m_Output[lane] = (RotateLeft((s1[lane] * 5), 7) * 9);
+
+        auto t = (s1[lane] << 17);
+        s2[lane] ^= s0[lane];
+        s3[lane] ^= s1[lane];
+        s1[lane] ^= s2[lane];
+        s0[lane] ^= s3[lane];
+        s2[lane] ^= t;
+        s3[lane] = RotateLeft(s3[lane], 45);
+    }
+    m_OutputUsed = 0;
+}
+
+_Use_decl_annotations_
+void Utils::RandomStream::Fill(std::span<uint8_t> Buffer)
+{
+    auto output = RCAST(const uint8_t*)(m_Output.data());
+
+    //
+    // Drain what is left of the last step, then whole steps straight into
+    // the buffer, then part of one more step for the tail.
+    //
+    auto length = std::min<size_t>(Buffer.size(),
+                                   (sizeof(m_Output) - m_OutputUsed));
+    memcpy(Buffer.data(), (output + m_OutputUsed), length);
+    m_OutputUsed += length;
+    Buffer = Buffer.subspan(length);
+
+    while (Buffer.size() >= sizeof(m_Output))
+    {
+        Step();
+        memcpy(Buffer.data(), output, sizeof(m_Output));
+        m_OutputUsed = sizeof(m_Output);
+        Buffer = Buffer.subspan(sizeof(m_Output));
+    }
+
+    if (!Buffer.empty())
+    {
+        Step();
+        memcpy(Buffer.data(), output, Buffer.size());
+        m_OutputUsed = Buffer.size();
+    }
+}
+
+_Use_decl_annotations_
+HRESULT Utils::GenerateSeed(uint64_t& Seed)
+{
+    Seed = 0;
+
+    RETURN_IF_NTSTATUS_FAILED(
+        BCryptGenRandom(nullptr,
+                        RCAST(PUCHAR)(&Seed),
+                        sizeof(Seed),
+                        BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+uint64_t Utils::DeriveSeed(
+    uint64_t Seed,
+    uint64_t Stream)
+{
+    auto state = (Seed ^ SplitMix64(Stream));
+    return SplitMix64(state);
+}
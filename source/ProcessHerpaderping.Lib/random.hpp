@@ -0,0 +1,78 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/random.hpp
+// Author:   Johnny Shaw
+// Abstract: Seeded Pseudo Random Byte Stream
+//
+#pragma once
+
+namespace Utils
+{
+    /// <summary>
+    /// Generates a reproducible stream of pseudo random bytes from a 64-bit
+    /// seed. Four interleaved xoshiro256** generators are stepped together,
+    /// the lanes are independent so the loop vectorizes. This is not a
+    /// cryptographic generator, it only needs to be fast and repeatable.
+    /// </summary>
+    class RandomStream
+    {
+    public:
+        constexpr static size_t Lanes{ 4 };
+
+        /// <summary>
+        /// Creates a stream from a seed. The same seed always produces the
+        /// same bytes, regardless of how the stream is split across Fill
+        /// calls.
+        /// </summary>
+        /// <param name="Seed">
+        /// Seed of the stream.
+        /// </param>
+        explicit RandomStream(_In_ uint64_t Seed);
+
+        /// <summary>
+        /// Fills a buffer with the next bytes of the stream.
+        /// </summary>
+        /// <param name="Buffer">
+        /// Buffer to fill.
+        /// </param>
+        void Fill(_Out_ std::span<uint8_t> Buffer);
+
+    private:
+
+        void Step();
+
+        alignas(64) std::array<std::array<uint64_t, Lanes>, 4> m_State{};
+        alignas(64) std::array<uint64_t, Lanes> m_Output{};
+        size_t m_OutputUsed{ sizeof(m_Output) };
+    };
+
+    /// <summary>
+    /// Draws a seed from the system random number generator.
+    /// </summary>
+    /// <param name="Seed">
+    /// Set to the seed.
+    /// </param>
+    /// <returns>
+    /// Success if a seed was drawn.
+    /// </returns>
+    _Must_inspect_result_ HRESULT GenerateSeed(_Out_ uint64_t& Seed);
+
+    /// <summary>
+    /// Derives the seed of one stream from a run seed, for example one per
+    /// job, so every stream of a run differs and can be reproduced from the
+    /// run seed alone.
+    /// </summary>
+    /// <param name="Seed">
+    /// Run seed.
+    /// </param>
+    /// <param name="Stream">
+    /// Identifies the stream, such as a job identifier.
+    /// </param>
+    /// <returns>
+    /// Seed of the stream.
+    /// </returns>
+    uint64_t DeriveSeed(
+        _In_ uint64_t Seed,
+        _In_ uint64_t Stream);
+}
@@ -0,0 +1,481 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/results.cpp
+// Author:   Johnny Shaw
+// Abstract: Machine Readable Job Result Records
+//
+#include "pch.hpp"
+#include "herpaderp.hpp"
+#include "batch.hpp"
+#include "results.hpp"
+#include "utils.hpp"
+
+namespace Batch
+{
+    constexpr static size_t ResultBufferSize{ 0x10000 }; // 64kib
+
+    /// <summary>
+    /// Formats the fields of one record, in either format. The names of the
+    /// fields are collected for the CSV header.
+    /// </summary>
+    class RecordBuilder
+    {
+    public:
+        RecordBuilder(
+            _In_ ResultFormat Format,
+            _Inout_ std::string& Record,
+            _Inout_opt_ std::string* Header) :
+            m_Format(Format),
+            m_Record(Record),
+            m_Header(Header)
+        {
+            if (m_Format == ResultFormat::JsonLines)
+            {
+                m_Record += '{';
+            }
+        }
+
+        void Field(
+            _In_ std::string_view Name,
+            _In_ std::wstring_view Text)
+        {
+            Separate(Name);
+            m_Record += '"';
+            for (auto c : ToUtf8(Text))
+            {
+                AppendEscaped(c);
+            }
+            m_Record += '"';
+        }
+
+        void Field(
+            _In_ std::string_view Name,
+            _In_ uint64_t Number)
+        {
+            Separate(Name);
+            m_Record += std::to_string(Number);
+        }
+
+        void Field(
+            _In_ std::string_view Name,
+            _In_ double Number)
+        {
+            Separate(Name);
+            char buffer[64];
+            sprintf_s(buffer, "%.3f", Number);
+            m_Record += buffer;
+        }
+
+        void Hex(
+            _In_ std::string_view Name,
+            _In_ uint32_t Number)
+        {
+            std::wstring text;
+            wil::str_printf_nothrow(text, L"0x%08x", Number);
+            Field(Name, text);
+        }
+
+        void Null(_In_ std::string_view Name)
+        {
+            Separate(Name);
+            if (m_Format == ResultFormat::JsonLines)
+            {
+                m_Record += "null";
+            }
+        }
+
+        void End()
+        {
+            if (m_Format == ResultFormat::JsonLines)
+            {
+                m_Record += '}';
+            }
+            m_Record += '\n';
+
+            if (m_Header != nullptr)
+            {
+                *m_Header += '\n';
+            }
+        }
+
+    private:
+
+        void Separate(_In_ std::string_view Name)
+        {
+            if (!m_First)
+            {
+                m_Record += ',';
+                if (m_Header != nullptr)
+                {
+                    *m_Header += ',';
+                }
+            }
+            m_First = false;
+
+            if (m_Header != nullptr)
+            {
+                *m_Header += Name;
+            }
+
+            if (m_Format == ResultFormat::JsonLines)
+            {
+                m_Record += '"';
+                m_Record += Name;
+                m_Record += "\":";
+            }
+        }
+
+        void AppendEscaped(_In_ char C)
+        {
+            if (m_Format == ResultFormat::Csv)
+            {
+                //
+                // Quoted fields only escape the quote, by doubling it.
+                //
+                if (C == '"')
+                {
+                    m_Record += '"';
+                }
+                m_Record += C;
+                return;
+            }
+
+            if ((C == '"') || (C == '\\'))
+            {
+                m_Record += '\\';
+                m_Record += C;
+            }
+            else if (SCAST(unsigned char)(C) < 0x20)
+            {
+                char escaped[8];
+                sprintf_s(escaped, "\\u%04x", SCAST(unsigned int)(C));
+                m_Record += escaped;
+            }
+            else
+            {
+                m_Record += C;
+            }
+        }
+
+        static std::string ToUtf8(_In_ std::wstring_view Text)
+        {
+            std::string utf8;
+            if (!Text.empty())
+            {
+                auto length = WideCharToMultiByte(CP_UTF8,
+                                                  0,
+                                                  Text.data(),
+                                                  SCAST(int)(Text.size()),
+                                                  nullptr,
+                                                  0,
+                                                  nullptr,
+                                                  nullptr);
+                if (length > 0)
+                {
+                    utf8.resize(SCAST(size_t)(length));
+                    WideCharToMultiByte(CP_UTF8,
+                                        0,
+                                        Text.data(),
+                                        SCAST(int)(Text.size()),
+                                        utf8.data(),
+                                        length,
+                                        nullptr,
+                                        nullptr);
+                }
+            }
+            return utf8;
+        }
+
+        const ResultFormat m_Format;
+        std::string& m_Record;
+        std::string* m_Header;
+        bool m_First{ true };
+    };
+}
+
+/// <summary>
+/// Adds the "child_" fields of the resources a spawned process used to a
+/// record, every field is null if the usage was not collected.
+/// </summary>
+/// <param name="Record">
+/// Record to add the fields to.
+/// </param>
+/// <param name="Usage">
+/// Resource usage to add.
+/// </param>
+static void ChildUsageFields(
+    _Inout_ Batch::RecordBuilder& Record,
+    _In_ const std::optional<Herpaderp::ResourceUsage>& Usage)
+{
+    auto field = [&Record, &Usage](const char* Name, auto Value) -> void
+    {
+        std::string name("child_");
+        name += Name;
+        if (Usage.has_value())
+        {
+            Record.Field(name, Value);
+        }
+        else
+        {
+            Record.Null(name);
+        }
+    };
+
+    //
+    // Times are kept in 100 nanosecond units, records carry milliseconds.
+    //
+    Herpaderp::ResourceUsage usage = Usage.value_or(Herpaderp::ResourceUsage{});
+    field("cycles", usage.CycleTime);
+    field("kernel_ms", (SCAST(double)(usage.KernelTime) / 10000.0));
+    field("user_ms", (SCAST(double)(usage.UserTime) / 10000.0));
+    field("read_ops", usage.ReadOperations);
+    field("write_ops", usage.WriteOperations);
+    field("other_ops", usage.OtherOperations);
+    field("read_bytes", usage.ReadBytes);
+    field("write_bytes", usage.WriteBytes);
+    field("other_bytes", usage.OtherBytes);
+    field("peak_working_set", usage.PeakWorkingSet);
+}
+
+static void FormatRecord(
+    _In_ Batch::ResultFormat Format,
+    _In_ const Batch::Job& Job,
+    _In_ const Batch::JobResult& Result,
+    _Inout_ std::string& Record,
+    _Inout_opt_ std::string* Header)
+{
+    const auto& execution = Result.Execution;
+
+    Batch::RecordBuilder record(Format, Record, Header);
+    record.Field("id", SCAST(uint64_t)(Job.Id));
+    record.Field("source", Job.SourceFileName);
+    record.Field("target", (execution.TargetFileName.empty() ?
+                                Job.TargetFileName :
+                                execution.TargetFileName));
+    if (Job.ReplaceWithFileName.has_value())
+    {
+        record.Field("replace_with", *Job.ReplaceWithFileName);
+    }
+    else
+    {
+        record.Null("replace_with");
+    }
+    record.Hex("flags", Job.Flags);
+    record.Hex("status", SCAST(uint32_t)(Result.Status));
+    record.Field("pid", SCAST(uint64_t)(execution.ProcessId));
+    record.Field("tid", SCAST(uint64_t)(execution.ThreadId));
+    record.Hex("entry_rva", execution.EntryPointRva);
+    record.Field("copy_strategy",
+                 Herpaderp::CopyStrategyName(execution.Strategy));
+    record.Field("flush_policy",
+                 Herpaderp::FlushPolicyName(execution.Flush));
+    record.Field("write_backend",
+                 Herpaderp::WriteBackendName(execution.Backend));
+    if (execution.RandomSeed.has_value())
+    {
+        std::wstring seed;
+        wil::str_printf_nothrow(seed, L"0x%016llx", *execution.RandomSeed);
+        record.Field("random_seed", seed);
+    }
+    else
+    {
+        record.Null("random_seed");
+    }
+    record.Field("bytes_copied", execution.BytesCopied);
+    record.Field("bytes_overwritten", execution.BytesOverwritten);
+    record.Field("bytes_appended", execution.BytesAppended);
+    if (execution.Exit.has_value())
+    {
+        record.Hex("exit_status", SCAST(uint32_t)(execution.Exit->Status));
+        record.Hex("exit_code", execution.Exit->ExitCode);
+    }
+    else
+    {
+        record.Null("exit_status");
+        record.Null("exit_code");
+    }
+    ChildUsageFields(record,
+                     (execution.Exit.has_value() ? 
+                         execution.Exit->Usage : 
+                         std::nullopt));
+
+    const auto& tool = execution.ToolUsage;
+    record.Field("tool_cycles", tool.CycleTime);
+    record.Field("tool_kernel_ms", (SCAST(double)(tool.KernelTime) / 10000.0));
+    record.Field("tool_user_ms", (SCAST(double)(tool.UserTime) / 10000.0));
+    record.Field("tool_read_bytes", tool.ReadBytes);
+    record.Field("tool_write_bytes", tool.WriteBytes);
+
+    std::wstring digest;
+    if (execution.ImageDigest.has_value())
+    {
+        Herpaderp::FormatDigest(*execution.ImageDigest, digest);
+        record.Field("image_sha256", digest);
+    }
+    else
+    {
+        record.Null("image_sha256");
+    }
+    if (execution.TargetDigest.has_value())
+    {
+        Herpaderp::FormatDigest(*execution.TargetDigest, digest);
+        record.Field("target_sha256", digest);
+    }
+    else
+    {
+        record.Null("target_sha256");
+    }
+
+    std::string name;
+    for (size_t i = 0; i < Herpaderp::PhaseCount; i++)
+    {
+        //
+        // Phase names are display names, make them identifiers.
+        //
+        auto phase = SCAST(Herpaderp::Phase)(i);
+        name.clear();
+        for (auto p = Herpaderp::PhaseName(phase); *p != L'\0'; p++)
+        {
+            name += ((*p == L' ') ? '_' : SCAST(char)(*p));
+        }
+        name += "_ms";
+
+        record.Field(name, execution.PhaseMilliseconds(phase));
+    }
+
+    record.End();
+}
+
+_Use_decl_annotations_
+void Batch::FormatResultRecord(
+    ResultFormat Format,
+    const Job& Job,
+    const JobResult& Result,
+    std::string& Record)
+{
+    Record.clear();
+    FormatRecord(Format, Job, Result, Record, nullptr);
+}
+
+_Use_decl_annotations_
+Batch::ResultFormat Batch::ResultFormatFromFileName(const std::wstring& FileName)
+{
+    constexpr std::wstring_view csv{ L".csv" };
+    if ((FileName.size() >= csv.size()) &&
+        (_wcsicmp(FileName.c_str() + (FileName.size() - csv.size()),
+                  csv.data()) == 0))
+    {
+        return ResultFormat::Csv;
+    }
+    return ResultFormat::JsonLines;
+}
+
+Batch::ResultWriter::~ResultWriter()
+{
+    LOG_IF_FAILED(Close());
+}
+
+_Use_decl_annotations_
+HRESULT Batch::ResultWriter::Open(
+    const std::wstring& FileName,
+    ResultFormat Format)
+{
+    auto lock = m_Lock.lock_exclusive();
+    if (m_File.is_valid())
+    {
+        return E_UNEXPECTED;
+    }
+
+    m_File.reset(CreateFileW(FileName.c_str(),
+                             FILE_APPEND_DATA | SYNCHRONIZE,
+                             FILE_SHARE_READ,
+                             nullptr,
+                             OPEN_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL,
+                             nullptr));
+    RETURN_LAST_ERROR_IF(!m_File.is_valid());
+
+    m_Format = Format;
+    m_Buffer.clear();
+    m_Buffer.reserve(ResultBufferSize);
+
+    uint64_t fileSize;
+    RETURN_IF_FAILED(Utils::GetFileSize(m_File.get(), fileSize));
+    if ((m_Format == ResultFormat::Csv) && (fileSize == 0))
+    {
+        std::string record;
+        FormatRecord(m_Format, {}, {}, record, &m_Buffer);
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Batch::ResultWriter::Write(
+    const Job& Job,
+    const JobResult& Result)
+{
+    //
+    // Format outside of the lock, concurrent writers only serialize on the
+    // copy into the buffer.
+    //
+    std::string record;
+    FormatRecord(m_Format, Job, Result, record, nullptr);
+
+    auto lock = m_Lock.lock_exclusive();
+    if (!m_File.is_valid())
+    {
+        return E_UNEXPECTED;
+    }
+
+    m_Buffer += record;
+    if (m_Buffer.size() >= ResultBufferSize)
+    {
+        RETURN_IF_FAILED(FlushBuffer());
+    }
+
+    return S_OK;
+}
+
+HRESULT Batch::ResultWriter::Close()
+{
+    auto lock = m_Lock.lock_exclusive();
+    if (!m_File.is_valid())
+    {
+        return S_OK;
+    }
+
+    auto hr = FlushBuffer();
+    m_File.reset();
+    RETURN_HR(hr);
+}
+
+HRESULT Batch::ResultWriter::FlushBuffer()
+{
+    //
+    // Appends ignore the offset, the file is opened for append only. What
+    // fails to write is dropped rather than written twice.
+    //
+    auto clearBuffer = wil::scope_exit([this]() -> void
+    {
+        m_Buffer.clear();
+    });
+
+    auto buffer = std::span<const uint8_t>(RCAST(const uint8_t*)(m_Buffer.data()),
+                                           m_Buffer.size());
+    while (!buffer.empty())
+    {
+        auto length = SCAST(DWORD)(std::min<size_t>(buffer.size(), MAXDWORD));
+
+        DWORD bytesWritten = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_File.get(),
+                                             buffer.data(),
+                                             length,
+                                             &bytesWritten,
+                                             nullptr));
+        buffer = buffer.subspan(bytesWritten);
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,130 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/results.hpp
+// Author:   Johnny Shaw
+// Abstract: Machine Readable Job Result Records
+//
+#pragma once
+
+namespace Batch
+{
+    /// <summary>
+    /// Format of job result records.
+    /// </summary>
+    enum class ResultFormat : uint32_t
+    {
+        /// <summary>
+        /// One JSON object per line.
+        /// </summary>
+        JsonLines = 0,
+
+        /// <summary>
+        /// Comma separated values with a header row.
+        /// </summary>
+        Csv,
+    };
+
+    /// <summary>
+    /// Picks the result format from a file name, ".csv" files are CSV and
+    /// everything else is JSON lines.
+    /// </summary>
+    /// <param name="FileName">
+    /// Results file name.
+    /// </param>
+    /// <returns>
+    /// Format to write the file in.
+    /// </returns>
+    ResultFormat ResultFormatFromFileName(_In_ const std::wstring& FileName);
+
+    /// <summary>
+    /// Formats the record of a job, as written by ResultWriter. CSV records
+    /// have no header.
+    /// </summary>
+    /// <param name="Format">
+    /// Format of the record.
+    /// </param>
+    /// <param name="Job">
+    /// Job that was executed.
+    /// </param>
+    /// <param name="Result">
+    /// Outcome of the job.
+    /// </param>
+    /// <param name="Record">
+    /// Set to the record, including its line ending.
+    /// </param>
+    void FormatResultRecord(
+        _In_ ResultFormat Format,
+        _In_ const Job& Job,
+        _In_ const JobResult& Result,
+        _Out_ std::string& Record);
+
+    /// <summary>
+    /// Appends one record per job to a results file. Records are buffered
+    /// and appended in large writes, at the latest when the writer is
+    /// closed. Safe for concurrent use.
+    /// </summary>
+    class ResultWriter
+    {
+    public:
+        ResultWriter() = default;
+
+        /// <summary>
+        /// Closes the writer, see Close.
+        /// </summary>
+        ~ResultWriter();
+
+        ResultWriter(const ResultWriter&) = delete;
+        ResultWriter& operator=(const ResultWriter&) = delete;
+
+        /// <summary>
+        /// Opens the results file for appending, creating it if it does not
+        /// exist. A CSV header is written to an empty file.
+        /// </summary>
+        /// <param name="FileName">
+        /// Results file to append to.
+        /// </param>
+        /// <param name="Format">
+        /// Format of the records.
+        /// </param>
+        /// <returns>
+        /// Success if the file is open.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Open(
+            _In_ const std::wstring& FileName,
+            _In_ ResultFormat Format);
+
+        /// <summary>
+        /// Writes the record of a job.
+        /// </summary>
+        /// <param name="Job">
+        /// Job that was executed.
+        /// </param>
+        /// <param name="Result">
+        /// Outcome of the job.
+        /// </param>
+        /// <returns>
+        /// Success if the record is buffered or written.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Write(
+            _In_ const Job& Job,
+            _In_ const JobResult& Result);
+
+        /// <summary>
+        /// Writes out every buffered record and closes the file.
+        /// </summary>
+        /// <returns>
+        /// Success if every record was written.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Close();
+
+    private:
+
+        HRESULT FlushBuffer();
+
+        wil::srwlock m_Lock;
+        wil::unique_handle m_File;
+        ResultFormat m_Format{ ResultFormat::JsonLines };
+        std::string m_Buffer;
+    };
+}
@@ -0,0 +1,97 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/scratch.cpp
+// Author:   Johnny Shaw
+// Abstract: Placement of Target Files Under a Scratch Root
+//
+#include "pch.hpp"
+#include "scratch.hpp"
+
+static HRESULT CreateDirectoryIfMissing(_In_ const std::wstring& Directory)
+{
+    if (!CreateDirectoryW(Directory.c_str(), nullptr))
+    {
+        RETURN_LAST_ERROR_IF(GetLastError() != ERROR_ALREADY_EXISTS);
+    }
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ScratchDirectory::Initialize(
+    const std::wstring& Root,
+    uint32_t BucketCount)
+{
+    if (!m_Root.empty() || Root.empty() || (BucketCount == 0))
+    {
+        return E_INVALIDARG;
+    }
+
+    auto length = GetFullPathNameW(Root.c_str(), 0, nullptr, nullptr);
+    RETURN_LAST_ERROR_IF(length == 0);
+
+    std::wstring root(length, L'\0');
+    length = GetFullPathNameW(Root.c_str(), length, root.data(), nullptr);
+    RETURN_LAST_ERROR_IF(length == 0);
+    root.resize(length);
+
+    while ((root.size() > 1) &&
+           ((root.back() == L'\\') || (root.back() == L'/')))
+    {
+        root.pop_back();
+    }
+
+    RETURN_IF_FAILED(CreateDirectoryIfMissing(root));
+
+    std::wstring bucket;
+    for (uint32_t i = 0; i < BucketCount; i++)
+    {
+        RETURN_IF_FAILED(wil::str_printf_nothrow(bucket,
+                                                 L"%ls\\%02x",
+                                                 root.c_str(),
+                                                 i));
+        RETURN_IF_FAILED(CreateDirectoryIfMissing(bucket));
+    }
+
+    m_Root = std::move(root);
+    m_BucketCount = BucketCount;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Herpaderp::ScratchDirectory::PlaceTarget(
+    std::wstring_view TargetFileName,
+    std::wstring& PlacedFileName) const
+{
+    PlacedFileName.clear();
+
+    if (m_Root.empty())
+    {
+        return E_UNEXPECTED;
+    }
+
+    auto pos = TargetFileName.find_last_of(L"\\/:");
+    auto fileName = ((pos == std::wstring_view::npos) ?
+                         TargetFileName :
+                         TargetFileName.substr(pos + 1));
+    if (fileName.empty())
+    {
+        return E_INVALIDARG;
+    }
+
+    //
+    // The process identifier keeps names unique across tools sharing the
+    // root, the sequence across executions in this one.
+    //
+    auto sequence = m_Sequence.fetch_add(1, std::memory_order_relaxed);
+    RETURN_IF_FAILED(wil::str_printf_nothrow(
+                                    PlacedFileName,
+                                    L"%ls\\%02x\\%lx-%llx-%.*ls",
+                                    m_Root.c_str(),
+                                    SCAST(uint32_t)(sequence % m_BucketCount),
+                                    GetCurrentProcessId(),
+                                    sequence,
+                                    SCAST(int)(fileName.size()),
+                                    fileName.data()));
+    return S_OK;
+}
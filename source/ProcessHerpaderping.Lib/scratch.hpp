@@ -0,0 +1,89 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/scratch.hpp
+// Author:   Johnny Shaw
+// Abstract: Placement of Target Files Under a Scratch Root
+//
+#pragma once
+
+//
+// Public header of the library, a scratch directory can be shared by every
+// execution in the process through ExecuteOptions.
+//
+#include "herpaderp.hpp"
+#include <atomic>
+#include <string_view>
+
+namespace Herpaderp
+{
+    /// <summary>
+    /// Scratch root that target files are placed under with generated
+    /// unique names. Consecutive targets are spread over bucket directories
+    /// so concurrent executions do not contend on one directory. Safe for
+    /// concurrent use once initialized.
+    /// </summary>
+    class ScratchDirectory
+    {
+    public:
+        /// <summary>
+        /// Default number of bucket directories under the root.
+        /// </summary>
+        constexpr static uint32_t DefaultBucketCount = 16;
+
+        ScratchDirectory() = default;
+
+        ScratchDirectory(const ScratchDirectory&) = delete;
+        ScratchDirectory& operator=(const ScratchDirectory&) = delete;
+
+        /// <summary>
+        /// Creates the root and its bucket directories, if they do not
+        /// already exist.
+        /// </summary>
+        /// <param name="Root">
+        /// Directory to place targets under, for example on a RAM disk or a
+        /// dev drive.
+        /// </param>
+        /// <param name="BucketCount">
+        /// Number of bucket directories, optional. Must not be zero.
+        /// </param>
+        /// <returns>
+        /// Success if the directories exist.
+        /// </returns>
+        _Must_inspect_result_ HRESULT Initialize(
+            _In_ const std::wstring& Root,
+            _In_ uint32_t BucketCount = DefaultBucketCount);
+
+        /// <summary>
+        /// Generates a unique target file name under the root. The name
+        /// keeps the file name of the requested target so it stays
+        /// recognizable.
+        /// </summary>
+        /// <param name="TargetFileName">
+        /// Requested target file name, only its file name is used.
+        /// </param>
+        /// <param name="PlacedFileName">
+        /// Set to the full path of the target under the root.
+        /// </param>
+        /// <returns>
+        /// Success if the name is generated. E_INVALIDARG if the requested
+        /// target has no file name.
+        /// </returns>
+        _Must_inspect_result_ HRESULT PlaceTarget(
+            _In_ std::wstring_view TargetFileName,
+            _Out_ std::wstring& PlacedFileName) const;
+
+        /// <summary>Gets the full path of the root.</summary>
+        /// <returns>Full path of the root, empty if not initialized.</returns>
+        const std::wstring& Root() const
+        {
+            return m_Root;
+        }
+
+    private:
+
+        std::wstring m_Root;
+        uint32_t m_BucketCount{ 0 };
+        mutable std::atomic<uint64_t> m_Sequence{ 0 };
+    };
+}
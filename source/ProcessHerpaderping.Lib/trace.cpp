@@ -0,0 +1,241 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/trace.cpp
+// Author:   Johnny Shaw
+// Abstract: TraceLogging (ETW) Provider
+//
+#include "pch.hpp"
+#include "trace.hpp"
+#include "herpaderp.hpp"
+#include "utils.hpp"
+
+//
+// a7a6727b-1904-5156-9e42-4a7ff78a0ae3, derived from the provider name so
+// sessions may enable it as "*ProcessHerpaderping".
+//
+TRACELOGGING_DEFINE_PROVIDER(
+    g_TraceProvider,
+    "ProcessHerpaderping",
+    (0xa7a6727b, 0x1904, 0x5156, 0x9e, 0x42, 0x4a, 0x7f, 0xf7, 0x8a, 0x0a, 0xe3));
+
+static UCHAR GetTraceLevel(_In_ uint32_t Level)
+{
+    if (Level & Log::Error)
+    {
+        return WINEVENT_LEVEL_ERROR;
+    }
+    else if (Level & Log::Warning)
+    {
+        return WINEVENT_LEVEL_WARNING;
+    }
+    else if (Level & Log::Debug)
+    {
+        return WINEVENT_LEVEL_VERBOSE;
+    }
+
+    return WINEVENT_LEVEL_INFO;
+}
+
+void Trace::Register()
+{
+    LOG_IF_FAILED(TraceLoggingRegister(g_TraceProvider));
+}
+
+void Trace::Unregister()
+{
+    TraceLoggingUnregister(g_TraceProvider);
+}
+
+_Use_decl_annotations_
+bool Trace::IsLogEnabled(uint32_t Level)
+{
+    return TraceLoggingProviderEnabled(g_TraceProvider,
+                                       GetTraceLevel(Level),
+                                       KeywordLog);
+}
+
+_Use_decl_annotations_
+void Trace::LogMessage(
+    uint32_t Level,
+    uint32_t Error,
+    std::wstring_view Message)
+{
+    auto length = SCAST(USHORT)(std::min<size_t>(Message.size(), MAXUSHORT));
+
+    //
+    // The level of a TraceLogging event must be a constant.
+    //
+    switch (GetTraceLevel(Level))
+    {
+        case WINEVENT_LEVEL_ERROR:
+        {
+            TraceLoggingWrite(g_TraceProvider,
+                              "Log",
+                              TraceLoggingLevel(WINEVENT_LEVEL_ERROR),
+                              TraceLoggingKeyword(KeywordLog),
+                              TraceLoggingCountedWideString(Message.data(),
+                                                            length,
+                                                            "Message"),
+                              TraceLoggingHexUInt32(Error, "Error"));
+            break;
+        }
+        case WINEVENT_LEVEL_WARNING:
+        {
+            TraceLoggingWrite(g_TraceProvider,
+                              "Log",
+                              TraceLoggingLevel(WINEVENT_LEVEL_WARNING),
+                              TraceLoggingKeyword(KeywordLog),
+                              TraceLoggingCountedWideString(Message.data(),
+                                                            length,
+                                                            "Message"),
+                              TraceLoggingHexUInt32(Error, "Error"));
+            break;
+        }
+        case WINEVENT_LEVEL_VERBOSE:
+        {
+            TraceLoggingWrite(g_TraceProvider,
+                              "Log",
+                              TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                              TraceLoggingKeyword(KeywordLog),
+                              TraceLoggingCountedWideString(Message.data(),
+                                                            length,
+                                                            "Message"),
+                              TraceLoggingHexUInt32(Error, "Error"));
+            break;
+        }
+        default:
+        {
+            TraceLoggingWrite(g_TraceProvider,
+                              "Log",
+                              TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                              TraceLoggingKeyword(KeywordLog),
+                              TraceLoggingCountedWideString(Message.data(),
+                                                            length,
+                                                            "Message"),
+                              TraceLoggingHexUInt32(Error, "Error"));
+            break;
+        }
+    }
+}
+
+_Use_decl_annotations_
+void Trace::ExecuteStart(
+    const std::wstring& SourceFileName,
+    const std::wstring& TargetFileName,
+    uint32_t Flags)
+{
+    TraceLoggingWrite(g_TraceProvider,
+                      "Execute",
+                      TraceLoggingOpcode(WINEVENT_OPCODE_START),
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingKeyword(KeywordExecute),
+                      TraceLoggingWideString(SourceFileName.c_str(), "SourceFileName"),
+                      TraceLoggingWideString(TargetFileName.c_str(), "TargetFileName"),
+                      TraceLoggingHexUInt32(Flags, "Flags"));
+}
+
+_Use_decl_annotations_
+void Trace::ExecuteStop(
+    HRESULT Status,
+    const Herpaderp::ExecuteResult& Result)
+{
+    if (!TraceLoggingProviderEnabled(g_TraceProvider,
+                                     WINEVENT_LEVEL_INFO,
+                                     KeywordExecute))
+    {
+        return;
+    }
+
+    //
+    // Phase times are carried as an array indexed by Herpaderp::Phase.
+    //
+    std::array<uint64_t, Herpaderp::PhaseCount> phaseMicroseconds{};
+    for (size_t i = 0; i < Herpaderp::PhaseCount; i++)
+    {
+        phaseMicroseconds[i] = SCAST(uint64_t)(
+            Result.PhaseMilliseconds(SCAST(Herpaderp::Phase)(i)) * 1000.0);
+    }
+
+    auto window = Result.MilestoneGapMilliseconds(
+                                        Herpaderp::Milestone::TargetModified,
+                                        Herpaderp::Milestone::ThreadInserted);
+    auto windowMicroseconds = SCAST(uint64_t)(window.value_or(0.0) * 1000.0);
+
+    TraceLoggingWrite(g_TraceProvider,
+                      "Execute",
+                      TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingKeyword(KeywordExecute),
+                      TraceLoggingHResult(Status, "Status"),
+                      TraceLoggingUInt32(Result.ProcessId, "ProcessId"),
+                      TraceLoggingUInt32(Result.ThreadId, "ThreadId"),
+                      TraceLoggingUInt64(Result.BytesCopied, "BytesCopied"),
+                      TraceLoggingUInt64(Result.BytesOverwritten, 
+                                         "BytesOverwritten"),
+                      TraceLoggingUInt64(Result.BytesAppended, 
+                                         "BytesAppended"),
+                      TraceLoggingWideString(
+                          Herpaderp::CopyStrategyName(Result.Strategy),
+                          "CopyStrategy"),
+                      TraceLoggingWideString(
+                          Herpaderp::FlushPolicyName(Result.Flush),
+                          "FlushPolicy"),
+                      TraceLoggingWideString(
+                          Herpaderp::WriteBackendName(Result.Backend),
+                          "WriteBackend"),
+                      TraceLoggingUInt64Array(phaseMicroseconds.data(),
+                                              SCAST(UINT16)(phaseMicroseconds.size()),
+                                              "PhaseMicroseconds"),
+                      TraceLoggingUInt64(windowMicroseconds,
+                                         "ModifyToThreadMicroseconds"),
+                      TraceLoggingUInt32(Result.Remote.Syscalls, 
+                                         "RemoteSyscalls"),
+                      TraceLoggingUInt64(Result.Remote.BytesRead, 
+                                         "RemoteBytesRead"),
+                      TraceLoggingUInt64(Result.Remote.BytesWritten, 
+                                         "RemoteBytesWritten"));
+}
+
+_Use_decl_annotations_
+void Trace::PhaseStart(
+    const wchar_t* Phase,
+    uint32_t ProcessId)
+{
+    TraceLoggingWrite(g_TraceProvider,
+                      "Phase",
+                      TraceLoggingOpcode(WINEVENT_OPCODE_START),
+                      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                      TraceLoggingKeyword(KeywordPhase),
+                      TraceLoggingWideString(Phase, "Phase"),
+                      TraceLoggingUInt32(ProcessId, "ProcessId"));
+}
+
+_Use_decl_annotations_
+void Trace::PhaseStop(
+    const wchar_t* Phase,
+    uint32_t ProcessId,
+    uint64_t DurationMicroseconds)
+{
+    TraceLoggingWrite(g_TraceProvider,
+                      "Phase",
+                      TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+                      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+                      TraceLoggingKeyword(KeywordPhase),
+                      TraceLoggingWideString(Phase, "Phase"),
+                      TraceLoggingUInt32(ProcessId, "ProcessId"),
+                      TraceLoggingUInt64(DurationMicroseconds, "DurationMicroseconds"));
+}
+
+_Use_decl_annotations_
+void Trace::Milestone(
+    const wchar_t* Milestone,
+    uint32_t ProcessId)
+{
+    TraceLoggingWrite(g_TraceProvider,
+                      "Milestone",
+                      TraceLoggingLevel(WINEVENT_LEVEL_INFO),
+                      TraceLoggingKeyword(KeywordPhase),
+                      TraceLoggingWideString(Milestone, "Milestone"),
+                      TraceLoggingUInt32(ProcessId, "ProcessId"));
+}
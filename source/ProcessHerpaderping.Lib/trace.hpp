@@ -0,0 +1,131 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+//
+// File:     source/ProcessHerpaderping.Lib/trace.hpp
+// Author:   Johnny Shaw
+// Abstract: TraceLogging (ETW) Provider
+//
+#pragma once
+
+namespace Herpaderp
+{
+    struct ExecuteResult;
+}
+
+namespace Trace
+{
+    constexpr static uint64_t KeywordExecute{ 0x0000000000000001ull };
+    constexpr static uint64_t KeywordPhase{   0x0000000000000002ull };
+    constexpr static uint64_t KeywordLog{     0x0000000000000004ull };
+
+    /// <summary>
+    /// Registers the provider. Events are dropped until this is called.
+    /// </summary>
+    void Register();
+
+    /// <summary>
+    /// Unregisters the provider.
+    /// </summary>
+    void Unregister();
+
+    /// <summary>
+    /// Checks if a session is listening for log events at a logging level.
+    /// </summary>
+    /// <param name="Level">
+    /// Logging level (Log::Xxx).
+    /// </param>
+    /// <returns>
+    /// True if log events at the level would be recorded.
+    /// </returns>
+    bool IsLogEnabled(_In_ uint32_t Level);
+
+    /// <summary>
+    /// Emits a log message event.
+    /// </summary>
+    /// <param name="Level">
+    /// Logging level (Log::Xxx).
+    /// </param>
+    /// <param name="Error">
+    /// Error code attached to the message, zero if none.
+    /// </param>
+    /// <param name="Message">
+    /// Formatted message.
+    /// </param>
+    void LogMessage(
+        _In_ uint32_t Level,
+        _In_ uint32_t Error,
+        _In_ std::wstring_view Message);
+
+    /// <summary>
+    /// Emits the start of a herpaderping execution.
+    /// </summary>
+    /// <param name="SourceFileName">
+    /// Source binary being executed.
+    /// </param>
+    /// <param name="TargetFileName">
+    /// Target file the source is executed from.
+    /// </param>
+    /// <param name="Flags">
+    /// Flags of the execution (Herpaderp::FlagXxx).
+    /// </param>
+    void ExecuteStart(
+        _In_ const std::wstring& SourceFileName,
+        _In_ const std::wstring& TargetFileName,
+        _In_ uint32_t Flags);
+
+    /// <summary>
+    /// Emits the end of a herpaderping execution.
+    /// </summary>
+    /// <param name="Status">
+    /// Result of the execution.
+    /// </param>
+    /// <param name="Result">
+    /// Timings and details of the execution.
+    /// </param>
+    void ExecuteStop(
+        _In_ HRESULT Status,
+        _In_ const Herpaderp::ExecuteResult& Result);
+
+    /// <summary>
+    /// Emits the start of an execution phase.
+    /// </summary>
+    /// <param name="Phase">
+    /// Name of the phase.
+    /// </param>
+    /// <param name="ProcessId">
+    /// Process identifier of the spawned process, zero if not yet created.
+    /// </param>
+    void PhaseStart(
+        _In_z_ const wchar_t* Phase,
+        _In_ uint32_t ProcessId);
+
+    /// <summary>
+    /// Emits the end of an execution phase.
+    /// </summary>
+    /// <param name="Phase">
+    /// Name of the phase.
+    /// </param>
+    /// <param name="ProcessId">
+    /// Process identifier of the spawned process, zero if not yet created.
+    /// </param>
+    /// <param name="DurationMicroseconds">
+    /// Time spent in the phase since the matching start event.
+    /// </param>
+    void PhaseStop(
+        _In_z_ const wchar_t* Phase,
+        _In_ uint32_t ProcessId,
+        _In_ uint64_t DurationMicroseconds);
+
+    /// <summary>
+    /// Emits an execution milestone.
+    /// </summary>
+    /// <param name="Milestone">
+    /// Name of the milestone.
+    /// </param>
+    /// <param name="ProcessId">
+    /// Process identifier of the spawned process, zero if not yet created.
+    /// </param>
+    void Milestone(
+        _In_z_ const wchar_t* Milestone,
+        _In_ uint32_t ProcessId);
+}
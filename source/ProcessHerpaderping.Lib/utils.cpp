@@ -0,0 +1,1652 @@
+//
+// Copyright (c) Johnny Shaw. All rights reserved.
+// 
+// File:     source/ProcessHerpaderping.Lib/utils.cpp
+// Author:   Johnny Shaw
+// Abstract: Utility functionality for herpaderping. 
+//
+#include "pch.hpp"
+#include "utils.hpp"
+#include "arena.hpp"
+#include "filesink.hpp"
+#include "filesource.hpp"
+#include "random.hpp"
+#include "hashing.hpp"
+#include "peview.hpp"
+#include "trace.hpp"
+#include "logwriter.hpp"
+
+namespace Utils
+{
+    static std::atomic<uint32_t> g_LoggingMask{ 0xffffffff };
+    static wil::srwlock g_ErrorCacheLock;
+    static std::unordered_map<uint32_t, std::wstring> g_ErrorCache;
+    constexpr static uint32_t PatternBlockSize{ 0x100000 }; // 1mib
+    constexpr static uint32_t BufferAlignment{ 0x1000 }; // page
+    constexpr static uint64_t MaxCloneChunk{ 0x40000000 }; // 1gib
+    constexpr static uint32_t MaxIoChunk{ 0x40000000 }; // 1gib
+
+    constexpr static uint64_t AlignUp(
+        _In_ uint64_t Value, 
+        _In_ uint64_t Alignment)
+    {
+        return (((Value + Alignment - 1) / Alignment) * Alignment);
+    }
+}
+
+_Use_decl_annotations_
+HRESULT Utils::MatchParameter(
+    std::wstring_view Arg,
+    std::optional<std::wstring_view> Short,
+    std::optional<std::wstring_view> Long)
+{
+    if (Arg.length() < 2)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_PARAMETER);
+    }
+
+    if (Long.has_value() && (Arg[0] == L'-') && (Arg[1] == L'-'))
+    {
+        if (wcscmp(&Arg[2], Long->data()) == 0)
+        {
+            return S_OK;
+        }
+    }
+    if (Short.has_value() && ((Arg[0] == L'-') || (Arg[0] == L'/')))
+    {
+        if (wcscmp(&Arg[1], Short->data()) == 0)
+        {
+            return S_OK;
+        }
+    }
+
+    return E_FAIL;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::CheckForHelpOptions(
+    int Argc,
+    const wchar_t* Argv[])
+{
+    for (int i = 0; i < Argc; i++)
+    {
+        if (SUCCEEDED(MatchParameter(Argv[i], L"h", L"help")) || 
+            SUCCEEDED(MatchParameter(Argv[i], L"?", std::nullopt)))
+        {
+            return S_OK;
+        }
+    }
+    return E_NOT_SET;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::HandleCommandLineArgs(
+    int Argc,
+    const wchar_t* Argv[],
+    std::optional<std::wstring_view> Header,
+    IArgumentParser& Parser)
+{
+    if (SUCCEEDED(CheckForHelpOptions(Argc, Argv)) ||
+        FAILED(Parser.ParseArguments(Argc, Argv)) ||
+        FAILED(Parser.ValidateArguments()))
+    {
+        if (Header.has_value())
+        {
+            std::wcout << *Header << L'\n';
+        }
+        std::wcout << Parser.GetUsage();
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::SplitCommandLine(
+    const std::wstring& CommandLine,
+    std::vector<std::wstring>& Args)
+{
+    Args.clear();
+
+    //
+    // CommandLineToArgvW treats the first token as the program name which
+    // is parsed with different quoting rules. Put a placeholder in front so
+    // every real argument is parsed the same way.
+    //
+    std::wstring line = L"_ " + CommandLine;
+
+    int argc = 0;
+    wil::unique_any<LPWSTR*, decltype(&LocalFree), LocalFree> argv;
+    argv.reset(CommandLineToArgvW(line.c_str(), &argc));
+    RETURN_LAST_ERROR_IF(!argv.is_valid());
+
+    for (int i = 1; i < argc; i++)
+    {
+        Args.emplace_back(argv.get()[i]);
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::ReadFileLines(
+    const std::wstring& FileName,
+    std::vector<std::wstring>& Lines)
+{
+    Lines.clear();
+
+    wil::unique_handle fileHandle;
+    fileHandle.reset(CreateFileW(FileName.c_str(),
+                                 GENERIC_READ,
+                                 FILE_SHARE_READ,
+                                 nullptr,
+                                 OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL |
+                                     FILE_FLAG_SEQUENTIAL_SCAN,
+                                 nullptr));
+    RETURN_LAST_ERROR_IF(!fileHandle.is_valid());
+
+    uint64_t fileSize;
+    RETURN_IF_FAILED(GetFileSize(fileHandle.get(), fileSize));
+    if (fileSize > MAXDWORD)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_FILE_TOO_LARGE);
+    }
+
+    std::vector<uint8_t> buffer(SCAST(size_t)(fileSize));
+    if (!buffer.empty())
+    {
+        DWORD bytesRead = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(ReadFile(fileHandle.get(),
+                                            buffer.data(),
+                                            SCAST(DWORD)(buffer.size()),
+                                            &bytesRead,
+                                            nullptr));
+        buffer.resize(bytesRead);
+    }
+
+    std::wstring text;
+    if ((buffer.size() >= 2) && (buffer[0] == 0xff) && (buffer[1] == 0xfe))
+    {
+        text.assign(RCAST(const wchar_t*)(&buffer[2]),
+                    ((buffer.size() - 2) / sizeof(wchar_t)));
+    }
+    else
+    {
+        size_t offset = 0;
+        if ((buffer.size() >= 3) &&
+            (buffer[0] == 0xef) && (buffer[1] == 0xbb) && (buffer[2] == 0xbf))
+        {
+            offset = 3;
+        }
+
+        if (buffer.size() > offset)
+        {
+            auto source = RCAST(LPCCH)(&buffer[offset]);
+            auto sourceLength = SCAST(int)(buffer.size() - offset);
+            auto length = MultiByteToWideChar(CP_UTF8,
+                                              0,
+                                              source,
+                                              sourceLength,
+                                              nullptr,
+                                              0);
+            RETURN_LAST_ERROR_IF(length <= 0);
+
+            text.resize(SCAST(size_t)(length));
+            length = MultiByteToWideChar(CP_UTF8,
+                                         0,
+                                         source,
+                                         sourceLength,
+                                         text.data(),
+                                         length);
+            RETURN_LAST_ERROR_IF(length <= 0);
+        }
+    }
+
+    size_t begin = 0;
+    while (begin < text.size())
+    {
+        auto end = text.find(L'\n', begin);
+        if (end == std::wstring::npos)
+        {
+            end = text.size();
+        }
+
+        std::wstring line(text, begin, (end - begin));
+        EraseAll(line, { L'\r' });
+        Lines.emplace_back(std::move(line));
+
+        begin = (end + 1);
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+const std::wstring& Utils::FormatError(uint32_t Error)
+{
+    {
+        auto lock = g_ErrorCacheLock.lock_shared();
+        auto it = g_ErrorCache.find(Error);
+        if (it != g_ErrorCache.end())
+        {
+            return it->second;
+        }
+    }
+
+    wil::unique_any<LPWSTR, decltype(&LocalFree), LocalFree> buffer;
+    std::wstring message;
+    auto length = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER |
+                                     FORMAT_MESSAGE_FROM_SYSTEM |
+                                     FORMAT_MESSAGE_IGNORE_INSERTS,
+                                 nullptr,
+                                 Error,
+                                 MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                                 RCAST(LPWSTR)(&buffer),
+                                 0,
+                                 nullptr);
+    if ((buffer != nullptr) && (length > 0))
+    {
+        message = std::wstring(buffer.get(), length);
+    }
+    else
+    {
+        length = FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER |
+                                    FORMAT_MESSAGE_FROM_SYSTEM |
+                                    FORMAT_MESSAGE_FROM_HMODULE |
+                                    FORMAT_MESSAGE_IGNORE_INSERTS,
+                                GetModuleHandleA("ntdll.dll"),
+                                Error,
+                                MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                                RCAST(LPWSTR)(&buffer),
+                                0,
+                                nullptr);
+        if ((buffer != nullptr) && (length > 0))
+        {
+            //
+            // NT status codes are formatted with inserts, only use the 
+            // initial description if there is one, otherwise just use the 
+            // string as is.
+            //
+            message = std::wstring(buffer.get(), length);
+            if (message[0] == L'{')
+            {
+                auto pos = message.find(L'}', 1);
+                if (pos != std::wstring::npos)
+                {
+                    message = std::wstring(message.begin() + 1,
+                                           message.begin() + pos);
+                }
+            }
+        }
+    }
+
+    if (message.empty())
+    {
+        message = L"Unknown Error";
+    }
+
+    std::wstring res;
+    wil::str_printf_nothrow(res, L"0x%08x - %ls", Error, message.c_str());
+    EraseAll(res, { L'\r', L'\n', L'\t' });
+
+    //
+    // Formatting goes to the message tables, remember it. The set of error
+    // codes a run sees is small. Entries are never removed, callers keep a
+    // reference rather than copying the string.
+    //
+    auto lock = g_ErrorCacheLock.lock_exclusive();
+    return g_ErrorCache.emplace(Error, std::move(res)).first->second;
+}
+
+HRESULT Utils::StartAsyncLogging()
+{
+    return LogWriter::Instance().Start();
+}
+
+void Utils::StopAsyncLogging()
+{
+    LogWriter::Instance().Stop();
+}
+
+void Utils::FlushLog()
+{
+    LogWriter::Instance().Flush();
+}
+
+_Use_decl_annotations_
+void Utils::SetLoggingMask(uint32_t Level)
+{
+    g_LoggingMask.store(Level, std::memory_order_relaxed);
+}
+
+static const wchar_t* GetLogLevelPrefix(_In_ uint32_t Level)
+{
+    if (Level & Log::Error)
+    {
+        return L"[ERROR] ";
+    }
+    else if (Level & Log::Warning)
+    {
+        return L"[WARN]  ";
+    }
+    else if (Level & Log::Information)
+    {
+        return L"[INFO]  ";
+    }
+    else if (Level & Log::Debug)
+    {
+        return L"[DEBUG] ";
+    }
+
+    return L"[OK]    ";
+}
+
+static void LogInternal(
+    _In_ bool AppendError,
+    _In_ uint32_t Error,
+    _In_ uint32_t Level,
+    _Printf_format_string_ const wchar_t* Format,
+    _In_ va_list Args)
+{
+    //
+    // Filtered levels cost an atomic load and an ETW enabled check, nothing
+    // is formatted unless someone wants the line.
+    //
+    auto loggingMask = Utils::g_LoggingMask.load(std::memory_order_relaxed);
+    auto console = ((Level & loggingMask) != 0);
+    auto trace = Trace::IsLogEnabled(Level);
+    if (!console && !trace)
+    {
+        return;
+    }
+
+    //
+    // Lines are built in a per-thread buffer which keeps its capacity, so
+    // steady state logging does not allocate.
+    //
+    thread_local std::wstring t_Line;
+    auto& line = t_Line;
+    line.clear();
+
+    if (loggingMask & Log::Context)
+    {
+        wchar_t context[32];
+        if (SUCCEEDED(StringCchPrintfW(context,
+                                       ARRAYSIZE(context),
+                                       L"[%lu:%lu]",
+                                       GetCurrentProcessId(),
+                                       GetCurrentThreadId())))
+        {
+            line += context;
+        }
+    }
+
+    line += GetLogLevelPrefix(Level);
+
+    auto messageOffset = line.size();
+
+    va_list args;
+    va_copy(args, Args);
+    auto length = _vscwprintf(Format, args);
+    va_end(args);
+    if (length >= 0)
+    {
+        line.resize(messageOffset + SCAST(size_t)(length));
+        vswprintf_s(&line[messageOffset], (SCAST(size_t)(length) + 1), Format, Args);
+    }
+    else
+    {
+        line += L"Formatting Error";
+    }
+
+    if (AppendError)
+    {
+        line += L", ";
+        line += Utils::FormatError(Error);
+    }
+
+    if (trace)
+    {
+        Trace::LogMessage(Level,
+                          (AppendError ? Error : 0),
+                          std::wstring_view(line).substr(messageOffset));
+    }
+
+    if (console)
+    {
+        line += L'\n';
+        Utils::LogWriter::Instance().Write(Level, line);
+    }
+}
+
+_Use_decl_annotations_
+void Utils::Log(
+    uint32_t Level, 
+    const wchar_t* Format, 
+    ...)
+{
+    va_list args;
+    va_start(args, Format);
+    LogInternal(false, 0, Level, Format, args);
+    va_end(args);
+}
+
+_Use_decl_annotations_
+uint32_t Utils::Log(
+    uint32_t Level, 
+    uint32_t Error, 
+    const wchar_t* Format, 
+    ...)
+{
+    va_list args;
+    va_start(args, Format);
+    LogInternal(true, Error, Level, Format, args);
+    va_end(args);
+    return Error;
+}
+
+static void ReplicatePattern(
+    _Out_writes_bytes_(Length) uint8_t* Buffer,
+    _In_ size_t Length,
+    _In_ std::span<const uint8_t> Pattern)
+{
+    //
+    // Seed the buffer with one copy of the pattern then keep doubling what
+    // is already filled. This is a handful of large memcpy calls instead of
+    // one per pattern repetition.
+    //
+    auto filled = std::min<size_t>(Length, Pattern.size());
+    std::memcpy(Buffer, Pattern.data(), filled);
+    while (filled < Length)
+    {
+        auto len = std::min<size_t>(filled, (Length - filled));
+        std::memcpy(&Buffer[filled], Buffer, len);
+        filled += len;
+    }
+}
+
+static HRESULT GetPatternBlock(
+    _In_ std::span<const uint8_t> Pattern,
+    _Out_ std::span<const uint8_t>& Block)
+{
+    //
+    // Each thread keeps one aligned block filled with the last pattern it
+    // wrote. Jobs on the same thread reuse it without allocating or filling
+    // again unless the pattern changes.
+    //
+    struct PatternBlock
+    {
+        wil::unique_aligned_buffer Buffer;
+        size_t Capacity{ 0 };
+        size_t Length{ 0 };
+        std::vector<uint8_t> Pattern;
+    };
+    thread_local PatternBlock t_Block;
+
+    Block = {};
+
+    if (Pattern.empty())
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_PARAMETER);
+    }
+
+    if ((t_Block.Length != 0) &&
+        std::equal(Pattern.begin(),
+                   Pattern.end(),
+                   t_Block.Pattern.begin(),
+                   t_Block.Pattern.end()))
+    {
+        Block = { SCAST(const uint8_t*)(t_Block.Buffer.get()), t_Block.Length };
+        return S_OK;
+    }
+
+    //
+    // Round the block down to a whole number of patterns so consecutive
+    // writes stay in phase.
+    //
+    size_t length = ((Utils::PatternBlockSize / Pattern.size()) * Pattern.size());
+    if (length == 0)
+    {
+        length = Pattern.size();
+    }
+
+    if (length > t_Block.Capacity)
+    {
+        auto capacity = SCAST(size_t)(Utils::AlignUp(length,
+                                                     Utils::BufferAlignment));
+        wil::unique_aligned_buffer buffer(_aligned_malloc(capacity,
+                                                          Utils::BufferAlignment));
+        RETURN_IF_NULL_ALLOC(buffer.get());
+        t_Block.Buffer = std::move(buffer);
+        t_Block.Capacity = capacity;
+    }
+
+    t_Block.Length = 0;
+    t_Block.Pattern.assign(Pattern.begin(), Pattern.end());
+    ReplicatePattern(SCAST(uint8_t*)(t_Block.Buffer.get()), length, Pattern);
+    t_Block.Length = length;
+
+    Block = { SCAST(const uint8_t*)(t_Block.Buffer.get()), t_Block.Length };
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::FillBufferWithPattern(
+    std::vector<uint8_t>& Buffer,
+    std::span<const uint8_t> Pattern)
+{
+    if (Buffer.empty() || Pattern.empty())
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_PARAMETER);
+    }
+
+    ReplicatePattern(Buffer.data(), Buffer.size(), Pattern);
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::FillBufferWithRandomBytes(
+    std::vector<uint8_t>& Buffer)
+{
+    if (Buffer.empty())
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_PARAMETER);
+    }
+
+    RETURN_IF_NTSTATUS_FAILED(
+        BCryptGenRandom(nullptr,
+                        Buffer.data(),
+                        SCAST(ULONG)(Buffer.size()),
+                        BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::GetFileSize(
+    handle_t FileHandle,
+    uint64_t& FileSize)
+{
+    FileSize = 0;
+
+    LARGE_INTEGER fileSize;
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(FileHandle, &fileSize));
+
+    if (fileSize.QuadPart < 0)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_FILE_INVALID);
+    }
+
+    FileSize = fileSize.QuadPart;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::SetFilePointer(
+    handle_t FileHandle,
+    int64_t DistanceToMove,
+    uint32_t MoveMethod)
+{
+    LARGE_INTEGER distance;
+    distance.QuadPart = DistanceToMove;
+
+    RETURN_IF_WIN32_BOOL_FALSE_EXPECTED(SetFilePointerEx(FileHandle,
+                                                         distance,
+                                                         nullptr,
+                                                         MoveMethod));
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::ReadFileAt(
+    handle_t FileHandle,
+    uint64_t Offset,
+    std::span<uint8_t> Buffer,
+    size_t& BytesRead)
+{
+    BytesRead = 0;
+
+    while (BytesRead < Buffer.size())
+    {
+        auto length = SCAST(DWORD)(std::min<uint64_t>(MaxIoChunk,
+                                                      (Buffer.size() - BytesRead)));
+
+        OVERLAPPED overlapped{};
+        ULARGE_INTEGER offset;
+        offset.QuadPart = (Offset + BytesRead);
+        overlapped.Offset = offset.LowPart;
+        overlapped.OffsetHigh = offset.HighPart;
+
+        DWORD bytesRead = 0;
+        if (ReadFile(FileHandle,
+                     &Buffer[BytesRead],
+                     length,
+                     &bytesRead,
+                     &overlapped) == FALSE)
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+            {
+                break;
+            }
+            RETURN_LAST_ERROR();
+        }
+
+        if (bytesRead == 0)
+        {
+            break;
+        }
+
+        BytesRead += bytesRead;
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::WriteFileAt(
+    handle_t FileHandle,
+    uint64_t Offset,
+    std::span<const uint8_t> Buffer)
+{
+    size_t written = 0;
+    while (written < Buffer.size())
+    {
+        auto length = SCAST(DWORD)(std::min<uint64_t>(MaxIoChunk,
+                                                      (Buffer.size() - written)));
+
+        OVERLAPPED overlapped{};
+        ULARGE_INTEGER offset;
+        offset.QuadPart = (Offset + written);
+        overlapped.Offset = offset.LowPart;
+        overlapped.OffsetHigh = offset.HighPart;
+
+        DWORD bytesWritten = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(WriteFile(FileHandle,
+                                             &Buffer[written],
+                                             length,
+                                             &bytesWritten,
+                                             &overlapped));
+
+        written += bytesWritten;
+    }
+
+    return S_OK;
+}
+
+static HRESULT SetEndOfFileAt(
+    _In_ handle_t FileHandle,
+    _In_ uint64_t EndOfFile)
+{
+    FILE_END_OF_FILE_INFO eofInfo{};
+    eofInfo.EndOfFile.QuadPart = SCAST(LONGLONG)(EndOfFile);
+    RETURN_IF_WIN32_BOOL_FALSE(SetFileInformationByHandle(FileHandle,
+                                                          FileEndOfFileInfo,
+                                                          &eofInfo,
+                                                          sizeof(eofInfo)));
+    return S_OK;
+}
+
+namespace Utils
+{
+    /// <summary>
+    /// Hashes the writes to a sink, if a hash is given.
+    /// </summary>
+    static void HashWrites(
+        _Inout_opt_ Sha256* Hash,
+        _Inout_ ArenaPtr<IFileSink>& Sink)
+    {
+        if (Hash != nullptr)
+        {
+            //
+            // Without room for the hashing sink the writes go unhashed.
+            //
+            auto hashing = Arena::Current().New<HashingFileSink>(std::move(Sink), 
+                                                                 *Hash);
+            if (hashing == nullptr)
+            {
+                Hash->Discard();
+                return;
+            }
+            Sink = std::move(hashing);
+        }
+    }
+}
+
+_Use_decl_annotations_
+HRESULT Utils::CopyFileContents(
+    IFileSource& Source, 
+    IFileSink& Target,
+    uint64_t& BytesCopied)
+{
+    BytesCopied = 0;
+
+    //
+    // Each block is written while the source reads the ones after it.
+    //
+    for (;;)
+    {
+        std::span<const uint8_t> block;
+        RETURN_IF_FAILED(Source.Read(block));
+        if (block.empty())
+        {
+            break;
+        }
+
+        RETURN_IF_FAILED(Target.Write(BytesCopied, block));
+        BytesCopied += block.size();
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::CopyFileByHandle(
+    handle_t SourceHandle, 
+    handle_t TargetHandle,
+    uint64_t& BytesCopied,
+    bool FlushFile,
+    Herpaderp::WriteBackend Backend,
+    Sha256* Hash)
+{
+    BytesCopied = 0;
+
+    ArenaScope scratch;
+    HandleFileSource source(SourceHandle);
+    RETURN_IF_FAILED(source.Initialize());
+
+    ArenaPtr<IFileSink> sink;
+    RETURN_IF_FAILED(CreateFileSink(Backend, TargetHandle, source.Size(), sink));
+    HashWrites(Hash, sink);
+
+    RETURN_IF_FAILED(CopyFileContents(source, *sink, BytesCopied));
+
+    if (FlushFile)
+    {
+        RETURN_IF_FAILED(sink->Flush());
+    }
+
+    //
+    // The sink lets go of the target before it is cut to the copied size.
+    //
+    RETURN_IF_FAILED(sink->Close());
+    RETURN_IF_FAILED(SetEndOfFileAt(TargetHandle, BytesCopied));
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::ReplaceFileContents(
+    handle_t ReplaceWithHandle,
+    handle_t TargetHandle,
+    uint64_t TargetSize,
+    std::span<const uint8_t> Pattern,
+    uint64_t& BytesReplaced,
+    uint64_t& BytesHidden,
+    Herpaderp::WriteBackend Backend,
+    std::optional<uint64_t> RandomSeed,
+    Sha256* Hash)
+{
+    BytesReplaced = 0;
+    BytesHidden = 0;
+
+    uint64_t replaceWithSize;
+    RETURN_IF_FAILED(GetFileSize(ReplaceWithHandle, replaceWithSize));
+    if (replaceWithSize >= TargetSize)
+    {
+        return E_INVALIDARG;
+    }
+
+    //
+    // Plan the security directory patch from the replacement headers before
+    // anything is written. A replacement that is not an image has no 
+    // signature to retain.
+    //
+    ArenaScope scratch;
+    auto hiddenSize = (TargetSize - replaceWithSize);
+    std::optional<IMAGE_DATA_DIRECTORY> secDir;
+    uint64_t secDirOffset = 0;
+    PeView view(&scratch.Get());
+    if (SUCCEEDED(view.Parse(ReplaceWithHandle)))
+    {
+        secDir = view.SecurityDirectory();
+        secDirOffset = view.SecurityDirectoryOffset();
+        if (secDir.has_value())
+        {
+            secDir->Size = SCAST(DWORD)(secDir->Size + hiddenSize);
+        }
+    }
+
+    //
+    // Replacement bytes, then the patched directory entry while its page is
+    // still in the cache, then the pattern over the original bytes that are
+    // left. The target is never truncated.
+    //
+    ArenaPtr<IFileSink> sink;
+    RETURN_IF_FAILED(CreateFileSink(Backend, TargetHandle, TargetSize, sink));
+    if (Hash != nullptr)
+    {
+        //
+        // The patch lands behind the copy, hash it in place of the bytes it
+        // covers so the digest is of the final contents.
+        //
+        auto hashing = scratch.Get().New<HashingFileSink>(std::move(sink), *Hash);
+        RETURN_IF_NULL_ALLOC(hashing);
+        if (secDir.has_value())
+        {
+            hashing->Overlay(secDirOffset,
+                             { RCAST(const uint8_t*)(&secDir.value()),
+                               sizeof(IMAGE_DATA_DIRECTORY) });
+        }
+        sink = std::move(hashing);
+    }
+
+    HandleFileSource source(ReplaceWithHandle);
+    RETURN_IF_FAILED(source.Initialize());
+    RETURN_IF_FAILED(CopyFileContents(source, *sink, BytesReplaced));
+
+    if (secDir.has_value())
+    {
+        RETURN_IF_FAILED(sink->Write(secDirOffset,
+                                     { RCAST(const uint8_t*)(&secDir.value()),
+                                       sizeof(IMAGE_DATA_DIRECTORY) }));
+    }
+
+    if (RandomSeed.has_value())
+    {
+        RETURN_IF_FAILED(WriteRandomToSink(*sink,
+                                           BytesReplaced,
+                                           (TargetSize - BytesReplaced),
+                                           *RandomSeed,
+                                           BytesHidden));
+    }
+    else
+    {
+        RETURN_IF_FAILED(WritePatternToSink(*sink,
+                                            BytesReplaced,
+                                            (TargetSize - BytesReplaced),
+                                            Pattern,
+                                            BytesHidden));
+    }
+
+    RETURN_IF_FAILED(sink->Close());
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::WriteFileFromBuffer(
+    handle_t TargetHandle,
+    std::span<const uint8_t> Buffer,
+    uint64_t& BytesWritten,
+    bool FlushFile,
+    Herpaderp::WriteBackend Backend,
+    Sha256* Hash)
+{
+    BytesWritten = 0;
+
+    ArenaScope scratch;
+    ArenaPtr<IFileSink> sink;
+    RETURN_IF_FAILED(CreateFileSink(Backend, TargetHandle, Buffer.size(), sink));
+    HashWrites(Hash, sink);
+
+    while (BytesWritten < Buffer.size())
+    {
+        auto length = SCAST(size_t)(std::min<uint64_t>(
+                                                MaxIoChunk,
+                                                (Buffer.size() - BytesWritten)));
+
+        RETURN_IF_FAILED(sink->Write(BytesWritten,
+                                     Buffer.subspan(SCAST(size_t)(BytesWritten),
+                                                    length)));
+
+        BytesWritten += length;
+    }
+
+    if (FlushFile)
+    {
+        RETURN_IF_FAILED(sink->Flush());
+    }
+
+    RETURN_IF_FAILED(sink->Close());
+    RETURN_IF_FAILED(SetEndOfFileAt(TargetHandle, BytesWritten));
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::ReadFileToBuffer(
+    handle_t FileHandle,
+    std::vector<uint8_t>& Buffer)
+{
+    Buffer.clear();
+
+    uint64_t fileSize;
+    RETURN_IF_FAILED(GetFileSize(FileHandle, fileSize));
+    if (fileSize > SIZE_MAX)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_FILE_TOO_LARGE);
+    }
+
+    RETURN_IF_FAILED(SetFilePointer(FileHandle, 0, FILE_BEGIN));
+
+    Buffer.resize(SCAST(size_t)(fileSize));
+
+    size_t offset = 0;
+    while (offset < Buffer.size())
+    {
+        auto length = SCAST(DWORD)(std::min<uint64_t>(MaxIoChunk,
+                                                      (Buffer.size() - offset)));
+
+        DWORD bytesRead = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(ReadFile(FileHandle,
+                                            &Buffer[offset],
+                                            length,
+                                            &bytesRead,
+                                            nullptr));
+        if (bytesRead == 0)
+        {
+            //
+            // The file was truncated under us.
+            //
+            RETURN_LAST_ERROR_SET(ERROR_HANDLE_EOF);
+        }
+
+        offset += bytesRead;
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::PreallocateFile(
+    handle_t FileHandle,
+    uint64_t FileSize)
+{
+    FILE_ALLOCATION_INFO allocationInfo{};
+    allocationInfo.AllocationSize.QuadPart = SCAST(LONGLONG)(FileSize);
+    RETURN_IF_WIN32_BOOL_FALSE(SetFileInformationByHandle(
+                                                    FileHandle,
+                                                    FileAllocationInfo,
+                                                    &allocationInfo,
+                                                    sizeof(allocationInfo)));
+
+    //
+    // Setting the end of file does not zero the range, the valid data 
+    // length only advances as it is written.
+    //
+    RETURN_IF_FAILED(SetEndOfFileAt(FileHandle, FileSize));
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::CloneFileByHandle(
+    handle_t SourceHandle, 
+    handle_t TargetHandle,
+    uint64_t& BytesCopied)
+{
+    BytesCopied = 0;
+
+    //
+    // Block cloning only works within a volume that supports it.
+    //
+    DWORD sourceSerial = 0;
+    DWORD sourceFlags = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(GetVolumeInformationByHandleW(SourceHandle,
+                                                             nullptr,
+                                                             0,
+                                                             &sourceSerial,
+                                                             nullptr,
+                                                             &sourceFlags,
+                                                             nullptr,
+                                                             0));
+    DWORD targetSerial = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(GetVolumeInformationByHandleW(TargetHandle,
+                                                             nullptr,
+                                                             0,
+                                                             &targetSerial,
+                                                             nullptr,
+                                                             nullptr,
+                                                             nullptr,
+                                                             0));
+    if ((sourceSerial != targetSerial) ||
+        !FlagOn(sourceFlags, FILE_SUPPORTS_BLOCK_REFCOUNTING))
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    uint64_t sourceSize;
+    RETURN_IF_FAILED(GetFileSize(SourceHandle, sourceSize));
+    if (sourceSize == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    //
+    // The regions must be cluster aligned and the integrity settings of the
+    // files must match.
+    //
+    DWORD returned = 0;
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity{};
+    if (!DeviceIoControl(SourceHandle,
+                         FSCTL_GET_INTEGRITY_INFORMATION,
+                         nullptr,
+                         0,
+                         &integrity,
+                         sizeof(integrity),
+                         &returned,
+                         nullptr) || 
+        (integrity.ClusterSizeInBytes == 0))
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    FSCTL_SET_INTEGRITY_INFORMATION_BUFFER setIntegrity{};
+    setIntegrity.ChecksumAlgorithm = integrity.ChecksumAlgorithm;
+    setIntegrity.Flags = integrity.Flags;
+    RETURN_IF_WIN32_BOOL_FALSE(DeviceIoControl(TargetHandle,
+                                               FSCTL_SET_INTEGRITY_INFORMATION,
+                                               &setIntegrity,
+                                               sizeof(setIntegrity),
+                                               nullptr,
+                                               0,
+                                               &returned,
+                                               nullptr));
+
+    FILE_BASIC_INFO basicInfo{};
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileInformationByHandleEx(SourceHandle,
+                                                            FileBasicInfo,
+                                                            &basicInfo,
+                                                            sizeof(basicInfo)));
+    if (FlagOn(basicInfo.FileAttributes, FILE_ATTRIBUTE_SPARSE_FILE))
+    {
+        //
+        // A sparse source requires a sparse target.
+        //
+        RETURN_IF_WIN32_BOOL_FALSE(DeviceIoControl(TargetHandle,
+                                                   FSCTL_SET_SPARSE,
+                                                   nullptr,
+                                                   0,
+                                                   nullptr,
+                                                   0,
+                                                   &returned,
+                                                   nullptr));
+    }
+
+    //
+    // Clone whole clusters, the target is sized to cover the last partial 
+    // cluster and trimmed back to the source size after.
+    //
+    auto cloneSize = AlignUp(sourceSize, integrity.ClusterSizeInBytes);
+    auto chunkSize = AlignUp(MaxCloneChunk, integrity.ClusterSizeInBytes);
+    RETURN_IF_FAILED(SetEndOfFileAt(TargetHandle, cloneSize));
+
+    uint64_t offset = 0;
+    while (offset < cloneSize)
+    {
+        DUPLICATE_EXTENTS_DATA extents{};
+        extents.FileHandle = SourceHandle;
+        extents.SourceFileOffset.QuadPart = SCAST(LONGLONG)(offset);
+        extents.TargetFileOffset.QuadPart = SCAST(LONGLONG)(offset);
+        extents.ByteCount.QuadPart = SCAST(LONGLONG)(
+                                std::min<uint64_t>(chunkSize, (cloneSize - offset)));
+
+        if (!DeviceIoControl(TargetHandle,
+                             FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+                             &extents,
+                             sizeof(extents),
+                             nullptr,
+                             0,
+                             &returned,
+                             nullptr))
+        {
+            auto error = GetLastError();
+            if (offset == 0)
+            {
+                //
+                // Nothing was cloned, put the target back the way it was so 
+                // the caller may copy another way.
+                //
+                LOG_IF_FAILED(SetEndOfFileAt(TargetHandle, 0));
+                return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+            }
+            RETURN_WIN32(error);
+        }
+
+        offset += extents.ByteCount.QuadPart;
+    }
+
+    RETURN_IF_FAILED(SetEndOfFileAt(TargetHandle, sourceSize));
+    RETURN_IF_FAILED(SetFilePointer(TargetHandle, sourceSize, FILE_BEGIN));
+
+    BytesCopied = sourceSize;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::OffloadCopyFileByHandle(
+    handle_t SourceHandle, 
+    handle_t TargetHandle,
+    uint64_t& BytesCopied)
+{
+    BytesCopied = 0;
+
+    uint64_t sourceSize;
+    RETURN_IF_FAILED(GetFileSize(SourceHandle, sourceSize));
+    if (sourceSize == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    //
+    // Offload ranges are in logical sectors, like block cloning the target 
+    // covers the last partial sector and is trimmed after.
+    //
+    FILE_STORAGE_INFO storageInfo{};
+    RETURN_IF_WIN32_BOOL_FALSE(GetFileInformationByHandleEx(
+                                                        TargetHandle,
+                                                        FileStorageInfo,
+                                                        &storageInfo,
+                                                        sizeof(storageInfo)));
+    if (storageInfo.LogicalBytesPerSector == 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    auto copySize = AlignUp(sourceSize, storageInfo.LogicalBytesPerSector);
+    RETURN_IF_FAILED(SetEndOfFileAt(TargetHandle, copySize));
+
+    uint64_t offset = 0;
+    while (offset < copySize)
+    {
+        DWORD returned = 0;
+        FSCTL_OFFLOAD_READ_INPUT readInput{};
+        readInput.Size = sizeof(readInput);
+        readInput.FileOffset = offset;
+        readInput.CopyLength = (copySize - offset);
+
+        FSCTL_OFFLOAD_READ_OUTPUT readOutput{};
+        readOutput.Size = sizeof(readOutput);
+        RETURN_IF_WIN32_BOOL_FALSE(DeviceIoControl(SourceHandle,
+                                                   FSCTL_OFFLOAD_READ,
+                                                   &readInput,
+                                                   sizeof(readInput),
+                                                   &readOutput,
+                                                   sizeof(readOutput),
+                                                   &returned,
+                                                   nullptr));
+        if (readOutput.TransferLength == 0)
+        {
+            RETURN_LAST_ERROR_SET(ERROR_NOT_SUPPORTED);
+        }
+
+        //
+        // The token may describe less than asked, write all of it before 
+        // asking for the next.
+        //
+        uint64_t transferOffset = 0;
+        while (transferOffset < readOutput.TransferLength)
+        {
+            FSCTL_OFFLOAD_WRITE_INPUT writeInput{};
+            writeInput.Size = sizeof(writeInput);
+            writeInput.FileOffset = (offset + transferOffset);
+            writeInput.CopyLength = (readOutput.TransferLength - transferOffset);
+            writeInput.TransferOffset = transferOffset;
+            std::memcpy(writeInput.Token, 
+                        readOutput.Token, 
+                        sizeof(writeInput.Token));
+
+            FSCTL_OFFLOAD_WRITE_OUTPUT writeOutput{};
+            writeOutput.Size = sizeof(writeOutput);
+            RETURN_IF_WIN32_BOOL_FALSE(DeviceIoControl(TargetHandle,
+                                                       FSCTL_OFFLOAD_WRITE,
+                                                       &writeInput,
+                                                       sizeof(writeInput),
+                                                       &writeOutput,
+                                                       sizeof(writeOutput),
+                                                       &returned,
+                                                       nullptr));
+            if (writeOutput.LengthWritten == 0)
+            {
+                RETURN_LAST_ERROR_SET(ERROR_NOT_SUPPORTED);
+            }
+
+            transferOffset += writeOutput.LengthWritten;
+        }
+
+        offset += readOutput.TransferLength;
+    }
+
+    RETURN_IF_FAILED(SetEndOfFileAt(TargetHandle, sourceSize));
+    RETURN_IF_FAILED(SetFilePointer(TargetHandle, sourceSize, FILE_BEGIN));
+
+    BytesCopied = sourceSize;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::WritePatternToFile(
+    handle_t FileHandle,
+    uint64_t FileOffset,
+    uint64_t Length,
+    std::span<const uint8_t> Pattern,
+    uint64_t& BytesWritten)
+{
+    BytesWritten = 0;
+
+    ArenaScope scratch;
+    ArenaPtr<IFileSink> sink;
+    RETURN_IF_FAILED(CreateFileSink(Herpaderp::WriteBackend::Buffered,
+                                    FileHandle,
+                                    (FileOffset + Length),
+                                    sink));
+
+    RETURN_IF_FAILED(WritePatternToSink(*sink,
+                                        FileOffset,
+                                        Length,
+                                        Pattern,
+                                        BytesWritten));
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::WritePatternToSink(
+    IFileSink& Target,
+    uint64_t FileOffset,
+    uint64_t Length,
+    std::span<const uint8_t> Pattern,
+    uint64_t& BytesWritten)
+{
+    BytesWritten = 0;
+
+    std::span<const uint8_t> block;
+    RETURN_IF_FAILED(GetPatternBlock(Pattern, block));
+
+    while (BytesWritten < Length)
+    {
+        //
+        // The block holds a whole number of patterns, so every write starts
+        // at the beginning of the pattern relative to FileOffset.
+        //
+        auto length = SCAST(size_t)(std::min<uint64_t>(block.size(),
+                                                       (Length - BytesWritten)));
+        RETURN_IF_FAILED(Target.Write((FileOffset + BytesWritten),
+                                      block.first(length)));
+        BytesWritten += length;
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::WriteRandomToSink(
+    IFileSink& Target,
+    uint64_t FileOffset,
+    uint64_t Length,
+    uint64_t Seed,
+    uint64_t& BytesWritten)
+{
+    BytesWritten = 0;
+
+    //
+    // The stream is generated a block at a time as it is written, a file
+    // sized pattern never has to be held in memory.
+    //
+    struct RandomBlock
+    {
+        wil::unique_aligned_buffer Buffer;
+    };
+    thread_local RandomBlock t_Block;
+
+    if (t_Block.Buffer.get() == nullptr)
+    {
+        wil::unique_aligned_buffer buffer(_aligned_malloc(PatternBlockSize,
+                                                          BufferAlignment));
+        RETURN_IF_NULL_ALLOC(buffer.get());
+        t_Block.Buffer = std::move(buffer);
+    }
+
+    RandomStream stream(Seed);
+    while (BytesWritten < Length)
+    {
+        auto length = SCAST(size_t)(std::min<uint64_t>(PatternBlockSize,
+                                                       (Length - BytesWritten)));
+        auto block = std::span<uint8_t>(SCAST(uint8_t*)(t_Block.Buffer.get()),
+                                        length);
+        stream.Fill(block);
+        RETURN_IF_FAILED(Target.Write((FileOffset + BytesWritten), block));
+        BytesWritten += length;
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::OverwriteFileContentsWithPattern(
+    handle_t FileHandle,
+    std::span<const uint8_t> Pattern,
+    bool FlushFile,
+    Herpaderp::WriteBackend Backend,
+    std::optional<uint64_t> RandomSeed,
+    Sha256* Hash)
+{
+    uint64_t targetSize;
+    RETURN_IF_FAILED(GetFileSize(FileHandle, targetSize));
+
+    ArenaScope scratch;
+    ArenaPtr<IFileSink> sink;
+    RETURN_IF_FAILED(CreateFileSink(Backend, FileHandle, targetSize, sink));
+    HashWrites(Hash, sink);
+
+    uint64_t bytesWritten;
+    if (RandomSeed.has_value())
+    {
+        RETURN_IF_FAILED(WriteRandomToSink(*sink,
+                                           0,
+                                           targetSize,
+                                           *RandomSeed,
+                                           bytesWritten));
+    }
+    else
+    {
+        RETURN_IF_FAILED(WritePatternToSink(*sink,
+                                            0,
+                                            targetSize,
+                                            Pattern,
+                                            bytesWritten));
+    }
+
+    if (FlushFile)
+    {
+        RETURN_IF_FAILED(sink->Flush());
+    }
+
+    RETURN_IF_FAILED(sink->Close());
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::ExtendFileWithPattern(
+    handle_t FileHandle,
+    uint64_t NewFileSize,
+    std::span<const uint8_t> Pattern,
+    uint32_t& AppendedBytes,
+    bool FlushFile)
+{
+    AppendedBytes = 0;
+
+    uint64_t targetSize;
+    RETURN_IF_FAILED(GetFileSize(FileHandle, targetSize));
+
+    if (targetSize >= NewFileSize)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_FILE_TOO_LARGE);
+    }
+
+    RETURN_IF_FAILED(PreallocateFile(FileHandle, NewFileSize));
+
+    uint64_t bytesWritten;
+    RETURN_IF_FAILED(WritePatternToFile(FileHandle,
+                                        targetSize,
+                                        (NewFileSize - targetSize),
+                                        Pattern,
+                                        bytesWritten));
+    AppendedBytes = SCAST(uint32_t)(bytesWritten);
+
+    if (FlushFile)
+    {
+        RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(FileHandle));
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::OverwriteFileAfterWithPattern(
+    handle_t FileHandle,
+    uint64_t FileOffset,
+    std::span<const uint8_t> Pattern,
+    uint32_t& WrittenBytes,
+    bool FlushFile)
+{
+    WrittenBytes = 0;
+
+    uint64_t targetSize;
+    RETURN_IF_FAILED(GetFileSize(FileHandle, targetSize));
+
+    if (FileOffset >= targetSize)
+    {
+        RETURN_LAST_ERROR_SET(ERROR_INVALID_PARAMETER);
+    }
+
+    uint64_t bytesWritten;
+    RETURN_IF_FAILED(WritePatternToFile(FileHandle,
+                                        FileOffset,
+                                        (targetSize - FileOffset),
+                                        Pattern,
+                                        bytesWritten));
+    WrittenBytes = SCAST(uint32_t)(bytesWritten);
+
+    if (FlushFile)
+    {
+        RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(FileHandle));
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::ExtendFileSecurityDirectory(
+    handle_t FileHandle,
+    uint32_t ExtendedBy,
+    bool FlushFile)
+{
+    PeView view;
+    RETURN_IF_FAILED(view.Parse(FileHandle));
+
+    auto secDir = view.SecurityDirectory();
+    if (!secDir.has_value())
+    {
+        //
+        // No security directory, we're done.
+        //
+        return S_OK;
+    }
+
+    //
+    // Extend the security directory size. Only the directory entry in the
+    // optional header is rewritten.
+    //
+    secDir->Size = (secDir->Size + ExtendedBy);
+    RETURN_IF_FAILED(WriteFileAt(FileHandle,
+                                 view.SecurityDirectoryOffset(),
+                                 { RCAST(const uint8_t*)(&secDir.value()),
+                                   sizeof(IMAGE_DATA_DIRECTORY) }));
+
+    if (FlushFile)
+    {
+        RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(FileHandle));
+    }
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::GetImageEntryPointRva(
+    handle_t FileHandle,
+    uint32_t& EntryPointRva)
+{
+    EntryPointRva = 0;
+
+    ArenaScope scratch;
+    PeView view(&scratch.Get());
+    RETURN_IF_FAILED(view.Parse(FileHandle));
+
+    EntryPointRva = view.EntryPointRva();
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT Utils::GetImageEntryPointRva(
+    std::span<const uint8_t> Image,
+    uint32_t& EntryPointRva)
+{
+    EntryPointRva = 0;
+
+    PeView view;
+    RETURN_IF_FAILED(view.Parse(Image));
+
+    EntryPointRva = view.EntryPointRva();
+    return S_OK;
+}
+
+class OptionalUnicodeStringHelper
+{
+public:
+
+    OptionalUnicodeStringHelper(
+        _In_opt_ const std::optional<std::wstring>& String) :
+        m_String(String)
+    {
+        if (m_String.has_value())
+        {
+            RtlInitUnicodeString(&m_Unicode, m_String->c_str());
+        }
+        else
+        {
+            RtlInitUnicodeString(&m_Unicode, L"");
+        }
+    }
+
+    PUNICODE_STRING Get()
+    {
+        if (m_String.has_value())
+        {
+            return &m_Unicode;
+        }
+        return nullptr;
+    }
+
+    operator PUNICODE_STRING()
+    {
+        return Get();
+    }
+
+private:
+
+    const std::optional<std::wstring>& m_String;
+    UNICODE_STRING m_Unicode;
+
+};
+
+_Use_decl_annotations_
+HRESULT Utils::WriteRemoteProcessParameters(
+    handle_t ProcessHandle,
+    const std::wstring& ImageFileName,
+    const std::optional<std::wstring>& DllPath,
+    const std::optional<std::wstring>& CurrentDirectory,
+    const std::optional<std::wstring>& CommandLine,
+    void* EnvironmentBlock,
+    const std::optional<std::wstring>& WindowTitle,
+    const std::optional<std::wstring>& DesktopInfo,
+    const std::optional<std::wstring>& ShellInfo,
+    const std::optional<std::wstring>& RuntimeData)
+{
+    //
+    // Get the basic info for the remote PEB address.
+    //
+    PROCESS_BASIC_INFORMATION pbi{};
+    RETURN_IF_NTSTATUS_FAILED(NtQueryInformationProcess(
+                                                      ProcessHandle,
+                                                      ProcessBasicInformation,
+                                                      &pbi,
+                                                      sizeof(pbi),
+                                                      nullptr));
+
+    //
+    // Generate the process parameters to write into the process.
+    //
+    UNICODE_STRING imageName;
+    RtlInitUnicodeString(&imageName, ImageFileName.c_str());
+    OptionalUnicodeStringHelper dllPath(DllPath);
+    OptionalUnicodeStringHelper commandLine(CommandLine);
+    OptionalUnicodeStringHelper currentDirectory(CurrentDirectory);
+    OptionalUnicodeStringHelper windowTitle(WindowTitle);
+    OptionalUnicodeStringHelper desktopInfo(DesktopInfo);
+    OptionalUnicodeStringHelper shellInfo(ShellInfo);
+    OptionalUnicodeStringHelper runtimeData(RuntimeData);
+    wil::unique_user_process_parameters params;
+
+    //
+    // Generate the process parameters and do not pass
+    // RTL_USER_PROC_PARAMS_NORMALIZED, this will keep the process parameters
+    // de-normalized (pointers will be offsets instead of addresses) then 
+    // LdrpInitializeProcess will call RtlNormalizeProcessParameters and fix
+    // them up when the process starts.
+    //
+    // Note: There is an exception here, the Environment pointer is not
+    // de-normalized - we'll fix that up ourself.
+    //
+    RETURN_IF_NTSTATUS_FAILED(RtlCreateProcessParametersEx(
+                                            &params,
+                                            &imageName,
+                                            dllPath,
+                                            currentDirectory,
+                                            commandLine,
+                                            EnvironmentBlock,
+                                            windowTitle,
+                                            desktopInfo,
+                                            shellInfo,
+                                            runtimeData,
+                                            0));
+
+    //
+    // Calculate the required length.
+    //
+    size_t len = params.get()->MaximumLength + params.get()->EnvironmentSize;
+
+    //
+    // Allocate memory in the remote process to hold the process parameters.
+    //
+    auto remoteMemory = VirtualAllocEx(ProcessHandle,
+                                       nullptr,
+                                       len,
+                                       MEM_COMMIT | MEM_RESERVE,
+                                       PAGE_READWRITE);
+    RETURN_IF_NULL_ALLOC(remoteMemory);
+
+    //
+    // Okay we have some memory in the remote process, go do the final fix-ups.
+    //
+    if (params.get()->Environment != nullptr)
+    {
+        //
+        // The environment block will always be right after the length, which
+        // is the size of RTL_USER_PROCESS_PARAMETERS plus any extra field
+        // data.
+        //
+        params.get()->Environment = Add2Ptr(remoteMemory, params.get()->Length);
+    }
+
+    //
+    // Write the parameters into the remote process.
+    //
+    RETURN_IF_WIN32_BOOL_FALSE(WriteProcessMemory(ProcessHandle,
+                                                  remoteMemory,
+                                                  params.get(),
+                                                  len,
+                                                  nullptr));
+
+    //
+    // Write the parameter pointer to the remote process PEB.
+    //
+    RETURN_IF_WIN32_BOOL_FALSE(WriteProcessMemory(
+                                 ProcessHandle,
+                                 Add2Ptr(pbi.PebBaseAddress,
+                                         FIELD_OFFSET(PEB, ProcessParameters)),
+                                 &remoteMemory,
+                                 sizeof(remoteMemory),
+                                 nullptr));
+
+    return S_OK;
+}
\ No newline at end of file
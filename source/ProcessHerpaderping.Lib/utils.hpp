@@ -1,12 +1,14 @@
 //
 // Copyright (c) Johnny Shaw. All rights reserved.
 // 
-// File:     source/ProcessHerpaderping/utils.hpp
+// File:     source/ProcessHerpaderping.Lib/utils.hpp
 // Author:   Johnny Shaw
 // Abstract: Utility functionality for herpaderping. 
 //
 #pragma once
 
+#include "herpaderp.hpp"
+
 namespace Log
 {
 
@@ -21,6 +23,10 @@ namespace Log
 
 namespace Utils 
 {
+    class Sha256;
+    class IFileSink;
+    class IFileSource;
+
     /// <summary>
     /// Argument parser interface.
     /// </summary>
@@ -130,6 +136,40 @@ namespace Utils
         _In_opt_ std::optional<std::wstring_view> Header,
         _Inout_ IArgumentParser& Parser);
 
+    /// <summary>
+    /// Splits a command line string into arguments using the same rules as
+    /// the process command line.
+    /// </summary>
+    /// <param name="CommandLine">
+    /// Command line string to split.
+    /// </param>
+    /// <param name="Args">
+    /// Set to the split arguments on success.
+    /// </param>
+    /// <returns>
+    /// Success if the command line was split.
+    /// </returns>
+    _Must_inspect_result_ HRESULT SplitCommandLine(
+        _In_ const std::wstring& CommandLine,
+        _Out_ std::vector<std::wstring>& Args);
+
+    /// <summary>
+    /// Reads a text file into lines. UTF-16LE files are detected by their
+    /// byte order mark, otherwise the file is decoded as UTF-8.
+    /// </summary>
+    /// <param name="FileName">
+    /// File to read.
+    /// </param>
+    /// <param name="Lines">
+    /// Set to the lines of the file on success, line endings are removed.
+    /// </param>
+    /// <returns>
+    /// Success if the file was read.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ReadFileLines(
+        _In_ const std::wstring& FileName,
+        _Out_ std::vector<std::wstring>& Lines);
+
 #pragma warning(push)
 #pragma warning(disable : 4634)  // xmldoc: discarding XML document comment for invalid target 
     /// <summary>
@@ -168,9 +208,10 @@ namespace Utils
     /// </param>
     /// <returns>
     /// Human readable string for the error code if the error is unknown a 
-    /// string is returned formatted as "[number] - Unknown Error".
+    /// string is returned formatted as "[number] - Unknown Error". The string
+    /// is kept for the life of the process.
     /// </returns>
-    std::wstring FormatError(_In_ uint32_t Error);
+    const std::wstring& FormatError(_In_ uint32_t Error);
 
     /// <summary>
     /// Sets the logging mask.
@@ -180,6 +221,26 @@ namespace Utils
     /// </param>
     void SetLoggingMask(_In_ uint32_t Level);
 
+    /// <summary>
+    /// Starts writing log output from a background thread. Logging callers 
+    /// copy their line into a ring buffer instead of writing to the console.
+    /// </summary>
+    /// <returns>
+    /// Success if log output is written in the background.
+    /// </returns>
+    _Must_inspect_result_ HRESULT StartAsyncLogging();
+
+    /// <summary>
+    /// Writes out pending log output and stops background log writing. Log
+    /// output is written synchronously afterwards.
+    /// </summary>
+    void StopAsyncLogging();
+
+    /// <summary>
+    /// Waits for pending log output to be written.
+    /// </summary>
+    void FlushLog();
+
     /// <summary>
     /// Logs a string.
     /// </summary>
@@ -229,11 +290,11 @@ namespace Utils
     /// Buffer to fill with the patter, must not be empty.
     /// </param>
     /// <param name="Pattern">
-    /// Pattern to write into the buffer.
+    /// Pattern to write into the buffer, must not be empty.
     /// </param>
     /// <returns>
     /// Success when the buffer is filled with the pattern. Failure if Buffer 
-    /// is empty.
+    /// or Pattern is empty.
     /// </returns>
     _Must_inspect_result_ HRESULT FillBufferWithPattern(
         _Inout_ std::vector<uint8_t>& Buffer,
@@ -288,7 +349,71 @@ namespace Utils
         _In_ uint32_t MoveMethod);
 
     /// <summary>
-    /// Copies the contents for a source file to the target by handle.
+    /// Sizes a file to its final length before it is written, so the file 
+    /// system allocates it at once rather than as the writes extend it.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// File to size, the range past its current end should be written after.
+    /// </param>
+    /// <param name="FileSize">
+    /// Final length of the file.
+    /// </param>
+    /// <returns>
+    /// Success if the allocation and end of file are set.
+    /// </returns>
+    _Must_inspect_result_ HRESULT PreallocateFile(
+        _In_ handle_t FileHandle,
+        _In_ uint64_t FileSize);
+
+    /// <summary>
+    /// Reads from a file at an offset. Reads stop early at the end of the
+    /// file.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// File to read from.
+    /// </param>
+    /// <param name="Offset">
+    /// File offset to read at.
+    /// </param>
+    /// <param name="Buffer">
+    /// Buffer to read into.
+    /// </param>
+    /// <param name="BytesRead">
+    /// Set to the number of bytes read.
+    /// </param>
+    /// <returns>
+    /// Success if the read completed.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ReadFileAt(
+        _In_ handle_t FileHandle,
+        _In_ uint64_t Offset,
+        _In_ std::span<uint8_t> Buffer,
+        _Out_ size_t& BytesRead);
+
+    /// <summary>
+    /// Writes a buffer to a file at an offset.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// File to write to.
+    /// </param>
+    /// <param name="Offset">
+    /// File offset to write at.
+    /// </param>
+    /// <param name="Buffer">
+    /// Buffer to write.
+    /// </param>
+    /// <returns>
+    /// Success if the entire buffer was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WriteFileAt(
+        _In_ handle_t FileHandle,
+        _In_ uint64_t Offset,
+        _In_ std::span<const uint8_t> Buffer);
+
+    /// <summary>
+    /// Copies the contents for a source file to the target by handle. Reads 
+    /// of the source are pipelined with writes to the target using large
+    /// aligned buffers.
     /// </summary>
     /// <param name="SourceHandle">
     /// Source file handle.
@@ -296,16 +421,287 @@ namespace Utils
     /// <param name="TargetHandle">
     /// Target file handle.
     /// </param>
+    /// <param name="BytesCopied">
+    /// Number of bytes written to the target, set even on failure.
+    /// </param>
     /// <param name="FlushFile">
     /// Flushes file buffers after copy, optional, defaults to true.
     /// </param>
+    /// <param name="Backend">
+    /// How the target is written, optional, defaults to buffered writes.
+    /// </param>
+    /// <param name="Hash">
+    /// Optional, updated with the copied bytes as they are written.
+    /// </param>
     /// <returns>
     /// Success if the source file has been copied to the target.
     /// </returns>
     _Must_inspect_result_ HRESULT CopyFileByHandle(
         _In_ handle_t SourceHandle, 
         _In_ handle_t TargetHandle,
-        _In_ bool FlushFile = true);
+        _Out_ uint64_t& BytesCopied,
+        _In_ bool FlushFile = true,
+        _In_ Herpaderp::WriteBackend Backend = Herpaderp::WriteBackend::Buffered,
+        _Inout_opt_ Sha256* Hash = nullptr);
+
+    /// <summary>
+    /// Replaces the contents of a target file with a smaller file in one 
+    /// pass, without truncating the target. The replacement is copied over
+    /// the start of the target and the original bytes after it are 
+    /// overwritten with a pattern. If the replacement is an image with a 
+    /// security directory, the directory is extended over the pattern to 
+    /// retain the signature.
+    /// </summary>
+    /// <param name="ReplaceWithHandle">
+    /// File to replace the target contents with.
+    /// </param>
+    /// <param name="TargetHandle">
+    /// Target file handle.
+    /// </param>
+    /// <param name="TargetSize">
+    /// Size of the target file, must be larger than the replacement.
+    /// </param>
+    /// <param name="Pattern">
+    /// Pattern to overwrite the original bytes with.
+    /// </param>
+    /// <param name="BytesReplaced">
+    /// Number of replacement bytes written, set even on failure.
+    /// </param>
+    /// <param name="BytesHidden">
+    /// Number of original bytes overwritten with the pattern.
+    /// </param>
+    /// <param name="Backend">
+    /// How the target is written, optional, defaults to buffered writes.
+    /// </param>
+    /// <param name="RandomSeed">
+    /// Optional, the original bytes are overwritten with the random stream
+    /// of this seed rather than with the pattern.
+    /// </param>
+    /// <param name="Hash">
+    /// Optional, updated with the resulting target contents as they are written.
+    /// </param>
+    /// <returns>
+    /// Success if the target contents are replaced. E_INVALIDARG if the 
+    /// replacement is not smaller than the target.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ReplaceFileContents(
+        _In_ handle_t ReplaceWithHandle,
+        _In_ handle_t TargetHandle,
+        _In_ uint64_t TargetSize,
+        _In_ std::span<const uint8_t> Pattern,
+        _Out_ uint64_t& BytesReplaced,
+        _Out_ uint64_t& BytesHidden,
+        _In_ Herpaderp::WriteBackend Backend = Herpaderp::WriteBackend::Buffered,
+        _In_ std::optional<uint64_t> RandomSeed = std::nullopt,
+        _Inout_opt_ Sha256* Hash = nullptr);
+
+    /// <summary>
+    /// Writes the contents of a buffer to the target file by handle, the 
+    /// target is truncated to the buffer size.
+    /// </summary>
+    /// <param name="TargetHandle">
+    /// Target file handle.
+    /// </param>
+    /// <param name="Buffer">
+    /// Buffer to write to the target.
+    /// </param>
+    /// <param name="BytesWritten">
+    /// Number of bytes written to the target, set even on failure.
+    /// </param>
+    /// <param name="FlushFile">
+    /// Flushes file buffers after the write, optional, defaults to true.
+    /// </param>
+    /// <param name="Backend">
+    /// How the target is written, optional, defaults to buffered writes.
+    /// </param>
+    /// <param name="Hash">
+    /// Optional, updated with the buffer as it is written.
+    /// </param>
+    /// <returns>
+    /// Success if the buffer has been written to the target.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WriteFileFromBuffer(
+        _In_ handle_t TargetHandle,
+        _In_ std::span<const uint8_t> Buffer,
+        _Out_ uint64_t& BytesWritten,
+        _In_ bool FlushFile = true,
+        _In_ Herpaderp::WriteBackend Backend = Herpaderp::WriteBackend::Buffered,
+        _Inout_opt_ Sha256* Hash = nullptr);
+
+    /// <summary>
+    /// Reads the entire contents of a file into a buffer.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// File to read.
+    /// </param>
+    /// <param name="Buffer">
+    /// Set to the contents of the file on success.
+    /// </param>
+    /// <returns>
+    /// Success if the file was read.
+    /// </returns>
+    _Must_inspect_result_ HRESULT ReadFileToBuffer(
+        _In_ handle_t FileHandle,
+        _Out_ std::vector<uint8_t>& Buffer);
+
+    /// <summary>
+    /// Clones the contents of a source file to the target by handle using 
+    /// block cloning (FSCTL_DUPLICATE_EXTENTS_TO_FILE). No file data passes
+    /// through user mode. The files must be on the same volume and the file
+    /// system must support block reference counting (e.g. ReFS).
+    /// </summary>
+    /// <param name="SourceHandle">
+    /// Source file handle.
+    /// </param>
+    /// <param name="TargetHandle">
+    /// Target file handle.
+    /// </param>
+    /// <param name="BytesCopied">
+    /// Number of bytes cloned to the target.
+    /// </param>
+    /// <returns>
+    /// Success if the source file has been cloned to the target. Failure if 
+    /// block cloning is not possible for these files, the caller should copy
+    /// another way.
+    /// </returns>
+    _Must_inspect_result_ HRESULT CloneFileByHandle(
+        _In_ handle_t SourceHandle, 
+        _In_ handle_t TargetHandle,
+        _Out_ uint64_t& BytesCopied);
+
+    /// <summary>
+    /// Copies the contents of a source file to the target by handle using 
+    /// offloaded data transfer (FSCTL_OFFLOAD_READ/FSCTL_OFFLOAD_WRITE). The
+    /// storage performs the copy, no file data passes through user mode.
+    /// </summary>
+    /// <param name="SourceHandle">
+    /// Source file handle.
+    /// </param>
+    /// <param name="TargetHandle">
+    /// Target file handle.
+    /// </param>
+    /// <param name="BytesCopied">
+    /// Number of bytes copied to the target.
+    /// </param>
+    /// <returns>
+    /// Success if the source file has been copied to the target. Failure if 
+    /// offloaded transfer is not possible for these files, the caller should
+    /// copy another way.
+    /// </returns>
+    _Must_inspect_result_ HRESULT OffloadCopyFileByHandle(
+        _In_ handle_t SourceHandle, 
+        _In_ handle_t TargetHandle,
+        _Out_ uint64_t& BytesCopied);
+
+    /// <summary>
+    /// Writes a repeating pattern over a range of a file. The pattern starts
+    /// at FileOffset. Writes are issued from a large per-thread block that is
+    /// only refilled when the pattern changes.
+    /// </summary>
+    /// <param name="FileHandle">
+    /// Target file to write to.
+    /// </param>
+    /// <param name="FileOffset">
+    /// Offset to begin writing at.
+    /// </param>
+    /// <param name="Length">
+    /// Number of bytes to write, the file is extended if the range ends
+    /// beyond the end of the file.
+    /// </param>
+    /// <param name="Pattern">
+    /// Pattern to write, must not be empty.
+    /// </param>
+    /// <param name="BytesWritten">
+    /// Set to the number of bytes written.
+    /// </param>
+    /// <returns>
+    /// Success if the entire range was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WritePatternToFile(
+        _In_ handle_t FileHandle,
+        _In_ uint64_t FileOffset,
+        _In_ uint64_t Length,
+        _In_ std::span<const uint8_t> Pattern,
+        _Out_ uint64_t& BytesWritten);
+
+    /// <summary>
+    /// Copies every byte of a source to a sink, from offset zero. The file
+    /// helpers copy through this, it can also be run against sources and 
+    /// sinks that are not files.
+    /// </summary>
+    /// <param name="Source">
+    /// Source to copy.
+    /// </param>
+    /// <param name="Target">
+    /// Sink to copy to.
+    /// </param>
+    /// <param name="BytesCopied">
+    /// Set to the number of bytes copied.
+    /// </param>
+    /// <returns>
+    /// Success if the whole source was copied.
+    /// </returns>
+    _Must_inspect_result_ HRESULT CopyFileContents(
+        _Inout_ IFileSource& Source,
+        _Inout_ IFileSink& Target,
+        _Out_ uint64_t& BytesCopied);
+
+    /// <summary>
+    /// Writes a pattern over a range of a sink. The file helpers overwrite
+    /// through this.
+    /// </summary>
+    /// <param name="Target">
+    /// Sink to write to.
+    /// </param>
+    /// <param name="FileOffset">
+    /// Offset to begin writing at.
+    /// </param>
+    /// <param name="Length">
+    /// Number of bytes to write.
+    /// </param>
+    /// <param name="Pattern">
+    /// Pattern to write, must not be empty.
+    /// </param>
+    /// <param name="BytesWritten">
+    /// Set to the number of bytes written.
+    /// </param>
+    /// <returns>
+    /// Success if the entire range was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WritePatternToSink(
+        _Inout_ IFileSink& Target,
+        _In_ uint64_t FileOffset,
+        _In_ uint64_t Length,
+        _In_ std::span<const uint8_t> Pattern,
+        _Out_ uint64_t& BytesWritten);
+
+    /// <summary>
+    /// Writes the random stream of a seed over a range of a sink.
+    /// </summary>
+    /// <param name="Target">
+    /// Sink to write to.
+    /// </param>
+    /// <param name="FileOffset">
+    /// Offset to begin writing at, the stream starts at its beginning here.
+    /// </param>
+    /// <param name="Length">
+    /// Number of bytes to write.
+    /// </param>
+    /// <param name="Seed">
+    /// Seed of the random stream.
+    /// </param>
+    /// <param name="BytesWritten">
+    /// Set to the number of bytes written.
+    /// </param>
+    /// <returns>
+    /// Success if the entire range was written.
+    /// </returns>
+    _Must_inspect_result_ HRESULT WriteRandomToSink(
+        _Inout_ IFileSink& Target,
+        _In_ uint64_t FileOffset,
+        _In_ uint64_t Length,
+        _In_ uint64_t Seed,
+        _Out_ uint64_t& BytesWritten);
 
     /// <summary>
     /// Overwrites the contents of a file with a pattern.
@@ -322,13 +718,26 @@ namespace Utils
     /// <param name="FlushFile">
     /// Flushes file buffers after overwrite, optional, defaults to true.
     /// </param>
+    /// <param name="Backend">
+    /// How the file is written, optional, defaults to buffered writes.
+    /// </param>
+    /// <param name="RandomSeed">
+    /// Optional, the file is overwritten with the random stream of this 
+    /// seed rather than with the pattern.
+    /// </param>
+    /// <param name="Hash">
+    /// Optional, updated with the new file contents as they are written.
+    /// </param>
     /// <returns>
     /// Success if the file content was overwritten.
     /// </returns>
     _Must_inspect_result_ HRESULT OverwriteFileContentsWithPattern(
         _In_ handle_t FileHandle,
         _In_ std::span<const uint8_t> Pattern,
-        _In_ bool FlushFile = true);
+        _In_ bool FlushFile = true,
+        _In_ Herpaderp::WriteBackend Backend = Herpaderp::WriteBackend::Buffered,
+        _In_ std::optional<uint64_t> RandomSeed = std::nullopt,
+        _Inout_opt_ Sha256* Hash = nullptr);
 
     /// <summary>
     /// Extends file to meet a new size writes a pattern to the extension.
@@ -423,6 +832,22 @@ namespace Utils
         _In_ handle_t FileHandle,
         _Out_ uint32_t& EntryPointRva);
 
+    /// <summary>
+    /// Retrieves the image entry point RVA from an image in memory.
+    /// </summary>
+    /// <param name="Image">
+    /// Image file content to parse for the entry point RVA.
+    /// </param>
+    /// <param name="EntryPointRva">
+    /// Set to the entry point RVA on success.
+    /// </param>
+    /// <returns>
+    /// Success if the PE image entry RVA is located.
+    /// </returns>
+    _Must_inspect_result_ HRESULT GetImageEntryPointRva(
+        _In_ std::span<const uint8_t> Image,
+        _Out_ uint32_t& EntryPointRva);
+
     /// <summary>
     /// Writes remote process parameters into target process.
     /// </summary>
@@ -461,7 +886,7 @@ namespace Utils
     /// </returns>
     _Must_inspect_result_ HRESULT WriteRemoteProcessParameters(
         _In_ handle_t ProcessHandle,
-        _In_ const std::wstring ImageFileName,
+        _In_ const std::wstring& ImageFileName,
         _In_opt_ const std::optional<std::wstring>& DllPath,
         _In_opt_ const std::optional<std::wstring>& CurrentDirectory,
         _In_opt_ const std::optional<std::wstring>& CommandLine,
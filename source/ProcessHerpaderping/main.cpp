@@ -6,8 +6,20 @@
 // Abstract: Process Herpaderping Tool 
 //
 #include "pch.hpp"
+#include "res/version.h"
 #include "utils.hpp"
 #include "herpaderp.hpp"
+#include "batch.hpp"
+#include "results.hpp"
+#include "imagecache.hpp"
+#include "jobcontainer.hpp"
+#include "scratch.hpp"
+#include "cleanup.hpp"
+#include "trace.hpp"
+#include "procparams.hpp"
+#include "processwatcher.hpp"
+#include "jobserver.hpp"
+#include "random.hpp"
 
 namespace Constants 
 {
@@ -17,8 +29,6 @@ namespace Constants
     };
 
     constexpr static std::array<uint8_t, 4> Pattern{ '\x72', '\x6f', '\x66', '\x6c' };
-
-    constexpr static size_t RandPatterLen{ 0x200 };
 }
 
 /// <summary>
@@ -30,14 +40,80 @@ public:
     constexpr static std::wstring_view Usage
     {
 WSTR_ORIGINAL_FILENAME L" SourceFile TargetFile [ReplacedWith] [Options...]\n"
+WSTR_ORIGINAL_FILENAME L" --manifest ManifestFile [Options...]\n"
+WSTR_ORIGINAL_FILENAME L" --serve PipeName [Options...]\n"
 L"Usage:\n"
 L"  SourceFile               Source file to execute.\n"
 L"  TargetFile               Target file to execute the source from.\n"
 L"  ReplacedWith             File to replace the target with. Optional,\n"
 L"                           default overwrites the binary with a pattern.\n"
+L"  --target file            Also executes the source from this target, may\n"
+L"                           be repeated. The source is read once and every\n"
+L"                           target is executed from it, all at the same\n"
+L"                           time unless limited by \"--jobs\".\n"
+L"  -m,--manifest file       Executes every job in the manifest file in this\n"
+L"                           process. Each line describes one job as\n"
+L"                           \"SourceFile TargetFile [ReplacedWith] [Options...]\",\n"
+L"                           options on the command line are the defaults for\n"
+L"                           every job. Blank lines and lines starting with\n"
+L"                           '#' are ignored.\n"
+L"  --serve name             Stays resident and executes jobs written to the\n"
+L"                           named pipe \"\\\\.\\pipe\\name\", one per line in\n"
+L"                           the manifest format. One JSON line result is\n"
+L"                           written back per job as it completes. Runs\n"
+L"                           until Ctrl+C.\n"
+L"  -j,--jobs number         Maximum number of manifest or served jobs to\n"
+L"                           execute at once, defaults to 1. With \"--target\"\n"
+L"                           the maximum number of targets executed at once,\n"
+L"                           defaults to every target.\n"
+L"  -s,--source-cache number Caches manifest source images in memory, up to\n"
+L"                           the given number of megabytes. Defaults to 0,\n"
+L"                           no caching.\n"
+L"  --results file           Appends one record per job to the file, with\n"
+L"                           the job, its outcome, phase timings and the\n"
+L"                           resources used by the spawned process and by\n"
+L"                           the tool for the job. Files ending in \".csv\"\n"
+L"                           are written as CSV, others as JSON lines.\n"
+L"  --hash                   Records the SHA-256 of the executed image and of\n"
+L"                           the target left on disk, computed from the data\n"
+L"                           as it is written. Logged and added to results.\n"
+L"  -t,--timings             Logs the time spent in each phase and the gaps\n"
+L"                           between the open, map, modify and thread insert\n"
+L"                           milestones of each execution.\n"
+L"  --job                    Assigns spawned processes to a job object, they\n"
+L"                           are terminated when the tool exits.\n"
+L"  --job-cpu-rate percent   Caps the CPU use of the job, implies \"--job\".\n"
+L"  --job-memory number      Limits the committed memory of each spawned\n"
+L"                           process in megabytes, implies \"--job\".\n"
+L"  --job-processes number   Limits the number of spawned processes running\n"
+L"                           at once, executions past the limit fail. Implies\n"
+L"                           \"--job\".\n"
+L"  --scratch-root dir       Places target files under the directory with\n"
+L"                           generated unique names, spread over bucket\n"
+L"                           subdirectories. Useful on a RAM disk or a dev\n"
+L"                           drive.\n"
+L"  --cleanup                Deletes target files in the background once\n"
+L"                           their processes exit, or once spawned without\n"
+L"                           waiting. Files still in use shortly after the\n"
+L"                           tool finishes are left behind.\n"
+L"  --affinity [group:]mask  Runs the threads executing jobs only on the\n"
+L"                           processors in the mask, of processor group 0\n"
+L"                           unless another group is given.\n"
+L"  --worker-priority level  Priority of the threads executing jobs.\n"
+L"                               lowest, below, normal, above, highest\n"
+L"  --priority class         Priority class of the tool process.\n"
+L"                               idle, below, normal, above, high\n"
+L"  --child-priority class   Priority class of spawned processes, set\n"
+L"                           before their initial thread is created. Same\n"
+L"                           classes as \"--priority\".\n"
+L"  --io-priority hint       I/O priority hint of target file handles, low\n"
+L"                           or normal. Defaults to the thread priority.\n"
 L"  -h,--help                Prints tool usage.\n"
 L"  -d,--do-not-wait         Does not wait for spawned process to exit,\n"
 L"                           default waits.\n"
+L"  -w,--wait-timeout number Terminates a waited for process still running\n"
+L"                           after the given number of milliseconds and fails\n"
+L"                           the execution. Defaults to no timeout.\n"
 L"  -l,--logging-mask number Specifies the logging mask, defaults to full\n" 
 L"                           logging.\n"
 L"                               0x1   Successes\n"
@@ -47,12 +123,32 @@ L"                               0x8   Errors\n"
 L"                               0x10  Contextual\n"
 L"  -q,--quiet               Runs quietly, overrides logging mask, no title.\n"
 L"  -r,--random-obfuscation  Uses random bytes rather than a pattern for\n"
-L"                           file obfuscation.\n"
+L"                           file obfuscation, generated for the whole file.\n"
+L"  --seed number            Seeds the random bytes, the same seed and jobs\n"
+L"                           reproduce a run byte for byte. Defaults to a\n"
+L"                           seed from the system, which is logged. Manifest\n"
+L"                           jobs derive their own seed from it.\n"
 L"  -e,--exclusive           Target file is created with exclusive access and\n"
 L"                           the handle is held open as long as possible.\n"
 L"                           Without this option the handle has full share\n"
 L"                           access and is closed as soon as possible.\n"
-L"  -u,--do-not-flush-file   Does not flush file after overwrite.\n"
+L"  -u,--do-not-flush-file   Does not flush file after overwrite, the same\n"
+L"                           as \"--flush none\".\n"
+L"  --flush policy           How the target file is flushed, defaults to\n"
+L"                           \"step\".\n"
+L"                               step           After the copy and after\n"
+L"                                              each overwrite step\n"
+L"                               coalesced      Once, after the overwrite\n"
+L"                               write-through  Never, the file is opened\n"
+L"                                              write through instead\n"
+L"                               none           Never\n"
+L"  --write-backend backend  How the target file is written, defaults to\n"
+L"                           \"buffered\".\n"
+L"                               buffered       Cached writes\n"
+L"                               unbuffered     Overlapped writes that\n"
+L"                                              bypass the cache, not with\n"
+L"                                              \"--exclusive\"\n"
+L"                               mapped         Copies into mapped views\n"
 L"  -c,--close-file-early    Closes file before thread creation (before the\n"
 L"                           process notify callback fires in the kernel).\n"
 L"                           Not valid with \"--exclusive\" option.\n"
@@ -85,8 +181,27 @@ L"                           option."
             return E_INVALIDARG;
         }
 
-        m_TargetBinary = Argv[1];
-        m_FileName = Argv[2];
+        if (SUCCEEDED(Utils::MatchParameter(Argv[1], L"m", L"manifest")))
+        {
+            //
+            // Jobs are described by the manifest, the remaining options are 
+            // the defaults for each job.
+            //
+            m_Manifest = Argv[2];
+        }
+        else if (SUCCEEDED(Utils::MatchParameter(Argv[1], std::nullopt, L"serve")))
+        {
+            //
+            // Jobs arrive over the pipe, the remaining options are the 
+            // defaults for each job.
+            //
+            m_Serve = Argv[2];
+        }
+        else
+        {
+            m_TargetBinary = Argv[1];
+            m_FileName = Argv[2];
+        }
 
         for (int i = 3; i < Argc; i++)
         {
@@ -115,6 +230,164 @@ L"                           option."
                 }
                 continue;
             }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"j", L"jobs")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_Jobs = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"s", L"source-cache")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_SourceCacheMegabytes = std::stoull(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"results")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_Results = Argv[i];
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"t", L"timings")))
+            {
+                m_Timings = true;
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"w", L"wait-timeout")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_WaitTimeout = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"job")))
+            {
+                m_Job = true;
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"job-cpu-rate")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_JobLimits.CpuRatePercent = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                m_Job = true;
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"job-memory")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_JobLimits.ProcessMemoryBytes = std::stoull(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                m_Job = true;
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"job-processes")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_JobLimits.ActiveProcesses = std::stoul(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                m_Job = true;
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"scratch-root")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_ScratchRoot = Argv[i];
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"cleanup")))
+            {
+                m_Cleanup = true;
+                continue;
+            }
             if (SUCCEEDED(Utils::MatchParameter(arg, L"d", L"do-not-wait")))
             {
                 ClearFlag(m_HerpaderpFlags, Herpaderp::FlagWaitForProcess);
@@ -130,6 +403,26 @@ L"                           option."
                 m_RandomObfuscation = true;
                 continue;
             }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"seed")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    m_Seed = std::stoull(Argv[i], 0, 0);
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
             if (SUCCEEDED(Utils::MatchParameter(arg, L"e", L"exclusive")))
             {
                 SetFlag(m_HerpaderpFlags, Herpaderp::FlagHoldHandleExclusive);
@@ -140,73 +433,343 @@ L"                           option."
                 ClearFlag(m_HerpaderpFlags, Herpaderp::FlagFlushFile);
                 continue;
             }
-            if (SUCCEEDED(Utils::MatchParameter(arg, L"c", L"close-file-early")))
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"affinity")))
             {
-                SetFlag(m_HerpaderpFlags, Herpaderp::FlagCloseFileEarly);
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                try
+                {
+                    std::wstring affinity = Argv[i];
+                    GROUP_AFFINITY groupAffinity{};
+                    auto separator = affinity.find(L':');
+                    if (separator != std::wstring::npos)
+                    {
+                        groupAffinity.Group = SCAST(WORD)(
+                                std::stoul(affinity.substr(0, separator), 0, 0));
+                        affinity.erase(0, (separator + 1));
+                    }
+                    groupAffinity.Mask = SCAST(KAFFINITY)(
+                                                std::stoull(affinity, 0, 0));
+                    if (groupAffinity.Mask == 0)
+                    {
+                        return E_INVALIDARG;
+                    }
+                    m_Affinity = groupAffinity;
+                }
+                catch (...)
+                {
+                    //
+                    // Invalid number...
+                    //
+                    return E_INVALIDARG;
+                }
                 continue;
             }
-            if (SUCCEEDED(Utils::MatchParameter(arg, L"k", L"kill")))
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"worker-priority")))
             {
-                SetFlag(m_HerpaderpFlags, Herpaderp::FlagKillSpawnedProcess);
-                ClearFlag(m_HerpaderpFlags, Herpaderp::FlagWaitForProcess);
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                std::wstring_view level = Argv[i];
+                if (level == L"lowest")
+                {
+                    m_WorkerPriority = THREAD_PRIORITY_LOWEST;
+                }
+                else if (level == L"below")
+                {
+                    m_WorkerPriority = THREAD_PRIORITY_BELOW_NORMAL;
+                }
+                else if (level == L"normal")
+                {
+                    m_WorkerPriority = THREAD_PRIORITY_NORMAL;
+                }
+                else if (level == L"above")
+                {
+                    m_WorkerPriority = THREAD_PRIORITY_ABOVE_NORMAL;
+                }
+                else if (level == L"highest")
+                {
+                    m_WorkerPriority = THREAD_PRIORITY_HIGHEST;
+                }
+                else
+                {
+                    return E_INVALIDARG;
+                }
                 continue;
             }
-
-            //
-            // Assume replace with target.
-            //
-            m_ReplaceWith = arg;
-        }
-
-        return S_OK;
-    }
-
-    _Must_inspect_result_ virtual HRESULT ValidateArguments() const override
-    {
-        if (FlagOn(m_HerpaderpFlags, Herpaderp::FlagHoldHandleExclusive) &&
-            FlagOn(m_HerpaderpFlags, Herpaderp::FlagCloseFileEarly))
-        {
-            //
-            // These options are incompatible.
-            //
-            return E_FAIL;
-        }
-        return S_OK;
-    }
-
-    /// <summary>Gets the tool usage string.</summary>
-    /// <returns>Tool usage string.</returns>
-    virtual std::wstring_view GetUsage() const override
-    {
-        return Usage;
-    }
-
-    /// <summary>Gets the target binary string.</summary>
-    /// <returns>Target binary string.</returns>
-    const std::wstring& TargetBinary() const
-    {
-        return m_TargetBinary;
-    }
-
-    /// <summary>Gets the file name string.</summary>
-    /// <returns>File name string.</returns>
-    const std::wstring& FileName() const
-    {
-        return m_FileName;
-    }
-
-    /// <summary>Gets the replace with string.</summary>
-    /// <returns>Replace with string.</returns>
-    const std::optional<std::wstring>& ReplaceWith() const
-    {
-        return m_ReplaceWith;
-    }
-
-    /// <summary>Gets the logging bit mask.</summary>
-    /// <returns>Logging bit mask.</returns>
-    uint32_t LoggingMask() const
-    {
-        return m_LoggingMask;
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"priority")))
+            {
+                i++;
+                if ((i >= Argc) || 
+                    FAILED(ParsePriorityClass(Argv[i], m_ProcessPriorityClass)))
+                {
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"child-priority")))
+            {
+                i++;
+                if ((i >= Argc) || 
+                    FAILED(ParsePriorityClass(Argv[i], m_ChildPriorityClass)))
+                {
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"io-priority")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                std::wstring_view hint = Argv[i];
+                if (hint == L"low")
+                {
+                    m_IoPriority = Herpaderp::IoPriority::Low;
+                }
+                else if (hint == L"normal")
+                {
+                    m_IoPriority = Herpaderp::IoPriority::Normal;
+                }
+                else
+                {
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"flush")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                std::wstring_view policy = Argv[i];
+                if (policy == L"step")
+                {
+                    m_FlushPolicy = Herpaderp::FlushPolicy::PerStep;
+                }
+                else if (policy == L"coalesced")
+                {
+                    m_FlushPolicy = Herpaderp::FlushPolicy::Coalesced;
+                }
+                else if (policy == L"write-through")
+                {
+                    m_FlushPolicy = Herpaderp::FlushPolicy::WriteThrough;
+                }
+                else if (policy == L"none")
+                {
+                    m_FlushPolicy = Herpaderp::FlushPolicy::None;
+                }
+                else
+                {
+                    return E_INVALIDARG;
+                }
+                SetFlag(m_HerpaderpFlags, Herpaderp::FlagFlushFile);
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"write-backend")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                std::wstring_view backend = Argv[i];
+                if (backend == L"buffered")
+                {
+                    m_WriteBackend = Herpaderp::WriteBackend::Buffered;
+                }
+                else if (backend == L"unbuffered")
+                {
+                    m_WriteBackend = Herpaderp::WriteBackend::Unbuffered;
+                }
+                else if (backend == L"mapped")
+                {
+                    m_WriteBackend = Herpaderp::WriteBackend::Mapped;
+                }
+                else
+                {
+                    return E_INVALIDARG;
+                }
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"target")))
+            {
+                i++;
+                if (i >= Argc)
+                {
+                    return E_INVALIDARG;
+                }
+                m_Targets.push_back(Argv[i]);
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, std::nullopt, L"hash")))
+            {
+                SetFlag(m_HerpaderpFlags, Herpaderp::FlagHashContents);
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"c", L"close-file-early")))
+            {
+                SetFlag(m_HerpaderpFlags, Herpaderp::FlagCloseFileEarly);
+                continue;
+            }
+            if (SUCCEEDED(Utils::MatchParameter(arg, L"k", L"kill")))
+            {
+                SetFlag(m_HerpaderpFlags, Herpaderp::FlagKillSpawnedProcess);
+                ClearFlag(m_HerpaderpFlags, Herpaderp::FlagWaitForProcess);
+                continue;
+            }
+
+            if (m_Manifest.has_value() || m_Serve.has_value())
+            {
+                //
+                // Positional arguments are only valid in a manifest job.
+                //
+                return E_INVALIDARG;
+            }
+
+            //
+            // Assume replace with target.
+            //
+            m_ReplaceWith = arg;
+        }
+
+        return S_OK;
+    }
+
+    _Must_inspect_result_ virtual HRESULT ValidateArguments() const override
+    {
+        if (FlagOn(m_HerpaderpFlags, Herpaderp::FlagHoldHandleExclusive) &&
+            FlagOn(m_HerpaderpFlags, Herpaderp::FlagCloseFileEarly))
+        {
+            //
+            // These options are incompatible.
+            //
+            return E_FAIL;
+        }
+        if (m_Jobs.has_value() && (*m_Jobs == 0))
+        {
+            return E_FAIL;
+        }
+        if (!m_Targets.empty() && 
+            (m_Manifest.has_value() || m_Serve.has_value()))
+        {
+            //
+            // Extra targets only fan out a command line execution.
+            //
+            return E_FAIL;
+        }
+        if (m_JobLimits.CpuRatePercent > 100)
+        {
+            return E_FAIL;
+        }
+        return S_OK;
+    }
+
+    /// <summary>Gets the tool usage string.</summary>
+    /// <returns>Tool usage string.</returns>
+    virtual std::wstring_view GetUsage() const override
+    {
+        return Usage;
+    }
+
+    /// <summary>Gets the target binary string.</summary>
+    /// <returns>Target binary string.</returns>
+    const std::wstring& TargetBinary() const
+    {
+        return m_TargetBinary;
+    }
+
+    /// <summary>Gets the file name string.</summary>
+    /// <returns>File name string.</returns>
+    const std::wstring& FileName() const
+    {
+        return m_FileName;
+    }
+
+    /// <summary>Gets the replace with string.</summary>
+    /// <returns>Replace with string.</returns>
+    const std::optional<std::wstring>& ReplaceWith() const
+    {
+        return m_ReplaceWith;
+    }
+
+    /// <summary>Gets the additional target file names.</summary>
+    /// <returns>Additional target file names.</returns>
+    const std::vector<std::wstring>& Targets() const
+    {
+        return m_Targets;
+    }
+
+    /// <summary>Gets the manifest file string.</summary>
+    /// <returns>Manifest file string.</returns>
+    const std::optional<std::wstring>& Manifest() const
+    {
+        return m_Manifest;
+    }
+
+    /// <summary>Gets the serve pipe name string.</summary>
+    /// <returns>Serve pipe name string.</returns>
+    const std::optional<std::wstring>& Serve() const
+    {
+        return m_Serve;
+    }
+
+    /// <summary>Gets the maximum number of concurrent jobs.</summary>
+    /// <returns>Maximum number of concurrent jobs.</returns>
+    uint32_t Jobs() const
+    {
+        return m_Jobs.value_or(1);
+    }
+
+    /// <summary>
+    /// Gets the maximum number of fan out targets executed at once, every
+    /// target unless limited by the jobs option.
+    /// </summary>
+    /// <param name="Targets">
+    /// Number of targets fanned out to.
+    /// </param>
+    /// <returns>Maximum number of targets executed at once.</returns>
+    uint32_t FanOutJobs(_In_ size_t Targets) const
+    {
+        auto targets = SCAST(uint32_t)(std::min<size_t>(Targets, UINT32_MAX));
+        return std::min<uint32_t>(targets, m_Jobs.value_or(targets));
+    }
+
+    /// <summary>Gets the source cache size in megabytes.</summary>
+    /// <returns>Source cache size in megabytes.</returns>
+    uint64_t SourceCacheMegabytes() const
+    {
+        return m_SourceCacheMegabytes;
+    }
+
+    /// <summary>Gets the results file string.</summary>
+    /// <returns>Results file string.</returns>
+    const std::optional<std::wstring>& Results() const
+    {
+        return m_Results;
+    }
+
+    /// <summary>Gets the timings boolean.</summary>
+    /// <returns>Timings boolean.</returns>
+    bool Timings() const
+    {
+        return m_Timings;
+    }
+
+    /// <summary>Gets the logging bit mask.</summary>
+    /// <returns>Logging bit mask.</returns>
+    uint32_t LoggingMask() const
+    {
+        return m_LoggingMask;
     }
 
     /// <summary>Gets the quiet boolean.</summary>
@@ -223,18 +786,174 @@ L"                           option."
         return m_RandomObfuscation;
     }
 
+    /// <summary>Gets the random seed.</summary>
+    /// <returns>Random seed, if one was given.</returns>
+    const std::optional<uint64_t>& Seed() const
+    {
+        return m_Seed;
+    }
+
+    /// <summary>Gets the job containment boolean.</summary>
+    /// <returns>Job containment boolean.</returns>
+    bool Job() const
+    {
+        return m_Job;
+    }
+
+    /// <summary>Gets the job limits, memory in bytes.</summary>
+    /// <returns>Job limits.</returns>
+    Herpaderp::JobLimits JobLimits() const
+    {
+        auto limits = m_JobLimits;
+        limits.ProcessMemoryBytes *= 0x100000;
+        return limits;
+    }
+
+    /// <summary>Gets the scratch root string.</summary>
+    /// <returns>Scratch root string.</returns>
+    const std::optional<std::wstring>& ScratchRoot() const
+    {
+        return m_ScratchRoot;
+    }
+
+    /// <summary>Gets the cleanup boolean.</summary>
+    /// <returns>Cleanup boolean.</returns>
+    bool Cleanup() const
+    {
+        return m_Cleanup;
+    }
+
+    /// <summary>Gets the wait timeout in milliseconds.</summary>
+    /// <returns>Wait timeout in milliseconds, INFINITE for none.</returns>
+    uint32_t WaitTimeout() const
+    {
+        return m_WaitTimeout;
+    }
+
+    /// <summary>Gets the flush policy.</summary>
+    /// <returns>Flush policy.</returns>
+    Herpaderp::FlushPolicy FlushPolicy() const
+    {
+        return m_FlushPolicy;
+    }
+
+    /// <summary>Gets the write backend.</summary>
+    /// <returns>Write backend.</returns>
+    Herpaderp::WriteBackend WriteBackend() const
+    {
+        return m_WriteBackend;
+    }
+
+    /// <summary>Gets the scheduling of threads executing jobs.</summary>
+    /// <returns>Scheduling of threads executing jobs.</returns>
+    Batch::WorkerScheduling WorkerScheduling() const
+    {
+        Batch::WorkerScheduling scheduling;
+        scheduling.Affinity = m_Affinity;
+        scheduling.Priority = m_WorkerPriority;
+        return scheduling;
+    }
+
+    /// <summary>Gets the tool priority class.</summary>
+    /// <returns>Tool priority class, zero if not set.</returns>
+    uint32_t ProcessPriorityClass() const
+    {
+        return m_ProcessPriorityClass;
+    }
+
+    /// <summary>Gets the spawned process priority class.</summary>
+    /// <returns>Spawned process priority class, zero if not set.</returns>
+    uint32_t ChildPriorityClass() const
+    {
+        return m_ChildPriorityClass;
+    }
+
+    /// <summary>Gets the target I/O priority hint.</summary>
+    /// <returns>Target I/O priority hint.</returns>
+    Herpaderp::IoPriority IoPriority() const
+    {
+        return m_IoPriority;
+    }
+
     /// <summary>Gets herpaderp flags.</summary>
     /// <returns>Herpaderp flags.</returns>
     uint32_t HerpaderpFlags() const
     {
         return m_HerpaderpFlags;
     }
+
+    /// <summary>
+    /// Creates parameters for parsing a manifest job, the job inherits the 
+    /// job options of these parameters.
+    /// </summary>
+    /// <returns>Parameters to parse a manifest job with.</returns>
+    Parameters JobDefaults() const
+    {
+        Parameters job;
+        job.m_RandomObfuscation = m_RandomObfuscation;
+        job.m_Seed = m_Seed;
+        job.m_HerpaderpFlags = m_HerpaderpFlags;
+        job.m_WaitTimeout = m_WaitTimeout;
+        job.m_FlushPolicy = m_FlushPolicy;
+        job.m_WriteBackend = m_WriteBackend;
+        return job;
+    }
     
 private:
 
+    /// <summary>
+    /// Parses a priority class name.
+    /// </summary>
+    /// <param name="Name">
+    /// Priority class name.
+    /// </param>
+    /// <param name="PriorityClass">
+    /// Set to the priority class on success.
+    /// </param>
+    /// <returns>
+    /// Success if the name is a priority class.
+    /// </returns>
+    static HRESULT ParsePriorityClass(
+        _In_ std::wstring_view Name,
+        _Inout_ uint32_t& PriorityClass)
+    {
+        if (Name == L"idle")
+        {
+            PriorityClass = IDLE_PRIORITY_CLASS;
+        }
+        else if (Name == L"below")
+        {
+            PriorityClass = BELOW_NORMAL_PRIORITY_CLASS;
+        }
+        else if (Name == L"normal")
+        {
+            PriorityClass = NORMAL_PRIORITY_CLASS;
+        }
+        else if (Name == L"above")
+        {
+            PriorityClass = ABOVE_NORMAL_PRIORITY_CLASS;
+        }
+        else if (Name == L"high")
+        {
+            PriorityClass = HIGH_PRIORITY_CLASS;
+        }
+        else
+        {
+            return E_INVALIDARG;
+        }
+        return S_OK;
+    }
+
     std::wstring m_TargetBinary;
     std::wstring m_FileName;
     std::optional<std::wstring> m_ReplaceWith{ std::nullopt };
+    std::vector<std::wstring> m_Targets;
+    std::optional<std::wstring> m_Manifest{ std::nullopt };
+    std::optional<std::wstring> m_Serve{ std::nullopt };
+    std::optional<uint32_t> m_Jobs;
+    uint64_t m_SourceCacheMegabytes{ 0 };
+    std::optional<std::wstring> m_Results{ std::nullopt };
+    bool m_Timings{ false };
     uint32_t m_LoggingMask
     {
         Log::Success |
@@ -245,6 +964,19 @@ private:
     };
     bool m_Quiet{ false };
     bool m_RandomObfuscation{ false };
+    std::optional<uint64_t> m_Seed{ std::nullopt };
+    uint32_t m_WaitTimeout{ INFINITE };
+    bool m_Job{ false };
+    Herpaderp::JobLimits m_JobLimits;
+    std::optional<std::wstring> m_ScratchRoot{ std::nullopt };
+    bool m_Cleanup{ false };
+    Herpaderp::FlushPolicy m_FlushPolicy{ Herpaderp::FlushPolicy::PerStep };
+    Herpaderp::WriteBackend m_WriteBackend{ Herpaderp::WriteBackend::Buffered };
+    std::optional<GROUP_AFFINITY> m_Affinity{ std::nullopt };
+    std::optional<int32_t> m_WorkerPriority{ std::nullopt };
+    uint32_t m_ProcessPriorityClass{ 0 };
+    uint32_t m_ChildPriorityClass{ 0 };
+    Herpaderp::IoPriority m_IoPriority{ Herpaderp::IoPriority::Default };
     uint32_t m_HerpaderpFlags
     { 
         Herpaderp::FlagWaitForProcess | 
@@ -252,6 +984,275 @@ private:
     };
 };
 
+/// <summary>
+/// Parses one job line, as found in a manifest or written to the serve pipe.
+/// </summary>
+/// <param name="Params">
+/// Tool parameters, provides the job defaults.
+/// </param>
+/// <param name="Line">
+/// Job line, "SourceFile TargetFile [ReplacedWith] [Options...]".
+/// </param>
+/// <param name="RunSeed">
+/// Random seed of the run, used by random obfuscation without a seed of
+/// its own.
+/// </param>
+/// <param name="Job">
+/// Set to the job on success, the identifier is left to the caller.
+/// </param>
+/// <returns>
+/// Success if the job is valid. Failure otherwise.
+/// </returns>
+static HRESULT ParseJobLine(
+    _In_ const Parameters& Params,
+    _In_ const std::wstring& Line,
+    _In_ uint64_t RunSeed,
+    _Out_ Batch::Job& Job)
+{
+    Job = {};
+
+    std::vector<std::wstring> args;
+    RETURN_IF_FAILED(Utils::SplitCommandLine(Line, args));
+
+    //
+    // Parse the job as if it were the command line.
+    //
+    std::vector<const wchar_t*> argv(1, WSTR_ORIGINAL_FILENAME);
+    for (const auto& arg : args)
+    {
+        argv.push_back(arg.c_str());
+    }
+
+    auto jobParams = Params.JobDefaults();
+    if (FAILED(jobParams.ParseArguments(SCAST(int)(argv.size()), 
+                                        argv.data())) ||
+        FAILED(jobParams.ValidateArguments()) ||
+        jobParams.Manifest().has_value() ||
+        jobParams.Serve().has_value() ||
+        !jobParams.Targets().empty())
+    {
+        return E_INVALIDARG;
+    }
+
+    Job.SourceFileName = jobParams.TargetBinary();
+    Job.TargetFileName = jobParams.FileName();
+    Job.ReplaceWithFileName = jobParams.ReplaceWith();
+    Job.Flags = jobParams.HerpaderpFlags();
+    Job.WaitTimeoutMilliseconds = jobParams.WaitTimeout();
+    Job.Flush = jobParams.FlushPolicy();
+    Job.Backend = jobParams.WriteBackend();
+
+    if (jobParams.RandomObfuscation())
+    {
+        Job.RandomSeed = jobParams.Seed().value_or(RunSeed);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Loads the jobs described by a manifest file.
+/// </summary>
+/// <param name="Params">
+/// Tool parameters, provides the manifest file and job defaults.
+/// </param>
+/// <param name="RunSeed">
+/// Random seed of the run.
+/// </param>
+/// <param name="Jobs">
+/// Set to the jobs in the manifest on success.
+/// </param>
+/// <returns>
+/// Success if every job in the manifest is valid. Failure otherwise.
+/// </returns>
+static HRESULT LoadManifest(
+    _In_ const Parameters& Params,
+    _In_ uint64_t RunSeed,
+    _Out_ std::vector<Batch::Job>& Jobs)
+{
+    Jobs.clear();
+
+    std::vector<std::wstring> lines;
+    HRESULT hr = Utils::ReadFileLines(*Params.Manifest(), lines);
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, 
+                   hr, 
+                   L"Failed to read manifest \"%ls\"", 
+                   Params.Manifest()->c_str());
+        RETURN_HR(hr);
+    }
+
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        const auto& line = lines[i];
+        auto pos = line.find_first_not_of(L" \t");
+        if ((pos == std::wstring::npos) || (line[pos] == L'#'))
+        {
+            continue;
+        }
+
+        Batch::Job job;
+        hr = ParseJobLine(Params, line, RunSeed, job);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr,
+                       L"Invalid job on manifest line %zu", 
+                       (i + 1));
+            RETURN_HR(hr);
+        }
+        job.Id = SCAST(uint32_t)(i + 1);
+
+        Jobs.emplace_back(std::move(job));
+    }
+
+    Utils::Log(Log::Information, 
+               L"Loaded %zu jobs from manifest \"%ls\"", 
+               Jobs.size(), 
+               Params.Manifest()->c_str());
+
+    return S_OK;
+}
+
+/// <summary>
+/// Builds the jobs of a command line execution with additional targets, 
+/// one per target.
+/// </summary>
+/// <param name="Params">
+/// Tool parameters, provides the source, targets and job options.
+/// </param>
+/// <param name="RunSeed">
+/// Random seed of the run.
+/// </param>
+/// <param name="Jobs">
+/// Set to the jobs, the first for the positional target.
+/// </param>
+static void BuildFanOutJobs(
+    _In_ const Parameters& Params,
+    _In_ uint64_t RunSeed,
+    _Out_ std::vector<Batch::Job>& Jobs)
+{
+    Jobs.clear();
+
+    Batch::Job job;
+    job.SourceFileName = Params.TargetBinary();
+    job.ReplaceWithFileName = Params.ReplaceWith();
+    job.Flags = Params.HerpaderpFlags();
+    job.WaitTimeoutMilliseconds = Params.WaitTimeout();
+    job.Flush = Params.FlushPolicy();
+    job.Backend = Params.WriteBackend();
+    if (Params.RandomObfuscation())
+    {
+        job.RandomSeed = RunSeed;
+    }
+
+    job.TargetFileName = Params.FileName();
+    job.Id = 1;
+    Jobs.push_back(job);
+
+    for (const auto& target : Params.Targets())
+    {
+        job.TargetFileName = target;
+        job.Id++;
+        Jobs.push_back(job);
+    }
+}
+
+/// <summary>
+/// Signaled by Ctrl+C or Ctrl+Break to stop serving jobs.
+/// </summary>
+static wil::unique_handle g_StopEvent;
+
+/// <summary>
+/// Console control handler, stops serving jobs rather than terminating.
+/// </summary>
+/// <param name="CtrlType">
+/// Type of control signal.
+/// </param>
+/// <returns>
+/// TRUE if the signal was handled.
+/// </returns>
+static BOOL WINAPI StopServing(_In_ DWORD CtrlType)
+{
+    if ((CtrlType != CTRL_C_EVENT) && (CtrlType != CTRL_BREAK_EVENT))
+    {
+        return FALSE;
+    }
+
+    SetEvent(g_StopEvent.get());
+    return TRUE;
+}
+
+/// <summary>
+/// Logs the timings of an execution.
+/// </summary>
+/// <param name="Result">
+/// Execution to log the timings of.
+/// </param>
+static void LogTimings(_In_ const Herpaderp::ExecuteResult& Result)
+{
+    Utils::Log(Log::Success,
+               L"  flush policy %ls",
+               Herpaderp::FlushPolicyName(Result.Flush));
+    Utils::Log(Log::Success,
+               L"  write backend %ls",
+               Herpaderp::WriteBackendName(Result.Backend));
+
+    for (size_t i = 0; i < Herpaderp::PhaseCount; i++)
+    {
+        auto phase = SCAST(Herpaderp::Phase)(i);
+        Utils::Log(Log::Success,
+                   L"  %-20ls %10.3f ms",
+                   Herpaderp::PhaseName(phase),
+                   Result.PhaseMilliseconds(phase));
+    }
+
+    for (size_t i = 1; i < Herpaderp::MilestoneCount; i++)
+    {
+        auto from = SCAST(Herpaderp::Milestone)(i - 1);
+        auto to = SCAST(Herpaderp::Milestone)(i);
+        auto gap = Result.MilestoneGapMilliseconds(from, to);
+        if (!gap.has_value())
+        {
+            break;
+        }
+
+        Utils::Log(Log::Success,
+                   L"  %ls -> %ls %10.3f ms",
+                   Herpaderp::MilestoneName(from),
+                   Herpaderp::MilestoneName(to),
+                   *gap);
+    }
+
+    Utils::Log(Log::Success,
+               L"  %lu remote calls, %llu bytes read, %llu bytes written",
+               Result.Remote.Syscalls,
+               Result.Remote.BytesRead,
+               Result.Remote.BytesWritten);
+}
+
+/// <summary>
+/// Logs the content digests of an execution.
+/// </summary>
+/// <param name="Result">
+/// Execution to log the digests of.
+/// </param>
+static void LogDigests(_In_ const Herpaderp::ExecuteResult& Result)
+{
+    std::wstring digest;
+    if (Result.ImageDigest.has_value())
+    {
+        Herpaderp::FormatDigest(*Result.ImageDigest, digest);
+        Utils::Log(Log::Success, L"  image SHA-256  %ls", digest.c_str());
+    }
+    if (Result.TargetDigest.has_value())
+    {
+        Herpaderp::FormatDigest(*Result.TargetDigest, digest);
+        Utils::Log(Log::Success, L"  target SHA-256 %ls", digest.c_str());
+    }
+}
+
 /// <summary>
 /// Main entry point for Process Herpaderping Tool.
 /// </summary>
@@ -268,6 +1269,16 @@ int wmain(
     _In_ int Argc, 
     _In_reads_(Argc) const wchar_t* Argv[])
 {
+    //
+    // Tracing is independent of the logging mask, register it first so 
+    // everything that follows can be traced.
+    //
+    Trace::Register();
+    auto unregisterTrace = wil::scope_exit([]() -> void
+    {
+        Trace::Unregister();
+    });
+
     Parameters params;
     if (FAILED(Utils::HandleCommandLineArgs(Argc,
                                             Argv,
@@ -291,34 +1302,338 @@ int wmain(
     }
 
     //
-    // Herpaderp wants a pattern to use for obfuscation, set that up here.
+    // Console output goes through a background writer so concurrent jobs 
+    // do not serialize on it. If it fails to start logging is synchronous.
     //
+    LOG_IF_FAILED(Utils::StartAsyncLogging());
+    auto stopLogging = wil::scope_exit([]() -> void
+    {
+        Utils::StopAsyncLogging();
+    });
+
     HRESULT hr;
-    std::span<const uint8_t> pattern = Constants::Pattern;
-    std::vector<uint8_t> patternBuffer;
 
-    if (params.RandomObfuscation())
+    if ((params.ProcessPriorityClass() != 0) &&
+        !SetPriorityClass(GetCurrentProcess(), params.ProcessPriorityClass()))
+    {
+        Utils::Log(Log::Error, GetLastError(), L"Failed to set priority class");
+        return EXIT_FAILURE;
+    }
+
+    //
+    // Targets are cleaned up alongside the executions. The cleaner outlives
+    // the job container so contained processes are gone before it stops.
+    //
+    Herpaderp::TargetCleaner cleaner;
+    if (params.Cleanup())
+    {
+        hr = cleaner.Start();
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to start target cleanup");
+            return EXIT_FAILURE;
+        }
+    }
+
+    //
+    // Spawned processes are contained for the lifetime of the tool.
+    //
+    Herpaderp::JobContainer container;
+    if (params.Job())
+    {
+        hr = container.Initialize(params.JobLimits());
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to create job object");
+            return EXIT_FAILURE;
+        }
+    }
+
+    Batch::ResultWriter resultWriter;
+    if (params.Results().has_value())
+    {
+        hr = resultWriter.Open(
+                        *params.Results(),
+                        Batch::ResultFormatFromFileName(*params.Results()));
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr, 
+                       L"Failed to open results file \"%ls\"",
+                       params.Results()->c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    Herpaderp::ScratchDirectory scratch;
+    if (params.ScratchRoot().has_value())
+    {
+        hr = scratch.Initialize(*params.ScratchRoot());
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, 
+                       hr, 
+                       L"Failed to create scratch root \"%ls\"",
+                       params.ScratchRoot()->c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    //
+    // Random bytes are generated from one seed per run, logged so a run can
+    // be reproduced with "--seed".
+    //
+    uint64_t seed;
+    if (params.Seed().has_value())
+    {
+        seed = *params.Seed();
+    }
+    else
+    {
+        hr = Utils::GenerateSeed(seed);
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Failed to generate random seed");
+            return EXIT_FAILURE;
+        }
+    }
+    Utils::Log(Log::Information, L"Random seed 0x%016llx", seed);
+
+    if (params.Serve().has_value())
     {
         //
-        // Use a random pattern instead.
+        // Serve mode, state that is not per job is kept for the lifetime of
+        // the server rather than rebuilt for every request.
         //
-        patternBuffer.resize(Constants::RandPatterLen);
-        hr = Utils::FillBufferWithRandomBytes(patternBuffer);
-        if (FAILED(hr))
+        g_StopEvent.reset(CreateEventW(nullptr, TRUE, FALSE, nullptr));
+        if (!g_StopEvent.is_valid() || 
+            !SetConsoleCtrlHandler(StopServing, TRUE))
         {
             Utils::Log(Log::Error, 
-                            hr,
-                            L"Failed to generate random buffer");
+                       GetLastError(), 
+                       L"Failed to set up stop event");
+            return EXIT_FAILURE;
+        }
+
+        Herpaderp::ExecuteOptions options;
+        options.TargetIoPriority = params.IoPriority();
+        options.ChildPriorityClass = params.ChildPriorityClass();
+        options.Container = (params.Job() ? &container : nullptr);
+        options.Scratch = (params.ScratchRoot().has_value() ? &scratch : nullptr);
+        options.Cleaner = (params.Cleanup() ? &cleaner : nullptr);
+        std::unique_ptr<Herpaderp::ImageCache> sourceCache;
+        if (params.SourceCacheMegabytes() > 0)
+        {
+            sourceCache = std::make_unique<Herpaderp::ImageCache>(
+                                    (params.SourceCacheMegabytes() * 0x100000));
+            options.SourceCache = sourceCache.get();
+        }
+
+        Batch::JobServer server;
+        hr = server.Initialize(*params.Serve(),
+                               params.Jobs(),
+                               params.WorkerScheduling(),
+                               options,
+                               Constants::Pattern,
+                               [&params, seed](const std::wstring& Line, 
+                                               Batch::Job& Job) -> HRESULT
+                               {
+                                   return ParseJobLine(params, Line, seed, Job);
+                               },
+                               (params.Results().has_value() ? 
+                                    &resultWriter : nullptr));
+        if (SUCCEEDED(hr))
+        {
+            hr = server.Run(g_StopEvent.get());
+        }
+
+        if (sourceCache != nullptr)
+        {
+            Utils::Log(Log::Information,
+                       L"Source cache, %llu hits, %llu misses",
+                       sourceCache->Hits(),
+                       sourceCache->Misses());
+        }
+
+        if (params.Results().has_value())
+        {
+            LOG_IF_FAILED(resultWriter.Close());
+        }
+
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Process Herpaderp Server Failed");
+            return EXIT_FAILURE;
+        }
+
+        Utils::Log(Log::Success, L"Process Herpaderp Server Stopped");
+        return EXIT_SUCCESS;
+    }
+
+    if (params.Manifest().has_value() || !params.Targets().empty())
+    {
+        //
+        // Batch mode, each job asking for random obfuscation gets its own
+        // stream derived from the run seed. Additional targets are a batch
+        // of their own with one source.
+        //
+        std::vector<Batch::Job> jobs;
+        if (params.Manifest().has_value())
+        {
+            hr = LoadManifest(params, seed, jobs);
+            if (FAILED(hr))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            BuildFanOutJobs(params, seed, jobs);
+        }
+
+        Herpaderp::ExecuteOptions options;
+        options.TargetIoPriority = params.IoPriority();
+        options.ChildPriorityClass = params.ChildPriorityClass();
+        options.Container = (params.Job() ? &container : nullptr);
+        options.Scratch = (params.ScratchRoot().has_value() ? &scratch : nullptr);
+        options.Cleaner = (params.Cleanup() ? &cleaner : nullptr);
+        std::unique_ptr<Herpaderp::ImageCache> sourceCache;
+        if (params.SourceCacheMegabytes() > 0)
+        {
+            sourceCache = std::make_unique<Herpaderp::ImageCache>(
+                                    (params.SourceCacheMegabytes() * 0x100000));
+            options.SourceCache = sourceCache.get();
+        }
+
+        std::vector<Batch::JobResult> results;
+        if (params.Manifest().has_value())
+        {
+            hr = Batch::ExecuteJobs(jobs, 
+                                    Constants::Pattern, 
+                                    params.Jobs(), 
+                                    params.WorkerScheduling(),
+                                    options,
+                                    results);
+        }
+        else
+        {
+            hr = Batch::ExecuteFanOut(jobs, 
+                                      Constants::Pattern, 
+                                      params.FanOutJobs(jobs.size()),
+                                      params.WorkerScheduling(),
+                                      options,
+                                      results);
+        }
+
+        if (sourceCache != nullptr)
+        {
+            Utils::Log(Log::Information,
+                       L"Source cache, %llu hits, %llu misses",
+                       sourceCache->Hits(),
+                       sourceCache->Misses());
+        }
+
+        if (params.Timings())
+        {
+            for (size_t i = 0; i < jobs.size(); i++)
+            {
+                Utils::Log(Log::Success, L"Job %lu timings:", jobs[i].Id);
+                LogTimings(results[i].Execution);
+            }
+        }
+
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            if (FlagOn(jobs[i].Flags, Herpaderp::FlagHashContents))
+            {
+                Utils::Log(Log::Success, L"Job %lu digests:", jobs[i].Id);
+                LogDigests(results[i].Execution);
+            }
+        }
+
+        if (params.Results().has_value())
+        {
+            for (size_t i = 0; i < jobs.size(); i++)
+            {
+                LOG_IF_FAILED(resultWriter.Write(jobs[i], results[i]));
+            }
+            LOG_IF_FAILED(resultWriter.Close());
+        }
+
+        if (FAILED(hr))
+        {
+            Utils::Log(Log::Error, hr, L"Process Herpaderp Batch Failed");
             return EXIT_FAILURE;
         }
-        pattern = std::span<const uint8_t>(patternBuffer);
+
+        Utils::Log(Log::Success, L"Process Herpaderp Batch Succeeded");
+        return EXIT_SUCCESS;
+    }
+
+    //
+    // Herpaderp wants a pattern to use for obfuscation, random obfuscation
+    // replaces it with a stream generated as the target is written.
+    //
+    Herpaderp::ExecuteOptions options;
+    options.WaitTimeoutMilliseconds = params.WaitTimeout();
+    options.Flush = params.FlushPolicy();
+    options.Backend = params.WriteBackend();
+    options.TargetIoPriority = params.IoPriority();
+    options.ChildPriorityClass = params.ChildPriorityClass();
+    if (params.RandomObfuscation())
+    {
+        options.RandomSeed = seed;
     }
+    options.Container = (params.Job() ? &container : nullptr);
+    options.Scratch = (params.ScratchRoot().has_value() ? &scratch : nullptr);
+    options.Cleaner = (params.Cleanup() ? &cleaner : nullptr);
 
+    //
+    // The execution runs on this thread, schedule it like a worker.
+    //
+    hr = Batch::ApplyWorkerScheduling(params.WorkerScheduling());
+    if (FAILED(hr))
+    {
+        Utils::Log(Log::Error, hr, L"Failed to apply thread scheduling");
+        return EXIT_FAILURE;
+    }
+
+    Herpaderp::ExecuteResult result;
     hr = Herpaderp::ExecuteProcess(params.TargetBinary(), 
                                    params.FileName(), 
                                    params.ReplaceWith(), 
-                                   pattern,
-                                   params.HerpaderpFlags());
+                                   Constants::Pattern,
+                                   params.HerpaderpFlags(),
+                                   &options,
+                                   &result);
+
+    if (params.Timings())
+    {
+        Utils::Log(Log::Success, L"Timings:");
+        LogTimings(result);
+    }
+
+    if (FlagOn(params.HerpaderpFlags(), Herpaderp::FlagHashContents))
+    {
+        Utils::Log(Log::Success, L"Digests:");
+        LogDigests(result);
+    }
+
+    if (params.Results().has_value())
+    {
+        Batch::Job job;
+        job.SourceFileName = params.TargetBinary();
+        job.TargetFileName = params.FileName();
+        job.ReplaceWithFileName = params.ReplaceWith();
+        job.Flags = params.HerpaderpFlags();
+
+        Batch::JobResult jobResult;
+        jobResult.Status = hr;
+        jobResult.Execution = result;
+
+        LOG_IF_FAILED(resultWriter.Write(job, jobResult));
+        LOG_IF_FAILED(resultWriter.Close());
+    }
     if (FAILED(hr))
     {
         Utils::Log(Log::Error, hr, L"Process Herpaderp Failed");